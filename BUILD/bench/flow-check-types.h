@@ -0,0 +1,36 @@
+/*
+   The node types of flow-check, standing for Soletta's constant/boolean,
+   boolean/toggle and console, as fbp-static.py finds them in
+   flow-check.json.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <sol-flow.h>
+
+#define SOL_FLOW_NODE_TYPE_CONSTANT_BOOLEAN_OPTIONS_API_VERSION (1)
+#define SOL_FLOW_NODE_TYPE_BOOLEAN_TOGGLE_OPTIONS_API_VERSION (1)
+#define SOL_FLOW_NODE_TYPE_CONSOLE_OPTIONS_API_VERSION (1)
+
+struct sol_flow_node_type_constant_boolean_options {
+    struct sol_flow_node_options base;
+    bool value;
+};
+
+struct sol_flow_node_type_boolean_toggle_options {
+    struct sol_flow_node_options base;
+    bool initial_state;
+};
+
+struct sol_flow_node_type_console_options {
+    struct sol_flow_node_options base;
+    const char *prefix;
+    int32_t repeat;
+};
+
+extern const struct sol_flow_node_type *SOL_FLOW_NODE_TYPE_CONSTANT_BOOLEAN;
+extern const struct sol_flow_node_type *SOL_FLOW_NODE_TYPE_BOOLEAN_TOGGLE;
+extern const struct sol_flow_node_type *SOL_FLOW_NODE_TYPE_CONSOLE;
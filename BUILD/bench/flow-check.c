@@ -0,0 +1,514 @@
+/*
+   Checks the C that tools/fbp-static.py generates, against a fake flow
+   runtime standing for Soletta's: flow-check.fbp, generated into
+   flow-check-gen.c, is opened, run and closed with the node types of
+   flow-check-types.h. Soletta is not needed, stub/ has the few headers
+   the generated flow includes.
+
+   Each node keeps which sides of its ports are connected, so a side
+   disconnected without being connected, or left connected as its node
+   goes, fails the check. The flow is opened once failing each node
+   open and port connect in turn, and must undo just what it made. The
+   console closes the flow as it processes a packet, with another one
+   still queued, which must be dropped and not delivered.
+
+   Prints each case as it passes and exits with failure on the first one
+   that does not.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sol-flow.h>
+#include <sol-flow-packet.h>
+#include <sol-mainloop.h>
+
+#include "flow-check-types.h"
+
+#define MAX_IDLES (4)
+
+#define CHECK(_cond) \
+    do { \
+        if (!(_cond)) { \
+            fprintf(stderr, "%s:%d: %s: failed: %s\n", __FILE__, __LINE__, \
+                __func__, #_cond); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+void sol_main_startup(void);
+void sol_main_shutdown(void);
+
+struct sol_flow_node {
+    struct sol_flow_node *parent;
+    const struct sol_flow_node_type *type;
+    void *data;
+};
+
+struct sol_flow_packet {
+    bool value;
+};
+
+struct sol_idle {
+    bool (*cb)(void *data);
+    const void *data;
+    bool active;
+};
+
+//Private data of the nodes of every type
+struct fake_node {
+    bool value;
+    //A bit per conn_id, all ports are 0
+    uint32_t out_connected;
+    uint32_t in_connected;
+};
+
+static struct {
+    struct sol_idle idles[MAX_IDLES];
+    int live_nodes;
+    int live_packets;
+    unsigned int connects;
+    unsigned int disconnects;
+    //Fails the given node open or port connect, counting from 1
+    unsigned int fail_at;
+    unsigned int steps;
+    //The console closes the flow as it gets this packet, counting from 1
+    unsigned int close_at;
+    int quit_code;
+    //What the console got
+    unsigned int printed;
+    bool last_printed;
+} fake;
+
+static int
+step(void)
+{
+    fake.steps++;
+    return fake.steps == fake.fail_at ? -EIO : 0;
+}
+
+struct sol_flow_node *
+sol_flow_node_new(struct sol_flow_node *parent, const char *id,
+    const struct sol_flow_node_type *type,
+    const struct sol_flow_node_options *options)
+{
+    struct sol_flow_node *node = calloc(1, sizeof(*node));
+
+    CHECK(node);
+    node->parent = parent;
+    node->type = type;
+    node->data = calloc(1, type->data_size + 1);
+    CHECK(node->data);
+
+    if (type->open && type->open(node, node->data, options) < 0) {
+        free(node->data);
+        free(node);
+        return NULL;
+    }
+
+    fake.live_nodes++;
+    return node;
+}
+
+void
+sol_flow_node_del(struct sol_flow_node *node)
+{
+    if (node->type->close)
+        node->type->close(node, node->data);
+    if (!(node->type->flags & SOL_FLOW_NODE_TYPE_FLAGS_CONTAINER)) {
+        struct fake_node *n = node->data;
+
+        CHECK(!n->out_connected && !n->in_connected);
+    }
+    free(node->data);
+    free(node);
+    fake.live_nodes--;
+}
+
+void *
+sol_flow_node_get_private_data(const struct sol_flow_node *node)
+{
+    return node->data;
+}
+
+const struct sol_flow_port_type_in *
+sol_flow_node_type_get_port_in(const struct sol_flow_node_type *type,
+    uint16_t port)
+{
+    return type->get_port_in ? type->get_port_in(type, port) : NULL;
+}
+
+const struct sol_flow_port_type_out *
+sol_flow_node_type_get_port_out(const struct sol_flow_node_type *type,
+    uint16_t port)
+{
+    return type->get_port_out ? type->get_port_out(type, port) : NULL;
+}
+
+void
+sol_flow_packet_del(struct sol_flow_packet *packet)
+{
+    free(packet);
+    fake.live_packets--;
+}
+
+int
+sol_flow_packet_get_bool(const struct sol_flow_packet *packet, bool *value)
+{
+    *value = packet->value;
+    return 0;
+}
+
+int
+sol_flow_send_bool_packet(struct sol_flow_node *src, uint16_t src_port,
+    bool value)
+{
+    const struct sol_flow_node_container_type *container =
+        (const struct sol_flow_node_container_type *)src->parent->type;
+    struct sol_flow_packet *packet = malloc(sizeof(*packet));
+    int r;
+
+    CHECK(packet);
+    packet->value = value;
+    fake.live_packets++;
+
+    r = container->send(src->parent, src, src_port, packet);
+    if (r < 0)
+        sol_flow_packet_del(packet);
+    return r;
+}
+
+struct sol_idle *
+sol_idle_add(bool (*cb)(void *data), const void *data)
+{
+    unsigned int i;
+
+    for (i = 0; i < MAX_IDLES; i++) {
+        struct sol_idle *idle = &fake.idles[i];
+
+        if (idle->active)
+            continue;
+        idle->cb = cb;
+        idle->data = data;
+        idle->active = true;
+        return idle;
+    }
+
+    return NULL;
+}
+
+bool
+sol_idle_del(struct sol_idle *handle)
+{
+    CHECK(handle->active);
+    handle->active = false;
+    return true;
+}
+
+void
+sol_quit_with_code(int return_code)
+{
+    fake.quit_code = return_code;
+}
+
+static unsigned int
+idles_active(void)
+{
+    unsigned int i, n = 0;
+
+    for (i = 0; i < MAX_IDLES; i++)
+        n += fake.idles[i].active;
+    return n;
+}
+
+static void
+idles_run(void)
+{
+    unsigned int i;
+
+    while (idles_active()) {
+        for (i = 0; i < MAX_IDLES; i++) {
+            struct sol_idle *idle = &fake.idles[i];
+
+            if (idle->active && !idle->cb((void *)idle->data))
+                idle->active = false;
+        }
+    }
+}
+
+static int
+port_connect(uint32_t *connected, uint16_t conn_id)
+{
+    int r = step();
+
+    if (r < 0)
+        return r;
+    CHECK(!(*connected & (1u << conn_id)));
+    *connected |= 1u << conn_id;
+    fake.connects++;
+    return 0;
+}
+
+static int
+port_disconnect(uint32_t *connected, uint16_t conn_id)
+{
+    CHECK(*connected & (1u << conn_id));
+    *connected &= ~(1u << conn_id);
+    fake.disconnects++;
+    return 0;
+}
+
+static int
+out_connect(struct sol_flow_node *node, void *data, uint16_t port,
+    uint16_t conn_id)
+{
+    return port_connect(&((struct fake_node *)data)->out_connected, conn_id);
+}
+
+static int
+out_disconnect(struct sol_flow_node *node, void *data, uint16_t port,
+    uint16_t conn_id)
+{
+    return port_disconnect(&((struct fake_node *)data)->out_connected,
+        conn_id);
+}
+
+static int
+in_connect(struct sol_flow_node *node, void *data, uint16_t port,
+    uint16_t conn_id)
+{
+    return port_connect(&((struct fake_node *)data)->in_connected, conn_id);
+}
+
+static int
+in_disconnect(struct sol_flow_node *node, void *data, uint16_t port,
+    uint16_t conn_id)
+{
+    return port_disconnect(&((struct fake_node *)data)->in_connected,
+        conn_id);
+}
+
+//As Soletta's, the constant sends its value as each connection is made
+static int
+constant_open(struct sol_flow_node *node, void *data,
+    const struct sol_flow_node_options *options)
+{
+    const struct sol_flow_node_type_constant_boolean_options *opts =
+        (const struct sol_flow_node_type_constant_boolean_options *)options;
+
+    ((struct fake_node *)data)->value = opts->value;
+    return step();
+}
+
+static int
+constant_connect(struct sol_flow_node *node, void *data, uint16_t port,
+    uint16_t conn_id)
+{
+    int r = out_connect(node, data, port, conn_id);
+
+    if (r < 0)
+        return r;
+    return sol_flow_send_bool_packet(node, 0,
+        ((struct fake_node *)data)->value);
+}
+
+static const struct sol_flow_port_type_out constant_out = {
+    .connect = constant_connect,
+    .disconnect = out_disconnect,
+};
+
+static const struct sol_flow_port_type_out *
+constant_get_port_out(const struct sol_flow_node_type *type, uint16_t port)
+{
+    return port == 0 ? &constant_out : NULL;
+}
+
+static const struct sol_flow_node_type constant_type = {
+    .data_size = sizeof(struct fake_node),
+    .open = constant_open,
+    .get_port_out = constant_get_port_out,
+};
+
+static int
+toggle_open(struct sol_flow_node *node, void *data,
+    const struct sol_flow_node_options *options)
+{
+    const struct sol_flow_node_type_boolean_toggle_options *opts =
+        (const struct sol_flow_node_type_boolean_toggle_options *)options;
+
+    ((struct fake_node *)data)->value = opts->initial_state;
+    return step();
+}
+
+static int
+toggle_process(struct sol_flow_node *node, void *data, uint16_t port,
+    uint16_t conn_id, const struct sol_flow_packet *packet)
+{
+    struct fake_node *n = data;
+
+    n->value = !n->value;
+    return sol_flow_send_bool_packet(node, 0, n->value);
+}
+
+static const struct sol_flow_port_type_in toggle_in = {
+    .process = toggle_process,
+    .connect = in_connect,
+    .disconnect = in_disconnect,
+};
+
+static const struct sol_flow_port_type_out toggle_out = {
+    .connect = out_connect,
+    .disconnect = out_disconnect,
+};
+
+static const struct sol_flow_port_type_in *
+toggle_get_port_in(const struct sol_flow_node_type *type, uint16_t port)
+{
+    return port == 0 ? &toggle_in : NULL;
+}
+
+static const struct sol_flow_port_type_out *
+toggle_get_port_out(const struct sol_flow_node_type *type, uint16_t port)
+{
+    return port == 0 ? &toggle_out : NULL;
+}
+
+static const struct sol_flow_node_type toggle_type = {
+    .data_size = sizeof(struct fake_node),
+    .open = toggle_open,
+    .get_port_in = toggle_get_port_in,
+    .get_port_out = toggle_get_port_out,
+};
+
+static int
+console_open(struct sol_flow_node *node, void *data,
+    const struct sol_flow_node_options *options)
+{
+    const struct sol_flow_node_type_console_options *opts =
+        (const struct sol_flow_node_type_console_options *)options;
+
+    CHECK(!strcmp(opts->prefix, "led ") && opts->repeat == 1);
+    return step();
+}
+
+static int
+console_process(struct sol_flow_node *node, void *data, uint16_t port,
+    uint16_t conn_id, const struct sol_flow_packet *packet)
+{
+    sol_flow_packet_get_bool(packet, &fake.last_printed);
+    fake.printed++;
+    if (fake.printed == fake.close_at)
+        sol_main_shutdown();
+    return 0;
+}
+
+static const struct sol_flow_port_type_in console_in = {
+    .process = console_process,
+    .connect = in_connect,
+    .disconnect = in_disconnect,
+};
+
+static const struct sol_flow_port_type_in *
+console_get_port_in(const struct sol_flow_node_type *type, uint16_t port)
+{
+    return port == 0 ? &console_in : NULL;
+}
+
+static const struct sol_flow_node_type console_type = {
+    .data_size = sizeof(struct fake_node),
+    .open = console_open,
+    .get_port_in = console_get_port_in,
+};
+
+const struct sol_flow_node_type *SOL_FLOW_NODE_TYPE_CONSTANT_BOOLEAN =
+    &constant_type;
+const struct sol_flow_node_type *SOL_FLOW_NODE_TYPE_BOOLEAN_TOGGLE =
+    &toggle_type;
+const struct sol_flow_node_type *SOL_FLOW_NODE_TYPE_CONSOLE = &console_type;
+
+static void
+check_run(void)
+{
+    memset(&fake, 0, sizeof(fake));
+
+    sol_main_startup();
+    CHECK(fake.quit_code == 0);
+    CHECK(fake.live_nodes == 4);
+    //Three nodes created, six sides connected
+    CHECK(fake.steps == 9);
+
+    /*
+       The constant sends as each of its two connections is made, to the
+       console and the toggle, whose two packets follow on the next run
+     */
+    idles_run();
+    CHECK(fake.printed == 4);
+    CHECK(!fake.last_printed);
+    CHECK(!fake.live_packets);
+
+    sol_main_shutdown();
+    CHECK(!fake.live_nodes);
+    CHECK(fake.disconnects == fake.connects);
+    CHECK(!idles_active());
+    puts("open, deliver and close: ok");
+}
+
+static void
+check_open_failure(void)
+{
+    unsigned int i, steps;
+
+    memset(&fake, 0, sizeof(fake));
+    sol_main_startup();
+    idles_run();
+    sol_main_shutdown();
+    steps = fake.steps;
+
+    for (i = 1; i <= steps; i++) {
+        memset(&fake, 0, sizeof(fake));
+        fake.fail_at = i;
+
+        sol_main_startup();
+        CHECK(fake.quit_code == EXIT_FAILURE);
+        CHECK(!fake.live_nodes);
+        CHECK(fake.disconnects == fake.connects);
+        //Packets the constant sent as it connected are dropped
+        CHECK(!fake.live_packets);
+        CHECK(!idles_active());
+        sol_main_shutdown();
+    }
+
+    printf("open failing at each of its %u steps, undone: ok\n", steps);
+}
+
+static void
+check_close_from_process(void)
+{
+    memset(&fake, 0, sizeof(fake));
+    fake.close_at = 1;
+
+    sol_main_startup();
+    CHECK(fake.live_nodes == 4);
+
+    //The packet to the toggle is still queued as the console closes
+    idles_run();
+    CHECK(fake.printed == 1);
+    CHECK(!fake.live_nodes);
+    CHECK(!fake.live_packets);
+    CHECK(fake.disconnects == fake.connects);
+    CHECK(!idles_active());
+    puts("closed by a node as it processes: ok");
+}
+
+int
+main(int argc, char *argv[])
+{
+    check_run();
+    check_open_failure();
+    check_close_from_process();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <stdbool.h>
+
+struct sol_flow_packet;
+
+void sol_flow_packet_del(struct sol_flow_packet *packet);
+int sol_flow_packet_get_bool(const struct sol_flow_packet *packet,
+    bool *value);
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define SOL_SET_API_VERSION(...) __VA_ARGS__
+#define SOL_FLOW_NODE_OPTIONS_API_VERSION (1)
+#define SOL_FLOW_NODE_TYPE_API_VERSION (1)
+#define SOL_FLOW_NODE_TYPE_FLAGS_CONTAINER (1 << 0)
+
+struct sol_flow_node;
+struct sol_flow_packet;
+
+struct sol_flow_node_options {
+    uint16_t api_version;
+    uint16_t sub_api;
+};
+
+struct sol_flow_port_type_in {
+    int (*process)(struct sol_flow_node *node, void *data, uint16_t port,
+        uint16_t conn_id, const struct sol_flow_packet *packet);
+    int (*connect)(struct sol_flow_node *node, void *data, uint16_t port,
+        uint16_t conn_id);
+    int (*disconnect)(struct sol_flow_node *node, void *data, uint16_t port,
+        uint16_t conn_id);
+};
+
+struct sol_flow_port_type_out {
+    int (*connect)(struct sol_flow_node *node, void *data, uint16_t port,
+        uint16_t conn_id);
+    int (*disconnect)(struct sol_flow_node *node, void *data, uint16_t port,
+        uint16_t conn_id);
+};
+
+struct sol_flow_node_type {
+    uint16_t api_version;
+    uint16_t data_size;
+    uint16_t flags;
+    const struct sol_flow_port_type_in *(*get_port_in)(
+        const struct sol_flow_node_type *type, uint16_t port);
+    const struct sol_flow_port_type_out *(*get_port_out)(
+        const struct sol_flow_node_type *type, uint16_t port);
+    int (*open)(struct sol_flow_node *node, void *data,
+        const struct sol_flow_node_options *options);
+    void (*close)(struct sol_flow_node *node, void *data);
+    void (*init_type)(void);
+};
+
+struct sol_flow_node_container_type {
+    struct sol_flow_node_type base;
+    int (*send)(struct sol_flow_node *container,
+        struct sol_flow_node *source_node, uint16_t source_out_port_idx,
+        struct sol_flow_packet *packet);
+};
+
+struct sol_flow_node *sol_flow_node_new(struct sol_flow_node *parent,
+    const char *id, const struct sol_flow_node_type *type,
+    const struct sol_flow_node_options *options);
+void sol_flow_node_del(struct sol_flow_node *node);
+void *sol_flow_node_get_private_data(const struct sol_flow_node *node);
+const struct sol_flow_port_type_in *sol_flow_node_type_get_port_in(
+    const struct sol_flow_node_type *type, uint16_t port);
+const struct sol_flow_port_type_out *sol_flow_node_type_get_port_out(
+    const struct sol_flow_node_type *type, uint16_t port);
+int sol_flow_send_bool_packet(struct sol_flow_node *src, uint16_t src_port,
+    bool value);
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdio.h>
+
+#define SOL_WRN(...) (fprintf(stderr, __VA_ARGS__), fputc('\n', stderr))
+#define SOL_DBG(...) ((void)0)
+#define SOL_INF(...) ((void)0)
+#define SOL_NULL_CHECK(_ptr, ...) \
+    do { if (!(_ptr)) return __VA_ARGS__; } while (0)
+#define SOL_NULL_CHECK_GOTO(_ptr, _label) \
+    do { if (!(_ptr)) goto _label; } while (0)
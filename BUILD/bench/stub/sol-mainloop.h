@@ -0,0 +1,21 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct sol_timeout;
+struct sol_idle;
+
+struct sol_timeout *sol_timeout_add(uint32_t timeout_ms,
+    bool (*cb)(void *data), const void *data);
+bool sol_timeout_del(struct sol_timeout *handle);
+
+struct sol_idle *sol_idle_add(bool (*cb)(void *data), const void *data);
+bool sol_idle_del(struct sol_idle *handle);
+
+void sol_quit_with_code(int return_code);
+
+//The checks run the main loop themselves, calling these
+#define SOL_MAIN_DEFAULT(_startup, _shutdown) \
+    void sol_main_startup(void) { _startup(); } \
+    void sol_main_shutdown(void) { _shutdown(); }
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <stdint.h>
+#include <time.h>
+
+struct timespec sol_util_timespec_get_current(void);
+
+static inline int64_t
+sol_util_msec_from_timespec(const struct timespec *ts)
+{
+    return (int64_t)ts->tv_sec * 1000 + ts->tv_nsec / 1000000;
+}
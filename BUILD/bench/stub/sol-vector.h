@@ -0,0 +1,91 @@
+#pragma once
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+struct sol_vector {
+    void *data;
+    uint16_t len;
+    uint16_t elem_size;
+};
+
+struct sol_ptr_vector {
+    struct sol_vector base;
+};
+
+#define SOL_PTR_VECTOR_INIT { { NULL, 0, sizeof(void *) } }
+
+#define SOL_PTR_VECTOR_FOREACH_IDX(vector, itrvar, idx) \
+    for (idx = 0; idx < (vector)->base.len && \
+        ((itrvar = sol_ptr_vector_get((vector), idx)), true); idx++)
+
+#define SOL_PTR_VECTOR_FOREACH_REVERSE_IDX(vector, itrvar, idx) \
+    for (idx = (vector)->base.len - 1; \
+        idx != ((__typeof__(idx)) - 1) && \
+        ((itrvar = sol_ptr_vector_get((vector), idx)), true); idx--)
+
+static inline void
+sol_ptr_vector_init(struct sol_ptr_vector *pv)
+{
+    pv->base.data = NULL;
+    pv->base.len = 0;
+    pv->base.elem_size = sizeof(void *);
+}
+
+static inline uint16_t
+sol_ptr_vector_get_len(const struct sol_ptr_vector *pv)
+{
+    return pv->base.len;
+}
+
+static inline void *
+sol_ptr_vector_get(const struct sol_ptr_vector *pv, uint16_t i)
+{
+    return i < pv->base.len ? ((void **)pv->base.data)[i] : NULL;
+}
+
+static inline int
+sol_ptr_vector_append(struct sol_ptr_vector *pv, const void *ptr)
+{
+    void **data = realloc(pv->base.data, (pv->base.len + 1) * sizeof(void *));
+
+    if (!data)
+        return -ENOMEM;
+    data[pv->base.len++] = (void *)ptr;
+    pv->base.data = data;
+    return 0;
+}
+
+static inline int
+sol_ptr_vector_del(struct sol_ptr_vector *pv, uint16_t i)
+{
+    void **data = pv->base.data;
+
+    if (i >= pv->base.len)
+        return -EINVAL;
+    memmove(data + i, data + i + 1, (pv->base.len - i - 1) * sizeof(void *));
+    pv->base.len--;
+    return 0;
+}
+
+static inline int
+sol_ptr_vector_remove(struct sol_ptr_vector *pv, const void *ptr)
+{
+    uint16_t i;
+
+    for (i = 0; i < pv->base.len; i++) {
+        if (((void **)pv->base.data)[i] == ptr)
+            return sol_ptr_vector_del(pv, i);
+    }
+    return -ENOENT;
+}
+
+static inline void
+sol_ptr_vector_clear(struct sol_ptr_vector *pv)
+{
+    free(pv->base.data);
+    sol_ptr_vector_init(pv);
+}
@@ -0,0 +1,449 @@
+/*
+   Checks common/timer-coalesce.c on the host, against a fake main loop
+   with a clock of its own: the wrapped sol_timeout_add() and
+   sol_timeout_del() are called directly, and the real ones they wrap
+   are the fake's. Soletta is not needed, stub/ has the few headers
+   timer-coalesce.c includes.
+
+   Covers timeouts deleted and added from the callbacks of the timeout
+   they share, and counts the wakeups of the timers and generators of
+   ipm-flow both ways. No callback may come before its timeout is due,
+   every case fails if one does. Prints each case as it passes and exits with
+   failure on the first one that does not.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sol-mainloop.h>
+#include <sol-util.h>
+
+#include "timer-coalesce.h"
+
+#define MAX_TIMEOUTS (32)
+#define MAX_CALLS (64)
+
+#define CHECK(_cond) \
+    do { \
+        if (!(_cond)) { \
+            fprintf(stderr, "%s:%d: %s: failed: %s\n", __FILE__, __LINE__, \
+                __func__, #_cond); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+struct sol_timeout *__wrap_sol_timeout_add(uint32_t timeout_ms,
+    bool (*cb)(void *data), const void *data);
+bool __wrap_sol_timeout_del(struct sol_timeout *handle);
+
+struct sol_timeout {
+    bool (*cb)(void *data);
+    const void *data;
+    int64_t due;
+    uint32_t interval;
+    bool active;
+};
+
+//One of the timeouts under test, handed to its callback
+struct member {
+    struct sol_timeout *handle;
+    const char *name;
+    unsigned int calls;
+    int64_t last_ms;
+    int64_t due;
+    uint32_t interval;
+    //Ticks before returning false, 0 for never
+    unsigned int ticks;
+    bool (*action)(struct member *m);
+};
+
+static struct {
+    int64_t now;
+    struct sol_timeout timeouts[MAX_TIMEOUTS];
+    unsigned int expiries; //real timeouts that went off
+    //Members called, in order
+    const char *calls[MAX_CALLS];
+    unsigned int calls_len;
+} loop;
+
+struct timespec
+sol_util_timespec_get_current(void)
+{
+    struct timespec ts = {
+        .tv_sec = loop.now / 1000,
+        .tv_nsec = (loop.now % 1000) * 1000000
+    };
+
+    return ts;
+}
+
+struct sol_timeout *
+__real_sol_timeout_add(uint32_t timeout_ms, bool (*cb)(void *data),
+    const void *data)
+{
+    unsigned int i;
+
+    for (i = 0; i < MAX_TIMEOUTS; i++) {
+        struct sol_timeout *t = &loop.timeouts[i];
+
+        if (t->active)
+            continue;
+        t->cb = cb;
+        t->data = data;
+        t->interval = timeout_ms;
+        t->due = loop.now + timeout_ms;
+        t->active = true;
+        return t;
+    }
+
+    return NULL;
+}
+
+bool
+__real_sol_timeout_del(struct sol_timeout *handle)
+{
+    CHECK(handle >= loop.timeouts && handle < loop.timeouts + MAX_TIMEOUTS);
+    CHECK(handle->active);
+    handle->active = false;
+    return true;
+}
+
+static unsigned int
+timeouts_active(void)
+{
+    unsigned int i, n = 0;
+
+    for (i = 0; i < MAX_TIMEOUTS; i++)
+        n += loop.timeouts[i].active;
+    return n;
+}
+
+//Runs the real timeouts due until ms, the earliest first
+static void
+loop_run(int64_t ms)
+{
+    while (true) {
+        struct sol_timeout *next = NULL;
+        unsigned int i;
+
+        for (i = 0; i < MAX_TIMEOUTS; i++) {
+            struct sol_timeout *t = &loop.timeouts[i];
+
+            if (t->active && t->due <= ms && (!next || t->due < next->due))
+                next = t;
+        }
+        if (!next)
+            break;
+
+        loop.now = next->due;
+        loop.expiries++;
+        if (next->cb((void *)next->data))
+            next->due += next->interval;
+        else
+            next->active = false;
+    }
+    loop.now = ms;
+}
+
+static void
+loop_reset(void)
+{
+    CHECK(!timeouts_active());
+    memset(&loop, 0, sizeof(loop));
+}
+
+static bool
+member_cb(void *data)
+{
+    struct member *m = data;
+
+    CHECK(loop.now >= m->due);
+    m->due = loop.now + m->interval;
+    m->calls++;
+    m->last_ms = loop.now;
+    CHECK(loop.calls_len < MAX_CALLS);
+    loop.calls[loop.calls_len++] = m->name;
+
+    if (m->action && !m->action(m))
+        return false;
+    return !m->ticks || m->calls < m->ticks;
+}
+
+static void
+member_add(struct member *m, uint32_t interval,
+    struct sol_timeout *(*add)(uint32_t, bool (*)(void *), const void *))
+{
+    m->due = loop.now + interval;
+    m->interval = interval;
+    m->handle = add(interval, member_cb, m);
+    CHECK(m->handle);
+}
+
+static bool
+called(const char *names)
+{
+    char buf[256] = "";
+    unsigned int i;
+
+    for (i = 0; i < loop.calls_len; i++) {
+        if (i)
+            strcat(buf, " ");
+        strcat(buf, loop.calls[i]);
+    }
+    loop.calls_len = 0;
+    return !strcmp(buf, names);
+}
+
+static struct member a = { .name = "a" }, b = { .name = "b" },
+    c = { .name = "c" }, d = { .name = "d" }, e = { .name = "e" };
+
+static void
+members_reset(void)
+{
+    struct member *all[] = { &a, &b, &c, &d, &e };
+    unsigned int i;
+
+    for (i = 0; i < sizeof(all) / sizeof(*all); i++) {
+        const char *name = all[i]->name;
+
+        memset(all[i], 0, sizeof(*all[i]));
+        all[i]->name = name;
+    }
+}
+
+static void
+check_shared(void)
+{
+    loop_reset();
+    members_reset();
+
+    member_add(&a, 1000, __wrap_sol_timeout_add);
+    //Due later, a waits for it
+    loop.now = 60;
+    member_add(&b, 1000, __wrap_sol_timeout_add);
+    //More than an eighth away, a timeout of its own
+    loop.now = 400;
+    member_add(&c, 1000, __wrap_sol_timeout_add);
+    CHECK(timeouts_active() == 2);
+
+    loop_run(1059);
+    CHECK(called(""));
+    loop_run(1060);
+    CHECK(called("a b"));
+    CHECK(a.last_ms == 1060 && b.last_ms == 1060);
+    loop_run(2500);
+    CHECK(called("c a b c"));
+    CHECK(loop.expiries == 4);
+
+    //Intervals under TIMER_COALESCE_MIN_MS are not shared
+    member_add(&d, 10, __wrap_sol_timeout_add);
+    member_add(&e, 10, __wrap_sol_timeout_add);
+    CHECK(timeouts_active() == 4);
+
+    CHECK(__wrap_sol_timeout_del(a.handle));
+    CHECK(__wrap_sol_timeout_del(b.handle));
+    CHECK(__wrap_sol_timeout_del(c.handle));
+    CHECK(__wrap_sol_timeout_del(d.handle));
+    CHECK(__wrap_sol_timeout_del(e.handle));
+    puts("shared timeouts: ok");
+}
+
+static void
+check_never_early(void)
+{
+    loop_reset();
+    members_reset();
+
+    member_add(&a, 1000, __wrap_sol_timeout_add);
+    //Due a bit before the tick after the next one, it waits for that
+    loop.now = 950;
+    member_add(&b, 1000, __wrap_sol_timeout_add);
+    CHECK(timeouts_active() == 1);
+    loop_run(1000);
+    CHECK(called("a"));
+
+    //Due a bit after the next tick, that tick waits for it
+    loop.now = 1050;
+    member_add(&c, 1000, __wrap_sol_timeout_add);
+    loop_run(2049);
+    CHECK(called(""));
+    loop_run(2050);
+    CHECK(called("a b c"));
+    //Then every interval from there
+    loop_run(3050);
+    CHECK(called("a b c"));
+    CHECK(timeouts_active() == 1);
+    CHECK(loop.expiries == 3);
+
+    //Too late for a and b to wait, a timeout of its own
+    loop.now = 3250;
+    member_add(&d, 1000, __wrap_sol_timeout_add);
+    CHECK(timeouts_active() == 2);
+    loop_run(4250);
+    CHECK(called("a b c d"));
+
+    CHECK(__wrap_sol_timeout_del(a.handle));
+    CHECK(__wrap_sol_timeout_del(b.handle));
+    CHECK(__wrap_sol_timeout_del(c.handle));
+    CHECK(__wrap_sol_timeout_del(d.handle));
+    CHECK(!timeouts_active());
+    puts("never early: ok");
+}
+
+//b deletes the one called before it, the one after it and itself
+static bool
+delete_around(struct member *m)
+{
+    CHECK(__wrap_sol_timeout_del(a.handle));
+    CHECK(__wrap_sol_timeout_del(c.handle));
+    CHECK(!__wrap_sol_timeout_del(c.handle));
+    CHECK(__wrap_sol_timeout_del(m->handle));
+    return true;
+}
+
+static void
+check_delete_during_dispatch(void)
+{
+    loop_reset();
+    members_reset();
+
+    member_add(&a, 1000, __wrap_sol_timeout_add);
+    member_add(&b, 1000, __wrap_sol_timeout_add);
+    member_add(&c, 1000, __wrap_sol_timeout_add);
+    member_add(&d, 1000, __wrap_sol_timeout_add);
+    b.action = delete_around;
+    CHECK(timeouts_active() == 1);
+
+    loop_run(1000);
+    CHECK(called("a b d"));
+    CHECK(c.calls == 0);
+    loop_run(3000);
+    CHECK(called("d d"));
+    CHECK(timeouts_active() == 1);
+
+    //The last member returning false ends the shared timeout
+    d.ticks = d.calls + 1;
+    loop_run(5000);
+    CHECK(called("d"));
+    CHECK(!timeouts_active());
+    puts("delete during dispatch: ok");
+}
+
+//a adds e on its first call, b adds and deletes one at once
+static bool
+add_first(struct member *m)
+{
+    if (m->calls == 1)
+        member_add(&e, 1000, __wrap_sol_timeout_add);
+    return true;
+}
+
+static bool
+add_and_delete(struct member *m)
+{
+    struct sol_timeout *handle;
+
+    if (m->calls == 1) {
+        handle = __wrap_sol_timeout_add(1000, member_cb, &c);
+        CHECK(handle);
+        CHECK(__wrap_sol_timeout_del(handle));
+    }
+    return true;
+}
+
+static void
+check_add_during_dispatch(void)
+{
+    loop_reset();
+    members_reset();
+
+    member_add(&a, 1000, __wrap_sol_timeout_add);
+    member_add(&b, 1000, __wrap_sol_timeout_add);
+    a.action = add_first;
+    b.action = add_and_delete;
+
+    loop_run(1000);
+    CHECK(called("a b"));
+    CHECK(timeouts_active() == 1);
+    //Due an interval after it was added, with the others
+    loop_run(2000);
+    CHECK(called("a b e"));
+    CHECK(e.last_ms == 2000);
+    CHECK(c.calls == 0);
+    CHECK(loop.expiries == 2);
+
+    CHECK(__wrap_sol_timeout_del(a.handle));
+    CHECK(__wrap_sol_timeout_del(b.handle));
+    CHECK(__wrap_sol_timeout_del(e.handle));
+    CHECK(!timeouts_active());
+    puts("add during dispatch: ok");
+}
+
+/*
+   The nodes of ipm-flow on x86, opened a millisecond apart: five
+   generators of a two-item sequence, done after their second tick, and
+   three timers switched off by a packet of their own after their first,
+   delivered once the main loop is back.
+ */
+static unsigned int
+ipm_flow_wakeups(struct sol_timeout *(*add)(uint32_t, bool (*)(void *),
+    const void *), bool (*del)(struct sol_timeout *))
+{
+    struct member nodes[8];
+    unsigned int i, ticks = 0;
+    int64_t ms;
+
+    loop_reset();
+    memset(nodes, 0, sizeof(nodes));
+    for (i = 0; i < 8; i++) {
+        nodes[i].name = "n";
+        nodes[i].ticks = i < 5 ? 2 : 0;
+        loop.now = i;
+        member_add(&nodes[i], 4000, add);
+    }
+
+    for (ms = 0; ms <= 60000; ms += 100) {
+        loop_run(ms);
+        for (i = 5; i < 8; i++) {
+            if (nodes[i].calls == 1 && nodes[i].handle) {
+                CHECK(del(nodes[i].handle));
+                nodes[i].handle = NULL;
+            }
+        }
+    }
+
+    for (i = 0; i < 8; i++)
+        ticks += nodes[i].calls;
+    CHECK(ticks == 13);
+    CHECK(!timeouts_active());
+    loop.calls_len = 0;
+    return loop.expiries;
+}
+
+static void
+check_ipm_flow(void)
+{
+    unsigned int alone, shared;
+
+    alone = ipm_flow_wakeups(__real_sol_timeout_add, __real_sol_timeout_del);
+    shared = ipm_flow_wakeups(__wrap_sol_timeout_add, __wrap_sol_timeout_del);
+    CHECK(alone == 13);
+    CHECK(shared == 2);
+    printf("ipm-flow: %u wakeups, %u alone, 13 ticks both ways: ok\n",
+        shared, alone);
+}
+
+int
+main(int argc, char *argv[])
+{
+    check_shared();
+    check_never_early();
+    check_delete_during_dispatch();
+    check_add_during_dispatch();
+    check_ipm_flow();
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,55 @@
+#!/bin/sh
+#
+# Dry runs the Zephyr build of each application with the options that
+# wrap functions of Soletta turned on (TIMER_COALESCE, IPM_BATCH, and
+# FLOW_PROFILE from a sol.conf of the target, as documented), and checks
+# that the source defining each __wrap_ function given to the linker is
+# in the obj-y the build writes. Neither Zephyr nor Soletta is needed,
+# nothing is built.
+#
+#     ./wrap-check.sh [application directory]...
+
+top=$(cd "$(dirname "$0")/../.." && pwd)
+apps="$*"
+if [ -z "$apps" ]; then
+    apps=$(cd "$top" && find . -name Makefile.application -not -path './BUILD/*' |
+        sed 's|^\./||; s|/Makefile.application$||' | sort)
+fi
+
+# Stands for the sol.conf of each application
+sol_conf=$(mktemp)
+trap 'rm -f "$sol_conf"' EXIT
+echo FLOW_PROFILE=y > "$sol_conf"
+
+status=0
+for app in $apps; do
+    out=$(cd "$top/$app" && ZEPHYR_BASE=/zephyr ZEPHYR_GCC_VARIANT=zephyr \
+        ZEPHYR_SDK_INSTALL_DIR=/sdk SOLETTA_BASE_DIR=/soletta \
+        make -s -n -C "$top/BUILD" zephyr TIMER_COALESCE=y IPM_BATCH=y \
+        TARGET_SOL_CONF="$sol_conf" 2>/dev/null)
+    objs=" $(printf '%s\n' "$out" | sed -n 's/^echo "obj-y := \(.*\)" > .*/\1/p') "
+    wraps=$(printf '%s\n' "$out" | sed -n 's/.* APP_WRAP="\([^"]*\)".*/\1/p')
+    # What prepare copies to the sources of the build
+    sources=$(printf '%s\n' "$out" | grep '^cp .*/src/$' | tr ' ' '\n' |
+        grep '\.c$')
+
+    failed=0
+    for sym in $wraps; do
+        file=$(grep -l "^__wrap_$sym(" $sources /dev/null)
+        obj=$(basename "${file:-none}" .c).o
+        if [ -z "$file" ]; then
+            echo "$app: no source defines __wrap_$sym"
+            failed=1
+        elif [ "${objs#* $obj }" = "$objs" ]; then
+            echo "$app: $obj, defining __wrap_$sym, is not in obj-y:$objs"
+            failed=1
+        fi
+    done
+    if [ $failed = 0 ]; then
+        echo "$app: ${wraps:-nothing} wrapped: ok"
+    else
+        status=1
+    fi
+done
+
+exit $status
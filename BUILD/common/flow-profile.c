@@ -0,0 +1,512 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2016 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sol-flow.h>
+#include <sol-log.h>
+#include <sol-macros.h>
+#include <sol-mainloop.h>
+#include <sol-util.h>
+#include <sol-vector.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef SOL_PLATFORM_LINUX
+#include <signal.h>
+#endif
+
+#include "flow-profile.h"
+
+#ifndef SOL_FLOW_INSPECTOR_ENABLED
+#error "The flow profiler needs Soletta built with FLOW_INSPECTOR=y"
+#endif
+
+struct sol_flow_node *__real_sol_flow_node_new(struct sol_flow_node *parent,
+    const char *id, const struct sol_flow_node_type *type,
+    const struct sol_flow_node_options *options);
+
+struct port_in {
+    uint64_t packets;
+    uint64_t time_us;
+    uint32_t max_us;
+    uint32_t queued;
+    uint32_t max_queued;
+};
+
+struct node {
+    const struct sol_flow_node *node; //NULL once closed
+    const struct sol_flow_node_type *type;
+    char *id;
+    struct port_in *in;
+    uint64_t *out; //packets sent
+    uint16_t in_count;
+    uint16_t out_count;
+};
+
+struct conn {
+    struct node *src;
+    struct node *dst;
+    uint16_t src_port;
+    uint16_t dst_port;
+};
+
+static struct {
+    bool initialized;
+    bool done; //main flow closed
+    const struct sol_flow_node *root;
+    struct sol_ptr_vector nodes;
+    struct sol_vector conns;
+    struct node *last; //of the last lookup
+    //Port processing a packet now, until the next one or the main loop
+    struct port_in *timed;
+    struct timespec start;
+    struct sol_idle *closer;
+    struct sol_timeout *interval;
+    unsigned int dumps;
+} profile;
+
+#ifdef SOL_PLATFORM_LINUX
+static volatile sig_atomic_t dump_requested;
+
+static void
+dump_signal(int signum)
+{
+    dump_requested = 1;
+}
+#endif
+
+static struct node *
+node_find(const struct sol_flow_node *node)
+{
+    struct node *n;
+    uint16_t i;
+
+    if (profile.last && profile.last->node == node)
+        return profile.last;
+
+    SOL_PTR_VECTOR_FOREACH_IDX (&profile.nodes, n, i) {
+        if (n->node == node) {
+            profile.last = n;
+            return n;
+        }
+    }
+
+    return NULL;
+}
+
+static void
+node_free(struct node *n)
+{
+    struct conn *c;
+    uint16_t i;
+
+    for (i = profile.conns.len; i > 0; i--) {
+        c = sol_vector_get(&profile.conns, i - 1);
+        if (c->src == n || c->dst == n)
+            sol_vector_del(&profile.conns, i - 1);
+    }
+    if (profile.last == n)
+        profile.last = NULL;
+    free(n->id);
+    free(n);
+}
+
+static void
+timing_stop(void)
+{
+    struct timespec now, elapsed;
+    uint32_t us;
+
+    if (!profile.timed)
+        return;
+
+    now = sol_util_timespec_get_current();
+    sol_util_timespec_sub(&now, &profile.start, &elapsed);
+    us = elapsed.tv_sec * 1000000 + elapsed.tv_nsec / 1000;
+
+    profile.timed->time_us += us;
+    if (us > profile.timed->max_us)
+        profile.timed->max_us = us;
+    profile.timed = NULL;
+}
+
+static bool
+closer_cb(void *data)
+{
+    profile.closer = NULL;
+    timing_stop();
+    return false;
+}
+
+static void
+port_name(char *buf, size_t len, const struct node *n, bool in,
+    uint16_t port)
+{
+#ifdef SOL_FLOW_NODE_TYPE_DESCRIPTION_ENABLED
+    const struct sol_flow_port_description *desc;
+
+    desc = in ? sol_flow_node_get_description_port_in(n->type, port) :
+        sol_flow_node_get_description_port_out(n->type, port);
+    if (desc && desc->array_size > 0) {
+        snprintf(buf, len, "%s[%u]", desc->name,
+            port - desc->base_port_idx);
+        return;
+    }
+    if (desc) {
+        snprintf(buf, len, "%s", desc->name);
+        return;
+    }
+#endif
+    snprintf(buf, len, "%u", port);
+}
+
+static const char *
+type_name(const struct node *n)
+{
+#ifdef SOL_FLOW_NODE_TYPE_DESCRIPTION_ENABLED
+    if (n->type->description && n->type->description->name)
+        return n->type->description->name;
+#endif
+    return "";
+}
+
+void
+flow_profile_dump(void)
+{
+    struct timespec now = sol_util_timespec_get_current();
+    unsigned int dump = profile.dumps++;
+    int64_t ms = sol_util_msec_from_timespec(&now);
+    char port[64];
+    struct node *n;
+    uint16_t i, p;
+    FILE *out = stdout;
+
+#ifdef SOL_PLATFORM_LINUX
+    const char *path = getenv(FLOW_PROFILE_ENV);
+
+    dump_requested = 0;
+    if (path && *path) {
+        out = fopen(path, "ae");
+        if (!out) {
+            SOL_WRN("Could not open %s (%d), dumping to the console", path,
+                errno);
+            out = stdout;
+        }
+    }
+#endif
+
+    fprintf(out, "dump,ms,node,type,dir,port,packets,time_us,max_us,"
+        "queued,max_queued\n");
+    SOL_PTR_VECTOR_FOREACH_IDX (&profile.nodes, n, i) {
+        for (p = 0; p < n->in_count; p++) {
+            const struct port_in *in = &n->in[p];
+
+            if (!in->packets && !in->max_queued)
+                continue;
+            port_name(port, sizeof(port), n, true, p);
+            fprintf(out, "%u,%" PRId64 ",%s,%s,in,%s,%" PRIu64 ",%" PRIu64
+                ",%" PRIu32 ",%" PRIu32 ",%" PRIu32 "\n", dump, ms, n->id,
+                type_name(n), port, in->packets, in->time_us, in->max_us,
+                in->queued, in->max_queued);
+        }
+        for (p = 0; p < n->out_count; p++) {
+            if (!n->out[p])
+                continue;
+            port_name(port, sizeof(port), n, false, p);
+            fprintf(out, "%u,%" PRId64 ",%s,%s,out,%s,%" PRIu64
+                ",0,0,0,0\n", dump, ms, n->id, type_name(n), port, n->out[p]);
+        }
+    }
+
+    if (out != stdout)
+        fclose(out);
+    else
+        fflush(out);
+}
+
+static void
+check_dump_request(void)
+{
+#ifdef SOL_PLATFORM_LINUX
+    if (dump_requested)
+        flow_profile_dump();
+#endif
+}
+
+static bool
+interval_cb(void *data)
+{
+    flow_profile_dump();
+    return true;
+}
+
+//Once the main flow and all of its nodes are gone
+static void
+profile_shutdown(void)
+{
+    struct node *n;
+    uint16_t i;
+
+    sol_flow_set_inspector(NULL);
+    if (profile.closer) {
+        sol_idle_del(profile.closer);
+        profile.closer = NULL;
+    }
+    if (profile.interval) {
+        sol_timeout_del(profile.interval);
+        profile.interval = NULL;
+    }
+
+    SOL_PTR_VECTOR_FOREACH_IDX (&profile.nodes, n, i)
+        node_free(n);
+    sol_ptr_vector_clear(&profile.nodes);
+    sol_vector_clear(&profile.conns);
+
+    //A flow created after this one is profiled on its own
+    profile.initialized = false;
+    profile.done = false;
+    profile.root = NULL;
+    profile.last = NULL;
+    profile.timed = NULL;
+}
+
+static void
+did_open_node(const struct sol_flow_inspector *inspector,
+    const struct sol_flow_node *node,
+    const struct sol_flow_node_options *options)
+{
+    const struct sol_flow_node_type *type = sol_flow_node_get_type(node);
+    const char *id = sol_flow_node_get_id(node);
+    struct node *n;
+
+    n = calloc(1, sizeof(*n) + type->ports_in_count * sizeof(*n->in) +
+        type->ports_out_count * sizeof(*n->out));
+    SOL_NULL_CHECK(n);
+
+    n->in = (struct port_in *)(n + 1);
+    n->out = (uint64_t *)(n->in + type->ports_in_count);
+    n->in_count = type->ports_in_count;
+    n->out_count = type->ports_out_count;
+    n->node = node;
+    n->type = type;
+    n->id = strdup(id ? id : "");
+    SOL_NULL_CHECK_GOTO(n->id, err);
+
+    if (sol_ptr_vector_append(&profile.nodes, n) < 0)
+        goto err;
+    return;
+
+err:
+    SOL_WRN("Could not keep the profile of node %s", id);
+    free(n->id);
+    free(n);
+}
+
+static void
+will_close_node(const struct sol_flow_inspector *inspector,
+    const struct sol_flow_node *node)
+{
+    struct node *n;
+    uint16_t i;
+
+    if (node == profile.root) {
+        timing_stop();
+        flow_profile_dump();
+        profile.done = true;
+
+        //Nodes already closed are in no dump to come
+        for (i = sol_ptr_vector_get_len(&profile.nodes); i > 0; i--) {
+            n = sol_ptr_vector_get(&profile.nodes, i - 1);
+            if (!n->node) {
+                sol_ptr_vector_del(&profile.nodes, i - 1);
+                node_free(n);
+            }
+        }
+    }
+
+    //Kept for the dumps to come, unless there is none
+    SOL_PTR_VECTOR_FOREACH_IDX (&profile.nodes, n, i) {
+        if (n->node != node)
+            continue;
+        if (profile.timed >= n->in && profile.timed < n->in + n->in_count)
+            timing_stop();
+        if (profile.done) {
+            sol_ptr_vector_del(&profile.nodes, i);
+            node_free(n);
+        } else {
+            n->node = NULL;
+            if (profile.last == n)
+                profile.last = NULL;
+        }
+        break;
+    }
+
+    //The main flow closes before its nodes, the last of them ends it
+    if (profile.done && !sol_ptr_vector_get_len(&profile.nodes))
+        profile_shutdown();
+}
+
+static void
+did_connect_port(const struct sol_flow_inspector *inspector,
+    const struct sol_flow_node *src_node, uint16_t src_port,
+    uint16_t src_conn_id, const struct sol_flow_node *dst_node,
+    uint16_t dst_port, uint16_t dst_conn_id)
+{
+    struct node *src = node_find(src_node), *dst = node_find(dst_node);
+    struct conn *c;
+
+    if (!src || !dst || dst_port >= dst->in_count)
+        return;
+
+    c = sol_vector_append(&profile.conns);
+    SOL_NULL_CHECK(c);
+    c->src = src;
+    c->src_port = src_port;
+    c->dst = dst;
+    c->dst_port = dst_port;
+}
+
+static void
+will_disconnect_port(const struct sol_flow_inspector *inspector,
+    const struct sol_flow_node *src_node, uint16_t src_port,
+    uint16_t src_conn_id, const struct sol_flow_node *dst_node,
+    uint16_t dst_port, uint16_t dst_conn_id)
+{
+    struct node *src = node_find(src_node), *dst = node_find(dst_node);
+    struct conn *c;
+    uint16_t i;
+
+    SOL_VECTOR_FOREACH_IDX (&profile.conns, c, i) {
+        if (c->src == src && c->src_port == src_port &&
+            c->dst == dst && c->dst_port == dst_port) {
+            sol_vector_del(&profile.conns, i);
+            return;
+        }
+    }
+}
+
+static void
+will_send_packet(const struct sol_flow_inspector *inspector,
+    const struct sol_flow_node *src_node, uint16_t src_port,
+    const struct sol_flow_packet *packet)
+{
+    struct node *src = node_find(src_node);
+    struct port_in *in;
+    struct conn *c;
+    uint16_t i;
+
+    check_dump_request();
+    if (!src || src_port >= src->out_count)
+        return;
+
+    src->out[src_port]++;
+    SOL_VECTOR_FOREACH_IDX (&profile.conns, c, i) {
+        if (c->src != src || c->src_port != src_port)
+            continue;
+        in = &c->dst->in[c->dst_port];
+        if (++in->queued > in->max_queued)
+            in->max_queued = in->queued;
+    }
+}
+
+static void
+will_deliver_packet(const struct sol_flow_inspector *inspector,
+    const struct sol_flow_node *dst_node, uint16_t dst_port,
+    uint16_t dst_conn_id, const struct sol_flow_packet *packet)
+{
+    struct node *dst;
+    struct port_in *in;
+
+    //The previous packet was processed by now
+    timing_stop();
+    check_dump_request();
+
+    dst = node_find(dst_node);
+    if (!dst || dst_port >= dst->in_count)
+        return;
+
+    in = &dst->in[dst_port];
+    in->packets++;
+    if (in->queued)
+        in->queued--;
+
+    profile.timed = in;
+    profile.start = sol_util_timespec_get_current();
+    if (!profile.closer)
+        profile.closer = sol_idle_add(closer_cb, NULL);
+}
+
+static const struct sol_flow_inspector inspector = {
+    SOL_SET_API_VERSION(.api_version = SOL_FLOW_INSPECTOR_API_VERSION, )
+    .did_open_node = did_open_node,
+    .will_close_node = will_close_node,
+    .did_connect_port = did_connect_port,
+    .will_disconnect_port = will_disconnect_port,
+    .will_send_packet = will_send_packet,
+    .will_deliver_packet = will_deliver_packet,
+};
+
+static int
+profile_init(void)
+{
+    if (profile.initialized)
+        return 0;
+    //Tried once, whatever comes of it
+    profile.initialized = true;
+
+    sol_ptr_vector_init(&profile.nodes);
+    sol_vector_init(&profile.conns, sizeof(struct conn));
+
+    if (!sol_flow_set_inspector(&inspector)) {
+        SOL_WRN("Could not set the flow inspector, not profiling");
+        return -EBUSY;
+    }
+
+#ifdef SOL_PLATFORM_LINUX
+    signal(SIGUSR1, dump_signal);
+#endif
+    if (FLOW_PROFILE_INTERVAL_MS > 0) {
+        profile.interval = sol_timeout_add(FLOW_PROFILE_INTERVAL_MS,
+            interval_cb, NULL);
+        SOL_NULL_CHECK(profile.interval, -ENOMEM);
+    }
+
+    return 0;
+}
+
+struct sol_flow_node *
+__wrap_sol_flow_node_new(struct sol_flow_node *parent, const char *id,
+    const struct sol_flow_node_type *type,
+    const struct sol_flow_node_options *options)
+{
+    struct sol_flow_node *node;
+
+    //Before the flow opens, so its nodes and connections are seen
+    profile_init();
+
+    node = __real_sol_flow_node_new(parent, id, type, options);
+    if (node && !parent && !profile.root)
+        profile.root = node;
+
+    return node;
+}
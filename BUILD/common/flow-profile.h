@@ -0,0 +1,57 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2016 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+/*
+ * Per node profile of the flows of an application, kept through the flow
+ * inspector of Soletta: for each input port, packets delivered, time
+ * spent processing them (total and longest) and packets waiting to be
+ * delivered (now and at most); for each output port, packets sent.
+ *
+ * Built in with FLOW_PROFILE=y in the sol.conf of the target, or on the
+ * make command line, and Soletta built with FLOW_INSPECTOR=y; the
+ * application is linked with sol_flow_node_new() wrapped (APP_WRAP), to
+ * have the inspector set before the first flow opens. Without it none of
+ * this is built, nor is the inspector of Soletta called.
+ *
+ * The profile is printed when the main flow closes, every
+ * FLOW_PROFILE_INTERVAL_MS if set and on flow_profile_dump(); on Linux
+ * also on SIGUSR1, and appended to the file named in FLOW_PROFILE_ENV
+ * instead of the console if set. The time a packet is processed in is
+ * measured until the next packet is delivered, or the main loop comes
+ * back, so it includes the dispatching of the flow. Once the main flow
+ * and all of its nodes are closed the profile is freed, its timeout and
+ * idler deleted and the inspector unset.
+ *
+ * Each dump is a CSV header line followed by one line per port:
+ *
+ *   dump,ms,node,type,dir,port,packets,time_us,max_us,queued,max_queued
+ *
+ * dump numbering the dumps and ms the time it was taken at, so dumps of
+ * several runs or boards can be concatenated and summed up by node.
+ */
+
+#ifndef FLOW_PROFILE_INTERVAL_MS
+#define FLOW_PROFILE_INTERVAL_MS (0)
+#endif
+//Environment variable naming the file to append dumps to, Linux only
+#define FLOW_PROFILE_ENV "FLOW_PROFILE_FILE"
+
+/* Prints the profile gathered so far. */
+void flow_profile_dump(void);
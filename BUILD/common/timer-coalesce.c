@@ -0,0 +1,297 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2016 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sol-log.h>
+#include <sol-mainloop.h>
+#include <sol-util.h>
+#include <sol-vector.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "timer-coalesce.h"
+
+struct sol_timeout *__real_sol_timeout_add(uint32_t timeout_ms,
+    bool (*cb)(void *data), const void *data);
+bool __real_sol_timeout_del(struct sol_timeout *handle);
+
+struct group;
+
+//Handed out as the struct sol_timeout of the caller
+struct member {
+    struct group *group;
+    bool (*cb)(void *data);
+    const void *data;
+    int64_t due; //ms its next call is due at, it may only come later
+    uint32_t skip; //ticks to let pass before the first call
+    bool deleted;
+};
+
+struct group {
+    struct sol_timeout *timeout;
+    struct sol_ptr_vector members;
+    int64_t next; //ms the next tick is due at
+    uint32_t interval;
+    bool dispatching;
+    //The next tick was moved later, its timeout is not of the interval
+    bool moved;
+};
+
+static struct sol_ptr_vector groups = SOL_PTR_VECTOR_INIT;
+
+static int64_t
+now_ms(void)
+{
+    struct timespec ts = sol_util_timespec_get_current();
+
+    return sol_util_msec_from_timespec(&ts);
+}
+
+static void
+group_del(struct group *g)
+{
+    sol_ptr_vector_remove(&groups, g);
+    sol_ptr_vector_clear(&g->members);
+    free(g);
+}
+
+static bool
+group_cb(void *data)
+{
+    struct group *g = data;
+    struct sol_timeout *timeout;
+    struct member *m;
+    int64_t now = now_ms();
+    uint16_t i, count;
+
+    //A moved timeout that could not go back to the interval, not yet due
+    if (g->moved && now < g->next)
+        return true;
+
+    //Timeouts added from the callbacks are due a tick after this one
+    g->next = now + g->interval;
+
+    g->dispatching = true;
+    count = sol_ptr_vector_get_len(&g->members);
+    for (i = 0; i < count; i++) {
+        m = sol_ptr_vector_get(&g->members, i);
+        if (m->deleted)
+            continue;
+        if (m->skip) {
+            m->skip--;
+            continue;
+        }
+        m->due = g->next;
+        if (!m->cb((void *)m->data))
+            m->deleted = true;
+    }
+    g->dispatching = false;
+
+    SOL_PTR_VECTOR_FOREACH_REVERSE_IDX (&g->members, m, i) {
+        if (!m->deleted)
+            continue;
+        sol_ptr_vector_del(&g->members, i);
+        free(m);
+    }
+
+    if (!sol_ptr_vector_get_len(&g->members)) {
+        group_del(g);
+        return false;
+    }
+
+    if (!g->moved)
+        return true;
+
+    //Tried again on the next call of this one if it fails
+    timeout = __real_sol_timeout_add(g->interval, group_cb, g);
+    if (!timeout) {
+        SOL_WRN("Could not restore a shared timeout of %" PRIu32 "ms",
+            g->interval);
+        return true;
+    }
+    g->timeout = timeout;
+    g->moved = false;
+    return false;
+}
+
+//Whether no member would be called later than the slack, were the next
+//tick at tick
+static bool
+group_can_move(const struct group *g, int64_t tick, int64_t slack)
+{
+    struct member *m;
+    uint16_t i;
+
+    SOL_PTR_VECTOR_FOREACH_IDX (&g->members, m, i) {
+        int64_t at = m->skip ? tick + g->interval : tick;
+
+        if (!m->deleted && at - m->due > slack)
+            return false;
+    }
+
+    return true;
+}
+
+static int
+group_move(struct group *g, int64_t tick)
+{
+    struct sol_timeout *timeout;
+
+    timeout = __real_sol_timeout_add(tick - now_ms(), group_cb, g);
+    if (!timeout)
+        return -ENOMEM;
+
+    __real_sol_timeout_del(g->timeout);
+    g->timeout = timeout;
+    g->next = tick;
+    g->moved = true;
+    return 0;
+}
+
+static struct group *
+group_find(uint32_t interval, int64_t due, uint32_t *skip)
+{
+    int64_t slack = interval / TIMER_COALESCE_SLACK_DIV;
+    struct group *g;
+    uint16_t i;
+
+    SOL_PTR_VECTOR_FOREACH_IDX (&groups, g, i) {
+        if (g->interval != interval)
+            continue;
+        //Never early: the next tick comes at most an interval from now,
+        //take it or the one after, if it is due within the slack
+        if (g->next >= due && g->next - due <= slack) {
+            *skip = 0;
+            return g;
+        }
+        if (g->next + interval >= due && g->next + interval - due <= slack) {
+            *skip = 1;
+            return g;
+        }
+        //Or have the next tick wait for it, if the others can wait too
+        if (due > g->next && !g->dispatching &&
+            group_can_move(g, due, slack) && group_move(g, due) == 0) {
+            *skip = 0;
+            return g;
+        }
+    }
+
+    return NULL;
+}
+
+struct sol_timeout *
+__wrap_sol_timeout_add(uint32_t timeout_ms, bool (*cb)(void *data),
+    const void *data)
+{
+    int64_t due = now_ms() + timeout_ms;
+    struct member *m;
+    struct group *g;
+    uint32_t skip = 0;
+
+    if (timeout_ms < TIMER_COALESCE_MIN_MS || !cb)
+        return __real_sol_timeout_add(timeout_ms, cb, data);
+
+    m = calloc(1, sizeof(*m));
+    SOL_NULL_CHECK(m, NULL);
+    m->cb = cb;
+    m->data = data;
+    m->due = due;
+
+    g = group_find(timeout_ms, due, &skip);
+    if (!g) {
+        g = calloc(1, sizeof(*g));
+        SOL_NULL_CHECK_GOTO(g, err);
+        sol_ptr_vector_init(&g->members);
+        g->interval = timeout_ms;
+        g->next = due;
+        g->timeout = __real_sol_timeout_add(timeout_ms, group_cb, g);
+        SOL_NULL_CHECK_GOTO(g->timeout, err_group);
+        if (sol_ptr_vector_append(&groups, g) < 0)
+            goto err_timeout;
+    }
+
+    if (sol_ptr_vector_append(&g->members, m) < 0) {
+        if (sol_ptr_vector_get_len(&g->members))
+            goto err;
+        __real_sol_timeout_del(g->timeout);
+        group_del(g);
+        goto err;
+    }
+    m->group = g;
+    m->skip = skip;
+
+    return (struct sol_timeout *)m;
+
+err_timeout:
+    __real_sol_timeout_del(g->timeout);
+err_group:
+    free(g);
+err:
+    free(m);
+    //Not shared, but not to be lost either
+    SOL_WRN("Could not share a timeout of %" PRIu32 "ms", timeout_ms);
+    return __real_sol_timeout_add(timeout_ms, cb, data);
+}
+
+static struct member *
+member_find(const struct sol_timeout *handle)
+{
+    struct member *m;
+    struct group *g;
+    uint16_t i, j;
+
+    SOL_PTR_VECTOR_FOREACH_IDX (&groups, g, i) {
+        SOL_PTR_VECTOR_FOREACH_IDX (&g->members, m, j) {
+            if ((const struct sol_timeout *)m == handle)
+                return m;
+        }
+    }
+
+    return NULL;
+}
+
+bool
+__wrap_sol_timeout_del(struct sol_timeout *handle)
+{
+    struct member *m = member_find(handle);
+    struct group *g;
+
+    if (!m)
+        return __real_sol_timeout_del(handle);
+    if (m->deleted)
+        return false;
+
+    //Freed once the group is done with it
+    g = m->group;
+    if (g->dispatching) {
+        m->deleted = true;
+        return true;
+    }
+
+    sol_ptr_vector_remove(&g->members, m);
+    free(m);
+    if (!sol_ptr_vector_get_len(&g->members)) {
+        __real_sol_timeout_del(g->timeout);
+        group_del(g);
+    }
+
+    return true;
+}
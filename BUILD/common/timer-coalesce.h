@@ -0,0 +1,50 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2016 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+/*
+ * Timeouts of the same interval share a single timeout of the main loop,
+ * whose callbacks are all called in one go, so that eight timers of one
+ * second wake the core up once a second rather than eight times.
+ *
+ * It sits under sol_timeout itself: the application is linked with
+ * sol_timeout_add() and sol_timeout_del() wrapped (APP_WRAP, done by
+ * TIMER_COALESCE=y), so the timer and generator nodes of Soletta use it
+ * without knowing, where Soletta is linked statically (Zephyr, RIOT). On
+ * Linux only the application's own calls go through it.
+ *
+ * Every timeout of Soletta goes through it there, the retransmissions of
+ * CoAP and LWM2M and those of the main loop included, so no callback is
+ * ever called before it is due, only later: a new timeout joins a shared
+ * one of its interval if that one's next tick, or the one after, comes
+ * no more than interval / TIMER_COALESCE_SLACK_DIV after the new one is
+ * due. Otherwise the next tick may wait for the new timeout, as long as
+ * none of the timeouts already sharing it gets called more than that
+ * late. Only the first expiry moves, the ones after are an interval
+ * apart as usual. Intervals under TIMER_COALESCE_MIN_MS, like the zero
+ * ones used to run something on the next main loop iteration, are left
+ * alone.
+ */
+
+#ifndef TIMER_COALESCE_MIN_MS
+#define TIMER_COALESCE_MIN_MS (100)
+#endif
+#ifndef TIMER_COALESCE_SLACK_DIV
+#define TIMER_COALESCE_SLACK_DIV (8)
+#endif
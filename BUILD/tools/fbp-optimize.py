@@ -0,0 +1,304 @@
+#!/usr/bin/env python3
+
+# This file is part of the Soletta Project
+#
+# Copyright (C) 2016 Intel Corporation. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Rewrites an FBP flow into an equivalent one with fewer nodes.
+
+Four passes, repeated until none changes anything:
+
+ * constants feeding a port that has an option of the same name and type
+   (like timer's ENABLED and enabled) become that option of the node
+   they feed;
+ * chains of two converters that amount to one are merged;
+ * twins, nodes with no effect but their packets that have the same type,
+   options and inputs, are merged into one feeding what both fed. A node
+   that switches itself off through a converter of its own, like a timer
+   that ticks once, counts that loop as one of its inputs;
+ * nodes with no effect but their packets, once none of their output
+   ports is connected, are removed.
+
+Ports and options of the node types are read from the descriptions given
+with -j, and aliases from the flow configuration given with -c, as
+sol-fbp-generator does; constants are only folded into types described
+there. Flows using what this does not know of (exported ports, declared
+sub-flows, exported options) are written out unchanged.
+
+Only nodes of a type known to have no effect but its packets are merged or
+removed: "pure" in its description, true or false, says so, otherwise it
+has to be one of PURE_TYPES, each checked by hand against its Soletta
+implementation. Anything else, a node type added later included, is left
+alone. Each node merged or removed is printed as it happens, and the count
+of nodes left at the end, so the build log shows what went.
+"""
+
+import argparse
+import json
+import os
+import sys
+
+# Keeps BUILD/tools free of __pycache__
+sys.dont_write_bytecode = True
+import fbp_flow  # noqa: E402
+from fbp_flow import Node, Unsupported, parse  # noqa: E402
+
+# Types whose only effect is the packets they send, when their
+# description does not say. Neither prefixes nor patterns: a type gets
+# here once its implementation is read, like the ones the flows of this
+# tree use
+PURE_TYPES = frozenset((
+    "boolean/not",
+    "boolean/toggle",
+    "constant/boolean",
+    "constant/byte",
+    "constant/float",
+    "constant/int",
+    "constant/string",
+    "converter/empty-to-boolean",
+    "converter/empty-to-rgb",
+    "converter/rgb-to-direction-vector",
+    "test/boolean-generator",
+    "test/byte-generator",
+    "test/float-generator",
+    "test/int-generator",
+    "test/string-generator",
+    "timer",
+))
+
+CONSTANT_TYPES = {
+    "constant/boolean": "boolean",
+    "constant/byte": "byte",
+    "constant/float": "float",
+    "constant/int": "int",
+    "constant/string": "string",
+}
+
+
+class Types(fbp_flow.Types):
+    def option_for_port(self, type_, port):
+        desc = self.types.get(type_)
+        if not desc:
+            return None
+        p = self.in_port(type_, port)
+        if not p:
+            return None
+        for m in desc.get("options", {}).get("members", []):
+            if m.get("name") == port.lower():
+                if m.get("data_type") == p.get("data_type"):
+                    return m["name"], m["data_type"]
+        return None
+
+    def is_pure(self, type_):
+        pure = self.types.get(type_, {}).get("pure")
+        if isinstance(pure, bool):
+            return pure
+        return type_ in PURE_TYPES
+
+
+def fold_constants(flow, types, log):
+    changed = False
+    for name in list(flow.order):
+        node = flow.nodes[name]
+        type_, alias_opts = types.resolve(node)
+        data_type = CONSTANT_TYPES.get(type_)
+        if not data_type:
+            continue
+        value = node.option("value")
+        if value is None and "value" in alias_opts:
+            value = json.dumps(alias_opts["value"])
+        # Ranges or anything but the value can not be folded
+        if value is None or [k for k, _ in node.options if k != "value"]:
+            continue
+
+        for c in flow.outputs(name):
+            if c[1] != "OUT":
+                continue
+            dst = flow.nodes[c[2]]
+            dst_type, _ = types.resolve(dst)
+            option = types.option_for_port(dst_type, c[3])
+            if not option or option[1] != data_type:
+                continue
+            # Which of two constants gets in first is up to the runtime
+            others = [o for o in flow.inputs(dst.name)
+                      if o[3] == c[3] and o is not c and
+                      types.resolve(flow.nodes[o[0]])[0] in CONSTANT_TYPES]
+            if others:
+                continue
+
+            dst.set_option(option[0], value)
+            flow.conns.remove(c)
+            log("folded %s into %s.%s" % (node.text(), dst.name, option[0]))
+            changed = True
+    return changed
+
+
+def merge_chains(flow, types, log):
+    """Pairs of converters that do what a single one does."""
+    for name in list(flow.order):
+        if name not in flow.nodes:
+            continue
+        first = flow.nodes[name]
+        outs = flow.outputs(name)
+        if len(outs) != 1:
+            continue
+        second = flow.nodes[outs[0][2]]
+        if second is first or len(flow.inputs(second.name)) != 1:
+            continue
+        t1, a1 = types.resolve(first)
+        t2, a2 = types.resolve(second)
+        if a1 or a2:
+            continue
+
+        merged = None
+        # Negating a constant boolean is another constant boolean
+        if (t1 == "converter/empty-to-boolean" and t2 == "boolean/not" and
+                not second.options and
+                [k for k, _ in first.options] == ["output_value"] and
+                outs[0][1] == "OUT" and outs[0][3] == "IN"):
+            v = first.option("output_value").lower()
+            if v in ("true", "false"):
+                merged = Node(first.name, t1, [
+                    ["output_value", "false" if v == "true" else "true"]])
+
+        if not merged:
+            continue
+
+        log("merged %s and %s into %s" % (first.text(), second.text(),
+                                          merged.text()))
+        flow.nodes[first.name] = merged
+        for c in flow.outputs(second.name):
+            c[0] = first.name
+        flow.conns.remove(outs[0])
+        flow.remove_node(second.name)
+        return True
+    return False
+
+
+def self_latch(flow, types, name, node):
+    """The port of node feeding name, if node is a converter that only
+    takes packets from name and only sends them back to it."""
+    ins, outs = flow.inputs(node), flow.outputs(node)
+    type_, alias_opts = types.resolve(flow.nodes[node])
+    if (node == name or alias_opts or not type_.startswith("converter/") or
+            not types.is_pure(type_) or
+            len(ins) != 1 or ins[0][0] != name or not outs or
+            any(c[2] != name for c in outs)):
+        return None
+    return ins[0][1]
+
+
+def merge_twins(flow, types, log):
+    groups = {}
+    for name in flow.order:
+        node = flow.nodes[name]
+        type_, alias_opts = types.resolve(node)
+        if not types.is_pure(type_):
+            continue
+        inputs, latches = [], []
+        for src, src_port, _, dst_port in flow.inputs(name):
+            port = self_latch(flow, types, name, src)
+            if port is not None:
+                latch = flow.nodes[src]
+                inputs.append(("latch", port, latch.type,
+                               tuple(map(tuple, latch.options)), dst_port))
+                latches.append(src)
+            elif src == name:
+                break
+            else:
+                inputs.append((src, src_port, dst_port))
+        else:
+            key = (node.type, tuple(map(tuple, node.options)),
+                   tuple(sorted(inputs)))
+            groups.setdefault(key, []).append((name, latches))
+
+    changed = False
+    for twins in groups.values():
+        keep = twins[0][0]
+        for name, latches in twins[1:]:
+            moved = [c for c in flow.outputs(name) if c[2] not in latches]
+            # Both feeding the same port would send it twice
+            if any(c[1:] == o[1:] for c in moved for o in flow.outputs(keep)):
+                continue
+            log("merged %s into its twin %s" % (flow.nodes[name].text(),
+                                                 keep))
+            for c in moved:
+                c[0] = keep
+            for latch in latches:
+                log("removed %s, it only switched off %s" %
+                    (flow.nodes[latch].text(), name))
+                flow.remove_node(latch)
+            flow.remove_node(name)
+            changed = True
+    return changed
+
+
+def remove_dead(flow, types, log):
+    changed = False
+    for name in list(flow.order):
+        node = flow.nodes[name]
+        if flow.outputs(name) or not types.is_pure(types.resolve(node)[0]):
+            continue
+        log("removed %s, nothing uses its packets" % node.text())
+        flow.remove_node(name)
+        changed = True
+    return changed
+
+
+def optimize(flow, types, log):
+    while (fold_constants(flow, types, log) or
+           merge_chains(flow, types, log) or
+           merge_twins(flow, types, log) or
+           remove_dead(flow, types, log)):
+        pass
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("-j", action="append", default=[],
+                        metavar="DESCRIPTIONS",
+                        help="node type descriptions, file or directory")
+    parser.add_argument("-c", metavar="CONFIG", help="flow configuration")
+    parser.add_argument("input")
+    parser.add_argument("output")
+    args = parser.parse_args()
+
+    with open(args.input) as f:
+        text = f.read()
+
+    source = os.path.basename(args.input)
+
+    def log(msg):
+        print("%s: %s" % (source, msg), file=sys.stderr)
+
+    try:
+        flow = parse(text)
+        types = Types(args.j, args.c)
+        before = len(flow.order)
+        optimize(flow, types, log)
+        log("%d nodes of %d left" % (len(flow.order), before))
+        out = ("# Generated from %s by fbp-optimize.py, %d nodes of %d\n" %
+               (source, len(flow.order), before)) + flow.text()
+    except Unsupported as e:
+        log("left as is, %s" % e)
+        out = text
+
+    with open(args.output, "w") as f:
+        f.write(out)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,563 @@
+#!/usr/bin/env python3
+
+# This file is part of the Soletta Project
+#
+# Copyright (C) 2016 Intel Corporation. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""Generates the C of a small FBP flow as const tables and open code.
+
+sol-fbp-generator describes a flow with tables that
+sol_flow_static_new_type() turns into a flow type as the program starts,
+on the heap: the type itself, an index of the connections of each port
+and the storage of every node, and each packet is routed by searching
+the connections of its port. For a flow of up to --max-nodes nodes, this
+writes instead:
+
+ * the options of each node as const structs, the defaults of its
+   description filling in those the flow does not give;
+ * the container type of the flow as a const struct, so nothing is
+   built as it starts but the nodes themselves;
+ * the routing as a switch on the node and port that sent a packet,
+   each case calling the process functions of the input ports it is
+   connected to, looked up once as the flow opens. The node that sent
+   is found by the hash of its address, not by searching the nodes;
+ * a fixed queue of the packets to deliver, sized from the number of
+   connections, in place of the list of the static flow.
+
+Packets are still delivered from an idler, after the node that sends
+them returns, as Soletta does. The flow inspector is not called for
+them, so FLOW_PROFILE does not see these flows.
+
+Flows that are larger, that export ports or options, or that use a type
+or option value this does not know how to write, are handed to the
+generator given with --generator, along with the same arguments.
+"""
+
+import argparse
+import json
+import os
+import shlex
+import subprocess
+import sys
+
+# Keeps BUILD/tools free of __pycache__
+sys.dont_write_bytecode = True
+import fbp_flow as fbp  # noqa: E402
+from fbp_flow import Unsupported  # noqa: E402
+
+
+def c_string(value):
+    return '"%s"' % (value.replace("\\", "\\\\").replace('"', '\\"')
+                     .replace("\n", "\\n"))
+
+
+def c_value(data_type, value):
+    """The C initializer of an option value, either raw FBP text or what
+    a JSON description or configuration gives."""
+    if isinstance(value, str):
+        raw = value.strip()
+        if data_type == "string":
+            if len(raw) >= 2 and raw[0] == raw[-1] == '"':
+                try:
+                    raw = json.loads(raw)
+                except ValueError:
+                    raise Unsupported("string option %s" % raw)
+            return c_string(raw)
+        value = raw
+
+    try:
+        if data_type == "boolean":
+            if isinstance(value, bool):
+                return "true" if value else "false"
+            if value.lower() in ("true", "false"):
+                return value.lower()
+        elif data_type == "int":
+            if isinstance(value, bool):
+                raise ValueError
+            v = value if isinstance(value, int) else int(value, 0)
+            if -2 ** 31 <= v < 2 ** 31:
+                return "%d" % v
+        elif data_type == "byte":
+            v = value if isinstance(value, int) else int(value, 0)
+            if 0 <= v <= 255:
+                return "%d" % v
+        elif data_type == "float":
+            return repr(float(value))
+        elif data_type == "string" and value is None:
+            return "NULL"
+    except (TypeError, ValueError):
+        pass
+    raise Unsupported("%s option %r" % (data_type, value))
+
+
+def port_index(desc, direction, port):
+    """Index of port, NAME or NAME[i], among the ports of desc."""
+    name, _, idx = port.partition("[")
+    idx = int(idx.rstrip("]")) if idx else 0
+    base = 0
+    for p in desc.get(direction, []):
+        size = p.get("array_size") or 0
+        start = p.get("base_port_idx", base)
+        if p.get("name") == name:
+            if idx >= max(size, 1):
+                raise Unsupported("no port %s" % port)
+            return start + idx
+        base = start + max(size, 1)
+    raise Unsupported("no port %s in %s" % (port, desc.get("name")))
+
+
+class StaticFlow:
+    def __init__(self, flow, types, max_nodes):
+        if len(flow.order) > max_nodes:
+            raise Unsupported("%d nodes, more than %d" %
+                              (len(flow.order), max_nodes))
+        if not flow.conns:
+            raise Unsupported("no connections")
+
+        self.nodes = []
+        index = {}
+        for name in flow.order:
+            node = flow.nodes[name]
+            type_, alias_opts = types.resolve(node)
+            desc = types.types.get(type_)
+            if not desc or not all(desc.get(k) for k in
+                                   ("symbol", "options_symbol",
+                                    "header_file")):
+                raise Unsupported("no description of %s" % type_)
+            index[name] = len(self.nodes)
+            self.nodes.append((name, desc, self.options(node, desc,
+                                                        alias_opts)))
+
+        # conn ids count the connections of a port in the order they come
+        self.conns = []
+        out_ids, in_ids = {}, {}
+        for src, src_port, dst, dst_port in flow.conns:
+            s, d = index[src], index[dst]
+            sp = port_index(self.nodes[s][1], "out_ports", src_port)
+            dp = port_index(self.nodes[d][1], "in_ports", dst_port)
+            sc = out_ids.get((s, sp), 0)
+            dc = in_ids.get((d, dp), 0)
+            out_ids[(s, sp)] = sc + 1
+            in_ids[(d, dp)] = dc + 1
+            self.conns.append((s, sp, sc, d, dp, dc,
+                               "%s %s -> %s %s" % (src, src_port,
+                                                   dst_port, dst)))
+
+    @staticmethod
+    def options(node, desc, alias_opts):
+        given = dict(alias_opts)
+        given.update(dict(node.options))
+        members = desc.get("options", {}).get("members", [])
+        names = [m.get("name") for m in members]
+        for key in given:
+            if key not in names:
+                raise Unsupported("no option %s in %s" % (key, desc["name"]))
+
+        values = []
+        for m in members:
+            if m["name"] in given:
+                value = given[m["name"]]
+            elif "default" in m:
+                value = m["default"]
+            elif m.get("data_type") == "string":
+                value = None
+            else:
+                raise Unsupported("no default for %s of %s" %
+                                  (m["name"], desc["name"]))
+            values.append((m["name"], c_value(m.get("data_type"), value)))
+        return values
+
+    def write(self, source):
+        nodes, conns = self.nodes, self.conns
+        queue_len = max(8, 4 * len(conns))
+        node_slots = 1
+        while node_slots < 2 * len(nodes):
+            node_slots *= 2
+        out = []
+        w = out.append
+
+        w("/* Generated from %s by fbp-static.py, do not edit. */\n" % source)
+        w("#include <errno.h>")
+        w("#include <stdbool.h>")
+        w("#include <stdint.h>")
+        w("#include <stdlib.h>")
+        w("#include <string.h>\n")
+        w("#include <sol-flow.h>")
+        w("#include <sol-flow-packet.h>")
+        w("#include <sol-log.h>")
+        w("#include <sol-mainloop.h>\n")
+        for header in sorted(set(d["header_file"] for _, d, _ in nodes)):
+            w('#include "%s"' % header)
+        w("")
+        w("#define NODE_COUNT (%d)" % len(nodes))
+        w("#define CONN_COUNT (%d)" % len(conns))
+        w("//Power of two, at least twice NODE_COUNT")
+        w("#define NODE_SLOTS (%d)" % node_slots)
+        w("#ifndef FBP_STATIC_QUEUE_LEN")
+        w("#define FBP_STATIC_QUEUE_LEN (%d)" % queue_len)
+        w("#endif\n")
+
+        for i, (name, desc, values) in enumerate(nodes):
+            sym = desc["symbol"]
+            w("//%s (%s)" % (name, desc["name"]))
+            w("static const struct %s opts%d = {" % (desc["options_symbol"],
+                                                     i))
+            w("    .base = {")
+            w("        SOL_SET_API_VERSION(.api_version = "
+              "SOL_FLOW_NODE_OPTIONS_API_VERSION, )")
+            w("        SOL_SET_API_VERSION(.sub_api = "
+              "%s_OPTIONS_API_VERSION)" % sym)
+            w("    },")
+            for key, value in values:
+                w("    .%s = %s," % (key, value))
+            w("};\n")
+
+        w("static const char *const node_names[NODE_COUNT] = {")
+        for name, _, _ in nodes:
+            w("    %s," % c_string(name))
+        w("};\n")
+        w("static const struct sol_flow_node_options *const "
+          "node_options[NODE_COUNT] = {")
+        for i in range(len(nodes)):
+            w("    &opts%d.base," % i)
+        w("};\n")
+
+        w("static const struct conn {")
+        w("    uint8_t src, dst;")
+        w("    uint16_t src_port, src_conn_id, dst_port, dst_conn_id;")
+        w("} conns[CONN_COUNT] = {")
+        for s, sp, sc, d, dp, dc, text in conns:
+            w("    { %d, %d, %d, %d, %d, %d }, //%s" % (s, d, sp, sc, dp, dc,
+                                                       text))
+        w("};\n")
+
+        w("static struct sol_flow_node *nodes[NODE_COUNT];")
+        w("//Index + 1 of each node, by the hash of its address, 0 if free")
+        w("static uint8_t node_slots[NODE_SLOTS];")
+        w("static const struct sol_flow_port_type_in *ports_in[CONN_COUNT];")
+        w("//Sides of each connection made so far, the ones to undo")
+        w("#define CONNECTED_OUT (1 << 0)")
+        w("#define CONNECTED_IN (1 << 1)")
+        w("static uint8_t connected[CONN_COUNT];")
+        w("static struct {")
+        w("    struct sol_flow_node *src;")
+        w("    uint16_t port;")
+        w("    struct sol_flow_packet *packet;")
+        w("} queue[FBP_STATIC_QUEUE_LEN];")
+        w("static uint16_t queue_head, queue_len;")
+        w("static struct sol_idle *dispatcher;")
+        w("static bool dispatching;")
+        w("//Times flow_close ran, a node may close the flow as it processes")
+        w("static unsigned int closes;\n")
+
+        w("""static const struct sol_flow_node_type *
+node_type(unsigned int i)
+{
+    switch (i) {""")
+        for i, (_, desc, _) in enumerate(nodes):
+            w("    case %d:\n        return %s;" % (i, desc["symbol"]))
+        w("""    }
+    return NULL;
+}
+
+static unsigned int
+node_slot(const struct sol_flow_node *node)
+{
+    return ((uintptr_t)node >> 4) * 2654435761u & (NODE_SLOTS - 1);
+}
+
+static void
+node_slot_add(unsigned int i)
+{
+    unsigned int s = node_slot(nodes[i]);
+
+    while (node_slots[s])
+        s = (s + 1) & (NODE_SLOTS - 1);
+    node_slots[s] = i + 1;
+}
+
+//The index of a node of the flow, -1 for any other
+static int
+node_index(const struct sol_flow_node *node)
+{
+    unsigned int s;
+
+    for (s = node_slot(node); node_slots[s]; s = (s + 1) & (NODE_SLOTS - 1)) {
+        if (nodes[node_slots[s] - 1] == node)
+            return node_slots[s] - 1;
+    }
+    return -1;
+}
+
+static void
+deliver(unsigned int c, const struct sol_flow_packet *packet)
+{
+    struct sol_flow_node *dst = nodes[conns[c].dst];
+
+    if (ports_in[c] && ports_in[c]->process)
+        ports_in[c]->process(dst, sol_flow_node_get_private_data(dst),
+            conns[c].dst_port, conns[c].dst_conn_id, packet);
+}
+
+//Each output port, as node << 16 | port, to the connections it feeds
+static void
+route(uint32_t src, const struct sol_flow_packet *packet)
+{
+    switch (src) {""")
+        routes = {}
+        for c, conn in enumerate(conns):
+            routes.setdefault((conn[0], conn[1]), []).append(c)
+        for (s, sp), cs in sorted(routes.items()):
+            w("    case %d << 16 | %d:" % (s, sp))
+            for c in cs:
+                w("        deliver(%d, packet); //%s" % (c, conns[c][6]))
+            w("        break;")
+        w("""    }
+}
+
+/*
+   The source of a packet is looked up here, not as it is sent: a node
+   may send while it opens, before the flow knows its address.
+ */
+static bool
+dispatch_cb(void *data)
+{
+    //Packets sent meanwhile wait for the next run
+    uint16_t n = queue_len;
+    unsigned int opened = closes;
+
+    dispatching = true;
+    while (n--) {
+        struct sol_flow_node *src = queue[queue_head].src;
+        uint16_t port = queue[queue_head].port;
+        struct sol_flow_packet *packet = queue[queue_head].packet;
+        int i = node_index(src);
+
+        queue_head = (queue_head + 1) % FBP_STATIC_QUEUE_LEN;
+        queue_len--;
+        if (i >= 0)
+            route((uint32_t)i << 16 | port, packet);
+        sol_flow_packet_del(packet);
+
+        //The queue went with the flow, and this idler too
+        if (closes != opened) {
+            dispatching = false;
+            return false;
+        }
+    }
+    dispatching = false;
+
+    if (queue_len)
+        return true;
+    dispatcher = NULL;
+    return false;
+}
+
+static int
+flow_send(struct sol_flow_node *container, struct sol_flow_node *src,
+    uint16_t port, struct sol_flow_packet *packet)
+{
+    uint16_t tail;
+
+    if (queue_len == FBP_STATIC_QUEUE_LEN) {
+        SOL_WRN("More than %d packets waiting, raise FBP_STATIC_QUEUE_LEN",
+            FBP_STATIC_QUEUE_LEN);
+        return -ENOBUFS;
+    }
+    if (!dispatcher) {
+        dispatcher = sol_idle_add(dispatch_cb, NULL);
+        if (!dispatcher)
+            return -ENOMEM;
+    }
+
+    tail = (queue_head + queue_len) % FBP_STATIC_QUEUE_LEN;
+    queue[tail].src = src;
+    queue[tail].port = port;
+    queue[tail].packet = packet;
+    queue_len++;
+    return 0;
+}
+
+static void
+flow_close(struct sol_flow_node *node, void *data)
+{
+    unsigned int i;
+
+    for (i = CONN_COUNT; i-- > 0;) {
+        const struct conn *c = &conns[i];
+        const struct sol_flow_port_type_out *out;
+
+        if ((connected[i] & CONNECTED_IN) && ports_in[i]->disconnect)
+            ports_in[i]->disconnect(nodes[c->dst],
+                sol_flow_node_get_private_data(nodes[c->dst]), c->dst_port,
+                c->dst_conn_id);
+        out = sol_flow_node_type_get_port_out(node_type(c->src), c->src_port);
+        if ((connected[i] & CONNECTED_OUT) && out && out->disconnect)
+            out->disconnect(nodes[c->src],
+                sol_flow_node_get_private_data(nodes[c->src]), c->src_port,
+                c->src_conn_id);
+        connected[i] = 0;
+    }
+
+    for (i = NODE_COUNT; i-- > 0;) {
+        if (nodes[i])
+            sol_flow_node_del(nodes[i]);
+        nodes[i] = NULL;
+    }
+    memset(node_slots, 0, sizeof(node_slots));
+
+    while (queue_len) {
+        sol_flow_packet_del(queue[queue_head].packet);
+        queue_head = (queue_head + 1) % FBP_STATIC_QUEUE_LEN;
+        queue_len--;
+    }
+    //A running dispatcher ends itself as it returns
+    if (dispatcher && !dispatching)
+        sol_idle_del(dispatcher);
+    dispatcher = NULL;
+    closes++;
+}
+
+static int
+flow_open(struct sol_flow_node *node, void *data,
+    const struct sol_flow_node_options *options)
+{
+    unsigned int i;
+    int r = -ENOMEM;
+
+    for (i = 0; i < NODE_COUNT; i++) {
+        nodes[i] = sol_flow_node_new(node, node_names[i], node_type(i),
+            node_options[i]);
+        if (!nodes[i]) {
+            SOL_WRN("Could not create node '%s'", node_names[i]);
+            goto err;
+        }
+        node_slot_add(i);
+    }
+
+    for (i = 0; i < CONN_COUNT; i++) {
+        const struct conn *c = &conns[i];
+        const struct sol_flow_port_type_out *out;
+
+        out = sol_flow_node_type_get_port_out(node_type(c->src), c->src_port);
+        if (out && out->connect) {
+            r = out->connect(nodes[c->src],
+                sol_flow_node_get_private_data(nodes[c->src]), c->src_port,
+                c->src_conn_id);
+            if (r < 0)
+                goto err;
+        }
+        connected[i] |= CONNECTED_OUT;
+
+        ports_in[i] = sol_flow_node_type_get_port_in(node_type(c->dst),
+            c->dst_port);
+        if (ports_in[i] && ports_in[i]->connect) {
+            r = ports_in[i]->connect(nodes[c->dst],
+                sol_flow_node_get_private_data(nodes[c->dst]), c->dst_port,
+                c->dst_conn_id);
+            if (r < 0)
+                goto err;
+        }
+        if (ports_in[i])
+            connected[i] |= CONNECTED_IN;
+    }
+
+    return 0;
+
+err:
+    //Only what was made: nodes created, and the sides connected
+    flow_close(node, data);
+    return r;
+}
+
+static const struct sol_flow_node_container_type flow_type = {
+    .base = {
+        SOL_SET_API_VERSION(.api_version = SOL_FLOW_NODE_TYPE_API_VERSION, )
+        .flags = SOL_FLOW_NODE_TYPE_FLAGS_CONTAINER,
+        .open = flow_open,
+        .close = flow_close,
+    },
+    .send = flow_send,
+};
+
+static struct sol_flow_node *flow;
+
+static void
+startup(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < NODE_COUNT; i++) {
+        if (node_type(i)->init_type)
+            node_type(i)->init_type();
+    }
+
+    flow = sol_flow_node_new(NULL, NULL, &flow_type.base, NULL);
+    if (!flow) {
+        SOL_WRN("Could not open the flow");
+        sol_quit_with_code(EXIT_FAILURE);
+    }
+}
+
+static void
+shutdown(void)
+{
+    if (flow)
+        sol_flow_node_del(flow);
+}
+
+SOL_MAIN_DEFAULT(startup, shutdown);""")
+        return "\n".join(out) + "\n"
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--generator", required=True,
+                        help="command of the generator for other flows")
+    parser.add_argument("--max-nodes", type=int, default=16)
+    parser.add_argument("-j", action="append", default=[],
+                        metavar="DESCRIPTIONS",
+                        help="node type descriptions, file or directory")
+    parser.add_argument("-c", metavar="CONFIG", help="flow configuration")
+    parser.add_argument("input")
+    parser.add_argument("output")
+    args = parser.parse_args()
+
+    with open(args.input) as f:
+        text = f.read()
+    source = os.path.basename(args.input)
+
+    try:
+        flow = fbp.parse(text)
+        static = StaticFlow(flow, fbp.Types(args.j, args.c), args.max_nodes)
+    except Unsupported as e:
+        print("%s: generated by the generator, %s" % (source, e),
+              file=sys.stderr)
+        cmd = shlex.split(args.generator)
+        for j in args.j:
+            cmd += ["-j", j]
+        if args.c:
+            cmd += ["-c", args.c]
+        return subprocess.call(cmd + [args.input, args.output])
+
+    print("%s: %d nodes and %d connections generated as const tables" %
+          (source, len(static.nodes), len(static.conns)), file=sys.stderr)
+    with open(args.output, "w") as f:
+        f.write(static.write(source))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
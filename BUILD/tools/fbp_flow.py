@@ -0,0 +1,271 @@
+# This file is part of the Soletta Project
+#
+# Copyright (C) 2016 Intel Corporation. All rights reserved.
+#
+# Licensed under the Apache License, Version 2.0 (the "License");
+# you may not use this file except in compliance with the License.
+# You may obtain a copy of the License at
+#
+#     http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS,
+# WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+# See the License for the specific language governing permissions and
+# limitations under the License.
+
+"""The FBP flows and node type descriptions, as the tools of BUILD read
+them.
+
+Flows are parsed into their nodes, with type and options as written,
+and their connections. What the parser does not know of (exported
+ports, declared sub-flows, exported options) raises Unsupported, so a
+tool can leave such a flow to sol-fbp-generator. Node types are looked
+up in the descriptions and aliases in the flow configuration, as
+sol-fbp-generator does.
+"""
+
+import json
+import os
+import re
+
+IDENT = re.compile(r"[A-Za-z0-9_]+")
+PORT = re.compile(r"[A-Za-z0-9_]+(\[[0-9]+\])?")
+
+
+class Unsupported(Exception):
+    pass
+
+
+class Node:
+    def __init__(self, name, type_, options):
+        self.name = name
+        self.type = type_
+        self.options = options  # [[key, raw value]], in order
+
+    def option(self, key):
+        for k, v in self.options:
+            if k == key:
+                return v
+        return None
+
+    def set_option(self, key, value):
+        for o in self.options:
+            if o[0] == key:
+                o[1] = value
+                return
+        self.options.append([key, value])
+
+    def text(self):
+        if not self.options:
+            return "%s(%s)" % (self.name, self.type)
+        return "%s(%s:%s)" % (self.name, self.type,
+                              ",".join("%s=%s" % (k, v)
+                                       for k, v in self.options))
+
+
+class Flow:
+    def __init__(self):
+        self.nodes = {}
+        self.order = []
+        self.conns = []  # [src, src port, dst, dst port]
+        self.anonymous = 0
+
+    def add_node(self, name, type_, options):
+        if name == "_":
+            self.anonymous += 1
+            name = "_anon%d" % self.anonymous
+            while name in self.nodes:
+                name += "_"
+        elif name in self.nodes:
+            if type_ is not None:
+                if self.nodes[name].type is not None:
+                    raise Unsupported("node '%s' declared twice" % name)
+                self.nodes[name].type = type_
+                self.nodes[name].options = options
+            return name
+
+        self.nodes[name] = Node(name, type_, options)
+        self.order.append(name)
+        return name
+
+    def remove_node(self, name):
+        del self.nodes[name]
+        self.order.remove(name)
+        self.conns = [c for c in self.conns if name not in (c[0], c[2])]
+
+    def outputs(self, name):
+        return [c for c in self.conns if c[0] == name]
+
+    def inputs(self, name):
+        return [c for c in self.conns if c[2] == name]
+
+    def text(self):
+        lines = [self.nodes[n].text() for n in self.order]
+        lines += ["%s %s -> %s %s" % (c[0], c[1], c[3], c[2])
+                  for c in self.conns]
+        return "\n".join(lines) + "\n"
+
+
+def split_top(text, seps):
+    """Splits text at seps out of quotes and parentheses."""
+    parts, depth, quote, start, i = [], 0, False, 0, 0
+    while i < len(text):
+        ch = text[i]
+        if quote:
+            if ch == "\\":
+                i += 1
+            elif ch == '"':
+                quote = False
+        elif ch == '"':
+            quote = True
+        elif ch == "(":
+            depth += 1
+        elif ch == ")":
+            depth -= 1
+        elif ch in seps and depth == 0:
+            parts.append(text[start:i])
+            start = i + 1
+        i += 1
+    if quote or depth:
+        raise Unsupported("unbalanced quotes or parentheses")
+    parts.append(text[start:])
+    return parts
+
+
+def strip_comments(text):
+    out, quote = [], False
+    for line in text.split("\n"):
+        kept, i = "", 0
+        while i < len(line):
+            ch = line[i]
+            if quote and ch == "\\":
+                kept += line[i:i + 2]
+                i += 2
+                continue
+            if ch == '"':
+                quote = not quote
+            elif ch == "#" and not quote:
+                break
+            kept += ch
+            i += 1
+        out.append(kept)
+    return "\n".join(out)
+
+
+def parse_node(flow, text):
+    text = text.strip()
+    m = IDENT.match(text)
+    if not m:
+        raise Unsupported("expected a node, got '%s'" % text)
+    name, rest = m.group(0), text[m.end():].strip()
+    if not rest:
+        return flow.add_node(name, None, [])
+    if not (rest.startswith("(") and rest.endswith(")")):
+        raise Unsupported("unexpected '%s'" % rest)
+
+    inner = rest[1:-1].strip()
+    if not inner:
+        return flow.add_node(name, None, [])
+    type_, _, opts = inner.partition(":")
+    options = []
+    if opts.strip():
+        for o in split_top(opts, ","):
+            key, eq, value = o.partition("=")
+            if not eq:
+                raise Unsupported("option without value '%s'" % o)
+            options.append([key.strip(), value.strip()])
+    return flow.add_node(name, type_.strip(), options)
+
+
+def parse_statement(flow, text):
+    text = text.strip()
+    if not text:
+        return
+    if re.match(r"(INPORT|OUTPORT|DECLARE|OPTION)\s*=", text):
+        raise Unsupported(text.split("=")[0].strip())
+
+    # node [PORT -> PORT node]...
+    parts = split_top(text, ">")
+    for i in range(len(parts) - 1):
+        # Cut at '>', the '-' of each arrow is left behind
+        if not parts[i].endswith("-"):
+            raise Unsupported("unexpected '>'")
+        parts[i] = parts[i][:-1]
+
+    prev, prev_port = None, None
+    for i, part in enumerate(parts):
+        part = part.strip()
+        in_port = None
+        if i > 0:
+            m = PORT.match(part)
+            if not m:
+                raise Unsupported("expected a port in '%s'" % part)
+            in_port, part = m.group(0), part[m.end():].strip()
+        out_port = None
+        if i < len(parts) - 1:
+            m = re.search(r"\s(" + PORT.pattern + r")$", " " + part)
+            if not m:
+                raise Unsupported("expected a port in '%s'" % part)
+            out_port = m.group(1)
+            part = (" " + part)[:m.start()].strip()
+
+        name = parse_node(flow, part)
+        if prev is not None:
+            flow.conns.append([prev, prev_port, name, in_port])
+        prev, prev_port = name, out_port
+
+
+def parse(text):
+    flow = Flow()
+    for line in split_top(strip_comments(text), "\n,"):
+        parse_statement(flow, line)
+    for n in flow.order:
+        if flow.nodes[n].type is None:
+            raise Unsupported("node '%s' has no type" % n)
+    return flow
+
+
+class Types:
+    def __init__(self, descriptions, config):
+        self.types = {}
+        self.aliases = {}
+        for path in descriptions:
+            files = [path]
+            if os.path.isdir(path):
+                files = [os.path.join(path, f) for f in sorted(os.listdir(path))
+                         if f.endswith(".json")]
+            for f in files:
+                self.load(f)
+        if config:
+            with open(config) as f:
+                for t in json.load(f).get("nodetypes", []):
+                    self.aliases[t["name"]] = t
+
+    def load(self, path):
+        try:
+            with open(path) as f:
+                data = json.load(f)
+        except (OSError, ValueError):
+            return
+        entries = data.get("types", []) if isinstance(data, dict) else []
+        if isinstance(data, dict) and not entries:
+            for v in data.values():
+                if isinstance(v, list):
+                    entries += v
+        for t in entries:
+            if isinstance(t, dict) and "name" in t:
+                self.types[t["name"]] = t
+
+    def resolve(self, node):
+        """The actual type of node and the options the alias gives."""
+        alias = self.aliases.get(node.type)
+        if alias:
+            return alias["type"], alias.get("options", {})
+        return node.type, {}
+
+    def in_port(self, type_, port):
+        for p in self.types.get(type_, {}).get("in_ports", []):
+            if p.get("name") == port:
+                return p
+        return None
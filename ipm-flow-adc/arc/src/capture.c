@@ -0,0 +1,367 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2016 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Burst sampling of an ADC channel, far above the rate of flow packets.
+ *
+ * Every CAPTURE_TICK_MS, the samples due since the last tick, `rate`
+ * per second with the remainder carried to the next tick, are taken by
+ * a single read of the ADC driver straight into one of two static
+ * blocks. The read is synchronous, so the ADC takes them back to back
+ * at CAPTURE_READ_HZ rather than spaced over the tick, which would
+ * block the main loop for all of it: the rate is exact, the spacing
+ * only on average. A full block is sent over IPM as it is, the blob
+ * pointing to the block, and the other block is filled meanwhile. When
+ * the other core still holds both, samples are dropped, and counted,
+ * until it releases one.
+ */
+
+#include <sol-flow.h>
+#include <sol-flow-packet.h>
+#include <sol-ipm.h>
+#include <sol-log.h>
+#include <sol-mainloop.h>
+#include <sol-types.h>
+#include <sol-util.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#ifdef SOL_PLATFORM_ZEPHYR
+#include <adc.h>
+#include <device.h>
+#endif
+
+#include "ipm-block.h"
+#include "capture-gen.h"
+
+#define CAPTURE_MAX_SAMPLES (512)
+#define CAPTURE_MAX_RATE (20000)
+#define CAPTURE_TICK_MS (8)
+#define CAPTURE_BITS (12)
+//Clock of the ADC, sampling_delay counts its cycles
+#ifndef CAPTURE_ADC_CLOCK_HZ
+#define CAPTURE_ADC_CLOCK_HZ (32000000)
+#endif
+//Pace of the samples of a read, 160 of them at the highest rate take
+//1.6ms of a tick
+#ifndef CAPTURE_READ_HZ
+#define CAPTURE_READ_HZ (100000)
+#endif
+
+struct block {
+    struct ipm_block_header header;
+    uint16_t samples[CAPTURE_MAX_SAMPLES];
+};
+
+//Read by the other core while in flight, kept out of the node's data
+static struct block blocks[2];
+static bool blocks_busy[2];
+
+struct capture_data {
+    struct sol_flow_node *node;
+    struct sol_timeout *timeout;
+    struct block *filling; //NULL while the other core holds both
+    uint32_t id;
+    uint32_t rate;
+    uint32_t seq;
+    uint32_t lost; //since the last block sent
+    uint32_t lost_total;
+    uint32_t last_ms; //of the last tick
+    uint32_t due; //thousandths of a sample left from the last tick
+    uint16_t samples;
+    uint8_t channel;
+#ifdef SOL_PLATFORM_ZEPHYR
+    struct device *adc;
+    uint32_t raw[CAPTURE_MAX_SAMPLES];
+#endif
+};
+
+//A single ADC to sample, so a single node
+static struct capture_data *instance;
+
+#ifdef SOL_PLATFORM_ZEPHYR
+static int
+adc_setup(struct capture_data *mdata)
+{
+    mdata->adc = device_get_binding(CONFIG_ADC_0_NAME);
+    SOL_NULL_CHECK(mdata->adc, -ENODEV);
+
+    adc_enable(mdata->adc);
+    return 0;
+}
+
+static void
+adc_teardown(struct capture_data *mdata)
+{
+    adc_disable(mdata->adc);
+}
+
+static int
+adc_sample(struct capture_data *mdata, uint16_t *samples, uint16_t count)
+{
+    struct adc_seq_entry entry = {
+        .sampling_delay = CAPTURE_ADC_CLOCK_HZ / CAPTURE_READ_HZ,
+        .channel_id = mdata->channel,
+        .buffer = (uint8_t *)mdata->raw,
+        .buffer_length = count * sizeof(uint32_t)
+    };
+    struct adc_seq_table table = {
+        .entries = &entry,
+        .num_entries = 1
+    };
+    uint16_t i;
+
+    if (adc_read(mdata->adc, &table) != 0)
+        return -EIO;
+
+    for (i = 0; i < count; i++)
+        samples[i] = mdata->raw[i] & ((1 << CAPTURE_BITS) - 1);
+    return 0;
+}
+#else
+static int
+adc_setup(struct capture_data *mdata)
+{
+    SOL_WRN("adc/capture reads the ADC through Zephyr's driver only");
+    return -ENOTSUP;
+}
+
+static void
+adc_teardown(struct capture_data *mdata)
+{
+}
+
+static int
+adc_sample(struct capture_data *mdata, uint16_t *samples, uint16_t count)
+{
+    return -ENOTSUP;
+}
+#endif
+
+static uint32_t
+now_ms(void)
+{
+    struct timespec ts = sol_util_timespec_get_current();
+
+    return sol_util_msec_from_timespec(&ts);
+}
+
+static void
+add_lost(struct capture_data *mdata, uint32_t count)
+{
+    mdata->lost += count;
+    mdata->lost_total += count;
+    sol_flow_send_irange_value_packet(mdata->node,
+        SOL_FLOW_NODE_TYPE_ADC_CAPTURE__OUT__LOST, mdata->lost_total);
+}
+
+static void
+block_send(struct capture_data *mdata)
+{
+    struct block *b = mdata->filling, *other;
+    struct sol_blob *message;
+    int r = -ENOMEM;
+
+    b->header.seq = mdata->seq;
+    b->header.rate = mdata->rate;
+    b->header.lost = mdata->lost;
+    b->header.bits = CAPTURE_BITS;
+
+    //The block itself, released by consumed_cb()
+    message = sol_blob_new(&SOL_BLOB_TYPE_NO_FREE, NULL, b,
+        sizeof(b->header) + b->header.count * sizeof(uint16_t));
+    if (message) {
+        r = sol_ipm_send(mdata->id, message);
+        sol_blob_unref(message);
+    }
+    if (r < 0) {
+        SOL_WRN("Could not send block %" PRIu32 ": %d", mdata->seq, r);
+        add_lost(mdata, b->header.count);
+        b->header.count = 0;
+        return;
+    }
+
+    mdata->seq++;
+    mdata->lost = 0;
+    blocks_busy[b - blocks] = true;
+
+    other = &blocks[b == blocks];
+    mdata->filling = blocks_busy[other - blocks] ? NULL : other;
+    if (mdata->filling)
+        mdata->filling->header.count = 0;
+}
+
+static void
+consumed_cb(void *data, uint32_t id, struct sol_blob *message)
+{
+    unsigned int i;
+
+    for (i = 0; i < sol_util_array_size(blocks); i++) {
+        if (message->mem != &blocks[i])
+            continue;
+
+        blocks_busy[i] = false;
+        if (instance && !instance->filling) {
+            instance->filling = &blocks[i];
+            instance->filling->header.count = 0;
+        }
+        return;
+    }
+}
+
+static bool
+tick_cb(void *data)
+{
+    struct capture_data *mdata = data;
+    uint32_t now = now_ms();
+    uint64_t total;
+    uint32_t count, due;
+    int r;
+
+    //From the time elapsed, the ticks are not on time
+    total = (uint64_t)mdata->rate * (now - mdata->last_ms) + mdata->due;
+    mdata->last_ms = now;
+    mdata->due = total % 1000;
+    total /= 1000;
+
+    //Both blocks are the most a tick can fill, the other core does not
+    //release any meanwhile
+    due = 2u * mdata->samples;
+    if (total > due)
+        add_lost(mdata, total - due > UINT32_MAX ? UINT32_MAX : total - due);
+    else
+        due = total;
+
+    while (due) {
+        struct block *b = mdata->filling;
+
+        if (!b) {
+            add_lost(mdata, due);
+            break;
+        }
+
+        if (!b->header.count)
+            b->header.timestamp = now;
+        count = mdata->samples - b->header.count;
+        if (count > due)
+            count = due;
+
+        r = adc_sample(mdata, b->samples + b->header.count, count);
+        if (r < 0) {
+            SOL_WRN("Could not read %" PRIu32 " samples: %d", count, r);
+            break;
+        }
+
+        b->header.count += count;
+        due -= count;
+        if (b->header.count == mdata->samples)
+            block_send(mdata);
+    }
+
+    return true;
+}
+
+static int
+capture_open(struct sol_flow_node *node, void *data,
+    const struct sol_flow_node_options *options)
+{
+    struct capture_data *mdata = data;
+    const struct sol_flow_node_type_adc_capture_options *opts;
+    uint32_t tick = CAPTURE_TICK_MS;
+    int r;
+
+    SOL_FLOW_NODE_OPTIONS_SUB_API_CHECK(options,
+        SOL_FLOW_NODE_TYPE_ADC_CAPTURE_OPTIONS_API_VERSION, -EINVAL);
+    opts = (const struct sol_flow_node_type_adc_capture_options *)options;
+
+    if (instance) {
+        SOL_WRN("There can be a single adc/capture node");
+        return -EBUSY;
+    }
+    if (opts->rate < 1 || opts->rate > CAPTURE_MAX_RATE ||
+        opts->samples < 1 || opts->samples > CAPTURE_MAX_SAMPLES ||
+        opts->channel < 0 || opts->channel > UINT8_MAX || opts->id < 0 ||
+        (uint32_t)opts->id > sol_ipm_get_max_id()) {
+        SOL_WRN("Invalid options, rate must be up to %d Hz and samples up"
+            " to %d", CAPTURE_MAX_RATE, CAPTURE_MAX_SAMPLES);
+        return -EINVAL;
+    }
+
+    memset(mdata, 0, sizeof(*mdata));
+    mdata->node = node;
+    mdata->id = opts->id;
+    mdata->rate = opts->rate;
+    mdata->samples = opts->samples;
+    mdata->channel = opts->channel;
+
+    //Slow rates take about a sample per tick
+    if (mdata->rate * tick < 1000)
+        tick = 1000 / mdata->rate;
+    //A tick fills at most a block, or both would always be in flight
+    if (mdata->rate * tick > mdata->samples * 1000u) {
+        SOL_WRN("A rate of %" PRIu32 " Hz takes more than %u samples every"
+            " %" PRIu32 "ms, blocks must be larger", mdata->rate,
+            mdata->samples, tick);
+        return -EINVAL;
+    }
+
+    r = adc_setup(mdata);
+    if (r < 0)
+        return r;
+
+    r = sol_ipm_set_consumed_callback(mdata->id, consumed_cb, NULL);
+    if (r < 0)
+        goto err_consumed;
+
+    mdata->filling = blocks_busy[0] ? (blocks_busy[1] ? NULL : &blocks[1]) :
+        &blocks[0];
+    if (mdata->filling)
+        mdata->filling->header.count = 0;
+
+    mdata->last_ms = now_ms();
+    mdata->timeout = sol_timeout_add(tick, tick_cb, mdata);
+    if (!mdata->timeout) {
+        r = -ENOMEM;
+        goto err_timeout;
+    }
+
+    instance = mdata;
+    return 0;
+
+err_timeout:
+    sol_ipm_set_consumed_callback(mdata->id, NULL, NULL);
+err_consumed:
+    adc_teardown(mdata);
+    return r;
+}
+
+static void
+capture_close(struct sol_flow_node *node, void *data)
+{
+    struct capture_data *mdata = data;
+
+    //Blocks still in flight stay busy, they are static
+    sol_timeout_del(mdata->timeout);
+    adc_teardown(mdata);
+    instance = NULL;
+}
+
+#include "capture-gen.c"
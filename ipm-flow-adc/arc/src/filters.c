@@ -0,0 +1,347 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2016 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Streaming filters for the readings of the ARC, in integers only: each
+ * node keeps its state in its private data, sized by the options, and
+ * does a bounded amount of work per sample, without allocating.
+ *
+ * The output ranges are the ones of the input, only the values change.
+ */
+
+#include <sol-flow.h>
+#include <sol-flow-packet.h>
+#include <sol-log.h>
+#include <sol-types.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "filters-gen.h"
+
+#define MOVING_AVERAGE_MAX_SAMPLES (32)
+#define MEDIAN_MAX_SAMPLES (15)
+#define IIR_FRACTION_BITS (16)
+
+//Rounds to the nearest, halves away from zero
+static int32_t
+div_round(int64_t n, int64_t d)
+{
+    if (n < 0)
+        return (n - d / 2) / d;
+    return (n + d / 2) / d;
+}
+
+static int
+send_value(struct sol_flow_node *node, uint16_t port,
+    const struct sol_irange *range, int32_t value)
+{
+    struct sol_irange out = *range;
+
+    out.val = value;
+    return sol_flow_send_irange_packet(node, port, &out);
+}
+
+struct moving_average_data {
+    int32_t window[MOVING_AVERAGE_MAX_SAMPLES];
+    int64_t sum;
+    uint16_t samples;
+    uint16_t pos;
+    uint16_t count;
+};
+
+static int
+moving_average_open(struct sol_flow_node *node, void *data,
+    const struct sol_flow_node_options *options)
+{
+    struct moving_average_data *mdata = data;
+    const struct sol_flow_node_type_filter_moving_average_options *opts;
+
+    SOL_FLOW_NODE_OPTIONS_SUB_API_CHECK(options,
+        SOL_FLOW_NODE_TYPE_FILTER_MOVING_AVERAGE_OPTIONS_API_VERSION, -EINVAL);
+    opts = (const struct sol_flow_node_type_filter_moving_average_options *)
+        options;
+
+    if (opts->samples < 1 || opts->samples > MOVING_AVERAGE_MAX_SAMPLES) {
+        SOL_WRN("Invalid samples %" PRId32 ", from 1 to %d", opts->samples,
+            MOVING_AVERAGE_MAX_SAMPLES);
+        return -EINVAL;
+    }
+
+    memset(mdata, 0, sizeof(*mdata));
+    mdata->samples = opts->samples;
+    return 0;
+}
+
+static int
+moving_average_process(struct sol_flow_node *node, void *data, uint16_t port,
+    uint16_t conn_id, const struct sol_flow_packet *packet)
+{
+    struct moving_average_data *mdata = data;
+    struct sol_irange in;
+    int r;
+
+    r = sol_flow_packet_get_irange(packet, &in);
+    SOL_INT_CHECK(r, < 0, r);
+
+    //The oldest sample leaves the sum as the new one enters
+    if (mdata->count == mdata->samples)
+        mdata->sum -= mdata->window[mdata->pos];
+    else
+        mdata->count++;
+    mdata->window[mdata->pos] = in.val;
+    mdata->sum += in.val;
+    mdata->pos = (mdata->pos + 1) % mdata->samples;
+
+    return send_value(node, SOL_FLOW_NODE_TYPE_FILTER_MOVING_AVERAGE__OUT__OUT,
+        &in, div_round(mdata->sum, mdata->count));
+}
+
+struct iir_data {
+    int64_t acc; //16.16
+    uint8_t shift;
+    bool primed;
+};
+
+static int
+iir_open(struct sol_flow_node *node, void *data,
+    const struct sol_flow_node_options *options)
+{
+    struct iir_data *mdata = data;
+    const struct sol_flow_node_type_filter_iir_options *opts;
+
+    SOL_FLOW_NODE_OPTIONS_SUB_API_CHECK(options,
+        SOL_FLOW_NODE_TYPE_FILTER_IIR_OPTIONS_API_VERSION, -EINVAL);
+    opts = (const struct sol_flow_node_type_filter_iir_options *)options;
+
+    if (opts->shift < 1 || opts->shift >= IIR_FRACTION_BITS) {
+        SOL_WRN("Invalid shift %" PRId32 ", from 1 to %d", opts->shift,
+            IIR_FRACTION_BITS - 1);
+        return -EINVAL;
+    }
+
+    memset(mdata, 0, sizeof(*mdata));
+    mdata->shift = opts->shift;
+    return 0;
+}
+
+static int
+iir_process(struct sol_flow_node *node, void *data, uint16_t port,
+    uint16_t conn_id, const struct sol_flow_packet *packet)
+{
+    struct iir_data *mdata = data;
+    struct sol_irange in;
+    int64_t x;
+    int r;
+
+    r = sol_flow_packet_get_irange(packet, &in);
+    SOL_INT_CHECK(r, < 0, r);
+
+    x = (int64_t)in.val * (1 << IIR_FRACTION_BITS);
+    //Starts from the first sample instead of ramping up from zero
+    if (!mdata->primed) {
+        mdata->acc = x;
+        mdata->primed = true;
+    } else {
+        mdata->acc += (x - mdata->acc) / (1 << mdata->shift);
+    }
+
+    return send_value(node, SOL_FLOW_NODE_TYPE_FILTER_IIR__OUT__OUT, &in,
+        div_round(mdata->acc, 1 << IIR_FRACTION_BITS));
+}
+
+struct median_data {
+    int32_t window[MEDIAN_MAX_SAMPLES]; //in arrival order
+    int32_t sorted[MEDIAN_MAX_SAMPLES];
+    uint8_t samples;
+    uint8_t pos;
+    uint8_t count;
+};
+
+static int
+median_open(struct sol_flow_node *node, void *data,
+    const struct sol_flow_node_options *options)
+{
+    struct median_data *mdata = data;
+    const struct sol_flow_node_type_filter_median_options *opts;
+
+    SOL_FLOW_NODE_OPTIONS_SUB_API_CHECK(options,
+        SOL_FLOW_NODE_TYPE_FILTER_MEDIAN_OPTIONS_API_VERSION, -EINVAL);
+    opts = (const struct sol_flow_node_type_filter_median_options *)options;
+
+    if (opts->samples < 1 || opts->samples > MEDIAN_MAX_SAMPLES ||
+        !(opts->samples % 2)) {
+        SOL_WRN("Invalid samples %" PRId32 ", odd from 1 to %d",
+            opts->samples, MEDIAN_MAX_SAMPLES);
+        return -EINVAL;
+    }
+
+    memset(mdata, 0, sizeof(*mdata));
+    mdata->samples = opts->samples;
+    return 0;
+}
+
+static int
+median_process(struct sol_flow_node *node, void *data, uint16_t port,
+    uint16_t conn_id, const struct sol_flow_packet *packet)
+{
+    struct median_data *mdata = data;
+    struct sol_irange in;
+    int i, n;
+    int r;
+
+    r = sol_flow_packet_get_irange(packet, &in);
+    SOL_INT_CHECK(r, < 0, r);
+
+    //The sorted copy loses the oldest sample and gets the new one in
+    //place, a single pass over a window of at most 15
+    n = mdata->count;
+    if (mdata->count == mdata->samples) {
+        int32_t old = mdata->window[mdata->pos];
+
+        for (i = 0; mdata->sorted[i] != old; i++)
+            ;
+        memmove(mdata->sorted + i, mdata->sorted + i + 1,
+            (n - i - 1) * sizeof(int32_t));
+        n--;
+    } else {
+        mdata->count++;
+    }
+
+    for (i = n; i > 0 && mdata->sorted[i - 1] > in.val; i--)
+        mdata->sorted[i] = mdata->sorted[i - 1];
+    mdata->sorted[i] = in.val;
+
+    mdata->window[mdata->pos] = in.val;
+    mdata->pos = (mdata->pos + 1) % mdata->samples;
+
+    return send_value(node, SOL_FLOW_NODE_TYPE_FILTER_MEDIAN__OUT__OUT, &in,
+        mdata->sorted[mdata->count / 2]);
+}
+
+struct decimate_data {
+    int64_t sum;
+    int32_t factor;
+    int32_t count;
+    bool average;
+};
+
+static int
+decimate_open(struct sol_flow_node *node, void *data,
+    const struct sol_flow_node_options *options)
+{
+    struct decimate_data *mdata = data;
+    const struct sol_flow_node_type_filter_decimate_options *opts;
+
+    SOL_FLOW_NODE_OPTIONS_SUB_API_CHECK(options,
+        SOL_FLOW_NODE_TYPE_FILTER_DECIMATE_OPTIONS_API_VERSION, -EINVAL);
+    opts = (const struct sol_flow_node_type_filter_decimate_options *)options;
+
+    if (opts->factor < 1) {
+        SOL_WRN("Invalid factor %" PRId32, opts->factor);
+        return -EINVAL;
+    }
+
+    memset(mdata, 0, sizeof(*mdata));
+    mdata->factor = opts->factor;
+    mdata->average = opts->average;
+    return 0;
+}
+
+static int
+decimate_process(struct sol_flow_node *node, void *data, uint16_t port,
+    uint16_t conn_id, const struct sol_flow_packet *packet)
+{
+    struct decimate_data *mdata = data;
+    struct sol_irange in;
+    int32_t value;
+    int r;
+
+    r = sol_flow_packet_get_irange(packet, &in);
+    SOL_INT_CHECK(r, < 0, r);
+
+    mdata->sum += in.val;
+    if (++mdata->count < mdata->factor)
+        return 0;
+
+    value = mdata->average ? div_round(mdata->sum, mdata->factor) : in.val;
+    mdata->sum = 0;
+    mdata->count = 0;
+
+    return send_value(node, SOL_FLOW_NODE_TYPE_FILTER_DECIMATE__OUT__OUT, &in,
+        value);
+}
+
+struct envelope_data {
+    int32_t samples;
+    int32_t count;
+    int32_t min;
+    int32_t max;
+};
+
+static int
+envelope_open(struct sol_flow_node *node, void *data,
+    const struct sol_flow_node_options *options)
+{
+    struct envelope_data *mdata = data;
+    const struct sol_flow_node_type_filter_envelope_options *opts;
+
+    SOL_FLOW_NODE_OPTIONS_SUB_API_CHECK(options,
+        SOL_FLOW_NODE_TYPE_FILTER_ENVELOPE_OPTIONS_API_VERSION, -EINVAL);
+    opts = (const struct sol_flow_node_type_filter_envelope_options *)options;
+
+    if (opts->samples < 1) {
+        SOL_WRN("Invalid samples %" PRId32, opts->samples);
+        return -EINVAL;
+    }
+
+    memset(mdata, 0, sizeof(*mdata));
+    mdata->samples = opts->samples;
+    return 0;
+}
+
+static int
+envelope_process(struct sol_flow_node *node, void *data, uint16_t port,
+    uint16_t conn_id, const struct sol_flow_packet *packet)
+{
+    struct envelope_data *mdata = data;
+    struct sol_irange in;
+    int r;
+
+    r = sol_flow_packet_get_irange(packet, &in);
+    SOL_INT_CHECK(r, < 0, r);
+
+    if (!mdata->count || in.val < mdata->min)
+        mdata->min = in.val;
+    if (!mdata->count || in.val > mdata->max)
+        mdata->max = in.val;
+    if (++mdata->count < mdata->samples)
+        return 0;
+
+    mdata->count = 0;
+    r = send_value(node, SOL_FLOW_NODE_TYPE_FILTER_ENVELOPE__OUT__MIN, &in,
+        mdata->min);
+    SOL_INT_CHECK(r, < 0, r);
+    return send_value(node, SOL_FLOW_NODE_TYPE_FILTER_ENVELOPE__OUT__MAX, &in,
+        mdata->max);
+}
+
+#include "filters-gen.c"
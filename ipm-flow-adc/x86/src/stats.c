@@ -0,0 +1,280 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2016 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Summaries of a stream of readings without keeping them: a fixed amount
+ * of state and of work per sample, however many samples an interval has.
+ *
+ * Mean and variance are updated with Welford's method, which does not
+ * lose precision as the sums grow. Each percentile is estimated with the
+ * P-square algorithm (Jain and Chlamtac, 1985): five markers, the
+ * minimum, the maximum, the percentile and two midway, whose heights are
+ * moved along a parabola fitted to their neighbours as samples come.
+ */
+
+#include <sol-flow.h>
+#include <sol-flow-packet.h>
+#include <sol-log.h>
+#include <sol-mainloop.h>
+#include <sol-types.h>
+#include <sol-util.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "stats-gen.h"
+
+#define MARKERS (5)
+
+struct p2 {
+    double heights[MARKERS];
+    double desired[MARKERS]; //positions
+    double increments[MARKERS];
+    int32_t positions[MARKERS];
+    uint32_t count;
+    double p;
+};
+
+static void
+p2_init(struct p2 *est, double p)
+{
+    memset(est, 0, sizeof(*est));
+    est->p = p;
+}
+
+static double
+p2_parabolic(const struct p2 *est, int i, int d)
+{
+    const double *q = est->heights;
+    const int32_t *n = est->positions;
+
+    return q[i] + (double)d / (n[i + 1] - n[i - 1]) *
+           ((n[i] - n[i - 1] + d) * (q[i + 1] - q[i]) / (n[i + 1] - n[i]) +
+           (n[i + 1] - n[i] - d) * (q[i] - q[i - 1]) / (n[i] - n[i - 1]));
+}
+
+static void
+p2_add(struct p2 *est, double x)
+{
+    double *q = est->heights;
+    int32_t *n = est->positions;
+    double qp, diff;
+    int i, k, d;
+
+    //The first samples are the markers, kept sorted
+    if (est->count < MARKERS) {
+        for (i = est->count; i > 0 && q[i - 1] > x; i--)
+            q[i] = q[i - 1];
+        q[i] = x;
+
+        if (++est->count == MARKERS) {
+            for (i = 0; i < MARKERS; i++)
+                n[i] = i + 1;
+            est->desired[0] = 1;
+            est->desired[1] = 1 + 2 * est->p;
+            est->desired[2] = 1 + 4 * est->p;
+            est->desired[3] = 3 + 2 * est->p;
+            est->desired[4] = 5;
+            est->increments[0] = 0;
+            est->increments[1] = est->p / 2;
+            est->increments[2] = est->p;
+            est->increments[3] = (1 + est->p) / 2;
+            est->increments[4] = 1;
+        }
+        return;
+    }
+    est->count++;
+
+    if (x < q[0]) {
+        q[0] = x;
+        k = 0;
+    } else if (x >= q[MARKERS - 1]) {
+        q[MARKERS - 1] = x;
+        k = MARKERS - 2;
+    } else {
+        for (k = 0; x >= q[k + 1]; k++)
+            ;
+    }
+
+    for (i = k + 1; i < MARKERS; i++)
+        n[i]++;
+    for (i = 0; i < MARKERS; i++)
+        est->desired[i] += est->increments[i];
+
+    //Markers off their desired position by one or more move by one
+    for (i = 1; i < MARKERS - 1; i++) {
+        diff = est->desired[i] - n[i];
+        if (!((diff >= 1 && n[i + 1] - n[i] > 1) ||
+            (diff <= -1 && n[i - 1] - n[i] < -1)))
+            continue;
+
+        d = diff > 0 ? 1 : -1;
+        qp = p2_parabolic(est, i, d);
+        if (q[i - 1] < qp && qp < q[i + 1])
+            q[i] = qp;
+        else
+            q[i] += d * (q[i + d] - q[i]) / (n[i + d] - n[i]);
+        n[i] += d;
+    }
+}
+
+static double
+p2_get(const struct p2 *est)
+{
+    double rank;
+    int i;
+
+    if (est->count >= MARKERS)
+        return est->heights[2];
+
+    //Nearest rank among the few samples so far
+    rank = est->p * est->count;
+    i = rank;
+    if (i < rank)
+        i++;
+    return est->heights[i > 0 ? i - 1 : 0];
+}
+
+struct summary_data {
+    struct sol_flow_node *node;
+    struct sol_timeout *timeout;
+    struct p2 percentiles[3];
+    double mean;
+    double m2; //sum of squared differences to the mean
+    uint32_t count;
+    int32_t min;
+    int32_t max;
+    bool reset;
+};
+
+static const double summary_percentiles[] = { 0.5, 0.95, 0.99 };
+
+static void
+summary_reset(struct summary_data *mdata)
+{
+    unsigned int i;
+
+    for (i = 0; i < sol_util_array_size(summary_percentiles); i++)
+        p2_init(&mdata->percentiles[i], summary_percentiles[i]);
+    mdata->mean = 0;
+    mdata->m2 = 0;
+    mdata->count = 0;
+}
+
+static bool
+summary_cb(void *data)
+{
+    struct summary_data *mdata = data;
+    struct sol_flow_node *node = mdata->node;
+
+    if (!mdata->count)
+        return true;
+
+    sol_flow_send_irange_value_packet(node,
+        SOL_FLOW_NODE_TYPE_STATS_SUMMARY__OUT__COUNT, mdata->count);
+    sol_flow_send_irange_value_packet(node,
+        SOL_FLOW_NODE_TYPE_STATS_SUMMARY__OUT__MIN, mdata->min);
+    sol_flow_send_irange_value_packet(node,
+        SOL_FLOW_NODE_TYPE_STATS_SUMMARY__OUT__MAX, mdata->max);
+    sol_flow_send_drange_value_packet(node,
+        SOL_FLOW_NODE_TYPE_STATS_SUMMARY__OUT__MEAN, mdata->mean);
+    sol_flow_send_drange_value_packet(node,
+        SOL_FLOW_NODE_TYPE_STATS_SUMMARY__OUT__VARIANCE,
+        mdata->count > 1 ? mdata->m2 / (mdata->count - 1) : 0);
+    sol_flow_send_drange_value_packet(node,
+        SOL_FLOW_NODE_TYPE_STATS_SUMMARY__OUT__P50,
+        p2_get(&mdata->percentiles[0]));
+    sol_flow_send_drange_value_packet(node,
+        SOL_FLOW_NODE_TYPE_STATS_SUMMARY__OUT__P95,
+        p2_get(&mdata->percentiles[1]));
+    sol_flow_send_drange_value_packet(node,
+        SOL_FLOW_NODE_TYPE_STATS_SUMMARY__OUT__P99,
+        p2_get(&mdata->percentiles[2]));
+
+    if (mdata->reset)
+        summary_reset(mdata);
+    return true;
+}
+
+static int
+summary_open(struct sol_flow_node *node, void *data,
+    const struct sol_flow_node_options *options)
+{
+    struct summary_data *mdata = data;
+    const struct sol_flow_node_type_stats_summary_options *opts;
+
+    SOL_FLOW_NODE_OPTIONS_SUB_API_CHECK(options,
+        SOL_FLOW_NODE_TYPE_STATS_SUMMARY_OPTIONS_API_VERSION, -EINVAL);
+    opts = (const struct sol_flow_node_type_stats_summary_options *)options;
+
+    if (opts->interval < 1) {
+        SOL_WRN("Invalid interval %" PRId32, opts->interval);
+        return -EINVAL;
+    }
+
+    memset(mdata, 0, sizeof(*mdata));
+    summary_reset(mdata);
+    mdata->node = node;
+    mdata->reset = opts->reset;
+
+    mdata->timeout = sol_timeout_add(opts->interval, summary_cb, mdata);
+    SOL_NULL_CHECK(mdata->timeout, -ENOMEM);
+    return 0;
+}
+
+static void
+summary_close(struct sol_flow_node *node, void *data)
+{
+    struct summary_data *mdata = data;
+
+    sol_timeout_del(mdata->timeout);
+}
+
+static int
+summary_process(struct sol_flow_node *node, void *data, uint16_t port,
+    uint16_t conn_id, const struct sol_flow_packet *packet)
+{
+    struct summary_data *mdata = data;
+    struct sol_irange in;
+    unsigned int i;
+    double delta;
+    int r;
+
+    r = sol_flow_packet_get_irange(packet, &in);
+    SOL_INT_CHECK(r, < 0, r);
+
+    if (!mdata->count || in.val < mdata->min)
+        mdata->min = in.val;
+    if (!mdata->count || in.val > mdata->max)
+        mdata->max = in.val;
+
+    mdata->count++;
+    delta = in.val - mdata->mean;
+    mdata->mean += delta / mdata->count;
+    mdata->m2 += delta * (in.val - mdata->mean);
+
+    for (i = 0; i < sol_util_array_size(mdata->percentiles); i++)
+        p2_add(&mdata->percentiles[i], in.val);
+
+    return 0;
+}
+
+#include "stats-gen.c"
@@ -0,0 +1,145 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2015 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <soletta.h>
+#include <sol-ipm.h>
+#include <sol-mainloop.h>
+#include <sol-util.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ipm-rpc.h"
+
+/* Shared with the x86 */
+#define RPC_ID 1
+#define METHOD_ADD 1
+#define METHOD_STATS 2
+#define METHOD_DELAY 3
+
+struct delayed {
+    uint16_t call;
+    int32_t tag;
+};
+
+static int
+add_cb(void *data, uint16_t call, struct ipm_rpc_args *args,
+    struct ipm_rpc_args *results)
+{
+    int32_t a, b;
+
+    if (ipm_rpc_get_i32(args, &a) < 0 || ipm_rpc_get_i32(args, &b) < 0)
+        return -EINVAL;
+
+    return ipm_rpc_put_i32(results, a + b);
+}
+
+static int
+stats_cb(void *data, uint16_t call, struct ipm_rpc_args *args,
+    struct ipm_rpc_args *results)
+{
+    const void *mem;
+    int16_t sample, min = INT16_MAX, max = INT16_MIN;
+    int32_t sum = 0;
+    uint16_t len, i, n;
+
+    if (ipm_rpc_get_bytes(args, &mem, &len) < 0)
+        return -EINVAL;
+    n = len / sizeof(sample);
+    if (!n)
+        return -EINVAL;
+
+    for (i = 0; i < n; i++) {
+        memcpy(&sample, (const int16_t *)mem + i, sizeof(sample));
+        sum += sample;
+        if (sample < min)
+            min = sample;
+        if (sample > max)
+            max = sample;
+    }
+
+    ipm_rpc_put_float(results, (float)sum / n);
+    ipm_rpc_put_i32(results, min);
+    return ipm_rpc_put_i32(results, max);
+}
+
+static bool
+delay_reply_cb(void *data)
+{
+    struct delayed *d = data;
+    uint8_t buf[8];
+    struct ipm_rpc_args results = IPM_RPC_ARGS_INIT(buf);
+
+    ipm_rpc_put_i32(&results, d->tag);
+    if (ipm_rpc_reply(d->call, 0, &results) < 0)
+        printf("ARC could not reply to call %u\n", d->call);
+    free(d);
+
+    return false;
+}
+
+static int
+delay_cb(void *data, uint16_t call, struct ipm_rpc_args *args,
+    struct ipm_rpc_args *results)
+{
+    struct delayed *d;
+    uint32_t ms;
+    int32_t tag;
+
+    if (ipm_rpc_get_u32(args, &ms) < 0 || ipm_rpc_get_i32(args, &tag) < 0)
+        return -EINVAL;
+
+    d = malloc(sizeof(*d));
+    if (!d)
+        return -ENOMEM;
+    d->call = call;
+    d->tag = tag;
+
+    //Replied later, calls made after this one may complete first
+    if (!sol_timeout_add(ms, delay_reply_cb, d)) {
+        free(d);
+        return -ENOMEM;
+    }
+
+    return IPM_RPC_DEFERRED;
+}
+
+static const struct ipm_rpc_method methods[] = {
+    { METHOD_ADD, add_cb },
+    { METHOD_STATS, stats_cb },
+    { METHOD_DELAY, delay_cb },
+};
+
+static void
+startup(void)
+{
+    printf("ARC started\n");
+    if (ipm_rpc_init(RPC_ID, methods, sol_util_array_size(methods), NULL) < 0)
+        printf("ARC could not serve the calls\n");
+}
+
+static void
+shutdown(void)
+{
+    ipm_rpc_shutdown();
+}
+
+SOL_MAIN_DEFAULT(startup, shutdown);
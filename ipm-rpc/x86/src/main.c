@@ -0,0 +1,171 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2015 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <soletta.h>
+#include <sol-ipm.h>
+#include <sol-mainloop.h>
+#include <sol-util.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "ipm-rpc.h"
+
+/* Shared with the ARC */
+#define RPC_ID 1
+#define METHOD_ADD 1
+#define METHOD_STATS 2
+#define METHOD_DELAY 3
+/* Not served by the ARC */
+#define METHOD_UNKNOWN 9
+
+#define TIMEOUT 1000
+
+static int32_t iteration;
+
+static void
+print_failure(uint16_t call, const char *method, int status)
+{
+    printf("x86 call %u (%s) failed: %s\n", call, method, strerror(-status));
+}
+
+static void
+add_reply_cb(void *data, uint16_t call, int status,
+    struct ipm_rpc_args *results)
+{
+    int32_t sum;
+
+    if (status < 0 || ipm_rpc_get_i32(results, &sum) < 0) {
+        print_failure(call, "add", status);
+        return;
+    }
+
+    printf("x86 call %u (add) returned %" PRId32 "\n", call, sum);
+}
+
+static void
+stats_reply_cb(void *data, uint16_t call, int status,
+    struct ipm_rpc_args *results)
+{
+    int32_t min, max;
+    float mean;
+
+    if (status < 0 || ipm_rpc_get_float(results, &mean) < 0 ||
+        ipm_rpc_get_i32(results, &min) < 0 ||
+        ipm_rpc_get_i32(results, &max) < 0) {
+        print_failure(call, "stats", status);
+        return;
+    }
+
+    printf("x86 call %u (stats) returned mean %d.%02d min %" PRId32
+        " max %" PRId32 "\n", call, (int)mean,
+        (int)((mean < 0 ? -mean : mean) * 100) % 100, min, max);
+}
+
+static void
+delay_reply_cb(void *data, uint16_t call, int status,
+    struct ipm_rpc_args *results)
+{
+    int32_t tag;
+
+    if (status < 0 || ipm_rpc_get_i32(results, &tag) < 0) {
+        print_failure(call, "delay", status);
+        return;
+    }
+
+    printf("x86 call %u (delay) returned %" PRId32 "\n", call, tag);
+}
+
+static void
+unknown_reply_cb(void *data, uint16_t call, int status,
+    struct ipm_rpc_args *results)
+{
+    print_failure(call, "unknown", status);
+}
+
+static void
+call(uint16_t method, const struct ipm_rpc_args *args,
+    void (*reply_cb)(void *data, uint16_t call, int status,
+    struct ipm_rpc_args *results))
+{
+    int r;
+
+    r = ipm_rpc_call(method, args, TIMEOUT, reply_cb, NULL);
+    if (r < 0)
+        printf("x86 could not call method %u: %d\n", method, r);
+    else
+        printf("x86 call %d (method %u) sent\n", r, method);
+}
+
+static bool
+timeout_call_cb(void *data)
+{
+    int16_t samples[16];
+    uint8_t buf[sizeof(samples) + 8];
+    struct ipm_rpc_args args;
+    unsigned int i;
+
+    //All in flight at once, the ARC replies in its own order
+    args = (struct ipm_rpc_args)IPM_RPC_ARGS_INIT(buf);
+    ipm_rpc_put_u32(&args, 500);
+    ipm_rpc_put_i32(&args, iteration);
+    call(METHOD_DELAY, &args, delay_reply_cb);
+
+    args = (struct ipm_rpc_args)IPM_RPC_ARGS_INIT(buf);
+    ipm_rpc_put_i32(&args, iteration);
+    ipm_rpc_put_i32(&args, 100);
+    call(METHOD_ADD, &args, add_reply_cb);
+
+    for (i = 0; i < sol_util_array_size(samples); i++)
+        samples[i] = (int16_t)(iteration * 10 + i * i - 50);
+    args = (struct ipm_rpc_args)IPM_RPC_ARGS_INIT(buf);
+    ipm_rpc_put_bytes(&args, samples, sizeof(samples));
+    call(METHOD_STATS, &args, stats_reply_cb);
+
+    //Longer than TIMEOUT, its reply comes too late and is ignored
+    args = (struct ipm_rpc_args)IPM_RPC_ARGS_INIT(buf);
+    ipm_rpc_put_u32(&args, TIMEOUT * 2);
+    ipm_rpc_put_i32(&args, -iteration);
+    call(METHOD_DELAY, &args, delay_reply_cb);
+
+    call(METHOD_UNKNOWN, NULL, unknown_reply_cb);
+
+    iteration++;
+    return true;
+}
+
+static void
+startup(void)
+{
+    if (ipm_rpc_init(RPC_ID, NULL, 0, NULL) < 0) {
+        printf("x86 could not set up the calls\n");
+        return;
+    }
+
+    sol_timeout_add(5000, timeout_call_cb, NULL);
+}
+
+static void
+shutdown(void)
+{
+    ipm_rpc_shutdown();
+}
+
+SOL_MAIN_DEFAULT(startup, shutdown);
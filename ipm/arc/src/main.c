@@ -22,17 +22,67 @@
 
 #include <errno.h>
 #include <inttypes.h>
+#include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
 
+#ifdef IPM_RING
+#include "ipm-channel.h"
+#elif defined(IPM_PRIO)
+#include "ipm-prio.h"
+#else
+#include "ipm-credit.h"
+#endif
+
 #define MESSAGE_ID 1
 
+#ifdef IPM_RING
+#define SETUP_ID 2
+#define DOORBELL_ID 3
+#elif defined(IPM_PRIO)
+/* Stream of sensor readings, sent below MESSAGE_ID */
+#define BULK_ID 4
+#define BULK_INTERVAL 10
+#define BULK_SAMPLES 32
+/* Messages the other core may hold, of any id */
+#define WINDOW 4
+#define STATS_INTERVAL 10000
+#else
+/* Messages the other core may hold, and messages waiting for it */
+#define CREDITS 2
+#define QUEUE_LEN 2
+#endif
+
 static const char *samples[] = {"ABCDEFGHIJKLMNO",
                               "ABCDEFGHIJKLMNOPQRSTUVWYWZ",
                               "ABCDEFGHIJKLMNOPQRSTUVWYWZ0123456789",
                               "ABCDEFGHIJKLMNOPQRSTUVWYWZ0123456789abcdef"};
 static uint32_t count;
 
+#ifdef IPM_RING
+static bool
+timeout_send_cb(void *data)
+{
+    const char *str = samples[count % 4];
+    int r;
+
+    //Written straight to the ring, no copy nor blob to allocate
+    printf("ARC sending %s\n", str);
+    r = ipm_channel_send(MESSAGE_ID, str, strlen(str) + 1);
+    if (r < 0) {
+        printf("ARC could not send message: %d\n", r);
+    }
+
+    count++;
+    return true;
+}
+
+static void
+ring_receive_cb(void *data, uint16_t tag, const void *msg, uint16_t len)
+{
+    printf("ARC received %u bytes: %.*s\n", len, (int)len, (const char *)msg);
+}
+#else
 static bool
 timeout_send_cb(void *data)
 {
@@ -42,8 +92,21 @@ timeout_send_cb(void *data)
         str, strlen(str) + 1);
 
     printf("ARC sending %s - %p\n", (char *)message->mem, message->mem);
-    r = sol_ipm_send(MESSAGE_ID, message);
-    if (r < 0) {
+#ifdef IPM_PRIO
+    r = ipm_prio_send(MESSAGE_ID, message);
+    if (r == -ENOBUFS) {
+        printf("ARC dropping message, x86 is behind\n");
+    } else if (r < 0) {
+#else
+    r = ipm_credit_send(MESSAGE_ID, message);
+    if (r == -ENOBUFS) {
+        struct ipm_credit_stats stats;
+
+        ipm_credit_get_stats(MESSAGE_ID, &stats);
+        printf("ARC dropping message, x86 is behind (%" PRIu32 " stalls)\n",
+            stats.stalls);
+    } else if (r < 0) {
+#endif
         printf("ARC could not send message: %d\n", r);
     }
 
@@ -54,6 +117,64 @@ timeout_send_cb(void *data)
     return true;
 }
 
+#ifdef IPM_PRIO
+static bool
+bulk_send_cb(void *data)
+{
+    static uint16_t reading;
+    struct sol_blob *message;
+    uint16_t *block;
+    int i;
+
+    block = malloc(BULK_SAMPLES * sizeof(*block));
+    if (!block)
+        return true;
+    for (i = 0; i < BULK_SAMPLES; i++)
+        block[i] = reading++;
+
+    message = sol_blob_new(&SOL_BLOB_TYPE_DEFAULT, NULL, block,
+        BULK_SAMPLES * sizeof(*block));
+    if (!message) {
+        free(block);
+        return true;
+    }
+
+    //Readings that find no room are lost, the stats tell how many
+    ipm_prio_send(BULK_ID, message);
+    sol_blob_unref(message);
+
+    return true;
+}
+
+static void
+print_stats(const char *name, enum ipm_prio_class class)
+{
+    struct ipm_prio_stats stats;
+
+    if (ipm_prio_get_stats(class, &stats) < 0)
+        return;
+
+    printf("ARC %s: %" PRIu32 " sent, %" PRIu32 " queued, %" PRIu32
+        " dropped, wait avg %" PRIu32 "us max %" PRIu32 "us,"
+        " consumed avg %" PRIu32 "us max %" PRIu32 "us\n", name,
+        stats.sent, stats.queued, stats.rejected,
+        stats.queued ? (uint32_t)(stats.wait_total_us / stats.queued) : 0,
+        stats.wait_max_us,
+        stats.consumed ?
+        (uint32_t)(stats.latency_total_us / stats.consumed) : 0,
+        stats.latency_max_us);
+}
+
+static bool
+stats_cb(void *data)
+{
+    print_stats("messages", IPM_PRIO_HIGH);
+    print_stats("readings", IPM_PRIO_BULK);
+
+    return true;
+}
+#endif
+
 static bool
 unref_cb(void *data)
 {
@@ -73,18 +194,47 @@ receiver_cb(void *data, uint32_t id, struct sol_blob *message)
 
     sol_timeout_add(3000, unref_cb, message);
 }
+#endif
 
 static void
 startup(void)
 {
     printf("ARC started\n");
+#ifdef IPM_RING
+    if (ipm_channel_init(SETUP_ID, DOORBELL_ID, ring_receive_cb, NULL) < 0) {
+        printf("ARC could not set up the IPM ring\n");
+        return;
+    }
+#elif defined(IPM_PRIO)
     sol_ipm_set_receiver(MESSAGE_ID, receiver_cb, NULL);
+    if (ipm_prio_init(IPM_PRIO_STRICT, WINDOW) < 0 ||
+        ipm_prio_set_class(MESSAGE_ID, IPM_PRIO_HIGH, NULL, NULL) < 0 ||
+        ipm_prio_set_class(BULK_ID, IPM_PRIO_BULK, NULL, NULL) < 0) {
+        printf("ARC could not set up the priorities\n");
+        return;
+    }
+    sol_timeout_add(BULK_INTERVAL, bulk_send_cb, NULL);
+    sol_timeout_add(STATS_INTERVAL, stats_cb, NULL);
+#else
+    sol_ipm_set_receiver(MESSAGE_ID, receiver_cb, NULL);
+    if (ipm_credit_init(MESSAGE_ID, CREDITS, QUEUE_LEN, NULL, NULL) < 0) {
+        printf("ARC could not set up the flow control\n");
+        return;
+    }
+#endif
     sol_timeout_add(3000, timeout_send_cb, NULL);
 }
 
 static void
 shutdown(void)
 {
+#ifdef IPM_RING
+    ipm_channel_shutdown();
+#elif defined(IPM_PRIO)
+    ipm_prio_shutdown();
+#else
+    ipm_credit_shutdown(MESSAGE_ID);
+#endif
 }
 
 SOL_MAIN_DEFAULT(startup, shutdown);
@@ -0,0 +1,243 @@
+/*
+   Measures IPM over the Linux backend (ipm-shm): a child process stands
+   for the other core and consumes, or echoes back, what it receives.
+
+   For each payload size, from the 15 bytes of the samples up to 4KiB,
+   prints the messages per second when sending as fast as the slots
+   allow, the lifetime of a blob (sent to consumed) during that run and
+   the round trip latency of a message echoed back by the other side.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "ipm-shm.h"
+
+#define ID_DATA (1)
+#define ID_PING (2)
+#define ID_PONG (3)
+#define ID_STOP (4)
+
+#define MESSAGES (200000)
+#define ROUND_TRIPS (20000)
+
+static const size_t sizes[] = { 15, 42, 256, 1024, 4096 };
+
+struct echo {
+    struct ipm_shm *shm;
+    bool stop;
+};
+
+struct run {
+    struct ipm_shm *shm;
+    uint64_t *sent_at;
+    uint64_t *lifetimes;
+    unsigned int consumed;
+    bool ponged;
+};
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void
+wait_dispatch(struct ipm_shm *shm, const struct ipm_shm_handlers *handlers,
+    void *data)
+{
+    struct pollfd pfd = { .fd = ipm_shm_get_fd(shm), .events = POLLIN };
+
+    if (poll(&pfd, 1, 1000) > 0)
+        ipm_shm_dispatch(shm, handlers, data);
+}
+
+static void
+echo_message(void *data, uint32_t id, uint16_t slot, const void *mem,
+    size_t len)
+{
+    struct echo *echo = data;
+
+    //A single ping is in flight, there is always a slot for the pong
+    if (id == ID_PING)
+        ipm_shm_send(echo->shm, ID_PONG, mem, len, NULL);
+    else if (id == ID_STOP)
+        echo->stop = true;
+
+    ipm_shm_consume(echo->shm, slot);
+}
+
+static const struct ipm_shm_handlers echo_handlers = {
+    .message = echo_message
+};
+
+static int
+echo_main(const int fds[])
+{
+    struct echo echo = { .shm = ipm_shm_attach(fds, 1) };
+
+    if (!echo.shm)
+        return EXIT_FAILURE;
+
+    while (!echo.stop)
+        wait_dispatch(echo.shm, &echo_handlers, &echo);
+
+    ipm_shm_del(echo.shm);
+    return EXIT_SUCCESS;
+}
+
+static void
+run_message(void *data, uint32_t id, uint16_t slot, const void *mem,
+    size_t len)
+{
+    struct run *run = data;
+
+    if (id == ID_PONG)
+        run->ponged = true;
+    ipm_shm_consume(run->shm, slot);
+}
+
+static void
+run_consumed(void *data, uint32_t id, void *cookie)
+{
+    struct run *run = data;
+    uintptr_t i = (uintptr_t)cookie;
+
+    if (id != ID_DATA || !run->lifetimes)
+        return;
+    run->lifetimes[run->consumed++] = now_ns() - run->sent_at[i];
+}
+
+static const struct ipm_shm_handlers run_handlers = {
+    .message = run_message,
+    .consumed = run_consumed
+};
+
+static int
+cmp_u64(const void *a, const void *b)
+{
+    uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static double
+percentile_us(uint64_t *values, size_t len, unsigned int pct)
+{
+    size_t i = (len * pct + 99) / 100;
+
+    return values[i ? i - 1 : 0] / 1e3;
+}
+
+static void
+bench_size(struct ipm_shm *shm, size_t size)
+{
+    struct run ctx = { .shm = shm }, *run = &ctx;
+    uint64_t *rtts, started_at, elapsed;
+    uint8_t payload[IPM_SHM_SLOT_SIZE];
+    unsigned int i;
+
+    memset(payload, 'x', size);
+    run->sent_at = calloc(MESSAGES, sizeof(uint64_t));
+    run->lifetimes = calloc(MESSAGES, sizeof(uint64_t));
+    rtts = calloc(ROUND_TRIPS, sizeof(uint64_t));
+    if (!run->sent_at || !run->lifetimes || !rtts) {
+        fprintf(stderr, "Out of memory\n");
+        exit(EXIT_FAILURE);
+    }
+
+    started_at = now_ns();
+    for (i = 0; i < MESSAGES; i++) {
+        run->sent_at[i] = now_ns();
+        while (ipm_shm_send(shm, ID_DATA, payload, size,
+            (void *)(uintptr_t)i) == -EAGAIN)
+            wait_dispatch(shm, &run_handlers, &ctx);
+    }
+    while (run->consumed < MESSAGES)
+        wait_dispatch(shm, &run_handlers, &ctx);
+    elapsed = now_ns() - started_at;
+
+    for (i = 0; i < ROUND_TRIPS; i++) {
+        uint64_t sent_at = now_ns();
+
+        run->ponged = false;
+        ipm_shm_send(shm, ID_PING, payload, size, NULL);
+        while (!run->ponged)
+            wait_dispatch(shm, &run_handlers, &ctx);
+        rtts[i] = now_ns() - sent_at;
+    }
+
+    qsort(run->lifetimes, MESSAGES, sizeof(uint64_t), cmp_u64);
+    qsort(rtts, ROUND_TRIPS, sizeof(uint64_t), cmp_u64);
+
+    printf("%5zu bytes: %9.0f msg/s %8.1f MB/s | lifetime p50 %7.1fus"
+        " p99 %7.1fus | rtt p50 %6.1fus p90 %6.1fus p99 %6.1fus"
+        " max %7.1fus\n", size, MESSAGES * 1e9 / elapsed,
+        (double)MESSAGES * size * 1e3 / elapsed,
+        percentile_us(run->lifetimes, MESSAGES, 50),
+        percentile_us(run->lifetimes, MESSAGES, 99),
+        percentile_us(rtts, ROUND_TRIPS, 50),
+        percentile_us(rtts, ROUND_TRIPS, 90),
+        percentile_us(rtts, ROUND_TRIPS, 99),
+        rtts[ROUND_TRIPS - 1] / 1e3);
+
+    free(run->sent_at);
+    free(run->lifetimes);
+    free(rtts);
+}
+
+int
+main(int argc, char *argv[])
+{
+    int fds[1 + IPM_SHM_SIDES];
+    struct run stop = { 0 };
+    struct ipm_shm *shm;
+    unsigned int i;
+    pid_t pid;
+    int status;
+
+    if (ipm_shm_create(fds) < 0) {
+        perror("Could not create the shared memory");
+        return EXIT_FAILURE;
+    }
+
+    pid = fork();
+    if (pid < 0) {
+        perror("Could not fork");
+        return EXIT_FAILURE;
+    }
+    if (!pid)
+        return echo_main(fds);
+
+    shm = ipm_shm_attach(fds, 0);
+    stop.shm = shm;
+    if (!shm) {
+        fprintf(stderr, "Could not attach to the shared memory\n");
+        kill(pid, SIGTERM);
+        return EXIT_FAILURE;
+    }
+
+    printf("%u slots of %u bytes, %u messages and %u round trips per size\n",
+        IPM_SHM_SLOTS, IPM_SHM_SLOT_SIZE, MESSAGES, ROUND_TRIPS);
+    for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        bench_size(shm, sizes[i]);
+
+    while (ipm_shm_send(shm, ID_STOP, NULL, 0, NULL) == -EAGAIN)
+        wait_dispatch(shm, &run_handlers, &stop);
+    waitpid(pid, &status, 0);
+    ipm_shm_del(shm);
+
+    return WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+}
@@ -0,0 +1,437 @@
+/*
+   Checks the IPM helpers of common/ on the host, against a fake sol_ipm
+   that keeps what is sent until the test consumes it and can be told to
+   fail the next sends. Soletta is not needed, stub/ has the few headers
+   the helpers include.
+
+   Prints each case as it passes and exits with failure on the first one
+   that does not.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <sol-ipm.h>
+#include <sol-mainloop.h>
+#include <sol-types.h>
+#include <sol-util.h>
+
+#include "ipm-batch.h"
+#include "ipm-credit.h"
+#include "ipm-prio.h"
+
+#define MAX_ID (63)
+#define MAX_SENT (64)
+#define MAX_TIMEOUTS (8)
+
+#define CHECK(_cond) \
+    do { \
+        if (!(_cond)) { \
+            fprintf(stderr, "%s:%d: %s: failed: %s\n", __FILE__, __LINE__, \
+                __func__, #_cond); \
+            exit(EXIT_FAILURE); \
+        } \
+    } while (0)
+
+typedef void (*message_cb)(void *data, uint32_t id, struct sol_blob *message);
+
+struct sent {
+    uint32_t id;
+    struct sol_blob *message;
+};
+
+struct sol_timeout {
+    bool (*cb)(void *data);
+    const void *data;
+    bool active;
+};
+
+static struct {
+    message_cb consumed_cb[MAX_ID + 1];
+    const void *consumed_data[MAX_ID + 1];
+    //Sent and not consumed yet, in order
+    struct sent sent[MAX_SENT];
+    unsigned int sent_len;
+    //The next sends fail with error
+    unsigned int failing;
+    int error;
+} ipm;
+
+static struct sol_timeout timeouts[MAX_TIMEOUTS];
+
+/* Blobs */
+
+static void
+blob_free_mem(struct sol_blob *blob)
+{
+    free(blob->mem);
+}
+
+const struct sol_blob_type SOL_BLOB_TYPE_DEFAULT = { .free = blob_free_mem };
+const struct sol_blob_type SOL_BLOB_TYPE_NO_FREE = { .free = NULL };
+
+struct sol_blob *
+sol_blob_new(const struct sol_blob_type *type, struct sol_blob *parent,
+    const void *mem, size_t size)
+{
+    struct sol_blob *blob = calloc(1, sizeof(*blob));
+
+    if (!blob)
+        return NULL;
+
+    blob->type = type;
+    blob->parent = parent ? sol_blob_ref(parent) : NULL;
+    blob->mem = (void *)mem;
+    blob->size = size;
+    blob->refcnt = 1;
+    return blob;
+}
+
+struct sol_blob *
+sol_blob_ref(struct sol_blob *blob)
+{
+    blob->refcnt++;
+    return blob;
+}
+
+void
+sol_blob_unref(struct sol_blob *blob)
+{
+    if (--blob->refcnt)
+        return;
+
+    if (blob->type->free)
+        blob->type->free(blob);
+    if (blob->parent)
+        sol_blob_unref(blob->parent);
+    free(blob);
+}
+
+/* Main loop, timeouts only run when the test says so */
+
+struct sol_timeout *
+sol_timeout_add(uint32_t timeout_ms, bool (*cb)(void *data), const void *data)
+{
+    unsigned int i;
+
+    for (i = 0; i < MAX_TIMEOUTS; i++) {
+        if (!timeouts[i].active) {
+            timeouts[i].cb = cb;
+            timeouts[i].data = data;
+            timeouts[i].active = true;
+            return &timeouts[i];
+        }
+    }
+
+    return NULL;
+}
+
+bool
+sol_timeout_del(struct sol_timeout *handle)
+{
+    handle->active = false;
+    return true;
+}
+
+static unsigned int
+timeouts_pending(void)
+{
+    unsigned int i, n = 0;
+
+    for (i = 0; i < MAX_TIMEOUTS; i++)
+        n += timeouts[i].active;
+    return n;
+}
+
+static void
+timeouts_run(void)
+{
+    unsigned int i;
+
+    for (i = 0; i < MAX_TIMEOUTS; i++) {
+        if (timeouts[i].active && !timeouts[i].cb((void *)timeouts[i].data))
+            timeouts[i].active = false;
+    }
+}
+
+struct timespec
+sol_util_timespec_get_current(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts;
+}
+
+/* IPM */
+
+static void
+fail_sends(unsigned int n, int error)
+{
+    ipm.failing = n;
+    ipm.error = error;
+}
+
+int
+sol_ipm_send(uint32_t id, struct sol_blob *message)
+{
+    if (ipm.failing) {
+        ipm.failing--;
+        return ipm.error;
+    }
+    if (id > MAX_ID || ipm.sent_len == MAX_SENT)
+        return -EINVAL;
+
+    ipm.sent[ipm.sent_len].id = id;
+    ipm.sent[ipm.sent_len].message = sol_blob_ref(message);
+    ipm.sent_len++;
+    return 0;
+}
+
+int
+sol_ipm_set_receiver(uint32_t id, message_cb receive_cb, const void *data)
+{
+    return id > MAX_ID ? -EINVAL : 0;
+}
+
+int
+sol_ipm_set_consumed_callback(uint32_t id, message_cb consumed_cb,
+    const void *data)
+{
+    if (id > MAX_ID)
+        return -EINVAL;
+
+    ipm.consumed_cb[id] = consumed_cb;
+    ipm.consumed_data[id] = data;
+    return 0;
+}
+
+uint32_t
+sol_ipm_get_max_id(void)
+{
+    return MAX_ID;
+}
+
+//What ipm-batch.c calls under the wrapped ones
+int
+__real_sol_ipm_send(uint32_t id, struct sol_blob *message)
+{
+    return sol_ipm_send(id, message);
+}
+
+int
+__real_sol_ipm_set_receiver(uint32_t id, message_cb receive_cb,
+    const void *data)
+{
+    return sol_ipm_set_receiver(id, receive_cb, data);
+}
+
+int
+__real_sol_ipm_set_consumed_callback(uint32_t id, message_cb consumed_cb,
+    const void *data)
+{
+    return sol_ipm_set_consumed_callback(id, consumed_cb, data);
+}
+
+/* Consumes the oldest message sent, as the other core would. */
+static void
+consume(void)
+{
+    struct sent s = ipm.sent[0];
+
+    CHECK(ipm.sent_len > 0);
+    ipm.sent_len--;
+    memmove(ipm.sent, ipm.sent + 1, ipm.sent_len * sizeof(ipm.sent[0]));
+
+    if (ipm.consumed_cb[s.id])
+        ipm.consumed_cb[s.id]((void *)ipm.consumed_data[s.id], s.id,
+            s.message);
+    sol_blob_unref(s.message);
+}
+
+static void
+consume_all(void)
+{
+    while (ipm.sent_len)
+        consume();
+}
+
+static struct sol_blob *
+message_new(size_t size, uint8_t tag)
+{
+    uint8_t *mem = malloc(size);
+
+    CHECK(mem);
+    memset(mem, tag, size);
+    return sol_blob_new(&SOL_BLOB_TYPE_DEFAULT, NULL, mem, size);
+}
+
+static void
+send_one(int (*send)(uint32_t id, struct sol_blob *message), uint32_t id,
+    size_t size, uint8_t tag, int expected)
+{
+    struct sol_blob *message = message_new(size, tag);
+
+    CHECK(send(id, message) == expected);
+    sol_blob_unref(message);
+}
+
+/* ipm-batch */
+
+int __wrap_sol_ipm_send(uint32_t id, struct sol_blob *message);
+
+static void
+check_batch_order_on_failed_flush(void)
+{
+    const uint8_t *frame;
+    unsigned int i;
+
+    //Waits in the frame for its deadline
+    send_one(__wrap_sol_ipm_send, 1, 8, 'a', 0);
+    CHECK(ipm.sent_len == 0);
+    CHECK(timeouts_pending() == 1);
+
+    //The frame has to go before them and cannot, so neither can they
+    fail_sends(1, -EBUSY);
+    send_one(__wrap_sol_ipm_send, 2, IPM_BATCH_FRAME_SIZE, 'b', -EBUSY);
+    CHECK(ipm.sent_len == 0);
+    for (i = 0; i < 3; i++)
+        send_one(__wrap_sol_ipm_send, 3, 60, 'c', 0);
+    fail_sends(1, -EBUSY);
+    send_one(__wrap_sol_ipm_send, 3, 60, 'd', -EBUSY);
+    CHECK(ipm.sent_len == 0);
+
+    //The deadline keeps trying until the frame goes
+    fail_sends(1, -EBUSY);
+    timeouts_run();
+    CHECK(ipm.sent_len == 0);
+    CHECK(timeouts_pending() == 1);
+    timeouts_run();
+    CHECK(ipm.sent_len == 1);
+    CHECK(ipm.sent[0].id == MAX_ID);
+    CHECK(timeouts_pending() == 0);
+
+    //Then the message too big for a frame follows it
+    send_one(__wrap_sol_ipm_send, 2, IPM_BATCH_FRAME_SIZE, 'b', 0);
+    CHECK(ipm.sent_len == 2);
+    CHECK(ipm.sent[1].id == 2);
+
+    //Holding what was batched before the failures, and nothing after
+    frame = ipm.sent[0].message->mem;
+    CHECK(ipm.sent[0].message->size == 16 + 3 * 64);
+    CHECK(frame[0] == 1 && frame[4] == 'a');
+    CHECK(frame[16] == 3 && frame[20] == 'c');
+
+    consume_all();
+    printf("batch: no message overtakes a frame that failed to go\n");
+}
+
+/* ipm-credit */
+
+static uint8_t
+sent_tag(unsigned int i)
+{
+    return ((const uint8_t *)ipm.sent[i].message->mem)[0];
+}
+
+static void
+check_credit_failure_with_empty_window(void)
+{
+    struct ipm_credit_stats stats;
+
+    CHECK(ipm_credit_init(5, 1, 4, NULL, NULL) == 0);
+
+    send_one(ipm_credit_send, 5, 8, 'a', 0);
+    send_one(ipm_credit_send, 5, 8, 'b', 0);
+    CHECK(ipm.sent_len == 1);
+
+    //b fails as a gives its credit back, then nothing is outstanding
+    fail_sends(1, -EBUSY);
+    consume();
+    CHECK(ipm.sent_len == 0);
+    CHECK(ipm_credit_get_stats(5, &stats) == 0);
+    CHECK(stats.outstanding == 0 && stats.waiting == 1);
+
+    //Not stuck: the retry sends it
+    CHECK(timeouts_pending() == 1);
+    timeouts_run();
+    CHECK(ipm.sent_len == 1 && sent_tag(0) == 'b');
+    CHECK(timeouts_pending() == 0);
+
+    //Again, but a new message comes before the retry, and follows it
+    send_one(ipm_credit_send, 5, 8, 'c', 0);
+    fail_sends(1, -EBUSY);
+    consume();
+    CHECK(ipm.sent_len == 0);
+    send_one(ipm_credit_send, 5, 8, 'd', 0);
+    CHECK(ipm.sent_len == 1 && sent_tag(0) == 'c');
+    CHECK(timeouts_pending() == 0);
+    consume();
+    CHECK(ipm.sent_len == 1 && sent_tag(0) == 'd');
+    consume();
+
+    CHECK(ipm_credit_get_stats(5, &stats) == 0);
+    CHECK(stats.sent == 4 && stats.queued == 3 && stats.rejected == 0);
+    CHECK(stats.outstanding == 0 && stats.waiting == 0);
+
+    ipm_credit_shutdown(5);
+    printf("credit: a queued message that fails to go is sent later\n");
+}
+
+/* ipm-prio */
+
+static void
+check_prio_failure_with_empty_window(void)
+{
+    struct ipm_prio_stats stats;
+
+    //Room in the window for one normal message
+    CHECK(ipm_prio_init(IPM_PRIO_STRICT, IPM_PRIO_RESERVED + 1) == 0);
+    CHECK(ipm_prio_set_class(7, IPM_PRIO_NORMAL, NULL, NULL) == 0);
+
+    send_one(ipm_prio_send, 7, 8, 'a', 0);
+    send_one(ipm_prio_send, 7, 8, 'b', 0);
+    CHECK(ipm.sent_len == 1);
+
+    //b fails as a is consumed, and stays queued with the window empty
+    fail_sends(1, -EBUSY);
+    consume();
+    CHECK(ipm.sent_len == 0);
+    CHECK(ipm_prio_get_stats(IPM_PRIO_NORMAL, &stats) == 0);
+    CHECK(stats.waiting == 1 && stats.rejected == 0);
+
+    CHECK(timeouts_pending() == 1);
+    timeouts_run();
+    CHECK(ipm.sent_len == 1 && sent_tag(0) == 'b');
+    CHECK(timeouts_pending() == 0);
+
+    //An error that sending again cannot fix drops it
+    send_one(ipm_prio_send, 7, 8, 'c', 0);
+    fail_sends(1, -EINVAL);
+    consume();
+    CHECK(ipm.sent_len == 0);
+    CHECK(timeouts_pending() == 0);
+
+    CHECK(ipm_prio_get_stats(IPM_PRIO_NORMAL, &stats) == 0);
+    CHECK(stats.sent == 2 && stats.queued == 1 && stats.rejected == 1);
+    CHECK(stats.waiting == 0 && stats.consumed == 2);
+
+    ipm_prio_shutdown();
+    printf("prio: a queued message is kept on a transient error\n");
+}
+
+int
+main(int argc, char *argv[])
+{
+    check_batch_order_on_failed_flush();
+    check_credit_failure_with_empty_window();
+    check_prio_failure_with_empty_window();
+
+    return EXIT_SUCCESS;
+}
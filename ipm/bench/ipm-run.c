@@ -0,0 +1,101 @@
+/*
+   Runs the two "cores" of an IPM application on Linux, as two processes
+   sharing the memory and eventfds of ipm-shm:
+
+       ./ipm-run ../x86/x86 ../arc/arc
+
+   The programs must be the Linux builds, whose sol_ipm is ipm-host.c.
+   Stops both when one of them exits or on SIGINT.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "ipm-shm.h"
+
+static pid_t pids[IPM_SHM_SIDES];
+
+static void
+on_signal(int sig)
+{
+    unsigned int i;
+
+    for (i = 0; i < IPM_SHM_SIDES; i++) {
+        if (pids[i] > 0)
+            kill(pids[i], SIGTERM);
+    }
+}
+
+int
+main(int argc, char *argv[])
+{
+    int fds[1 + IPM_SHM_SIDES];
+    char env[64];
+    unsigned int i, left = 0;
+    int status, r = -1;
+    pid_t pid;
+
+    if (argc != 1 + IPM_SHM_SIDES) {
+        fprintf(stderr, "Usage: %s <program> <program>\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (ipm_shm_create(fds) < 0) {
+        perror("Could not create the shared memory");
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+
+    for (i = 0; i < IPM_SHM_SIDES; i++) {
+        pids[i] = fork();
+        if (pids[i] < 0) {
+            perror("Could not fork");
+            on_signal(SIGTERM);
+            break;
+        }
+        if (pids[i])
+            continue;
+
+        if (ipm_shm_env(fds, i, env, sizeof(env)) < 0 ||
+            setenv(IPM_SHM_ENV, env, 1) < 0)
+            _exit(EXIT_FAILURE);
+        execv(argv[1 + i], (char *[]){ argv[1 + i], NULL });
+        perror("Could not run the program");
+        _exit(EXIT_FAILURE);
+    }
+
+    for (i = 0; i < 1 + IPM_SHM_SIDES; i++)
+        close(fds[i]);
+
+    for (i = 0; i < IPM_SHM_SIDES; i++)
+        left += pids[i] > 0;
+
+    while (left) {
+        pid = wait(&status);
+        if (pid < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+
+        for (i = 0; i < IPM_SHM_SIDES; i++) {
+            if (pids[i] == pid)
+                pids[i] = 0;
+        }
+        //The first to exit tells, the other one is stopped by us
+        if (r < 0)
+            r = WIFEXITED(status) ? WEXITSTATUS(status) : EXIT_FAILURE;
+        left--;
+        //One core alone has no one to talk to
+        on_signal(SIGTERM);
+    }
+
+    return r < 0 ? EXIT_FAILURE : r;
+}
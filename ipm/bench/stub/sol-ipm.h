@@ -0,0 +1,12 @@
+#pragma once
+
+#include "sol-types.h"
+
+int sol_ipm_send(uint32_t id, struct sol_blob *message);
+int sol_ipm_set_receiver(uint32_t id,
+    void (*receive_cb)(void *data, uint32_t id, struct sol_blob *message),
+    const void *data);
+int sol_ipm_set_consumed_callback(uint32_t id,
+    void (*consumed_cb)(void *data, uint32_t id, struct sol_blob *message),
+    const void *data);
+uint32_t sol_ipm_get_max_id(void);
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct sol_timeout;
+
+struct sol_timeout *sol_timeout_add(uint32_t timeout_ms,
+    bool (*cb)(void *data), const void *data);
+bool sol_timeout_del(struct sol_timeout *handle);
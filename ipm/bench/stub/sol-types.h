@@ -0,0 +1,32 @@
+/*
+   The parts of the Soletta headers the ipm/common sources use, so they
+   can be checked on the host against the fakes of ipm-check.c.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+struct sol_blob;
+
+struct sol_blob_type {
+    void (*free)(struct sol_blob *blob);
+};
+
+struct sol_blob {
+    const struct sol_blob_type *type;
+    struct sol_blob *parent;
+    void *mem;
+    size_t size;
+    uint16_t refcnt;
+};
+
+extern const struct sol_blob_type SOL_BLOB_TYPE_DEFAULT;
+extern const struct sol_blob_type SOL_BLOB_TYPE_NO_FREE;
+
+struct sol_blob *sol_blob_new(const struct sol_blob_type *type,
+    struct sol_blob *parent, const void *mem, size_t size);
+struct sol_blob *sol_blob_ref(struct sol_blob *blob);
+void sol_blob_unref(struct sol_blob *blob);
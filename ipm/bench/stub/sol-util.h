@@ -0,0 +1,8 @@
+#pragma once
+
+#include <time.h>
+
+#define SOL_UTIL_USEC_PER_SEC (1000000ULL)
+#define SOL_UTIL_NSEC_PER_USEC (1000ULL)
+
+struct timespec sol_util_timespec_get_current(void);
@@ -0,0 +1,316 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2016 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sol-ipm.h>
+#include <sol-log.h>
+#include <sol-mainloop.h>
+#include <sol-types.h>
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "ipm-batch.h"
+
+//Payloads are 8 byte aligned, readers cast them to their structs
+#define ALIGN(_len) (((_len) + 7) & ~(size_t)7)
+#define RECORD_SIZE(_len) ALIGN(sizeof(struct record) + (_len))
+//A frame with less room than this left is sent at once
+#define FLUSH_ROOM RECORD_SIZE(sizeof(uint32_t))
+#define FRAME_MAX_MESSAGES (IPM_BATCH_FRAME_SIZE / RECORD_SIZE(0))
+
+typedef void (*message_cb)(void *data, uint32_t id, struct sol_blob *message);
+
+int __real_sol_ipm_send(uint32_t id, struct sol_blob *message);
+int __real_sol_ipm_set_receiver(uint32_t id, message_cb receive_cb,
+    const void *data);
+int __real_sol_ipm_set_consumed_callback(uint32_t id, message_cb consumed_cb,
+    const void *data);
+
+struct record {
+    uint16_t id;
+    uint16_t len;
+};
+
+struct frame {
+    uint8_t buf[IPM_BATCH_FRAME_SIZE] __attribute__((aligned(8)));
+    size_t len;
+    bool in_flight;
+    //Kept until the frame is consumed
+    struct {
+        uint32_t id;
+        struct sol_blob *message;
+    } messages[FRAME_MAX_MESSAGES];
+    unsigned int count;
+};
+
+static struct frame frames[IPM_BATCH_FRAMES];
+
+static struct {
+    bool initialized;
+    uint32_t frame_id;
+    struct frame *filling;
+    struct sol_timeout *deadline;
+    struct {
+        message_cb receive_cb;
+        const void *receive_data;
+        message_cb consumed_cb;
+        const void *consumed_data;
+    } ids[IPM_BATCH_MAX_IDS];
+} batch;
+
+static void
+frame_receive_cb(void *data, uint32_t id, struct sol_blob *frame)
+{
+    const uint8_t *p = frame->mem, *end = p + frame->size;
+    struct record record;
+
+    while (p + sizeof(record) <= end) {
+        struct sol_blob *message;
+
+        memcpy(&record, p, sizeof(record));
+        if (p + RECORD_SIZE(record.len) > end)
+            break;
+
+        if (record.id < IPM_BATCH_MAX_IDS &&
+            batch.ids[record.id].receive_cb) {
+            //Holds a reference to the frame until released
+            message = sol_blob_new(&SOL_BLOB_TYPE_NO_FREE, frame,
+                p + sizeof(record), record.len);
+            if (message)
+                batch.ids[record.id].receive_cb(
+                    (void *)batch.ids[record.id].receive_data, record.id,
+                    message);
+            else
+                SOL_WRN("Could not unpack a message of id %u", record.id);
+        }
+
+        p += RECORD_SIZE(record.len);
+    }
+
+    sol_blob_unref(frame);
+}
+
+static void
+frame_consumed_cb(void *data, uint32_t id, struct sol_blob *blob)
+{
+    struct frame *f = NULL;
+    unsigned int i;
+
+    //The blob of the frame was released once sent
+    for (i = 0; i < IPM_BATCH_FRAMES; i++) {
+        if (frames[i].in_flight && frames[i].buf == blob->mem) {
+            f = &frames[i];
+            break;
+        }
+    }
+    if (!f)
+        return;
+
+    for (i = 0; i < f->count; i++) {
+        uint32_t message_id = f->messages[i].id;
+        struct sol_blob *message = f->messages[i].message;
+
+        if (batch.ids[message_id].consumed_cb)
+            batch.ids[message_id].consumed_cb(
+                (void *)batch.ids[message_id].consumed_data, message_id,
+                message);
+        sol_blob_unref(message);
+    }
+
+    f->count = 0;
+    f->len = 0;
+    f->in_flight = false;
+}
+
+static int
+batch_init(void)
+{
+    int r;
+
+    if (batch.initialized)
+        return 0;
+
+    batch.frame_id = sol_ipm_get_max_id();
+    r = __real_sol_ipm_set_receiver(batch.frame_id, frame_receive_cb, NULL);
+    if (r < 0)
+        return r;
+    r = __real_sol_ipm_set_consumed_callback(batch.frame_id,
+        frame_consumed_cb, NULL);
+    if (r < 0)
+        return r;
+
+    batch.initialized = true;
+    return 0;
+}
+
+static struct frame *
+frame_get(void)
+{
+    unsigned int i;
+
+    if (batch.filling)
+        return batch.filling;
+
+    for (i = 0; i < IPM_BATCH_FRAMES; i++) {
+        if (!frames[i].in_flight) {
+            batch.filling = &frames[i];
+            return batch.filling;
+        }
+    }
+
+    return NULL;
+}
+
+int
+ipm_batch_flush(void)
+{
+    struct frame *f = batch.filling;
+    struct sol_blob *blob;
+    int r;
+
+    if (!f || !f->count)
+        return 0;
+
+    blob = sol_blob_new(&SOL_BLOB_TYPE_NO_FREE, NULL, f->buf, f->len);
+    if (!blob)
+        return -ENOMEM;
+
+    r = __real_sol_ipm_send(batch.frame_id, blob);
+    sol_blob_unref(blob);
+    //Kept as it is, the deadline tries again
+    if (r < 0)
+        return r;
+
+    f->in_flight = true;
+    batch.filling = NULL;
+    if (batch.deadline) {
+        sol_timeout_del(batch.deadline);
+        batch.deadline = NULL;
+    }
+
+    return 0;
+}
+
+static bool
+deadline_cb(void *data)
+{
+    struct sol_timeout *deadline = batch.deadline;
+
+    //Not to be deleted by the flush while running
+    batch.deadline = NULL;
+    if (ipm_batch_flush() < 0) {
+        batch.deadline = deadline;
+        return true;
+    }
+
+    return false;
+}
+
+int
+__wrap_sol_ipm_send(uint32_t id, struct sol_blob *message)
+{
+    struct record record;
+    struct frame *f;
+    size_t size;
+    int r;
+
+    if (!message || batch_init() < 0 || id == batch.frame_id ||
+        id >= IPM_BATCH_MAX_IDS)
+        return __real_sol_ipm_send(id, message);
+
+    //Too big, sent on its own but not ahead of the batched ones: if they
+    //cannot go, neither can it
+    size = RECORD_SIZE(message->size);
+    if (size > IPM_BATCH_FRAME_SIZE) {
+        r = ipm_batch_flush();
+        if (r < 0)
+            return r;
+        return __real_sol_ipm_send(id, message);
+    }
+
+    f = frame_get();
+    if (f && (f->len + size > IPM_BATCH_FRAME_SIZE ||
+        f->count == FRAME_MAX_MESSAGES)) {
+        r = ipm_batch_flush();
+        if (r < 0)
+            return r;
+        f = frame_get();
+    }
+    //All frames in flight, nothing batched is left behind
+    if (!f)
+        return __real_sol_ipm_send(id, message);
+
+    record.id = id;
+    record.len = message->size;
+    memcpy(f->buf + f->len, &record, sizeof(record));
+    memcpy(f->buf + f->len + sizeof(record), message->mem, message->size);
+    f->len += size;
+    f->messages[f->count].id = id;
+    f->messages[f->count].message = sol_blob_ref(message);
+    f->count++;
+
+    if (IPM_BATCH_FRAME_SIZE - f->len < FLUSH_ROOM && ipm_batch_flush() == 0)
+        return 0;
+    if (!batch.deadline)
+        batch.deadline = sol_timeout_add(IPM_BATCH_DEADLINE_MS, deadline_cb,
+            NULL);
+
+    return 0;
+}
+
+int
+__wrap_sol_ipm_set_receiver(uint32_t id, message_cb receive_cb,
+    const void *data)
+{
+    int r;
+
+    r = batch_init();
+    if (r < 0)
+        return r;
+    if (id == batch.frame_id)
+        return -EINVAL;
+
+    if (id < IPM_BATCH_MAX_IDS) {
+        batch.ids[id].receive_cb = receive_cb;
+        batch.ids[id].receive_data = data;
+    }
+
+    //Messages that were not batched still arrive on their own id
+    return __real_sol_ipm_set_receiver(id, receive_cb, data);
+}
+
+int
+__wrap_sol_ipm_set_consumed_callback(uint32_t id, message_cb consumed_cb,
+    const void *data)
+{
+    int r;
+
+    r = batch_init();
+    if (r < 0)
+        return r;
+    if (id == batch.frame_id)
+        return -EINVAL;
+
+    if (id < IPM_BATCH_MAX_IDS) {
+        batch.ids[id].consumed_cb = consumed_cb;
+        batch.ids[id].consumed_data = data;
+    }
+
+    return __real_sol_ipm_set_consumed_callback(id, consumed_cb, data);
+}
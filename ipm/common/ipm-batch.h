@@ -0,0 +1,59 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2016 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * Packs small IPM messages, of any id, into frames sent on a single id
+ * (the highest one, sol_ipm_get_max_id()), so a burst of messages costs
+ * one interrupt on the other core instead of one each.
+ *
+ * It sits under sol_ipm itself: the application is linked with
+ * sol_ipm_send(), sol_ipm_set_receiver() and
+ * sol_ipm_set_consumed_callback() wrapped (APP_WRAP), so the IPM flow
+ * nodes of Soletta use it without knowing. Both cores must be built so.
+ *
+ * A frame is sent when it is nearly full, IPM_BATCH_DEADLINE_MS after
+ * its first message or on ipm_batch_flush(). The receiver gets each
+ * message on its own id, as a blob whose parent is the frame; the frame
+ * is consumed once all of them are released, and only then are the
+ * consumed callbacks of the sender called for its messages. Messages
+ * that do not fit a frame, or sent while all frames are in flight, go
+ * as they are. No message overtakes one batched before it: when the
+ * frame being filled has to go first and cannot, sol_ipm_send() fails
+ * with the error of the frame.
+ */
+
+#ifndef IPM_BATCH_FRAME_SIZE
+#define IPM_BATCH_FRAME_SIZE (256)
+#endif
+#ifndef IPM_BATCH_FRAMES
+#define IPM_BATCH_FRAMES (4)
+#endif
+#ifndef IPM_BATCH_DEADLINE_MS
+#define IPM_BATCH_DEADLINE_MS (5)
+#endif
+//Ids that can be batched, the frame id excluded
+#ifndef IPM_BATCH_MAX_IDS
+#define IPM_BATCH_MAX_IDS (32)
+#endif
+
+/* Sends the frame being filled now, if any. */
+int ipm_batch_flush(void);
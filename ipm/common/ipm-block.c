@@ -0,0 +1,100 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2016 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sol-flow.h>
+#include <sol-flow-packet.h>
+#include <sol-ipm.h>
+#include <sol-log.h>
+#include <sol-types.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <string.h>
+
+#include "ipm-block.h"
+#include "ipm-block-gen.h"
+
+struct block_reader_data {
+    struct sol_flow_node *node;
+    uint32_t id;
+    uint32_t lost;
+};
+
+static void
+receive_cb(void *data, uint32_t id, struct sol_blob *message)
+{
+    struct block_reader_data *mdata = data;
+    struct ipm_block_header header;
+
+    if (message->size < sizeof(header))
+        goto err;
+    memcpy(&header, message->mem, sizeof(header));
+    if (message->size < sizeof(header) + header.count * sizeof(uint16_t))
+        goto err;
+
+    //No copy, the sender gets the block back once the packet is gone
+    sol_flow_send_blob_packet(mdata->node,
+        SOL_FLOW_NODE_TYPE_IPM_BLOCK_READER__OUT__OUT, message);
+
+    if (header.lost) {
+        mdata->lost += header.lost;
+        sol_flow_send_irange_value_packet(mdata->node,
+            SOL_FLOW_NODE_TYPE_IPM_BLOCK_READER__OUT__LOST, mdata->lost);
+    }
+
+    sol_blob_unref(message);
+    return;
+
+err:
+    sol_flow_send_error_packet(mdata->node, EINVAL,
+        "Invalid block of %zu bytes on IPM id %" PRIu32, message->size, id);
+    sol_blob_unref(message);
+}
+
+static int
+block_reader_open(struct sol_flow_node *node, void *data,
+    const struct sol_flow_node_options *options)
+{
+    struct block_reader_data *mdata = data;
+    const struct sol_flow_node_type_ipm_block_reader_options *opts;
+
+    SOL_FLOW_NODE_OPTIONS_SUB_API_CHECK(options,
+        SOL_FLOW_NODE_TYPE_IPM_BLOCK_READER_OPTIONS_API_VERSION, -EINVAL);
+    opts = (const struct sol_flow_node_type_ipm_block_reader_options *)options;
+
+    if (opts->id < 0 || (uint32_t)opts->id > sol_ipm_get_max_id()) {
+        SOL_WRN("Invalid IPM id %" PRId32 ", up to %" PRIu32, opts->id,
+            sol_ipm_get_max_id());
+        return -EINVAL;
+    }
+
+    memset(mdata, 0, sizeof(*mdata));
+    mdata->node = node;
+    mdata->id = opts->id;
+    return sol_ipm_set_receiver(mdata->id, receive_cb, mdata);
+}
+
+static void
+block_reader_close(struct sol_flow_node *node, void *data)
+{
+    struct block_reader_data *mdata = data;
+
+    sol_ipm_set_receiver(mdata->id, NULL, NULL);
+}
+
+#include "ipm-block-gen.c"
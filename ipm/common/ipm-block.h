@@ -0,0 +1,43 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2016 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/*
+ * A block of samples taken at a fixed rate, sent as a single IPM
+ * message: this header followed by count samples of 16 bits. The blob
+ * ipm/block-reader sends out is the IPM message itself, released to the
+ * sending core once all its users unref it.
+ */
+
+struct ipm_block_header {
+    uint32_t seq;
+    uint32_t rate; //Hz
+    uint32_t timestamp; //ms, of the first sample, clock of the sender
+    uint32_t lost; //samples not sent between the previous block and this
+    uint16_t count;
+    uint16_t bits; //significant bits of the samples
+};
+
+static inline const uint16_t *
+ipm_block_samples(const struct ipm_block_header *header)
+{
+    return (const uint16_t *)(header + 1);
+}
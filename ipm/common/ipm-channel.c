@@ -0,0 +1,228 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2016 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sol-ipm.h>
+#include <sol-log.h>
+#include <sol-mainloop.h>
+#include <sol-types.h>
+
+#include <errno.h>
+#include <string.h>
+
+#include "ipm-channel.h"
+#include "ipm-ring.h"
+
+#define DOORBELL_RETRY_MS (1)
+
+static uint8_t tx_mem[IPM_RING_HEADER_SIZE + IPM_CHANNEL_RING_SIZE]
+    __attribute__((aligned(IPM_RING_LINE)));
+static const uint8_t doorbell_mem;
+
+static struct {
+    struct ipm_ring_producer tx;
+    struct ipm_ring_consumer rx;
+    bool connected;
+
+    uint32_t setup_id;
+    uint32_t doorbell_id;
+    //Allocated once and sent for every doorbell
+    struct sol_blob *doorbell;
+    struct sol_timeout *doorbell_retry;
+
+    ipm_channel_receive_cb receive_cb;
+    const void *data;
+} channel;
+
+static void
+drain(void)
+{
+    const void *msg;
+    uint16_t len, tag;
+
+    if (!channel.connected)
+        return;
+
+    do {
+        while ((msg = ipm_ring_peek(&channel.rx, &len, &tag))) {
+            channel.receive_cb((void *)channel.data, tag, msg, len);
+            ipm_ring_release(&channel.rx);
+        }
+    } while (!ipm_ring_arm(&channel.rx));
+}
+
+static int
+send_setup(void)
+{
+    struct sol_blob *blob;
+    int r;
+
+    //The blob is the ring itself, its address is all the other core needs
+    blob = sol_blob_new(&SOL_BLOB_TYPE_NO_FREE, NULL, tx_mem, sizeof(tx_mem));
+    if (!blob)
+        return -ENOMEM;
+
+    r = sol_ipm_send(channel.setup_id, blob);
+    sol_blob_unref(blob);
+    return r;
+}
+
+static bool
+doorbell_retry_cb(void *data)
+{
+    if (sol_ipm_send(channel.doorbell_id, channel.doorbell) < 0)
+        return true;
+
+    channel.doorbell_retry = NULL;
+    return false;
+}
+
+static void
+ring_doorbell(void)
+{
+    if (channel.doorbell_retry)
+        return;
+
+    //The other core is waiting already, it must not miss this one
+    if (sol_ipm_send(channel.doorbell_id, channel.doorbell) < 0)
+        channel.doorbell_retry = sol_timeout_add(DOORBELL_RETRY_MS,
+            doorbell_retry_cb, NULL);
+}
+
+static void
+setup_cb(void *data, uint32_t id, struct sol_blob *message)
+{
+    struct ipm_ring *ring = message->mem;
+    bool first = !channel.connected;
+
+    if (!ipm_ring_is_valid(ring)) {
+        SOL_WRN("Invalid ring %p received from the other core", ring);
+        sol_blob_unref(message);
+        return;
+    }
+
+    ipm_ring_consumer_init(&channel.rx, ring);
+    channel.connected = true;
+    sol_blob_unref(message);
+
+    //Our own setup may have been sent before the other core was up
+    if (first && send_setup() < 0)
+        SOL_WRN("Could not send the ring address to the other core");
+
+    drain();
+}
+
+static void
+doorbell_cb(void *data, uint32_t id, struct sol_blob *message)
+{
+    sol_blob_unref(message);
+    drain();
+}
+
+int
+ipm_channel_init(uint32_t setup_id, uint32_t doorbell_id,
+    ipm_channel_receive_cb receive_cb, const void *data)
+{
+    struct ipm_ring *ring;
+    int r;
+
+    if (!receive_cb)
+        return -EINVAL;
+
+    memset(&channel, 0, sizeof(channel));
+    channel.setup_id = setup_id;
+    channel.doorbell_id = doorbell_id;
+    channel.receive_cb = receive_cb;
+    channel.data = data;
+
+    ring = ipm_ring_init(tx_mem, sizeof(tx_mem));
+    if (!ring)
+        return -EINVAL;
+    ipm_ring_producer_init(&channel.tx, ring);
+
+    channel.doorbell = sol_blob_new(&SOL_BLOB_TYPE_NO_FREE, NULL,
+        &doorbell_mem, sizeof(doorbell_mem));
+    if (!channel.doorbell)
+        return -ENOMEM;
+
+    r = sol_ipm_set_receiver(setup_id, setup_cb, NULL);
+    if (r < 0)
+        goto err_receiver;
+    r = sol_ipm_set_receiver(doorbell_id, doorbell_cb, NULL);
+    if (r < 0)
+        goto err_receiver;
+
+    //Fails if the other core is not up yet, it will ask again when it is
+    send_setup();
+
+    return 0;
+
+err_receiver:
+    sol_blob_unref(channel.doorbell);
+    channel.doorbell = NULL;
+    return r;
+}
+
+void
+ipm_channel_shutdown(void)
+{
+    if (channel.doorbell_retry)
+        sol_timeout_del(channel.doorbell_retry);
+    if (channel.doorbell)
+        sol_blob_unref(channel.doorbell);
+    memset(&channel, 0, sizeof(channel));
+}
+
+bool
+ipm_channel_is_connected(void)
+{
+    return channel.connected;
+}
+
+int
+ipm_channel_reserve(uint16_t len, void **buf)
+{
+    if (!channel.tx.ring)
+        return -ENOTCONN;
+
+    return ipm_ring_reserve(&channel.tx, len, buf);
+}
+
+int
+ipm_channel_commit(uint16_t len, uint16_t tag)
+{
+    if (!channel.tx.has_reservation)
+        return -EINVAL;
+
+    if (ipm_ring_commit(&channel.tx, len, tag))
+        ring_doorbell();
+    return 0;
+}
+
+int
+ipm_channel_send(uint16_t tag, const void *msg, uint16_t len)
+{
+    void *buf;
+    int r;
+
+    r = ipm_channel_reserve(len, &buf);
+    if (r < 0)
+        return r;
+
+    memcpy(buf, msg, len);
+    return ipm_channel_commit(len, tag);
+}
@@ -0,0 +1,65 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2016 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+ * Messages between two cores over a pair of shared memory rings, one per
+ * direction (see ipm-ring.h), with sol_ipm used only to exchange the ring
+ * addresses and as the doorbell.
+ *
+ * Each core owns the ring it writes to, in its own static memory, so no
+ * message needs a blob nor an allocation. A doorbell is sent only when a
+ * message lands in an empty ring the other core is waiting on.
+ *
+ * Both cores must call ipm_channel_init() with the same message ids. The
+ * memory of the rings must be seen by both cores without caching, as the
+ * memory of blobs sent over sol_ipm already is.
+ */
+
+#ifndef IPM_CHANNEL_RING_SIZE
+#define IPM_CHANNEL_RING_SIZE (1024)
+#endif
+
+/*
+ * Called from the main loop for each received message. The message is
+ * only valid until the callback returns.
+ */
+typedef void (*ipm_channel_receive_cb)(void *data, uint16_t tag,
+    const void *msg, uint16_t len);
+
+int ipm_channel_init(uint32_t setup_id, uint32_t doorbell_id,
+    ipm_channel_receive_cb receive_cb, const void *data);
+void ipm_channel_shutdown(void);
+
+/* Whether the other core is known, messages are queued until then. */
+bool ipm_channel_is_connected(void);
+
+/*
+ * Reserves room for a message of up to len bytes in the outgoing ring,
+ * to be written in place and then published by ipm_channel_commit().
+ * Returns -EAGAIN while the ring is full.
+ */
+int ipm_channel_reserve(uint16_t len, void **buf);
+int ipm_channel_commit(uint16_t len, uint16_t tag);
+
+/* Copies a message to the outgoing ring. */
+int ipm_channel_send(uint16_t tag, const void *msg, uint16_t len);
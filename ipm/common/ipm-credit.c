@@ -0,0 +1,244 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2016 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sol-ipm.h>
+#include <sol-log.h>
+#include <sol-mainloop.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ipm-credit.h"
+
+//A queued message that could not be sent is tried again after this long
+#define RETRY_MS (5)
+
+struct channel {
+    bool initialized;
+    uint16_t credits;
+    uint16_t queue_len;
+    //Ring of the messages waiting for a credit
+    struct sol_blob **queue;
+    uint16_t queue_head;
+    struct sol_timeout *retry;
+
+    void (*consumed_cb)(void *data, uint32_t id, struct sol_blob *message);
+    const void *data;
+
+    struct ipm_credit_stats stats;
+};
+
+static struct channel channels[IPM_CREDIT_MAX_IDS];
+
+static struct channel *
+channel_get(uint32_t id)
+{
+    if (id >= IPM_CREDIT_MAX_IDS || !channels[id].initialized)
+        return NULL;
+    return &channels[id];
+}
+
+static int
+channel_send(struct channel *ch, uint32_t id, struct sol_blob *message)
+{
+    int r;
+
+    r = sol_ipm_send(id, message);
+    if (r < 0)
+        return r;
+
+    ch->credits--;
+    ch->stats.outstanding++;
+    ch->stats.sent++;
+    return 0;
+}
+
+static bool retry_cb(void *data);
+
+/*
+ * Sends the queued messages while there are credits. When one fails it
+ * stays at the head and the retry timeout tries again, as with an empty
+ * window no consumed callback may ever come to do it.
+ */
+static int
+drain(struct channel *ch, uint32_t id)
+{
+    struct sol_blob *next;
+    int r;
+
+    while (ch->credits && ch->stats.waiting) {
+        next = ch->queue[ch->queue_head];
+        r = channel_send(ch, id, next);
+        if (r < 0) {
+            SOL_WRN("Could not send a queued message of id %" PRIu32, id);
+            if (!ch->retry)
+                ch->retry = sol_timeout_add(RETRY_MS, retry_cb,
+                    (void *)(uintptr_t)id);
+            return r;
+        }
+
+        ch->queue_head = (ch->queue_head + 1) % ch->queue_len;
+        ch->stats.waiting--;
+        ch->stats.queued++;
+        sol_blob_unref(next);
+    }
+
+    return 0;
+}
+
+static bool
+retry_cb(void *data)
+{
+    uint32_t id = (uintptr_t)data;
+    struct channel *ch = channel_get(id);
+
+    if (ch && drain(ch, id) < 0)
+        return true;
+
+    if (ch)
+        ch->retry = NULL;
+    return false;
+}
+
+static void
+retry_stop(struct channel *ch)
+{
+    if (ch->retry) {
+        sol_timeout_del(ch->retry);
+        ch->retry = NULL;
+    }
+}
+
+static void
+consumed_cb(void *data, uint32_t id, struct sol_blob *message)
+{
+    struct channel *ch = channel_get(id);
+
+    if (!ch)
+        return;
+
+    if (ch->consumed_cb)
+        ch->consumed_cb((void *)ch->data, id, message);
+
+    ch->credits++;
+    ch->stats.outstanding--;
+
+    if (drain(ch, id) == 0)
+        retry_stop(ch);
+}
+
+int
+ipm_credit_init(uint32_t id, uint16_t credits, uint16_t queue_len,
+    void (*cb)(void *data, uint32_t id, struct sol_blob *message),
+    const void *data)
+{
+    struct channel *ch;
+    int r;
+
+    if (id >= IPM_CREDIT_MAX_IDS || !credits)
+        return -EINVAL;
+
+    ch = &channels[id];
+    if (ch->initialized)
+        return -EALREADY;
+
+    memset(ch, 0, sizeof(*ch));
+    if (queue_len) {
+        ch->queue = calloc(queue_len, sizeof(struct sol_blob *));
+        if (!ch->queue)
+            return -ENOMEM;
+    }
+
+    r = sol_ipm_set_consumed_callback(id, consumed_cb, NULL);
+    if (r < 0) {
+        free(ch->queue);
+        ch->queue = NULL;
+        return r;
+    }
+
+    ch->credits = credits;
+    ch->queue_len = queue_len;
+    ch->consumed_cb = cb;
+    ch->data = data;
+    ch->initialized = true;
+    return 0;
+}
+
+void
+ipm_credit_shutdown(uint32_t id)
+{
+    struct channel *ch = channel_get(id);
+
+    if (!ch)
+        return;
+
+    while (ch->stats.waiting) {
+        sol_blob_unref(ch->queue[ch->queue_head]);
+        ch->queue_head = (ch->queue_head + 1) % ch->queue_len;
+        ch->stats.waiting--;
+    }
+
+    retry_stop(ch);
+    sol_ipm_set_consumed_callback(id, NULL, NULL);
+    free(ch->queue);
+    memset(ch, 0, sizeof(*ch));
+}
+
+int
+ipm_credit_send(uint32_t id, struct sol_blob *message)
+{
+    struct channel *ch = channel_get(id);
+    uint16_t tail;
+
+    if (!ch || !message)
+        return -EINVAL;
+
+    //Queued messages go first, in order
+    if (drain(ch, id) == 0)
+        retry_stop(ch);
+    if (ch->credits && !ch->stats.waiting)
+        return channel_send(ch, id, message);
+
+    ch->stats.stalls++;
+    if (ch->stats.waiting == ch->queue_len) {
+        ch->stats.rejected++;
+        return -ENOBUFS;
+    }
+
+    tail = (ch->queue_head + ch->stats.waiting) % ch->queue_len;
+    ch->queue[tail] = sol_blob_ref(message);
+    ch->stats.waiting++;
+    if (ch->stats.waiting > ch->stats.max_waiting)
+        ch->stats.max_waiting = ch->stats.waiting;
+    return 0;
+}
+
+int
+ipm_credit_get_stats(uint32_t id, struct ipm_credit_stats *stats)
+{
+    struct channel *ch = channel_get(id);
+
+    if (!ch || !stats)
+        return -EINVAL;
+
+    *stats = ch->stats;
+    return 0;
+}
@@ -0,0 +1,66 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2016 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <sol-types.h>
+
+/*
+ * Credit based flow control of the messages sent on an IPM id.
+ *
+ * An id starts with a number of credits, sending a message takes one
+ * and its consumed callback gives it back. Without credits left, a
+ * message waits in a queue of bounded length, to be sent as credits
+ * return, or is refused with -ENOBUFS once the queue is full (or
+ * straight away when there is no queue). So at most credits + queue_len
+ * messages of an id are alive at any time, whatever the pace of the
+ * other core. A queued message that fails to be sent stays at the head
+ * of the queue, tried again on the next send, consumed callback or
+ * after a few milliseconds.
+ */
+
+#define IPM_CREDIT_MAX_IDS (32)
+
+struct ipm_credit_stats {
+    uint32_t sent;
+    uint32_t queued; //sent after waiting for a credit
+    uint32_t rejected; //refused with -ENOBUFS
+    uint32_t stalls; //sends that found no credit left
+    uint16_t outstanding; //sent and not consumed yet
+    uint16_t waiting; //in the queue now
+    uint16_t max_waiting;
+};
+
+/*
+ * Takes over the consumed callback of id, consumed_cb (may be NULL) is
+ * called instead, before the credit is given back.
+ */
+int ipm_credit_init(uint32_t id, uint16_t credits, uint16_t queue_len,
+    void (*consumed_cb)(void *data, uint32_t id, struct sol_blob *message),
+    const void *data);
+void ipm_credit_shutdown(uint32_t id);
+
+/*
+ * Sends, or queues, the message, taking a reference to it. Returns
+ * -ENOBUFS when out of credits and queue room.
+ */
+int ipm_credit_send(uint32_t id, struct sol_blob *message);
+
+int ipm_credit_get_stats(uint32_t id, struct ipm_credit_stats *stats);
@@ -0,0 +1,346 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2016 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Integers over IPM for values that mostly stay put.
+ *
+ * ipm/delta-writer drops the values within a deadband of the last one
+ * sent and packs the others in batches, a batch per IPM message:
+ *
+ *     count (1 byte), min, max, step, first value, then each value
+ *     minus the previous one
+ *
+ * all but count as zigzag varints, so small changes take a byte each.
+ * ipm/delta-reader unpacks them on the other core.
+ */
+
+#include <sol-flow.h>
+#include <sol-flow-packet.h>
+#include <sol-ipm.h>
+#include <sol-log.h>
+#include <sol-mainloop.h>
+#include <sol-types.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ipm-delta-gen.h"
+
+#define DELTA_MAX_BATCH (32)
+#define VARINT_MAX_SIZE (5)
+//Count, the range and the values
+#define BATCH_MAX_SIZE (1 + VARINT_MAX_SIZE * (3 + DELTA_MAX_BATCH))
+
+static uint32_t
+zigzag_encode(int32_t value)
+{
+    return ((uint32_t)value << 1) ^ (uint32_t)(value >> 31);
+}
+
+static int32_t
+zigzag_decode(uint32_t value)
+{
+    return (int32_t)((value >> 1) ^ (~(value & 1) + 1));
+}
+
+static size_t
+varint_put(uint8_t *buf, int32_t value)
+{
+    uint32_t v = zigzag_encode(value);
+    size_t len = 0;
+
+    while (v >= 0x80) {
+        buf[len++] = (v & 0x7f) | 0x80;
+        v >>= 7;
+    }
+    buf[len++] = v;
+    return len;
+}
+
+static int
+varint_get(const uint8_t **p, const uint8_t *end, int32_t *value)
+{
+    uint32_t v = 0;
+    unsigned int shift;
+
+    for (shift = 0; shift < 7 * VARINT_MAX_SIZE; shift += 7) {
+        if (*p == end)
+            return -EINVAL;
+        v |= (uint32_t)(**p & 0x7f) << shift;
+        if (!(*(*p)++ & 0x80)) {
+            *value = zigzag_decode(v);
+            return 0;
+        }
+    }
+
+    return -EINVAL;
+}
+
+struct delta_writer_data {
+    struct sol_timeout *heartbeat_timeout;
+    struct sol_timeout *flush_timeout;
+    struct sol_irange last; //last value sent
+    struct sol_irange range; //of the values in the batch
+    int32_t values[DELTA_MAX_BATCH];
+    uint32_t id;
+    int32_t deadband;
+    uint32_t heartbeat;
+    uint32_t latency;
+    uint8_t batch;
+    uint8_t count;
+    bool has_last;
+};
+
+static int
+delta_writer_flush(struct delta_writer_data *mdata)
+{
+    uint8_t buf[BATCH_MAX_SIZE], *mem;
+    struct sol_blob *message;
+    size_t len = 0;
+    int32_t prev = 0;
+    uint8_t i;
+    int r;
+
+    if (mdata->flush_timeout) {
+        sol_timeout_del(mdata->flush_timeout);
+        mdata->flush_timeout = NULL;
+    }
+    if (!mdata->count)
+        return 0;
+
+    buf[len++] = mdata->count;
+    len += varint_put(buf + len, mdata->range.min);
+    len += varint_put(buf + len, mdata->range.max);
+    len += varint_put(buf + len, mdata->range.step);
+    for (i = 0; i < mdata->count; i++) {
+        //Wraps around for far apart values, undone the same way on reading
+        len += varint_put(buf + len,
+            (int32_t)((uint32_t)mdata->values[i] - (uint32_t)prev));
+        prev = mdata->values[i];
+    }
+    mdata->count = 0;
+
+    mem = malloc(len);
+    SOL_NULL_CHECK(mem, -ENOMEM);
+    memcpy(mem, buf, len);
+
+    message = sol_blob_new(&SOL_BLOB_TYPE_DEFAULT, NULL, mem, len);
+    if (!message) {
+        free(mem);
+        return -ENOMEM;
+    }
+
+    r = sol_ipm_send(mdata->id, message);
+    sol_blob_unref(message);
+    if (r < 0)
+        SOL_WRN("Could not send %zu bytes on IPM id %" PRIu32 ": %d", len,
+            mdata->id, r);
+    return r;
+}
+
+static bool
+flush_cb(void *data)
+{
+    struct delta_writer_data *mdata = data;
+
+    mdata->flush_timeout = NULL;
+    delta_writer_flush(mdata);
+    return false;
+}
+
+static bool heartbeat_cb(void *data);
+
+static int
+delta_writer_append(struct delta_writer_data *mdata,
+    const struct sol_irange *value)
+{
+    mdata->values[mdata->count++] = value->val;
+    mdata->range = *value;
+    mdata->last = *value;
+    mdata->has_last = true;
+
+    if (mdata->heartbeat) {
+        if (mdata->heartbeat_timeout)
+            sol_timeout_del(mdata->heartbeat_timeout);
+        mdata->heartbeat_timeout = sol_timeout_add(mdata->heartbeat,
+            heartbeat_cb, mdata);
+    }
+
+    if (mdata->count == mdata->batch || !mdata->latency)
+        return delta_writer_flush(mdata);
+
+    if (!mdata->flush_timeout) {
+        mdata->flush_timeout = sol_timeout_add(mdata->latency, flush_cb,
+            mdata);
+        SOL_NULL_CHECK(mdata->flush_timeout, -ENOMEM);
+    }
+    return 0;
+}
+
+static bool
+heartbeat_cb(void *data)
+{
+    struct delta_writer_data *mdata = data;
+    struct sol_irange last = mdata->last;
+
+    //A new one is added as the value is sent
+    mdata->heartbeat_timeout = NULL;
+    delta_writer_append(mdata, &last);
+    return false;
+}
+
+static int
+delta_writer_open(struct sol_flow_node *node, void *data,
+    const struct sol_flow_node_options *options)
+{
+    struct delta_writer_data *mdata = data;
+    const struct sol_flow_node_type_ipm_delta_writer_options *opts;
+
+    SOL_FLOW_NODE_OPTIONS_SUB_API_CHECK(options,
+        SOL_FLOW_NODE_TYPE_IPM_DELTA_WRITER_OPTIONS_API_VERSION, -EINVAL);
+    opts = (const struct sol_flow_node_type_ipm_delta_writer_options *)options;
+
+    if (opts->id < 0 || (uint32_t)opts->id > sol_ipm_get_max_id() ||
+        opts->deadband < 0 || opts->heartbeat < 0 || opts->latency < 0 ||
+        opts->batch < 1 || opts->batch > DELTA_MAX_BATCH) {
+        SOL_WRN("Invalid options, id must be up to %" PRIu32
+            " and batch from 1 to %d", sol_ipm_get_max_id(), DELTA_MAX_BATCH);
+        return -EINVAL;
+    }
+
+    memset(mdata, 0, sizeof(*mdata));
+    mdata->id = opts->id;
+    mdata->deadband = opts->deadband;
+    mdata->heartbeat = opts->heartbeat;
+    mdata->latency = opts->latency;
+    mdata->batch = opts->batch;
+    return 0;
+}
+
+static void
+delta_writer_close(struct sol_flow_node *node, void *data)
+{
+    struct delta_writer_data *mdata = data;
+
+    delta_writer_flush(mdata);
+    if (mdata->heartbeat_timeout)
+        sol_timeout_del(mdata->heartbeat_timeout);
+}
+
+static int
+delta_writer_process(struct sol_flow_node *node, void *data, uint16_t port,
+    uint16_t conn_id, const struct sol_flow_packet *packet)
+{
+    struct delta_writer_data *mdata = data;
+    struct sol_irange in;
+    int64_t diff;
+    int r;
+
+    r = sol_flow_packet_get_irange(packet, &in);
+    SOL_INT_CHECK(r, < 0, r);
+
+    if (mdata->has_last) {
+        diff = (int64_t)in.val - mdata->last.val;
+        if (diff <= mdata->deadband && diff >= -mdata->deadband)
+            return 0;
+    }
+
+    return delta_writer_append(mdata, &in);
+}
+
+struct delta_reader_data {
+    struct sol_flow_node *node;
+    uint32_t id;
+};
+
+static void
+receive_cb(void *data, uint32_t id, struct sol_blob *message)
+{
+    struct delta_reader_data *mdata = data;
+    const uint8_t *p = message->mem, *end = p + message->size;
+    struct sol_irange value;
+    int32_t delta;
+    uint8_t count;
+    int r = -EINVAL;
+
+    if (p == end)
+        goto err;
+    count = *p++;
+
+    r = varint_get(&p, end, &value.min);
+    if (r >= 0)
+        r = varint_get(&p, end, &value.max);
+    if (r >= 0)
+        r = varint_get(&p, end, &value.step);
+    if (r < 0)
+        goto err;
+
+    value.val = 0;
+    while (count--) {
+        r = varint_get(&p, end, &delta);
+        if (r < 0)
+            goto err;
+        value.val = (int32_t)((uint32_t)value.val + (uint32_t)delta);
+        sol_flow_send_irange_packet(mdata->node,
+            SOL_FLOW_NODE_TYPE_IPM_DELTA_READER__OUT__OUT, &value);
+    }
+
+    sol_blob_unref(message);
+    return;
+
+err:
+    sol_flow_send_error_packet(mdata->node, -r,
+        "Invalid batch of %zu bytes on IPM id %" PRIu32, message->size, id);
+    sol_blob_unref(message);
+}
+
+static int
+delta_reader_open(struct sol_flow_node *node, void *data,
+    const struct sol_flow_node_options *options)
+{
+    struct delta_reader_data *mdata = data;
+    const struct sol_flow_node_type_ipm_delta_reader_options *opts;
+
+    SOL_FLOW_NODE_OPTIONS_SUB_API_CHECK(options,
+        SOL_FLOW_NODE_TYPE_IPM_DELTA_READER_OPTIONS_API_VERSION, -EINVAL);
+    opts = (const struct sol_flow_node_type_ipm_delta_reader_options *)options;
+
+    if (opts->id < 0 || (uint32_t)opts->id > sol_ipm_get_max_id()) {
+        SOL_WRN("Invalid IPM id %" PRId32 ", up to %" PRIu32, opts->id,
+            sol_ipm_get_max_id());
+        return -EINVAL;
+    }
+
+    mdata->node = node;
+    mdata->id = opts->id;
+    return sol_ipm_set_receiver(mdata->id, receive_cb, mdata);
+}
+
+static void
+delta_reader_close(struct sol_flow_node *node, void *data)
+{
+    struct delta_reader_data *mdata = data;
+
+    sol_ipm_set_receiver(mdata->id, NULL, NULL);
+}
+
+#include "ipm-delta-gen.c"
@@ -0,0 +1,194 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2016 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * sol_ipm for Linux, where the two "cores" are two processes started by
+ * ipm-run (see ipm/bench), over ipm-shm.
+ *
+ * As on the boards, the receiver gets a blob it must unref, and the
+ * consumed callback of the sender is called once it does. The blob the
+ * receiver gets points to a copy of the message in shared memory, as
+ * the two processes do not share their address spaces.
+ */
+
+#include <sol-ipm.h>
+#include <sol-log.h>
+#include <sol-macros.h>
+#include <sol-mainloop.h>
+#include <sol-types.h>
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "ipm-shm.h"
+
+#define IPM_HOST_MAX_ID (31)
+
+struct host_blob {
+    struct sol_blob base;
+    uint16_t slot;
+};
+
+struct host_callbacks {
+    void (*receive_cb)(void *data, uint32_t id, struct sol_blob *message);
+    const void *receive_data;
+    void (*consumed_cb)(void *data, uint32_t id, struct sol_blob *message);
+    const void *consumed_data;
+};
+
+static struct {
+    struct ipm_shm *shm;
+    struct sol_fd *watch;
+    struct host_callbacks ids[IPM_HOST_MAX_ID + 1];
+} host;
+
+static void
+host_blob_free(struct sol_blob *blob)
+{
+    struct host_blob *hb = (struct host_blob *)blob;
+
+    if (host.shm && ipm_shm_consume(host.shm, hb->slot) < 0)
+        SOL_WRN("Could not give slot %u back", hb->slot);
+    free(hb);
+}
+
+static const struct sol_blob_type HOST_BLOB_TYPE = {
+    SOL_SET_API_VERSION(.api_version = SOL_BLOB_TYPE_API_VERSION, )
+    .free = host_blob_free
+};
+
+static void
+message_cb(void *data, uint32_t id, uint16_t slot, const void *mem,
+    size_t len)
+{
+    struct host_callbacks *cbs;
+    struct host_blob *hb;
+
+    cbs = id <= IPM_HOST_MAX_ID ? &host.ids[id] : NULL;
+    if (!cbs || !cbs->receive_cb)
+        goto err;
+
+    hb = malloc(sizeof(*hb));
+    if (!hb)
+        goto err;
+    sol_blob_setup(&hb->base, &HOST_BLOB_TYPE, mem, len);
+    hb->slot = slot;
+
+    //The receiver owns the only reference, consumed once it drops it
+    cbs->receive_cb((void *)cbs->receive_data, id, &hb->base);
+    return;
+
+err:
+    ipm_shm_consume(host.shm, slot);
+}
+
+static void
+consumed_cb(void *data, uint32_t id, void *cookie)
+{
+    struct sol_blob *message = cookie;
+    struct host_callbacks *cbs = &host.ids[id];
+
+    if (cbs->consumed_cb)
+        cbs->consumed_cb((void *)cbs->consumed_data, id, message);
+    sol_blob_unref(message);
+}
+
+static const struct ipm_shm_handlers handlers = {
+    .message = message_cb,
+    .consumed = consumed_cb
+};
+
+static bool
+fd_cb(void *data, int fd, uint32_t active_flags)
+{
+    ipm_shm_dispatch(host.shm, &handlers, NULL);
+    return true;
+}
+
+static int
+host_init(void)
+{
+    if (host.shm)
+        return 0;
+
+    host.shm = ipm_shm_attach_env();
+    if (!host.shm) {
+        SOL_WRN("No other core to talk to, run both programs with ipm-run");
+        return -ENOTCONN;
+    }
+
+    host.watch = sol_fd_add(ipm_shm_get_fd(host.shm), SOL_FD_FLAGS_IN, fd_cb,
+        NULL);
+    if (!host.watch) {
+        ipm_shm_del(host.shm);
+        host.shm = NULL;
+        return -ENOMEM;
+    }
+
+    return 0;
+}
+
+int
+sol_ipm_send(uint32_t id, struct sol_blob *message)
+{
+    int r;
+
+    if (id > IPM_HOST_MAX_ID || !message)
+        return -EINVAL;
+
+    r = host_init();
+    if (r < 0)
+        return r;
+
+    //Kept until consumed, as on the boards
+    r = ipm_shm_send(host.shm, id, message->mem, message->size,
+        sol_blob_ref(message));
+    if (r < 0)
+        sol_blob_unref(message);
+    return r == -EAGAIN ? -EBUSY : r;
+}
+
+int
+sol_ipm_set_receiver(uint32_t id, void (*receive_cb)(void *data, uint32_t id,
+    struct sol_blob *message), const void *data)
+{
+    if (id > IPM_HOST_MAX_ID)
+        return -EINVAL;
+
+    host.ids[id].receive_cb = receive_cb;
+    host.ids[id].receive_data = data;
+    return host_init();
+}
+
+int
+sol_ipm_set_consumed_callback(uint32_t id, void (*consumed_cb)(void *data,
+    uint32_t id, struct sol_blob *message), const void *data)
+{
+    if (id > IPM_HOST_MAX_ID)
+        return -EINVAL;
+
+    host.ids[id].consumed_cb = consumed_cb;
+    host.ids[id].consumed_data = data;
+    return host_init();
+}
+
+uint32_t
+sol_ipm_get_max_id(void)
+{
+    return IPM_HOST_MAX_ID;
+}
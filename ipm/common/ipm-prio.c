@@ -0,0 +1,368 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2016 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sol-ipm.h>
+#include <sol-log.h>
+#include <sol-mainloop.h>
+#include <sol-util.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "ipm-prio.h"
+
+//A queued message that could not be sent is tried again after this long
+#define RETRY_MS (5)
+
+typedef void (*message_cb)(void *data, uint32_t id, struct sol_blob *message);
+
+struct entry {
+    uint32_t id;
+    struct sol_blob *message;
+    int64_t queued_us;
+};
+
+struct queue {
+    struct entry entries[IPM_PRIO_QUEUE_LEN];
+    uint16_t head;
+    //Smooth weighted round robin state
+    int16_t current;
+    uint8_t weight;
+    struct ipm_prio_stats stats;
+};
+
+static struct {
+    bool initialized;
+    bool scheduling;
+    struct sol_timeout *retry;
+    enum ipm_prio_policy policy;
+    uint16_t window;
+    uint16_t in_flight;
+    //Messages sent and not consumed yet, message NULL for free slots
+    struct {
+        struct sol_blob *message;
+        enum ipm_prio_class class;
+        int64_t queued_us;
+    } slots[IPM_PRIO_MAX_WINDOW];
+    struct queue queues[IPM_PRIO_CLASSES];
+    struct {
+        bool set;
+        enum ipm_prio_class class;
+        message_cb consumed_cb;
+        const void *data;
+    } ids[IPM_PRIO_MAX_IDS];
+} prio;
+
+static const uint8_t default_weights[IPM_PRIO_CLASSES] = { 4, 2, 1 };
+
+static int64_t
+now_us(void)
+{
+    struct timespec ts = sol_util_timespec_get_current();
+
+    return (int64_t)ts.tv_sec * SOL_UTIL_USEC_PER_SEC +
+           ts.tv_nsec / SOL_UTIL_NSEC_PER_USEC;
+}
+
+static void
+account(uint32_t *max, uint64_t *total, int64_t us)
+{
+    if (us < 0)
+        us = 0;
+    if (us > *max)
+        *max = us > UINT32_MAX ? UINT32_MAX : us;
+    *total += us;
+}
+
+static bool
+class_fits(enum ipm_prio_class class)
+{
+    uint16_t limit = prio.window;
+
+    if (class != IPM_PRIO_HIGH)
+        limit -= IPM_PRIO_RESERVED;
+    return prio.in_flight < limit;
+}
+
+static int
+dispatch(uint32_t id, struct sol_blob *message, enum ipm_prio_class class,
+    int64_t queued_us)
+{
+    unsigned int i;
+    int r;
+
+    for (i = 0; i < prio.window; i++) {
+        if (!prio.slots[i].message)
+            break;
+    }
+    if (i == prio.window)
+        return -ENOBUFS;
+
+    //Taken first, in case it is consumed before sol_ipm_send() returns
+    prio.slots[i].message = message;
+    prio.slots[i].class = class;
+    prio.slots[i].queued_us = queued_us;
+    prio.in_flight++;
+
+    r = sol_ipm_send(id, message);
+    if (r < 0) {
+        prio.slots[i].message = NULL;
+        prio.in_flight--;
+        return r;
+    }
+
+    prio.queues[class].stats.sent++;
+    return 0;
+}
+
+static int
+pick(void)
+{
+    int c, best = -1, total = 0;
+
+    for (c = 0; c < IPM_PRIO_CLASSES; c++) {
+        struct queue *q = &prio.queues[c];
+
+        if (!q->stats.waiting || !class_fits(c))
+            continue;
+        if (prio.policy == IPM_PRIO_STRICT)
+            return c;
+
+        q->current += q->weight;
+        total += q->weight;
+        if (best < 0 || q->current > prio.queues[best].current)
+            best = c;
+    }
+
+    if (best >= 0)
+        prio.queues[best].current -= total;
+    return best;
+}
+
+//Errors that sending the same message again cannot fix
+static bool
+error_is_permanent(int r)
+{
+    return r == -EINVAL || r == -ENOENT || r == -ENOTSUP || r == -EMSGSIZE;
+}
+
+static bool retry_cb(void *data);
+
+static void
+schedule(void)
+{
+    int c;
+
+    //A message consumed while sending is picked up by the loop below
+    if (prio.scheduling)
+        return;
+    prio.scheduling = true;
+
+    while ((c = pick()) >= 0) {
+        struct queue *q = &prio.queues[c];
+        struct entry *e = &q->entries[q->head];
+        int64_t now = now_us();
+        int r;
+
+        r = dispatch(e->id, e->message, c, e->queued_us);
+        if (r < 0 && !error_is_permanent(r)) {
+            //Kept at the head, the window may be empty so a consumed
+            //callback is not enough to try it again
+            SOL_DBG("Could not send a queued message of id %" PRIu32
+                ", retrying: %d", e->id, r);
+            if (!prio.retry)
+                prio.retry = sol_timeout_add(RETRY_MS, retry_cb, NULL);
+            break;
+        }
+
+        if (r < 0) {
+            SOL_WRN("Could not send a queued message of id %" PRIu32 ": %d",
+                e->id, r);
+            q->stats.rejected++;
+        } else {
+            q->stats.queued++;
+            account(&q->stats.wait_max_us, &q->stats.wait_total_us,
+                now - e->queued_us);
+        }
+
+        sol_blob_unref(e->message);
+        e->message = NULL;
+        q->head = (q->head + 1) % IPM_PRIO_QUEUE_LEN;
+        q->stats.waiting--;
+    }
+
+    prio.scheduling = false;
+}
+
+static bool
+retry_cb(void *data)
+{
+    prio.retry = NULL;
+    schedule();
+    return false;
+}
+
+static void
+consumed_cb(void *data, uint32_t id, struct sol_blob *message)
+{
+    unsigned int i;
+
+    for (i = 0; i < prio.window; i++) {
+        struct queue *q;
+
+        if (prio.slots[i].message != message)
+            continue;
+
+        q = &prio.queues[prio.slots[i].class];
+        q->stats.consumed++;
+        account(&q->stats.latency_max_us, &q->stats.latency_total_us,
+            now_us() - prio.slots[i].queued_us);
+        prio.slots[i].message = NULL;
+        prio.in_flight--;
+        break;
+    }
+
+    if (id < IPM_PRIO_MAX_IDS && prio.ids[id].consumed_cb)
+        prio.ids[id].consumed_cb((void *)prio.ids[id].data, id, message);
+
+    schedule();
+}
+
+int
+ipm_prio_init(enum ipm_prio_policy policy, uint16_t window)
+{
+    int c;
+
+    if (window <= IPM_PRIO_RESERVED || window > IPM_PRIO_MAX_WINDOW)
+        return -EINVAL;
+    if (prio.initialized)
+        return -EALREADY;
+
+    memset(&prio, 0, sizeof(prio));
+    prio.policy = policy;
+    prio.window = window;
+    for (c = 0; c < IPM_PRIO_CLASSES; c++)
+        prio.queues[c].weight = default_weights[c];
+    prio.initialized = true;
+    return 0;
+}
+
+void
+ipm_prio_shutdown(void)
+{
+    uint32_t id;
+    int c;
+
+    if (!prio.initialized)
+        return;
+
+    if (prio.retry)
+        sol_timeout_del(prio.retry);
+
+    for (c = 0; c < IPM_PRIO_CLASSES; c++) {
+        struct queue *q = &prio.queues[c];
+
+        while (q->stats.waiting) {
+            sol_blob_unref(q->entries[q->head].message);
+            q->head = (q->head + 1) % IPM_PRIO_QUEUE_LEN;
+            q->stats.waiting--;
+        }
+    }
+
+    for (id = 0; id < IPM_PRIO_MAX_IDS; id++) {
+        if (prio.ids[id].set)
+            sol_ipm_set_consumed_callback(id, NULL, NULL);
+    }
+
+    memset(&prio, 0, sizeof(prio));
+}
+
+int
+ipm_prio_set_weight(enum ipm_prio_class class, uint8_t weight)
+{
+    if (!prio.initialized || class >= IPM_PRIO_CLASSES || !weight)
+        return -EINVAL;
+
+    prio.queues[class].weight = weight;
+    return 0;
+}
+
+int
+ipm_prio_set_class(uint32_t id, enum ipm_prio_class class,
+    void (*cb)(void *data, uint32_t id, struct sol_blob *message),
+    const void *data)
+{
+    int r;
+
+    if (!prio.initialized || id >= IPM_PRIO_MAX_IDS ||
+        class >= IPM_PRIO_CLASSES)
+        return -EINVAL;
+
+    r = sol_ipm_set_consumed_callback(id, consumed_cb, NULL);
+    if (r < 0)
+        return r;
+
+    prio.ids[id].set = true;
+    prio.ids[id].class = class;
+    prio.ids[id].consumed_cb = cb;
+    prio.ids[id].data = data;
+    return 0;
+}
+
+int
+ipm_prio_send(uint32_t id, struct sol_blob *message)
+{
+    enum ipm_prio_class class;
+    struct queue *q;
+    uint16_t tail;
+
+    if (!prio.initialized || id >= IPM_PRIO_MAX_IDS || !prio.ids[id].set ||
+        !message)
+        return -EINVAL;
+
+    class = prio.ids[id].class;
+    q = &prio.queues[class];
+
+    //Queued messages of the class go first, in order
+    if (!q->stats.waiting && class_fits(class))
+        return dispatch(id, message, class, now_us());
+
+    if (q->stats.waiting == IPM_PRIO_QUEUE_LEN) {
+        q->stats.rejected++;
+        return -ENOBUFS;
+    }
+
+    tail = (q->head + q->stats.waiting) % IPM_PRIO_QUEUE_LEN;
+    q->entries[tail].id = id;
+    q->entries[tail].message = sol_blob_ref(message);
+    q->entries[tail].queued_us = now_us();
+    q->stats.waiting++;
+    return 0;
+}
+
+int
+ipm_prio_get_stats(enum ipm_prio_class class, struct ipm_prio_stats *stats)
+{
+    if (!prio.initialized || class >= IPM_PRIO_CLASSES || !stats)
+        return -EINVAL;
+
+    *stats = prio.queues[class].stats;
+    return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2016 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+#include <sol-types.h>
+
+/*
+ * Priority classes for the messages sent on IPM ids.
+ *
+ * All ids share one window of messages sent and not consumed yet by the
+ * other core. Messages that find the window full wait in a queue per
+ * class, and as messages are consumed the next one is picked either by
+ * strict priority or by weighted round robin between the classes. The
+ * last IPM_PRIO_RESERVED slots of the window are kept for
+ * IPM_PRIO_HIGH, so a stream of bulk messages can never leave a high
+ * priority one waiting for the other core to catch up. A queued
+ * message that fails to be sent stays at the head of its queue, tried
+ * again on the next consumed callback or after a few milliseconds,
+ * unless the error is one that sending again cannot fix (-EINVAL,
+ * -ENOENT, -ENOTSUP, -EMSGSIZE): then it is dropped as rejected.
+ *
+ * Latency, from ipm_prio_send() until the message is consumed, and the
+ * time spent waiting in the queue are accounted per class.
+ */
+
+#ifndef IPM_PRIO_MAX_WINDOW
+#define IPM_PRIO_MAX_WINDOW (16)
+#endif
+#ifndef IPM_PRIO_QUEUE_LEN
+#define IPM_PRIO_QUEUE_LEN (8)
+#endif
+#ifndef IPM_PRIO_RESERVED
+#define IPM_PRIO_RESERVED (1)
+#endif
+#define IPM_PRIO_MAX_IDS (32)
+
+enum ipm_prio_class {
+    IPM_PRIO_HIGH,
+    IPM_PRIO_NORMAL,
+    IPM_PRIO_BULK,
+    IPM_PRIO_CLASSES
+};
+
+enum ipm_prio_policy {
+    IPM_PRIO_STRICT,
+    //Each class gets its weight's share of the window, 4:2:1 by default
+    IPM_PRIO_WEIGHTED
+};
+
+struct ipm_prio_stats {
+    uint32_t sent;
+    uint32_t queued; //sent after waiting for room in the window
+    uint32_t rejected; //refused with -ENOBUFS, or dropped on an error
+    uint32_t consumed;
+    uint16_t waiting; //in the queue now
+    uint32_t wait_max_us;
+    uint64_t wait_total_us;
+    uint32_t latency_max_us;
+    uint64_t latency_total_us;
+};
+
+int ipm_prio_init(enum ipm_prio_policy policy, uint16_t window);
+void ipm_prio_shutdown(void);
+
+int ipm_prio_set_weight(enum ipm_prio_class class, uint8_t weight);
+
+/*
+ * Puts id in class, taking over its consumed callback: consumed_cb (may
+ * be NULL) is called instead.
+ */
+int ipm_prio_set_class(uint32_t id, enum ipm_prio_class class,
+    void (*consumed_cb)(void *data, uint32_t id, struct sol_blob *message),
+    const void *data);
+
+/*
+ * Sends, or queues, the message, taking a reference to it. Returns
+ * -ENOBUFS when the window and the queue of its class are full.
+ */
+int ipm_prio_send(uint32_t id, struct sol_blob *message);
+
+int ipm_prio_get_stats(enum ipm_prio_class class, struct ipm_prio_stats *stats);
@@ -0,0 +1,220 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2016 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <errno.h>
+#include <string.h>
+
+#include "ipm-ring.h"
+
+#define LOAD(_p) __atomic_load_n(_p, __ATOMIC_RELAXED)
+#define LOAD_ACQUIRE(_p) __atomic_load_n(_p, __ATOMIC_ACQUIRE)
+#define STORE(_p, _v) __atomic_store_n(_p, _v, __ATOMIC_RELAXED)
+#define STORE_RELEASE(_p, _v) __atomic_store_n(_p, _v, __ATOMIC_RELEASE)
+#define FENCE() __atomic_thread_fence(__ATOMIC_SEQ_CST)
+
+/* Records are a length and a tag followed by the message, 4 byte aligned */
+#define RECORD_PAD (0xffff)
+#define RECORD_SIZE(_len) \
+    (IPM_RING_RECORD_HEADER_SIZE + (((uint32_t)(_len) + 3) & ~3u))
+
+struct record {
+    uint16_t len;
+    uint16_t tag;
+};
+
+struct ipm_ring *
+ipm_ring_init(void *mem, size_t size)
+{
+    struct ipm_ring *ring = mem;
+    uint32_t data_size = 4;
+
+    if (!mem || ((uintptr_t)mem & 3) || size < IPM_RING_HEADER_SIZE + 16)
+        return NULL;
+
+    size -= IPM_RING_HEADER_SIZE;
+    while ((size_t)data_size * 2 <= size && data_size < (1u << 30))
+        data_size *= 2;
+
+    memset(ring, 0, IPM_RING_HEADER_SIZE);
+    ring->size = data_size;
+    //The magic goes last, the other side may be looking at it
+    STORE_RELEASE(&ring->magic, IPM_RING_MAGIC);
+    return ring;
+}
+
+bool
+ipm_ring_is_valid(const struct ipm_ring *ring)
+{
+    uint32_t size;
+
+    if (!ring || LOAD_ACQUIRE(&ring->magic) != IPM_RING_MAGIC)
+        return false;
+
+    size = ring->size;
+    return size >= 16 && !(size & (size - 1));
+}
+
+uint16_t
+ipm_ring_max_message(const struct ipm_ring *ring)
+{
+    uint32_t max = ring->size / 2 - IPM_RING_RECORD_HEADER_SIZE;
+
+    return max < RECORD_PAD ? max : RECORD_PAD - 1;
+}
+
+void
+ipm_ring_producer_init(struct ipm_ring_producer *p, struct ipm_ring *ring)
+{
+    memset(p, 0, sizeof(*p));
+    p->ring = ring;
+    p->tail = LOAD(&ring->tail);
+    p->head = LOAD_ACQUIRE(&ring->head);
+}
+
+static struct record *
+record_at(struct ipm_ring *ring, uint32_t pos)
+{
+    return (struct record *)(ring->data + (pos & (ring->size - 1)));
+}
+
+int
+ipm_ring_reserve(struct ipm_ring_producer *p, uint16_t len, void **buf)
+{
+    struct ipm_ring *ring = p->ring;
+    uint32_t need = RECORD_SIZE(len), contiguous, wanted;
+
+    if (len > ipm_ring_max_message(ring))
+        return -EMSGSIZE;
+
+    //A record does not wrap, what is left at the end is skipped
+    contiguous = ring->size - (p->tail & (ring->size - 1));
+    wanted = need <= contiguous ? need : contiguous + need;
+
+    if (ring->size - (p->tail - p->head) < wanted) {
+        p->head = LOAD_ACQUIRE(&ring->head);
+        if (ring->size - (p->tail - p->head) < wanted)
+            return -EAGAIN;
+    }
+
+    if (need > contiguous) {
+        record_at(ring, p->tail)->len = RECORD_PAD;
+        p->tail += contiguous;
+    }
+
+    p->reserved = p->tail;
+    p->reserved_len = len;
+    p->has_reservation = true;
+    *buf = (uint8_t *)record_at(ring, p->tail) + IPM_RING_RECORD_HEADER_SIZE;
+    return 0;
+}
+
+bool
+ipm_ring_commit(struct ipm_ring_producer *p, uint16_t len, uint16_t tag)
+{
+    struct ipm_ring *ring = p->ring;
+    struct record *record;
+    uint32_t sleep_seq;
+
+    if (!p->has_reservation)
+        return false;
+    if (len > p->reserved_len)
+        len = p->reserved_len;
+
+    record = record_at(ring, p->reserved);
+    record->len = len;
+    record->tag = tag;
+    p->tail = p->reserved + RECORD_SIZE(len);
+    p->has_reservation = false;
+
+    STORE_RELEASE(&ring->tail, p->tail);
+
+    /*
+     * Pairs with the fence of ipm_ring_arm(): either the consumer sees
+     * the new tail, or this sees it armed and wakes it up.
+     */
+    FENCE();
+    sleep_seq = LOAD(&ring->sleep_seq);
+    if (sleep_seq == ring->wake_seq)
+        return false;
+
+    STORE(&ring->wake_seq, sleep_seq);
+    return true;
+}
+
+void
+ipm_ring_consumer_init(struct ipm_ring_consumer *c, struct ipm_ring *ring)
+{
+    memset(c, 0, sizeof(*c));
+    c->ring = ring;
+    c->head = LOAD(&ring->head);
+    c->tail = LOAD_ACQUIRE(&ring->tail);
+}
+
+const void *
+ipm_ring_peek(struct ipm_ring_consumer *c, uint16_t *len, uint16_t *tag)
+{
+    struct ipm_ring *ring = c->ring;
+    const struct record *record;
+
+    while (true) {
+        if (c->head == c->tail) {
+            c->tail = LOAD_ACQUIRE(&ring->tail);
+            if (c->head == c->tail)
+                return NULL;
+        }
+
+        record = record_at(ring, c->head);
+        if (record->len != RECORD_PAD)
+            break;
+
+        c->head += ring->size - (c->head & (ring->size - 1));
+    }
+
+    if (len)
+        *len = record->len;
+    if (tag)
+        *tag = record->tag;
+    return (const uint8_t *)record + IPM_RING_RECORD_HEADER_SIZE;
+}
+
+void
+ipm_ring_release(struct ipm_ring_consumer *c)
+{
+    const struct record *record;
+
+    if (c->head == c->tail)
+        return;
+
+    record = record_at(c->ring, c->head);
+    c->head += RECORD_SIZE(record->len);
+    STORE_RELEASE(&c->ring->head, c->head);
+}
+
+bool
+ipm_ring_arm(struct ipm_ring_consumer *c)
+{
+    struct ipm_ring *ring = c->ring;
+
+    //Skipped pads are given back too
+    STORE_RELEASE(&ring->head, c->head);
+    STORE(&ring->sleep_seq, ring->sleep_seq + 1);
+    FENCE();
+
+    c->tail = LOAD_ACQUIRE(&ring->tail);
+    return c->head == c->tail;
+}
@@ -0,0 +1,119 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2016 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Single producer, single consumer ring of variable sized messages, to
+ * be placed in memory shared by two cores.
+ *
+ * The producer reserves room for a message, writes it in place and
+ * commits it. The consumer peeks at the oldest message, reads it in
+ * place and releases it. Neither side allocates nor takes locks, and
+ * only plain loads, stores and fences are used, as the cores may have
+ * no atomic read-modify-write between them.
+ *
+ * A consumer with nothing to read arms the ring before waiting for a
+ * doorbell. Committing reports whether the consumer was armed, so the
+ * producer rings the doorbell only when the ring goes from empty to
+ * non-empty with the consumer waiting.
+ */
+
+#define IPM_RING_MAGIC (0x49504d52)
+//Control words of each side live in their own cache line
+#define IPM_RING_LINE (64)
+#define IPM_RING_HEADER_SIZE (3 * IPM_RING_LINE)
+#define IPM_RING_RECORD_HEADER_SIZE (4)
+
+struct ipm_ring {
+    uint32_t magic;
+    uint32_t size; //bytes of data, a power of two
+    uint8_t pad0[IPM_RING_LINE - 2 * sizeof(uint32_t)];
+
+    //Written by the producer only
+    uint32_t tail;
+    uint32_t wake_seq;
+    uint8_t pad1[IPM_RING_LINE - 2 * sizeof(uint32_t)];
+
+    //Written by the consumer only
+    uint32_t head;
+    uint32_t sleep_seq;
+    uint8_t pad2[IPM_RING_LINE - 2 * sizeof(uint32_t)];
+
+    uint8_t data[];
+};
+
+struct ipm_ring_producer {
+    struct ipm_ring *ring;
+    uint32_t tail;
+    uint32_t head; //last head seen, refreshed when the ring looks full
+    uint32_t reserved; //position of the reserved record
+    uint16_t reserved_len;
+    bool has_reservation;
+};
+
+struct ipm_ring_consumer {
+    struct ipm_ring *ring;
+    uint32_t head;
+    uint32_t tail; //last tail seen, refreshed when the ring looks empty
+};
+
+/*
+ * Lays out a ring over mem, done once by the side that owns the memory.
+ * The data area is the largest power of two that fits after the header.
+ */
+struct ipm_ring *ipm_ring_init(void *mem, size_t size);
+/* Checks a ring laid out by the other side. */
+bool ipm_ring_is_valid(const struct ipm_ring *ring);
+
+/* Largest message a ring takes, half of its data area. */
+uint16_t ipm_ring_max_message(const struct ipm_ring *ring);
+
+void ipm_ring_producer_init(struct ipm_ring_producer *p,
+    struct ipm_ring *ring);
+/*
+ * Reserves room for a message of up to len bytes. Returns 0 with *buf
+ * pointing into the ring, -EAGAIN if the ring is full and -EMSGSIZE if
+ * the message could never fit. Only one message is reserved at a time.
+ */
+int ipm_ring_reserve(struct ipm_ring_producer *p, uint16_t len, void **buf);
+/*
+ * Publishes the reserved message, with its final length (up to the
+ * reserved one) and an application tag. Returns true if the consumer
+ * is waiting and must be woken up.
+ */
+bool ipm_ring_commit(struct ipm_ring_producer *p, uint16_t len,
+    uint16_t tag);
+
+void ipm_ring_consumer_init(struct ipm_ring_consumer *c,
+    struct ipm_ring *ring);
+/* Oldest message, NULL if the ring is empty. */
+const void *ipm_ring_peek(struct ipm_ring_consumer *c, uint16_t *len,
+    uint16_t *tag);
+/* Gives the room of the peeked message back to the producer. */
+void ipm_ring_release(struct ipm_ring_consumer *c);
+/*
+ * To be called once the ring was drained, before waiting for the
+ * doorbell. Returns false if a message arrived meanwhile, in which case
+ * the consumer must keep reading instead of waiting.
+ */
+bool ipm_ring_arm(struct ipm_ring_consumer *c);
@@ -0,0 +1,393 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2016 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <sol-ipm.h>
+#include <sol-log.h>
+#include <sol-mainloop.h>
+#include <sol-types.h>
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ipm-rpc.h"
+
+enum kind {
+    KIND_CALL = 1,
+    KIND_REPLY
+};
+
+struct header {
+    uint8_t kind;
+    uint8_t reserved;
+    uint16_t method;
+    uint16_t call;
+    uint16_t reserved2;
+    int32_t status;
+};
+
+typedef void (*reply_cb_t)(void *data, uint16_t call, int status,
+    struct ipm_rpc_args *results);
+
+struct pending {
+    uint16_t call; //0 for free slots
+    reply_cb_t reply_cb;
+    const void *data;
+    struct sol_timeout *timeout;
+};
+
+static struct {
+    bool initialized;
+    uint32_t id;
+    const struct ipm_rpc_method *methods;
+    size_t methods_len;
+    const void *data;
+    uint16_t last_call;
+    struct pending pending[IPM_RPC_MAX_CALLS];
+} rpc;
+
+static int
+put(struct ipm_rpc_args *args, uint8_t type, const void *mem, uint16_t len)
+{
+    if (!args || args->invalid)
+        return -EINVAL;
+    if ((size_t)args->len + 1 + len > args->size) {
+        args->invalid = true;
+        return -ENOBUFS;
+    }
+
+    args->buf[args->len++] = type;
+    memcpy(args->buf + args->len, mem, len);
+    args->len += len;
+    return 0;
+}
+
+static int
+get(struct ipm_rpc_args *args, uint8_t type, void *mem, uint16_t len)
+{
+    if (!args || args->invalid)
+        return -EINVAL;
+    if ((size_t)args->pos + 1 + len > args->len ||
+        args->buf[args->pos] != type) {
+        args->invalid = true;
+        return -EINVAL;
+    }
+
+    memcpy(mem, args->buf + args->pos + 1, len);
+    args->pos += 1 + len;
+    return 0;
+}
+
+int
+ipm_rpc_put_i32(struct ipm_rpc_args *args, int32_t value)
+{
+    return put(args, IPM_RPC_TYPE_I32, &value, sizeof(value));
+}
+
+int
+ipm_rpc_put_u32(struct ipm_rpc_args *args, uint32_t value)
+{
+    return put(args, IPM_RPC_TYPE_U32, &value, sizeof(value));
+}
+
+int
+ipm_rpc_put_float(struct ipm_rpc_args *args, float value)
+{
+    return put(args, IPM_RPC_TYPE_FLOAT, &value, sizeof(value));
+}
+
+int
+ipm_rpc_put_bytes(struct ipm_rpc_args *args, const void *mem, uint16_t len)
+{
+    int r;
+
+    if (args && !args->invalid &&
+        (size_t)args->len + 1 + sizeof(len) + len > args->size) {
+        args->invalid = true;
+        return -ENOBUFS;
+    }
+
+    r = put(args, IPM_RPC_TYPE_BYTES, &len, sizeof(len));
+    if (r < 0)
+        return r;
+    memcpy(args->buf + args->len, mem, len);
+    args->len += len;
+    return 0;
+}
+
+int
+ipm_rpc_get_i32(struct ipm_rpc_args *args, int32_t *value)
+{
+    return get(args, IPM_RPC_TYPE_I32, value, sizeof(*value));
+}
+
+int
+ipm_rpc_get_u32(struct ipm_rpc_args *args, uint32_t *value)
+{
+    return get(args, IPM_RPC_TYPE_U32, value, sizeof(*value));
+}
+
+int
+ipm_rpc_get_float(struct ipm_rpc_args *args, float *value)
+{
+    return get(args, IPM_RPC_TYPE_FLOAT, value, sizeof(*value));
+}
+
+int
+ipm_rpc_get_bytes(struct ipm_rpc_args *args, const void **mem, uint16_t *len)
+{
+    uint16_t pos;
+    int r;
+
+    if (!mem)
+        return -EINVAL;
+
+    pos = args ? args->pos : 0;
+    r = get(args, IPM_RPC_TYPE_BYTES, len, sizeof(*len));
+    if (r < 0)
+        return r;
+    if ((size_t)args->pos + *len > args->len) {
+        args->pos = pos;
+        args->invalid = true;
+        return -EINVAL;
+    }
+
+    *mem = args->buf + args->pos;
+    args->pos += *len;
+    return 0;
+}
+
+static int
+send_message(enum kind kind, uint16_t method, uint16_t call, int32_t status,
+    const struct ipm_rpc_args *args)
+{
+    struct header header = {
+        .kind = kind,
+        .method = method,
+        .call = call,
+        .status = status
+    };
+    struct sol_blob *message;
+    uint16_t len = args ? args->len : 0;
+    uint8_t *mem;
+    int r;
+
+    //Header and arguments in the same blob, a single message
+    mem = malloc(sizeof(header) + len);
+    if (!mem)
+        return -ENOMEM;
+    memcpy(mem, &header, sizeof(header));
+    if (len)
+        memcpy(mem + sizeof(header), args->buf, len);
+
+    message = sol_blob_new(&SOL_BLOB_TYPE_DEFAULT, NULL, mem,
+        sizeof(header) + len);
+    if (!message) {
+        free(mem);
+        return -ENOMEM;
+    }
+
+    r = sol_ipm_send(rpc.id, message);
+    sol_blob_unref(message);
+    return r;
+}
+
+static struct pending *
+pending_find(uint16_t call)
+{
+    unsigned int i;
+
+    for (i = 0; i < IPM_RPC_MAX_CALLS; i++) {
+        if (rpc.pending[i].call == call)
+            return &rpc.pending[i];
+    }
+
+    return NULL;
+}
+
+static void
+pending_complete(struct pending *p, int status, struct ipm_rpc_args *results)
+{
+    struct pending done = *p;
+
+    //Released first, so reply_cb can make another call
+    if (p->timeout)
+        sol_timeout_del(p->timeout);
+    memset(p, 0, sizeof(*p));
+
+    done.reply_cb((void *)done.data, done.call, status,
+        status < 0 ? NULL : results);
+}
+
+static bool
+timeout_cb(void *data)
+{
+    struct pending *p = data;
+
+    p->timeout = NULL;
+    pending_complete(p, -ETIMEDOUT, NULL);
+    return false;
+}
+
+static void
+call_received(const struct header *header, struct ipm_rpc_args *args)
+{
+    uint8_t buf[IPM_RPC_MAX_ARGS];
+    struct ipm_rpc_args results = IPM_RPC_ARGS_INIT(buf);
+    int r = -ENOENT;
+    size_t i;
+
+    for (i = 0; i < rpc.methods_len; i++) {
+        if (rpc.methods[i].method == header->method) {
+            r = rpc.methods[i].handler((void *)rpc.data, header->call, args,
+                &results);
+            break;
+        }
+    }
+
+    if (r == IPM_RPC_DEFERRED)
+        return;
+    if (r >= 0 && results.invalid)
+        r = -ENOBUFS;
+
+    r = send_message(KIND_REPLY, header->method, header->call, r,
+        r < 0 ? NULL : &results);
+    if (r < 0)
+        SOL_WRN("Could not reply to call %u: %d", header->call, r);
+}
+
+static void
+receive_cb(void *data, uint32_t id, struct sol_blob *message)
+{
+    struct header header;
+    struct ipm_rpc_args args = { 0 };
+    struct pending *p;
+
+    if (message->size < sizeof(header) ||
+        message->size - sizeof(header) > UINT16_MAX) {
+        SOL_WRN("Invalid RPC message of %zu bytes", message->size);
+        goto end;
+    }
+
+    memcpy(&header, message->mem, sizeof(header));
+    args.buf = (uint8_t *)message->mem + sizeof(header);
+    args.size = args.len = message->size - sizeof(header);
+
+    if (header.kind == KIND_CALL) {
+        call_received(&header, &args);
+    } else if (header.kind == KIND_REPLY) {
+        //None for replies that came after their timeout
+        p = header.call ? pending_find(header.call) : NULL;
+        if (p)
+            pending_complete(p, header.status, &args);
+    }
+
+end:
+    sol_blob_unref(message);
+}
+
+int
+ipm_rpc_init(uint32_t id, const struct ipm_rpc_method *methods,
+    size_t methods_len, const void *data)
+{
+    int r;
+
+    if (rpc.initialized)
+        return -EALREADY;
+    if (methods_len && !methods)
+        return -EINVAL;
+
+    r = sol_ipm_set_receiver(id, receive_cb, NULL);
+    if (r < 0)
+        return r;
+
+    memset(&rpc, 0, sizeof(rpc));
+    rpc.id = id;
+    rpc.methods = methods;
+    rpc.methods_len = methods_len;
+    rpc.data = data;
+    rpc.initialized = true;
+    return 0;
+}
+
+void
+ipm_rpc_shutdown(void)
+{
+    unsigned int i;
+
+    if (!rpc.initialized)
+        return;
+
+    for (i = 0; i < IPM_RPC_MAX_CALLS; i++) {
+        if (rpc.pending[i].call)
+            pending_complete(&rpc.pending[i], -ECANCELED, NULL);
+    }
+
+    sol_ipm_set_receiver(rpc.id, NULL, NULL);
+    memset(&rpc, 0, sizeof(rpc));
+}
+
+int
+ipm_rpc_call(uint16_t method, const struct ipm_rpc_args *args,
+    uint32_t timeout_ms, reply_cb_t reply_cb, const void *data)
+{
+    struct pending *p;
+    uint16_t call;
+    int r;
+
+    if (!rpc.initialized || !reply_cb || (args && args->invalid))
+        return -EINVAL;
+
+    p = pending_find(0);
+    if (!p)
+        return -EBUSY;
+
+    do {
+        call = ++rpc.last_call;
+    } while (!call || pending_find(call));
+
+    if (timeout_ms) {
+        p->timeout = sol_timeout_add(timeout_ms, timeout_cb, p);
+        if (!p->timeout)
+            return -ENOMEM;
+    }
+
+    r = send_message(KIND_CALL, method, call, 0, args);
+    if (r < 0) {
+        if (p->timeout)
+            sol_timeout_del(p->timeout);
+        p->timeout = NULL;
+        return r;
+    }
+
+    p->call = call;
+    p->reply_cb = reply_cb;
+    p->data = data;
+    return call;
+}
+
+int
+ipm_rpc_reply(uint16_t call, int status, const struct ipm_rpc_args *results)
+{
+    if (!rpc.initialized || (results && results->invalid))
+        return -EINVAL;
+
+    //Replies are matched by call id only
+    return send_message(KIND_REPLY, 0, call, status,
+        status < 0 ? NULL : results);
+}
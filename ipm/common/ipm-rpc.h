@@ -0,0 +1,107 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2016 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Remote calls between the cores over a single IPM id.
+ *
+ * A call is one IPM message, its method, call id and arguments packed in
+ * the same blob, and its reply is another one. Many calls may be in
+ * flight at once, replies are matched by call id in whatever order they
+ * come, and a call without reply in time completes with -ETIMEDOUT.
+ *
+ * Each core may both call and serve: the methods it serves are a table
+ * given to ipm_rpc_init(). A handler returns the status of the call
+ * (negative errno on failure) with its results written, or
+ * IPM_RPC_DEFERRED to reply later with ipm_rpc_reply().
+ */
+
+#ifndef IPM_RPC_MAX_CALLS
+#define IPM_RPC_MAX_CALLS (8)
+#endif
+//Arguments or results of a call, in bytes, once packed
+#ifndef IPM_RPC_MAX_ARGS
+#define IPM_RPC_MAX_ARGS (128)
+#endif
+
+#define IPM_RPC_DEFERRED (1)
+
+enum ipm_rpc_type {
+    IPM_RPC_TYPE_I32 = 1,
+    IPM_RPC_TYPE_U32,
+    IPM_RPC_TYPE_FLOAT,
+    IPM_RPC_TYPE_BYTES
+};
+
+/*
+ * Typed values, each packed as a type byte followed by the value, read
+ * back in the order they were put. A put that does not fit, or a get of
+ * another type than the next value, fails and flags args as invalid.
+ */
+struct ipm_rpc_args {
+    uint8_t *buf;
+    uint16_t size;
+    uint16_t len;
+    uint16_t pos;
+    bool invalid;
+};
+
+#define IPM_RPC_ARGS_INIT(_buf) { .buf = (_buf), .size = sizeof(_buf) }
+
+int ipm_rpc_put_i32(struct ipm_rpc_args *args, int32_t value);
+int ipm_rpc_put_u32(struct ipm_rpc_args *args, uint32_t value);
+int ipm_rpc_put_float(struct ipm_rpc_args *args, float value);
+int ipm_rpc_put_bytes(struct ipm_rpc_args *args, const void *mem, uint16_t len);
+
+int ipm_rpc_get_i32(struct ipm_rpc_args *args, int32_t *value);
+int ipm_rpc_get_u32(struct ipm_rpc_args *args, uint32_t *value);
+int ipm_rpc_get_float(struct ipm_rpc_args *args, float *value);
+/* mem points into args, valid as long as args is */
+int ipm_rpc_get_bytes(struct ipm_rpc_args *args, const void **mem,
+    uint16_t *len);
+
+struct ipm_rpc_method {
+    uint16_t method;
+    int (*handler)(void *data, uint16_t call, struct ipm_rpc_args *args,
+        struct ipm_rpc_args *results);
+};
+
+int ipm_rpc_init(uint32_t id, const struct ipm_rpc_method *methods,
+    size_t methods_len, const void *data);
+/* Pending calls complete with -ECANCELED */
+void ipm_rpc_shutdown(void);
+
+/*
+ * Returns the call id, positive, or a negative errno. reply_cb is
+ * called once, with the status of the call and its results (NULL unless
+ * the status is not negative).
+ */
+int ipm_rpc_call(uint16_t method, const struct ipm_rpc_args *args,
+    uint32_t timeout_ms,
+    void (*reply_cb)(void *data, uint16_t call, int status,
+    struct ipm_rpc_args *results),
+    const void *data);
+
+/* Replies to a call its handler deferred, results may be NULL */
+int ipm_rpc_reply(uint16_t call, int status,
+    const struct ipm_rpc_args *results);
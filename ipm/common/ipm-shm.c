@@ -0,0 +1,328 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2016 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "ipm-ring.h"
+#include "ipm-shm.h"
+
+/*
+ * A ring holds at most a record per slot of each side: the messages of
+ * this side not yet read and the consumed notifications of the other's.
+ */
+#define RING_SIZE (IPM_SHM_SLOTS * 128)
+
+enum record_tag {
+    RECORD_MESSAGE = 1,
+    RECORD_CONSUMED
+};
+
+struct message_record {
+    uint32_t id;
+    uint32_t len;
+    uint16_t slot;
+};
+
+struct consumed_record {
+    uint16_t slot;
+};
+
+//Written by one side only
+struct side_region {
+    uint8_t ring[IPM_RING_HEADER_SIZE + RING_SIZE]
+        __attribute__((aligned(IPM_RING_LINE)));
+    uint8_t slots[IPM_SHM_SLOTS][IPM_SHM_SLOT_SIZE];
+};
+
+struct region {
+    struct side_region sides[IPM_SHM_SIDES];
+};
+
+struct ipm_shm {
+    struct region *region;
+    unsigned int side;
+    int fds[1 + IPM_SHM_SIDES];
+
+    struct ipm_ring_producer tx;
+    struct ipm_ring_consumer rx;
+
+    uint16_t free_slots[IPM_SHM_SLOTS];
+    unsigned int free_len;
+    struct {
+        uint32_t id;
+        void *cookie;
+    } sent[IPM_SHM_SLOTS];
+};
+
+int
+ipm_shm_create(int fds[1 + IPM_SHM_SIDES])
+{
+    struct region *region;
+    unsigned int i;
+    int r = -errno;
+
+    fds[0] = memfd_create("ipm-host", 0);
+    if (fds[0] < 0)
+        return -errno;
+    if (ftruncate(fds[0], sizeof(struct region)) < 0)
+        goto err_fd;
+
+    region = mmap(NULL, sizeof(struct region), PROT_READ | PROT_WRITE,
+        MAP_SHARED, fds[0], 0);
+    if (region == MAP_FAILED)
+        goto err_fd;
+    //Both rings are laid out before any side looks at them
+    for (i = 0; i < IPM_SHM_SIDES; i++)
+        ipm_ring_init(region->sides[i].ring, sizeof(region->sides[i].ring));
+    munmap(region, sizeof(struct region));
+
+    for (i = 0; i < IPM_SHM_SIDES; i++) {
+        fds[1 + i] = eventfd(0, EFD_NONBLOCK);
+        if (fds[1 + i] < 0)
+            goto err_eventfd;
+    }
+
+    return 0;
+
+err_eventfd:
+    r = -errno;
+    while (i--)
+        close(fds[1 + i]);
+    close(fds[0]);
+    return r;
+
+err_fd:
+    r = -errno;
+    close(fds[0]);
+    return r;
+}
+
+int
+ipm_shm_env(const int fds[1 + IPM_SHM_SIDES], unsigned int side, char *buf,
+    size_t len)
+{
+    int r;
+
+    r = snprintf(buf, len, "%u,%d,%d,%d", side, fds[0], fds[1], fds[2]);
+    if (r < 0 || (size_t)r >= len)
+        return -ENOBUFS;
+    return 0;
+}
+
+static void
+wake(int fd)
+{
+    uint64_t one = 1;
+
+    if (write(fd, &one, sizeof(one)) < 0 && errno != EAGAIN)
+        perror("Could not wake the other side up");
+}
+
+struct ipm_shm *
+ipm_shm_attach(const int fds[1 + IPM_SHM_SIDES], unsigned int side)
+{
+    struct ipm_shm *shm;
+    struct ipm_ring *tx, *rx;
+    unsigned int i;
+
+    if (side >= IPM_SHM_SIDES)
+        return NULL;
+
+    shm = calloc(1, sizeof(*shm));
+    if (!shm)
+        return NULL;
+
+    shm->region = mmap(NULL, sizeof(struct region), PROT_READ | PROT_WRITE,
+        MAP_SHARED, fds[0], 0);
+    if (shm->region == MAP_FAILED)
+        goto err_map;
+
+    tx = (struct ipm_ring *)shm->region->sides[side].ring;
+    rx = (struct ipm_ring *)shm->region->sides[!side].ring;
+    if (!ipm_ring_is_valid(tx) || !ipm_ring_is_valid(rx))
+        goto err_ring;
+
+    shm->side = side;
+    memcpy(shm->fds, fds, sizeof(shm->fds));
+    ipm_ring_producer_init(&shm->tx, tx);
+    ipm_ring_consumer_init(&shm->rx, rx);
+
+    for (i = 0; i < IPM_SHM_SLOTS; i++)
+        shm->free_slots[i] = IPM_SHM_SLOTS - 1 - i;
+    shm->free_len = IPM_SHM_SLOTS;
+
+    //The other side may have sent something already
+    if (!ipm_ring_arm(&shm->rx))
+        wake(shm->fds[1 + side]);
+
+    return shm;
+
+err_ring:
+    munmap(shm->region, sizeof(struct region));
+err_map:
+    free(shm);
+    return NULL;
+}
+
+struct ipm_shm *
+ipm_shm_attach_env(void)
+{
+    const char *env = getenv(IPM_SHM_ENV);
+    int fds[1 + IPM_SHM_SIDES];
+    unsigned int side;
+
+    if (!env || sscanf(env, "%u,%d,%d,%d", &side, &fds[0], &fds[1],
+        &fds[2]) != 4)
+        return NULL;
+
+    return ipm_shm_attach(fds, side);
+}
+
+void
+ipm_shm_del(struct ipm_shm *shm)
+{
+    unsigned int i;
+
+    if (!shm)
+        return;
+
+    munmap(shm->region, sizeof(struct region));
+    for (i = 0; i < 1 + IPM_SHM_SIDES; i++)
+        close(shm->fds[i]);
+    free(shm);
+}
+
+int
+ipm_shm_get_fd(const struct ipm_shm *shm)
+{
+    return shm->fds[1 + shm->side];
+}
+
+unsigned int
+ipm_shm_get_side(const struct ipm_shm *shm)
+{
+    return shm->side;
+}
+
+static int
+push(struct ipm_shm *shm, uint16_t tag, const void *record, uint16_t len)
+{
+    void *buf;
+    int r;
+
+    r = ipm_ring_reserve(&shm->tx, len, &buf);
+    if (r < 0)
+        return r;
+
+    memcpy(buf, record, len);
+    if (ipm_ring_commit(&shm->tx, len, tag))
+        wake(shm->fds[1 + !shm->side]);
+    return 0;
+}
+
+int
+ipm_shm_send(struct ipm_shm *shm, uint32_t id, const void *mem, size_t len,
+    void *cookie)
+{
+    struct message_record record;
+    int r;
+
+    if (len > IPM_SHM_SLOT_SIZE)
+        return -EMSGSIZE;
+    if (!shm->free_len)
+        return -EAGAIN;
+
+    record.id = id;
+    record.len = len;
+    record.slot = shm->free_slots[--shm->free_len];
+    memcpy(shm->region->sides[shm->side].slots[record.slot], mem, len);
+
+    r = push(shm, RECORD_MESSAGE, &record, sizeof(record));
+    if (r < 0) {
+        shm->free_len++;
+        return r;
+    }
+
+    shm->sent[record.slot].id = id;
+    shm->sent[record.slot].cookie = cookie;
+    return 0;
+}
+
+int
+ipm_shm_consume(struct ipm_shm *shm, uint16_t slot)
+{
+    struct consumed_record record = { .slot = slot };
+
+    //Never full, see RING_SIZE
+    return push(shm, RECORD_CONSUMED, &record, sizeof(record));
+}
+
+void
+ipm_shm_dispatch(struct ipm_shm *shm, const struct ipm_shm_handlers *handlers,
+    void *data)
+{
+    struct side_region *peer = &shm->region->sides[!shm->side];
+    const void *record;
+    uint16_t len, tag;
+    uint64_t count;
+
+    if (read(shm->fds[1 + shm->side], &count, sizeof(count)) < 0 &&
+        errno != EAGAIN)
+        perror("Could not read the eventfd");
+
+    do {
+        while ((record = ipm_ring_peek(&shm->rx, &len, &tag))) {
+            struct message_record msg;
+            struct consumed_record consumed;
+            uint32_t id;
+            void *cookie;
+
+            //Records are copied out so the ring is released first
+            if (tag == RECORD_MESSAGE && len == sizeof(msg)) {
+                memcpy(&msg, record, sizeof(msg));
+                ipm_ring_release(&shm->rx);
+                if (msg.slot >= IPM_SHM_SLOTS || msg.len > IPM_SHM_SLOT_SIZE)
+                    continue;
+                if (handlers->message)
+                    handlers->message(data, msg.id, msg.slot,
+                        peer->slots[msg.slot], msg.len);
+                else
+                    ipm_shm_consume(shm, msg.slot);
+            } else if (tag == RECORD_CONSUMED && len == sizeof(consumed)) {
+                memcpy(&consumed, record, sizeof(consumed));
+                ipm_ring_release(&shm->rx);
+                if (consumed.slot >= IPM_SHM_SLOTS ||
+                    shm->free_len == IPM_SHM_SLOTS)
+                    continue;
+                id = shm->sent[consumed.slot].id;
+                cookie = shm->sent[consumed.slot].cookie;
+                shm->free_slots[shm->free_len++] = consumed.slot;
+                if (handlers->consumed)
+                    handlers->consumed(data, id, cookie);
+            } else
+                ipm_ring_release(&shm->rx);
+        }
+    } while (!ipm_ring_arm(&shm->rx));
+}
@@ -0,0 +1,88 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2016 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Two "cores" as two Linux processes: the messages of each side are
+ * copied to slots of a shared memory region and announced on a ring
+ * (see ipm-ring.h), the other side is woken up through its eventfd. A
+ * slot is given back when the receiver consumes the message, which the
+ * sender is told about, as with blobs sent over sol_ipm.
+ *
+ * It does not need Soletta, ipm-host.c builds sol_ipm on top of it.
+ */
+
+#define IPM_SHM_SIDES (2)
+#ifndef IPM_SHM_SLOTS
+#define IPM_SHM_SLOTS (64)
+#endif
+#ifndef IPM_SHM_SLOT_SIZE
+#define IPM_SHM_SLOT_SIZE (4096)
+#endif
+//Environment variable the sides are given their descriptors in
+#define IPM_SHM_ENV "IPM_HOST"
+
+struct ipm_shm;
+
+struct ipm_shm_handlers {
+    /*
+     * A message from the other side. It stays valid until
+     * ipm_shm_consume() is called on its slot, which may be later.
+     */
+    void (*message)(void *data, uint32_t id, uint16_t slot, const void *mem,
+        size_t len);
+    /* A message of this side was consumed, with the cookie it was sent with. */
+    void (*consumed)(void *data, uint32_t id, void *cookie);
+};
+
+/*
+ * Creates the region and the eventfds of both sides, to be passed to the
+ * processes: fds gets the region, then the eventfd of each side.
+ */
+int ipm_shm_create(int fds[1 + IPM_SHM_SIDES]);
+/* Writes the value of IPM_SHM_ENV for the given side. */
+int ipm_shm_env(const int fds[1 + IPM_SHM_SIDES], unsigned int side,
+    char *buf, size_t len);
+
+struct ipm_shm *ipm_shm_attach(const int fds[1 + IPM_SHM_SIDES],
+    unsigned int side);
+/* Attaches to the descriptors found in IPM_SHM_ENV, NULL if not set. */
+struct ipm_shm *ipm_shm_attach_env(void);
+void ipm_shm_del(struct ipm_shm *shm);
+
+/* Readable when there is something to dispatch. */
+int ipm_shm_get_fd(const struct ipm_shm *shm);
+unsigned int ipm_shm_get_side(const struct ipm_shm *shm);
+
+/*
+ * Copies a message to a free slot. Returns -EAGAIN while all slots wait
+ * to be consumed and -EMSGSIZE if len is over IPM_SHM_SLOT_SIZE.
+ */
+int ipm_shm_send(struct ipm_shm *shm, uint32_t id, const void *mem,
+    size_t len, void *cookie);
+/* Gives back the slot of a received message. */
+int ipm_shm_consume(struct ipm_shm *shm, uint16_t slot);
+
+/* Calls the handlers for everything the other side sent. */
+void ipm_shm_dispatch(struct ipm_shm *shm,
+    const struct ipm_shm_handlers *handlers, void *data);
@@ -0,0 +1,476 @@
+/*
+ * This file is part of the Soletta Project
+ *
+ * Copyright (C) 2016 Intel Corporation. All rights reserved.
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *     http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Values of different types over a single IPM id.
+ *
+ * ipm/struct-writer keeps the latest value of each of its fields in a
+ * record and sends the whole record, a single IPM message, once any
+ * changes. Its layout is fixed by the fields option, the same on both
+ * cores:
+ *
+ *     signature (4 bytes), set and changed fields (a bit each), then
+ *     the fields in order, each in a slot of the size of its type
+ *
+ * The signature, 4 bits per field type, tells ipm/struct-reader whether
+ * the record was packed with the fields it expects.
+ */
+
+#include <sol-flow.h>
+#include <sol-flow-packet.h>
+#include <sol-ipm.h>
+#include <sol-log.h>
+#include <sol-mainloop.h>
+#include <sol-types.h>
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ipm-struct-gen.h"
+
+#define STRUCT_MAX_FIELDS (8)
+//Longer strings are truncated, terminator included
+#ifndef STRUCT_STRING_SIZE
+#define STRUCT_STRING_SIZE (32)
+#endif
+
+enum field_type {
+    FIELD_BOOLEAN = 1,
+    FIELD_BYTE,
+    FIELD_INT,
+    FIELD_FLOAT,
+    FIELD_STRING,
+    FIELD_RGB,
+    FIELD_DIRECTION_VECTOR,
+    FIELD_EMPTY
+};
+
+union field_value {
+    uint8_t byte; //booleans too
+    struct sol_irange irange;
+    struct sol_drange drange;
+    char string[STRUCT_STRING_SIZE];
+    struct sol_rgb rgb;
+    struct sol_direction_vector direction_vector;
+};
+
+static const struct {
+    const char *name;
+    uint8_t size;
+} field_types[] = {
+    [FIELD_BOOLEAN] = { "boolean", sizeof(uint8_t) },
+    [FIELD_BYTE] = { "byte", sizeof(uint8_t) },
+    [FIELD_INT] = { "int", sizeof(struct sol_irange) },
+    [FIELD_FLOAT] = { "float", sizeof(struct sol_drange) },
+    [FIELD_STRING] = { "string", STRUCT_STRING_SIZE },
+    [FIELD_RGB] = { "rgb", sizeof(struct sol_rgb) },
+    [FIELD_DIRECTION_VECTOR] = { "direction-vector",
+                                 sizeof(struct sol_direction_vector) },
+    [FIELD_EMPTY] = { "empty", 0 }
+};
+
+struct record_header {
+    uint32_t signature;
+    uint8_t set;
+    uint8_t changed;
+    uint16_t reserved;
+};
+
+#define RECORD_MAX_SIZE \
+    (sizeof(struct record_header) + \
+    STRUCT_MAX_FIELDS * sizeof(union field_value))
+
+struct layout {
+    uint8_t types[STRUCT_MAX_FIELDS];
+    uint16_t offsets[STRUCT_MAX_FIELDS];
+    uint16_t size;
+    uint8_t count;
+    uint8_t events; //empty fields
+    uint32_t signature;
+};
+
+static int
+layout_parse(struct layout *layout, const char *fields)
+{
+    const char *p = fields, *end;
+    size_t len;
+    uint8_t type;
+
+    memset(layout, 0, sizeof(*layout));
+    layout->size = sizeof(struct record_header);
+
+    while (p && *p) {
+        if (*p == ' ') {
+            p++;
+            continue;
+        }
+        for (end = p; *end && *end != ' '; end++)
+            ;
+        len = end - p;
+
+        for (type = FIELD_BOOLEAN; type <= FIELD_EMPTY; type++) {
+            if (!strncmp(field_types[type].name, p, len) &&
+                !field_types[type].name[len])
+                break;
+        }
+        if (type > FIELD_EMPTY) {
+            SOL_WRN("Unknown field type '%.*s'", (int)len, p);
+            return -EINVAL;
+        }
+        if (layout->count == STRUCT_MAX_FIELDS) {
+            SOL_WRN("Too many fields in '%s', up to %d", fields,
+                STRUCT_MAX_FIELDS);
+            return -EINVAL;
+        }
+
+        if (type == FIELD_EMPTY)
+            layout->events |= 1 << layout->count;
+        layout->signature |= (uint32_t)type << (4 * layout->count);
+        layout->types[layout->count] = type;
+        layout->offsets[layout->count++] = layout->size;
+        layout->size += field_types[type].size;
+        p = end;
+    }
+
+    if (!layout->count) {
+        SOL_WRN("No fields given");
+        return -EINVAL;
+    }
+    return 0;
+}
+
+static int
+field_get(uint8_t type, const struct sol_flow_packet *packet,
+    union field_value *value)
+{
+    const char *string;
+    bool b;
+    int r;
+
+    memset(value, 0, sizeof(*value));
+
+    switch (type) {
+    case FIELD_BOOLEAN:
+        r = sol_flow_packet_get_bool(packet, &b);
+        value->byte = b;
+        return r;
+    case FIELD_BYTE:
+        return sol_flow_packet_get_byte(packet, &value->byte);
+    case FIELD_INT:
+        return sol_flow_packet_get_irange(packet, &value->irange);
+    case FIELD_FLOAT:
+        return sol_flow_packet_get_drange(packet, &value->drange);
+    case FIELD_STRING:
+        r = sol_flow_packet_get_string(packet, &string);
+        if (r >= 0)
+            strncpy(value->string, string, STRUCT_STRING_SIZE - 1);
+        return r;
+    case FIELD_RGB:
+        return sol_flow_packet_get_rgb(packet, &value->rgb);
+    case FIELD_DIRECTION_VECTOR:
+        return sol_flow_packet_get_direction_vector(packet,
+            &value->direction_vector);
+    default:
+        return 0;
+    }
+}
+
+static int
+field_send(struct sol_flow_node *node, uint16_t port, uint8_t type,
+    const union field_value *value)
+{
+    switch (type) {
+    case FIELD_BOOLEAN:
+        return sol_flow_send_bool_packet(node, port, value->byte);
+    case FIELD_BYTE:
+        return sol_flow_send_byte_packet(node, port, value->byte);
+    case FIELD_INT:
+        return sol_flow_send_irange_packet(node, port, &value->irange);
+    case FIELD_FLOAT:
+        return sol_flow_send_drange_packet(node, port, &value->drange);
+    case FIELD_STRING:
+        return sol_flow_send_string_packet(node, port, value->string);
+    case FIELD_RGB:
+        return sol_flow_send_rgb_packet(node, port, &value->rgb);
+    case FIELD_DIRECTION_VECTOR:
+        return sol_flow_send_direction_vector_packet(node, port,
+            &value->direction_vector);
+    default:
+        return sol_flow_send_empty_packet(node, port);
+    }
+}
+
+struct struct_writer_data {
+    struct sol_flow_node *node;
+    struct sol_timeout *send_timeout;
+    struct sol_timeout *tick_timeout;
+    struct layout layout;
+    uint8_t record[RECORD_MAX_SIZE]; //latest values, after the header
+    uint32_t id;
+    uint32_t latency;
+    uint8_t set;
+    uint8_t changed;
+};
+
+static int
+struct_writer_send(struct struct_writer_data *mdata, uint8_t changed)
+{
+    struct record_header header = {
+        .signature = mdata->layout.signature,
+        .set = mdata->set,
+        .changed = changed
+    };
+    struct sol_blob *message;
+    uint8_t *mem;
+    int r;
+
+    if (mdata->send_timeout) {
+        sol_timeout_del(mdata->send_timeout);
+        mdata->send_timeout = NULL;
+    }
+    mdata->changed = 0;
+    if (!changed)
+        return 0;
+
+    mem = malloc(mdata->layout.size);
+    SOL_NULL_CHECK(mem, -ENOMEM);
+    memcpy(mdata->record, &header, sizeof(header));
+    memcpy(mem, mdata->record, mdata->layout.size);
+
+    message = sol_blob_new(&SOL_BLOB_TYPE_DEFAULT, NULL, mem,
+        mdata->layout.size);
+    if (!message) {
+        free(mem);
+        return -ENOMEM;
+    }
+
+    r = sol_ipm_send(mdata->id, message);
+    sol_blob_unref(message);
+    if (r < 0)
+        SOL_WRN("Could not send record on IPM id %" PRIu32 ": %d", mdata->id,
+            r);
+    return r;
+}
+
+static bool
+send_cb(void *data)
+{
+    struct struct_writer_data *mdata = data;
+
+    mdata->send_timeout = NULL;
+    struct_writer_send(mdata, mdata->changed);
+    return false;
+}
+
+static bool
+tick_cb(void *data)
+{
+    struct struct_writer_data *mdata = data;
+
+    //Every field set so far, but events, and the changes pending
+    struct_writer_send(mdata,
+        (mdata->set & ~mdata->layout.events) | mdata->changed);
+    return true;
+}
+
+static void
+consumed_cb(void *data, uint32_t id, struct sol_blob *message)
+{
+    struct struct_writer_data *mdata = data;
+
+    sol_flow_send_empty_packet(mdata->node,
+        SOL_FLOW_NODE_TYPE_IPM_STRUCT_WRITER__OUT__CONSUMED);
+}
+
+static int
+struct_writer_open(struct sol_flow_node *node, void *data,
+    const struct sol_flow_node_options *options)
+{
+    struct struct_writer_data *mdata = data;
+    const struct sol_flow_node_type_ipm_struct_writer_options *opts;
+    int r;
+
+    SOL_FLOW_NODE_OPTIONS_SUB_API_CHECK(options,
+        SOL_FLOW_NODE_TYPE_IPM_STRUCT_WRITER_OPTIONS_API_VERSION, -EINVAL);
+    opts = (const struct sol_flow_node_type_ipm_struct_writer_options *)options;
+
+    if (opts->id < 0 || (uint32_t)opts->id > sol_ipm_get_max_id() ||
+        opts->latency < 0 || opts->interval < 0) {
+        SOL_WRN("Invalid options, id must be up to %" PRIu32,
+            sol_ipm_get_max_id());
+        return -EINVAL;
+    }
+
+    memset(mdata, 0, sizeof(*mdata));
+    r = layout_parse(&mdata->layout, opts->fields);
+    if (r < 0)
+        return r;
+
+    mdata->node = node;
+    mdata->id = opts->id;
+    mdata->latency = opts->latency;
+
+    r = sol_ipm_set_consumed_callback(mdata->id, consumed_cb, mdata);
+    if (r < 0)
+        return r;
+
+    if (opts->interval) {
+        mdata->tick_timeout = sol_timeout_add(opts->interval, tick_cb, mdata);
+        if (!mdata->tick_timeout) {
+            sol_ipm_set_consumed_callback(mdata->id, NULL, NULL);
+            return -ENOMEM;
+        }
+    }
+
+    return 0;
+}
+
+static void
+struct_writer_close(struct sol_flow_node *node, void *data)
+{
+    struct struct_writer_data *mdata = data;
+
+    struct_writer_send(mdata, mdata->changed);
+    if (mdata->tick_timeout)
+        sol_timeout_del(mdata->tick_timeout);
+    sol_ipm_set_consumed_callback(mdata->id, NULL, NULL);
+}
+
+static int
+struct_writer_process(struct sol_flow_node *node, void *data, uint16_t port,
+    uint16_t conn_id, const struct sol_flow_packet *packet)
+{
+    struct struct_writer_data *mdata = data;
+    uint16_t field = port - SOL_FLOW_NODE_TYPE_IPM_STRUCT_WRITER__IN__IN;
+    union field_value value;
+    uint8_t type, *slot;
+    int r;
+
+    if (field >= mdata->layout.count) {
+        SOL_WRN("No field for IN[%" PRIu16 "], only %u fields", field,
+            mdata->layout.count);
+        return -EINVAL;
+    }
+
+    type = mdata->layout.types[field];
+    r = field_get(type, packet, &value);
+    SOL_INT_CHECK(r, < 0, r);
+
+    //Empty fields are events, they always count as changed
+    slot = mdata->record + mdata->layout.offsets[field];
+    if (type != FIELD_EMPTY && (mdata->set & (1 << field)) &&
+        !memcmp(slot, &value, field_types[type].size))
+        return 0;
+
+    memcpy(slot, &value, field_types[type].size);
+    mdata->set |= 1 << field;
+    mdata->changed |= 1 << field;
+
+    //Changes to other fields in the meantime go in the same record
+    if (!mdata->send_timeout) {
+        mdata->send_timeout = sol_timeout_add(mdata->latency, send_cb, mdata);
+        SOL_NULL_CHECK(mdata->send_timeout, -ENOMEM);
+    }
+    return 0;
+}
+
+struct struct_reader_data {
+    struct sol_flow_node *node;
+    struct layout layout;
+    uint32_t id;
+};
+
+static void
+receive_cb(void *data, uint32_t id, struct sol_blob *message)
+{
+    struct struct_reader_data *mdata = data;
+    const uint8_t *record = message->mem;
+    struct record_header header;
+    union field_value value;
+    uint8_t i, type;
+
+    if (message->size != mdata->layout.size)
+        goto err;
+    memcpy(&header, record, sizeof(header));
+    if (header.signature != mdata->layout.signature)
+        goto err;
+
+    for (i = 0; i < mdata->layout.count; i++) {
+        if (!(header.changed & (1 << i)))
+            continue;
+
+        type = mdata->layout.types[i];
+        memset(&value, 0, sizeof(value));
+        memcpy(&value, record + mdata->layout.offsets[i],
+            field_types[type].size);
+        if (type == FIELD_STRING)
+            value.string[STRUCT_STRING_SIZE - 1] = '\0';
+        field_send(mdata->node, SOL_FLOW_NODE_TYPE_IPM_STRUCT_READER__OUT__OUT
+            + i, type, &value);
+    }
+
+    sol_blob_unref(message);
+    return;
+
+err:
+    sol_flow_send_error_packet(mdata->node, EINVAL,
+        "Record of %zu bytes on IPM id %" PRIu32 " not packed with the"
+        " fields expected", message->size, id);
+    sol_blob_unref(message);
+}
+
+static int
+struct_reader_open(struct sol_flow_node *node, void *data,
+    const struct sol_flow_node_options *options)
+{
+    struct struct_reader_data *mdata = data;
+    const struct sol_flow_node_type_ipm_struct_reader_options *opts;
+    int r;
+
+    SOL_FLOW_NODE_OPTIONS_SUB_API_CHECK(options,
+        SOL_FLOW_NODE_TYPE_IPM_STRUCT_READER_OPTIONS_API_VERSION, -EINVAL);
+    opts = (const struct sol_flow_node_type_ipm_struct_reader_options *)options;
+
+    if (opts->id < 0 || (uint32_t)opts->id > sol_ipm_get_max_id()) {
+        SOL_WRN("Invalid IPM id %" PRId32 ", up to %" PRIu32, opts->id,
+            sol_ipm_get_max_id());
+        return -EINVAL;
+    }
+
+    r = layout_parse(&mdata->layout, opts->fields);
+    if (r < 0)
+        return r;
+
+    mdata->node = node;
+    mdata->id = opts->id;
+    return sol_ipm_set_receiver(mdata->id, receive_cb, mdata);
+}
+
+static void
+struct_reader_close(struct sol_flow_node *node, void *data)
+{
+    struct struct_reader_data *mdata = data;
+
+    sol_ipm_set_receiver(mdata->id, NULL, NULL);
+}
+
+#include "ipm-struct-gen.c"
@@ -26,14 +26,56 @@
 #include <string.h>
 #include <sys/time.h>
 
+#ifdef IPM_RING
+#include "ipm-channel.h"
+#else
+#include "ipm-credit.h"
+#endif
+
 #define MESSAGE_ID 1
 
+#ifdef IPM_RING
+#define SETUP_ID 2
+#define DOORBELL_ID 3
+#else
+/* Messages the other core may hold, and messages waiting for it */
+#define CREDITS 2
+#define QUEUE_LEN 2
+/* Readings streamed by the ARC when built with IPM_PRIO=y */
+#define BULK_ID 4
+#define BULK_HOLD 40
+#endif
+
 static const char *samples[] = {"abcdefghijklmno",
                               "abcdefghijklmnopqrstuvwywz",
                               "abcdefghijklmnopqrstuvwywz0123456789",
                               "abcdefghijklmnopqrstuvwywz0123456789ABCDEF"};
 static uint32_t count;
 
+#ifdef IPM_RING
+static bool
+timeout_send_cb(void *data)
+{
+    const char *str = samples[count % 4];
+    int r;
+
+    //Written straight to the ring, no blob nor consumed confirmation
+    printf("x86 sending %s\n", str);
+    r = ipm_channel_send(MESSAGE_ID, str, strlen(str));
+    if (r < 0) {
+        printf("x86 could not send message: %d\n", r);
+    }
+
+    count++;
+    return true;
+}
+
+static void
+ring_receive_cb(void *data, uint16_t tag, const void *msg, uint16_t len)
+{
+    printf("x86 received %u bytes: %.*s\n", len, (int)len, (const char *)msg);
+}
+#else
 static void
 consumed_cb(void *data, uint32_t id, struct sol_blob *message)
 {
@@ -51,10 +93,19 @@ timeout_send_cb(void *data)
         samples[count % 4], strlen(samples[count % 4]));
 
     printf("x86 sending %p - %s\n", message->mem, (char *)message->mem);
-    r = sol_ipm_send(MESSAGE_ID, message);
-    if (r < 0) {
+    r = ipm_credit_send(MESSAGE_ID, message);
+    if (r == -ENOBUFS) {
+        struct ipm_credit_stats stats;
+
+        ipm_credit_get_stats(MESSAGE_ID, &stats);
+        printf("x86 dropping message, ARC is behind (%" PRIu32 " stalls)\n",
+            stats.stalls);
+    } else if (r < 0) {
         printf("x86 could not send message: %d\n", r);
     }
+    /* Otherwise released once consumed */
+    if (r < 0)
+        sol_blob_unref(message);
 
     count++;
     return true;
@@ -80,17 +131,50 @@ receiver_cb(void *data, uint32_t id, struct sol_blob *message)
     sol_timeout_add(3000, unref_cb, message);
 }
 
+static bool
+bulk_unref_cb(void *data)
+{
+    sol_blob_unref(data);
+
+    return false;
+}
+
+static void
+bulk_receiver_cb(void *data, uint32_t id, struct sol_blob *message)
+{
+    //Slower than the ARC produces them, so its window fills up
+    sol_timeout_add(BULK_HOLD, bulk_unref_cb, message);
+}
+#endif
+
 static void
 startup(void)
 {
+#ifdef IPM_RING
+    if (ipm_channel_init(SETUP_ID, DOORBELL_ID, ring_receive_cb, NULL) < 0) {
+        printf("x86 could not set up the IPM ring\n");
+        return;
+    }
+#else
     sol_ipm_set_receiver(MESSAGE_ID, receiver_cb, NULL);
-    sol_ipm_set_consumed_callback(MESSAGE_ID, consumed_cb, NULL);
+    sol_ipm_set_receiver(BULK_ID, bulk_receiver_cb, NULL);
+    if (ipm_credit_init(MESSAGE_ID, CREDITS, QUEUE_LEN, consumed_cb,
+        NULL) < 0) {
+        printf("x86 could not set up the flow control\n");
+        return;
+    }
+#endif
     sol_timeout_add(5000, timeout_send_cb, NULL);
 }
 
 static void
 shutdown(void)
 {
+#ifdef IPM_RING
+    ipm_channel_shutdown();
+#else
+    ipm_credit_shutdown(MESSAGE_ID);
+#endif
 }
 
 SOL_MAIN_DEFAULT(startup, shutdown);
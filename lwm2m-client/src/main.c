@@ -6,376 +6,239 @@
 #include <soletta.h>
 #include <sol-log.h>
 #include <sol-lwm2m.h>
+#include <sol-memmap-storage.h>
 #include <sol-util.h>
 #include <sol-vector.h>
 
-#define LOCATION_OBJ_ID (6)
-#define LOCATION_OBJ_LATITUDE_RES_ID (0)
-#define LOCATION_OBJ_LONGITUDE_RES_ID (1)
-#define LOCATION_OBJ_TIMESTAMP_RES_ID (5)
-
-#define ONE_SECOND (1000)
-#define LIFETIME (60)
-
-#define SERVER_OBJ_ID (1)
-#define SERVER_OBJ_SHORT_RES_ID (0)
-#define SERVER_OBJ_LIFETIME_RES_ID (1)
-#define SERVER_OBJ_BINDING_RES_ID (7)
-#define SERVER_OBJ_REGISTRATION_UPDATE_RES_ID (8)
-
-#define SECURITY_SERVER_OBJ_ID (0)
-#define SECURITY_SERVER_SERVER_URI_RES_ID (0)
-#define SECURITY_SERVER_IS_BOOTSTRAP_RES_ID (1)
-#define SECURITY_SERVER_SERVER_ID_RES_ID (10)
-
-struct location_obj_instance_ctx {
-    struct sol_timeout *timeout;
-    struct sol_lwm2m_client *client;
-    char *latitude;
-    char *longitude;
+#include "objects.h"
+
+/*
+   Built with DTLS=y, the client authenticates with a pre-shared key,
+   set with LWM2M_PSK_ID= and LWM2M_PSK= on the make command line; the
+   server must know it. tinydtls cannot resume sessions, so the DTLS
+   session lives as long as the client instead, and the registration
+   updates after an idle period reuse it without any handshake. With a
+   PSK, resuming would only have saved a round trip (bench/dtls-relay.c
+   in lwm2m-server).
+ */
+#ifdef USE_DTLS
+#define SERVER_URI "coaps://[fe80::5846:1502:7238:bcee]:5684"
+#ifndef LWM2M_PSK_ID
+#define LWM2M_PSK_ID "lwm2m-client"
+#endif
+#ifndef LWM2M_PSK
+#define LWM2M_PSK "0123456789abcdef"
+#endif
+#else
+#define SERVER_URI "coap://[fe80::5846:1502:7238:bcee]:5683"
+#endif
+
+/*
+   The location instance is saved to the memory map so that, after a
+   reboot, the client registers with the instance already in place and
+   the server only has to observe it, skipping the create round trip. It
+   is saved when the instance is created or deleted, never on location
+   updates, to spare the flash. The notification periods are not kept:
+   the server owns them and writes them at every registration.
+
+   Only Linux has a default path, a file. The boards this sample builds
+   for have no storage set up for it, so there the state is not kept:
+   give the memmap path of your board with LWM2M_CLIENT_STATE_PATH= on
+   the make command line, with its storage enabled in the build.
+ */
+#if !defined(LWM2M_CLIENT_STATE_PATH) && defined(SOL_PLATFORM_LINUX)
+#define LWM2M_CLIENT_STATE_PATH "lwm2m-client.state"
+#endif
+
+#define STATE_ENTRY_NAME "lwm2m_state"
+#define STATE_MAGIC (0x4c4d5333)
+#define STATE_COORD_LEN (32)
+
+struct persisted_state {
+    uint32_t magic;
+    uint32_t has_location;
     int64_t timestamp;
+    char latitude[STATE_COORD_LEN];
+    char longitude[STATE_COORD_LEN];
 };
 
-static char *
-generate_new_coord(void)
-{
-    char *p;
-    int r;
-    double v = ((double)rand() / (double)RAND_MAX);
-
-    r = asprintf(&p, "%g", v);
-    if (r < 0)
-        return NULL;
-    return p;
-}
-
-static bool
-change_location(void *data)
-{
-    struct location_obj_instance_ctx *instance_ctx = data;
-    char *latitude, *longitude;
-    int r = 0;
-    static const char *paths[] = { "/6/0/0",
-                                   "/6/0/1", "/6/0/5", NULL };
-
-    latitude = longitude = NULL;
-
-    latitude = generate_new_coord();
+#ifdef LWM2M_CLIENT_STATE_PATH
+SOL_MEMMAP_ENTRY(state_version_entry, 0, 1);
+SOL_MEMMAP_ENTRY(state_entry, 1, sizeof(struct persisted_state));
 
-    if (!latitude) {
-        SOL_WRN("Could not generate a new latitude");
-        return true;
-    }
-
-    longitude = generate_new_coord();
-    if (!longitude) {
-        SOL_WRN("Could not generate a new longitude");
-        free(latitude);
-        return true;
-    }
-
-    free(instance_ctx->latitude);
-    free(instance_ctx->longitude);
-    instance_ctx->latitude = latitude;
-    instance_ctx->longitude = longitude;
-
-    instance_ctx->timestamp = (int64_t)time(NULL);
-
-    SOL_DBG("New latitude: %s - New longitude: %s", instance_ctx->latitude,
-        instance_ctx->longitude);
+static const struct sol_str_table_ptr state_entries[] = {
+    SOL_STR_TABLE_PTR_ITEM("_version", &state_version_entry),
+    SOL_STR_TABLE_PTR_ITEM(STATE_ENTRY_NAME, &state_entry),
+    { }
+};
 
-    r = sol_lwm2m_client_notify(instance_ctx->client, paths);
+static const struct sol_memmap_map state_map = {
+    .version = 1,
+    .path = LWM2M_CLIENT_STATE_PATH,
+    .timeout = 0,
+    .entries = state_entries
+};
+#endif
 
-    if (r < 0) {
-        SOL_WRN("Could not notify the observers");
-    } else
-        SOL_DBG("Sending new location coordinates to the observers");
+static bool state_storage_ready;
 
-    return true;
+static void
+state_write_cb(void *data, const char *name, struct sol_blob *blob,
+    int status)
+{
+    if (status < 0)
+        SOL_WRN("Could not persist the client state: %d", status);
 }
 
-static int
-create_location_obj(void *user_data, struct sol_lwm2m_client *client,
-    uint16_t instance_id, void **instance_data,
-    struct sol_lwm2m_payload payload)
+static void
+state_save(const struct lwm2m_client_ctx *ctx)
 {
-    struct location_obj_instance_ctx *instance_ctx;
-    bool *has_location_instance = user_data;
+    const struct location_obj_instance_ctx *instance_ctx = ctx->location;
+    struct persisted_state *state;
+    struct sol_blob *blob;
     int r;
-    uint16_t i;
-    struct sol_lwm2m_tlv *tlv;
-
-    //Only one location object is allowed
-    if (*has_location_instance) {
-        SOL_WRN("Only one location object instance is allowed");
-        return -EINVAL;
-    }
 
-    if (payload.type != SOL_LWM2M_CONTENT_TYPE_TLV) {
-        SOL_WRN("Content type is not in TLV format");
-        return -EINVAL;
-    }
+    if (!state_storage_ready)
+        return;
 
-    instance_ctx = calloc(1, sizeof(struct location_obj_instance_ctx));
-    if (!instance_ctx) {
-        SOL_WRN("Could not alloc memory for location object context");
-        return -ENOMEM;
+    state = calloc(1, sizeof(struct persisted_state));
+    if (!state) {
+        SOL_WRN("Could not alloc memory for the client state");
+        return;
     }
 
-    instance_ctx->timeout = sol_timeout_add(ONE_SECOND, change_location,
-        instance_ctx);
-    if (!instance_ctx->timeout) {
-        SOL_WRN("Could not create the client timer");
-        r = -ENOMEM;
-        goto err_free_instance;
+    state->magic = STATE_MAGIC;
+    if (instance_ctx) {
+        state->has_location = 1;
+        state->timestamp = instance_ctx->timestamp;
+        if (instance_ctx->latitude)
+            strncpy(state->latitude, instance_ctx->latitude,
+                STATE_COORD_LEN - 1);
+        if (instance_ctx->longitude)
+            strncpy(state->longitude, instance_ctx->longitude,
+                STATE_COORD_LEN - 1);
     }
 
-    if (payload.payload.tlv_content.len != 3) {
-        r = -EINVAL;
-        SOL_WRN("Missing mandatory fields.");
-        goto err_free_timeout;
+    blob = sol_blob_new(&SOL_BLOB_TYPE_DEFAULT, NULL, state,
+        sizeof(struct persisted_state));
+    if (!blob) {
+        SOL_WRN("Could not create the client state blob");
+        free(state);
+        return;
     }
 
-    SOL_VECTOR_FOREACH_IDX (&payload.payload.tlv_content, tlv, i) {
-        SOL_BUFFER_DECLARE_STATIC(buf, 32);
-        char **prop = NULL;
-
-        if (tlv->id == LOCATION_OBJ_LATITUDE_RES_ID) {
-            r = sol_lwm2m_tlv_get_bytes(tlv, &buf);
-            prop = &instance_ctx->latitude;
-        } else if (tlv->id == LOCATION_OBJ_LONGITUDE_RES_ID) {
-            r = sol_lwm2m_tlv_get_bytes(tlv, &buf);
-            prop = &instance_ctx->longitude;
-        } else
-            r = sol_lwm2m_tlv_get_int(tlv, &instance_ctx->timestamp);
-
-        if (r < 0) {
-            SOL_WRN("Could not get the tlv value for resource %"
-                PRIu16, tlv->id);
-            goto err_free_timeout;
-        }
-
-        if (buf.used) {
-            *prop = strndup((const char *)buf.data, buf.used);
-            if (!*prop) {
-                r = -ENOMEM;
-                SOL_WRN("Could not copy the longitude/latitude"
-                    " property");
-                goto err_free_timeout;
-            }
-        }
-        sol_buffer_fini(&buf);
-    }
-
-    instance_ctx->client = client;
-    *instance_data = instance_ctx;
-    *has_location_instance = true;
-    SOL_DBG("Location object created");
-
-    return 0;
-
-err_free_timeout:
-    sol_timeout_del(instance_ctx->timeout);
-    free(instance_ctx->longitude);
-    free(instance_ctx->latitude);
-err_free_instance:
-    free(instance_ctx);
-    return r;
+    r = sol_memmap_write_raw(STATE_ENTRY_NAME, blob, state_write_cb, NULL);
+    if (r < 0)
+        SOL_WRN("Could not write the client state: %d", r);
+    sol_blob_unref(blob);
 }
 
-static int
-read_location_obj(void *instance_data, void *user_data,
-    struct sol_lwm2m_client *client, uint16_t instance_id,
-    uint16_t res_id, struct sol_lwm2m_resource *res)
+static bool
+state_load(struct persisted_state *state)
 {
-    struct location_obj_instance_ctx *ctx = instance_data;
+    struct sol_buffer buf = SOL_BUFFER_INIT_FLAGS(state,
+        sizeof(struct persisted_state),
+        SOL_BUFFER_FLAGS_MEMORY_NOT_OWNED | SOL_BUFFER_FLAGS_NO_NUL_BYTE);
     int r;
 
-    switch (res_id) {
-    case LOCATION_OBJ_LATITUDE_RES_ID:
-        SOL_LWM2M_RESOURCE_INIT(r, res, res_id, 1,
-            SOL_LWM2M_RESOURCE_DATA_TYPE_STRING,
-            sol_str_slice_from_str(ctx->latitude));
-        break;
-    case LOCATION_OBJ_LONGITUDE_RES_ID:
-        SOL_LWM2M_RESOURCE_INIT(r, res, res_id, 1,
-            SOL_LWM2M_RESOURCE_DATA_TYPE_STRING,
-            sol_str_slice_from_str(ctx->longitude));
-        break;
-    case LOCATION_OBJ_TIMESTAMP_RES_ID:
-        SOL_LWM2M_RESOURCE_INIT(r, res, res_id, 1,
-            SOL_LWM2M_RESOURCE_DATA_TYPE_TIME, ctx->timestamp);
-        break;
-    default:
-        if (res_id >= 2 && res_id <= 4)
-            r = -ENOENT;
-        else
-            r = -EINVAL;
-    }
-
-    return r;
-}
+    if (!state_storage_ready)
+        return false;
 
-static int
-read_security_server_obj(void *instance_data, void *user_data,
-    struct sol_lwm2m_client *client,
-    uint16_t instance_id, uint16_t res_id, struct sol_lwm2m_resource *res)
-{
-    int r;
+    r = sol_memmap_read_raw(STATE_ENTRY_NAME, &buf);
+    if (r < 0 || buf.used != sizeof(struct persisted_state)) {
+        SOL_DBG("No persisted client state found");
+        return false;
+    }
 
-    //It implements only the necassary info to connect to a LWM2M
-    //server Without encryption.
-    switch (res_id) {
-    case SECURITY_SERVER_SERVER_URI_RES_ID:
-        SOL_LWM2M_RESOURCE_INIT(r, res, 0, 1,
-            SOL_LWM2M_RESOURCE_DATA_TYPE_STRING,
-            sol_str_slice_from_str("coap://[fe80::5846:1502:7238:bcee]:5683"));
-        break;
-    case SECURITY_SERVER_IS_BOOTSTRAP_RES_ID:
-        SOL_LWM2M_RESOURCE_INIT(r, res, 1, 1,
-            SOL_LWM2M_RESOURCE_DATA_TYPE_BOOL, false);
-        break;
-    case SECURITY_SERVER_SERVER_ID_RES_ID:
-        SOL_LWM2M_RESOURCE_INIT(r, res, 10, 1,
-            SOL_LWM2M_RESOURCE_DATA_TYPE_INT, (int64_t)101);
-        break;
-    default:
-        if (res_id >= 2 && res_id <= 11)
-            r = -ENOENT;
-        else
-            r = -EINVAL;
+    if (state->magic != STATE_MAGIC) {
+        SOL_DBG("Ignoring persisted client state with unknown layout");
+        return false;
     }
 
-    return r;
+    state->latitude[STATE_COORD_LEN - 1] = '\0';
+    state->longitude[STATE_COORD_LEN - 1] = '\0';
+    return true;
 }
 
-static int
-read_server_obj(void *instance_data, void *user_data,
-    struct sol_lwm2m_client *client,
-    uint16_t instance_id, uint16_t res_id, struct sol_lwm2m_resource *res)
+static void
+location_created(struct lwm2m_client_ctx *ctx)
 {
-    int r;
-
-    //It implements only the necassary info to connect to a LWM2M
-    //server Without encryption.
-
-    switch (res_id) {
-    case SERVER_OBJ_SHORT_RES_ID:
-        SOL_LWM2M_RESOURCE_INIT(r, res, res_id, 1,
-            SOL_LWM2M_RESOURCE_DATA_TYPE_INT, (int64_t)101);
-        break;
-    case SERVER_OBJ_LIFETIME_RES_ID:
-        SOL_LWM2M_RESOURCE_INIT(r, res, res_id, 1,
-            SOL_LWM2M_RESOURCE_DATA_TYPE_INT, (int64_t)LIFETIME);
-        break;
-    case SERVER_OBJ_BINDING_RES_ID:
-        SOL_LWM2M_RESOURCE_INIT(r, res, res_id, 1,
-            SOL_LWM2M_RESOURCE_DATA_TYPE_STRING,
-            sol_str_slice_from_str("U"));
-        break;
-    default:
-        if (res_id >= 2 && res_id <= 6)
-            r = -ENOENT;
-        else
-            r = -EINVAL;
-    }
-
-    return r;
+    state_save(ctx);
 }
 
-static int
-execute_server_obj(void *instance_data, void *user_data,
-    struct sol_lwm2m_client *client, uint16_t instance_id,
-    uint16_t res_id, const struct sol_str_slice args)
+static void
+location_deleted(struct lwm2m_client_ctx *ctx)
 {
-    if (res_id != SERVER_OBJ_REGISTRATION_UPDATE_RES_ID)
-        return -EINVAL;
-
-    return sol_lwm2m_client_send_update(client);
+    state_save(ctx);
 }
 
+static const struct lwm2m_client_monitor state_monitor = {
+    .location_created = location_created,
+    .location_deleted = location_deleted
+};
+
 static int
-del_location_obj(void *instance_data, void *user_data,
-    struct sol_lwm2m_client *client, uint16_t instance_id)
+restore_state(struct lwm2m_client_ctx *ctx)
 {
-    struct location_obj_instance_ctx *instance_ctx = instance_data;
-    bool *has_location_instance = user_data;
-
-    if (instance_ctx->timeout)
-        sol_timeout_del(instance_ctx->timeout);
-    free(instance_ctx->latitude);
-    free(instance_ctx->longitude);
-    free(instance_ctx);
-    *has_location_instance = false;
-    return 0;
-}
+    struct persisted_state state;
+    int r;
 
-static const struct sol_lwm2m_object location_object = {
-    SOL_SET_API_VERSION(.api_version = SOL_LWM2M_OBJECT_API_VERSION, )
-    .id = LOCATION_OBJ_ID,
-    .create = create_location_obj,
-    .read = read_location_obj,
-    .del = del_location_obj,
-    .resources_count = 6
-};
+    if (!state_load(&state))
+        return 0;
 
-static const struct sol_lwm2m_object security_object = {
-    SOL_SET_API_VERSION(.api_version = SOL_LWM2M_OBJECT_API_VERSION, )
-    .id = SECURITY_SERVER_OBJ_ID,
-    .resources_count = 12,
-    .read = read_security_server_obj
-};
+    if (!state.has_location)
+        return 0;
 
-static const struct sol_lwm2m_object server_object = {
-    SOL_SET_API_VERSION(.api_version = SOL_LWM2M_OBJECT_API_VERSION, )
-    .id = SERVER_OBJ_ID,
-    .resources_count = 9,
-    .read = read_server_obj,
-    .execute = execute_server_obj
-};
+    r = lwm2m_client_add_location(ctx, state.latitude, state.longitude,
+        state.timestamp);
+    if (r < 0)
+        return r;
+
+    SOL_DBG("Location object restored: %s, %s", state.latitude,
+        state.longitude);
+    return 0;
+}
 
 static bool
 setup_client(void)
 {
-    struct sol_lwm2m_client *client;
-    static const struct sol_lwm2m_object *objects[] =
-    { &security_object, &server_object, &location_object, NULL };
-    static bool has_location_instance = false;
-    bool ret = false;
+    static struct lwm2m_client_ctx ctx = {
+        .server_uri = SERVER_URI,
+#ifdef USE_DTLS
+        .psk_id = SOL_STR_SLICE_LITERAL(LWM2M_PSK_ID),
+        .psk = SOL_STR_SLICE_LITERAL(LWM2M_PSK),
+#endif
+        .notify_interval = ONE_SECOND,
+        .monitor = &state_monitor
+    };
     int r;
 
     srand(time(NULL));
 
-    client = sol_lwm2m_client_new("lwm2m-client", NULL, NULL, objects,
-        &has_location_instance);
-
-    if (!client) {
-        SOL_WRN("Could not the create the LWM2M client");
-        goto exit;
-    }
-
-    r = sol_lwm2m_client_add_object_instance(client, &server_object, NULL);
-    if (r < 0) {
-        SOL_WRN("Could not add a server object instance");
-        goto exit_del;
-    }
-
-    r = sol_lwm2m_client_add_object_instance(client, &security_object, NULL);
-
-    if (r < 0) {
-        SOL_WRN("Could not add a security object instance");
-        goto exit_del;
-    }
+#ifdef LWM2M_CLIENT_STATE_PATH
+    r = sol_memmap_add_map(&state_map);
+    if (r < 0)
+        SOL_WRN("Could not add the client state map, warm restart is"
+            " disabled");
+    else
+        state_storage_ready = true;
+#else
+    SOL_WRN("No LWM2M_CLIENT_STATE_PATH for this platform, warm restart is"
+        " disabled");
+#endif
+
+    r = lwm2m_client_ctx_init(&ctx, "lwm2m-client");
+    if (r < 0)
+        return false;
 
-    sol_lwm2m_client_start(client);
+    r = restore_state(&ctx);
+    if (r < 0)
+        SOL_WRN("Could not restore the location object, the server will"
+            " create a new one");
 
-    ret = true;
-    return ret;
+    sol_lwm2m_client_start(ctx.client);
 
-exit_del:
-    sol_lwm2m_client_del(client);
-exit:
-    return ret;
+    return true;
 }
 
 static void
@@ -0,0 +1,556 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <time.h>
+
+#include <soletta.h>
+#include <sol-log.h>
+#include <sol-lwm2m.h>
+#include <sol-util.h>
+#include <sol-vector.h>
+
+#include "objects.h"
+
+static char *
+generate_new_coord(void)
+{
+    char *p;
+    int r;
+    double v = ((double)rand() / (double)RAND_MAX);
+
+    r = asprintf(&p, "%g", v);
+    if (r < 0)
+        return NULL;
+    return p;
+}
+
+static bool
+change_location(void *data)
+{
+    struct location_obj_instance_ctx *instance_ctx = data;
+    struct lwm2m_client_ctx *ctx = instance_ctx->ctx;
+    char *latitude, *longitude;
+    int r = 0;
+    static const char *paths[] = { "/6/0/0",
+                                   "/6/0/1", "/6/0/5", NULL };
+
+    latitude = longitude = NULL;
+
+    latitude = generate_new_coord();
+
+    if (!latitude) {
+        SOL_WRN("Could not generate a new latitude");
+        return true;
+    }
+
+    longitude = generate_new_coord();
+    if (!longitude) {
+        SOL_WRN("Could not generate a new longitude");
+        free(latitude);
+        return true;
+    }
+
+    free(instance_ctx->latitude);
+    free(instance_ctx->longitude);
+    instance_ctx->latitude = latitude;
+    instance_ctx->longitude = longitude;
+
+    instance_ctx->timestamp = (int64_t)time(NULL);
+
+    SOL_DBG("New latitude: %s - New longitude: %s", instance_ctx->latitude,
+        instance_ctx->longitude);
+
+    r = sol_lwm2m_client_notify(ctx->client, paths);
+
+    if (r < 0) {
+        SOL_WRN("Could not notify the observers");
+    } else
+        SOL_DBG("Sending new location coordinates to the observers");
+
+    if (ctx->monitor && ctx->monitor->location_changed)
+        ctx->monitor->location_changed(ctx, r);
+
+    return true;
+}
+
+static struct location_obj_instance_ctx *
+location_instance_new(struct lwm2m_client_ctx *ctx)
+{
+    struct location_obj_instance_ctx *instance_ctx;
+
+    instance_ctx = calloc(1, sizeof(struct location_obj_instance_ctx));
+    if (!instance_ctx) {
+        SOL_WRN("Could not alloc memory for location object context");
+        return NULL;
+    }
+
+    instance_ctx->timeout = sol_timeout_add(lwm2m_client_notify_period(ctx),
+        change_location, instance_ctx);
+    if (!instance_ctx->timeout) {
+        SOL_WRN("Could not create the client timer");
+        free(instance_ctx);
+        return NULL;
+    }
+
+    instance_ctx->ctx = ctx;
+    return instance_ctx;
+}
+
+static void
+location_instance_free(struct location_obj_instance_ctx *instance_ctx)
+{
+    if (instance_ctx->timeout)
+        sol_timeout_del(instance_ctx->timeout);
+    free(instance_ctx->latitude);
+    free(instance_ctx->longitude);
+    free(instance_ctx);
+}
+
+static int
+create_location_obj(void *user_data, struct sol_lwm2m_client *client,
+    uint16_t instance_id, void **instance_data,
+    struct sol_lwm2m_payload payload)
+{
+    struct location_obj_instance_ctx *instance_ctx;
+    struct lwm2m_client_ctx *ctx = user_data;
+    int r;
+    uint16_t i;
+    struct sol_lwm2m_tlv *tlv;
+
+    //Only one location object is allowed
+    if (ctx->location) {
+        SOL_WRN("Only one location object instance is allowed");
+        return -EINVAL;
+    }
+
+    if (payload.type != SOL_LWM2M_CONTENT_TYPE_TLV) {
+        SOL_WRN("Content type is not in TLV format");
+        return -EINVAL;
+    }
+
+    if (payload.payload.tlv_content.len != 3) {
+        SOL_WRN("Missing mandatory fields.");
+        return -EINVAL;
+    }
+
+    instance_ctx = location_instance_new(ctx);
+    if (!instance_ctx)
+        return -ENOMEM;
+
+    SOL_VECTOR_FOREACH_IDX (&payload.payload.tlv_content, tlv, i) {
+        SOL_BUFFER_DECLARE_STATIC(buf, 32);
+        char **prop = NULL;
+
+        if (tlv->id == LOCATION_OBJ_LATITUDE_RES_ID) {
+            r = sol_lwm2m_tlv_get_bytes(tlv, &buf);
+            prop = &instance_ctx->latitude;
+        } else if (tlv->id == LOCATION_OBJ_LONGITUDE_RES_ID) {
+            r = sol_lwm2m_tlv_get_bytes(tlv, &buf);
+            prop = &instance_ctx->longitude;
+        } else
+            r = sol_lwm2m_tlv_get_int(tlv, &instance_ctx->timestamp);
+
+        if (r < 0) {
+            SOL_WRN("Could not get the tlv value for resource %"
+                PRIu16, tlv->id);
+            goto err_free_instance;
+        }
+
+        if (buf.used) {
+            *prop = strndup((const char *)buf.data, buf.used);
+            if (!*prop) {
+                r = -ENOMEM;
+                SOL_WRN("Could not copy the longitude/latitude"
+                    " property");
+                goto err_free_instance;
+            }
+        }
+        sol_buffer_fini(&buf);
+    }
+
+    *instance_data = instance_ctx;
+    ctx->location = instance_ctx;
+    SOL_DBG("Location object created");
+
+    if (ctx->monitor && ctx->monitor->location_created)
+        ctx->monitor->location_created(ctx);
+
+    return 0;
+
+err_free_instance:
+    location_instance_free(instance_ctx);
+    return r;
+}
+
+static int
+read_location_obj(void *instance_data, void *user_data,
+    struct sol_lwm2m_client *client, uint16_t instance_id,
+    uint16_t res_id, struct sol_lwm2m_resource *res)
+{
+    struct location_obj_instance_ctx *instance_ctx = instance_data;
+    struct lwm2m_client_ctx *ctx = user_data;
+    int r;
+
+    switch (res_id) {
+    case LOCATION_OBJ_LATITUDE_RES_ID:
+        SOL_LWM2M_RESOURCE_INIT(r, res, res_id, 1,
+            SOL_LWM2M_RESOURCE_DATA_TYPE_STRING,
+            sol_str_slice_from_str(instance_ctx->latitude));
+        break;
+    case LOCATION_OBJ_LONGITUDE_RES_ID:
+        SOL_LWM2M_RESOURCE_INIT(r, res, res_id, 1,
+            SOL_LWM2M_RESOURCE_DATA_TYPE_STRING,
+            sol_str_slice_from_str(instance_ctx->longitude));
+        break;
+    case LOCATION_OBJ_TIMESTAMP_RES_ID:
+        SOL_LWM2M_RESOURCE_INIT(r, res, res_id, 1,
+            SOL_LWM2M_RESOURCE_DATA_TYPE_TIME, instance_ctx->timestamp);
+        break;
+    default:
+        if (res_id >= 2 && res_id <= 4)
+            r = -ENOENT;
+        else
+            r = -EINVAL;
+    }
+
+    if (r >= 0 && ctx->monitor && ctx->monitor->location_read)
+        ctx->monitor->location_read(ctx, res_id);
+
+    return r;
+}
+
+static int
+read_security_server_obj(void *instance_data, void *user_data,
+    struct sol_lwm2m_client *client,
+    uint16_t instance_id, uint16_t res_id, struct sol_lwm2m_resource *res)
+{
+    struct lwm2m_client_ctx *ctx = user_data;
+    int r;
+
+    //It implements only the necassary info to connect to a LWM2M
+    //server, without encryption or with a pre-shared key.
+    switch (res_id) {
+    case SECURITY_SERVER_SERVER_URI_RES_ID:
+        SOL_LWM2M_RESOURCE_INIT(r, res, 0, 1,
+            SOL_LWM2M_RESOURCE_DATA_TYPE_STRING,
+            sol_str_slice_from_str(ctx->server_uri));
+        break;
+    case SECURITY_SERVER_IS_BOOTSTRAP_RES_ID:
+        SOL_LWM2M_RESOURCE_INIT(r, res, 1, 1,
+            SOL_LWM2M_RESOURCE_DATA_TYPE_BOOL, false);
+        break;
+    case SECURITY_SERVER_SECURITY_MODE_RES_ID:
+        SOL_LWM2M_RESOURCE_INIT(r, res, 2, 1,
+            SOL_LWM2M_RESOURCE_DATA_TYPE_INT,
+            (int64_t)(ctx->psk.len ? SECURITY_MODE_PSK : SECURITY_MODE_NO_SEC));
+        break;
+    case SECURITY_SERVER_PUBLIC_KEY_OR_ID_RES_ID:
+        if (!ctx->psk.len)
+            return -ENOENT;
+        SOL_LWM2M_RESOURCE_INIT(r, res, 3, 1,
+            SOL_LWM2M_RESOURCE_DATA_TYPE_OPAQUE, ctx->psk_id);
+        break;
+    case SECURITY_SERVER_SECRET_KEY_RES_ID:
+        if (!ctx->psk.len)
+            return -ENOENT;
+        SOL_LWM2M_RESOURCE_INIT(r, res, 5, 1,
+            SOL_LWM2M_RESOURCE_DATA_TYPE_OPAQUE, ctx->psk);
+        break;
+    case SECURITY_SERVER_SERVER_ID_RES_ID:
+        SOL_LWM2M_RESOURCE_INIT(r, res, 10, 1,
+            SOL_LWM2M_RESOURCE_DATA_TYPE_INT, (int64_t)101);
+        break;
+    default:
+        if (res_id >= 2 && res_id <= 11)
+            r = -ENOENT;
+        else
+            r = -EINVAL;
+    }
+
+    return r;
+}
+
+static int
+read_server_obj(void *instance_data, void *user_data,
+    struct sol_lwm2m_client *client,
+    uint16_t instance_id, uint16_t res_id, struct sol_lwm2m_resource *res)
+{
+    struct lwm2m_client_ctx *ctx = user_data;
+    uint32_t period;
+    int r;
+
+    //It implements only the necassary info to connect to a LWM2M
+    //server Without encryption.
+
+    switch (res_id) {
+    case SERVER_OBJ_SHORT_RES_ID:
+        SOL_LWM2M_RESOURCE_INIT(r, res, res_id, 1,
+            SOL_LWM2M_RESOURCE_DATA_TYPE_INT, (int64_t)101);
+        break;
+    case SERVER_OBJ_LIFETIME_RES_ID:
+        SOL_LWM2M_RESOURCE_INIT(r, res, res_id, 1,
+            SOL_LWM2M_RESOURCE_DATA_TYPE_INT, (int64_t)LIFETIME);
+        break;
+    case SERVER_OBJ_DEFAULT_MIN_PERIOD_RES_ID:
+    case SERVER_OBJ_DEFAULT_MAX_PERIOD_RES_ID:
+        period = res_id == SERVER_OBJ_DEFAULT_MIN_PERIOD_RES_ID ?
+            ctx->min_period : ctx->max_period;
+        if (!period)
+            return -ENOENT;
+        SOL_LWM2M_RESOURCE_INIT(r, res, res_id, 1,
+            SOL_LWM2M_RESOURCE_DATA_TYPE_INT, (int64_t)period);
+        break;
+    case SERVER_OBJ_BINDING_RES_ID:
+        SOL_LWM2M_RESOURCE_INIT(r, res, res_id, 1,
+            SOL_LWM2M_RESOURCE_DATA_TYPE_STRING,
+            sol_str_slice_from_str("U"));
+        break;
+    default:
+        if (res_id >= 4 && res_id <= 6)
+            r = -ENOENT;
+        else
+            r = -EINVAL;
+    }
+
+    return r;
+}
+
+uint32_t
+lwm2m_client_notify_period(const struct lwm2m_client_ctx *ctx)
+{
+    uint32_t period = ctx->notify_interval;
+
+    if (ctx->min_period && ctx->min_period * ONE_SECOND > period)
+        period = ctx->min_period * ONE_SECOND;
+    if (ctx->max_period && ctx->max_period * ONE_SECOND < period)
+        period = ctx->max_period * ONE_SECOND;
+    return period;
+}
+
+/* Restarts the location timer with the current period. */
+static void
+update_notify_period(struct lwm2m_client_ctx *ctx)
+{
+    struct location_obj_instance_ctx *instance_ctx = ctx->location;
+    uint32_t period = lwm2m_client_notify_period(ctx);
+
+    SOL_DBG("Notifying every %" PRIu32 "ms", period);
+
+    if (instance_ctx) {
+        if (instance_ctx->timeout)
+            sol_timeout_del(instance_ctx->timeout);
+        instance_ctx->timeout = sol_timeout_add(period, change_location,
+            instance_ctx);
+        if (!instance_ctx->timeout)
+            SOL_WRN("Could not restart the client timer");
+    }
+
+    if (ctx->monitor && ctx->monitor->period_changed)
+        ctx->monitor->period_changed(ctx, period);
+}
+
+static int
+set_server_period(struct lwm2m_client_ctx *ctx, uint16_t res_id,
+    int64_t value)
+{
+    //A day at most, zero clears the period
+    if (value < 0 || value > 24 * 60 * 60)
+        return -EINVAL;
+
+    if (res_id == SERVER_OBJ_DEFAULT_MIN_PERIOD_RES_ID)
+        ctx->min_period = value;
+    else if (res_id == SERVER_OBJ_DEFAULT_MAX_PERIOD_RES_ID)
+        ctx->max_period = value;
+    else
+        return -EPERM;
+
+    return 0;
+}
+
+static int
+write_server_obj_res(void *instance_data, void *user_data,
+    struct sol_lwm2m_client *client, uint16_t instance_id, uint16_t res_id,
+    const struct sol_lwm2m_resource *res)
+{
+    struct lwm2m_client_ctx *ctx = user_data;
+    int r;
+
+    if (res->data_type != SOL_LWM2M_RESOURCE_DATA_TYPE_INT)
+        return -EINVAL;
+
+    r = set_server_period(ctx, res_id, res->data[0].integer);
+    if (r < 0)
+        return r;
+
+    update_notify_period(ctx);
+    return 0;
+}
+
+static int
+write_server_obj_tlv(void *instance_data, void *user_data,
+    struct sol_lwm2m_client *client, uint16_t instance_id,
+    struct sol_vector *tlvs)
+{
+    struct lwm2m_client_ctx *ctx = user_data;
+    uint32_t min_period = ctx->min_period, max_period = ctx->max_period;
+    struct sol_lwm2m_tlv *tlv;
+    int64_t value;
+    uint16_t i;
+    int r;
+
+    SOL_VECTOR_FOREACH_IDX (tlvs, tlv, i) {
+        r = sol_lwm2m_tlv_get_int(tlv, &value);
+        if (r >= 0)
+            r = set_server_period(ctx, tlv->id, value);
+        if (r < 0) {
+            SOL_WRN("Could not write the resource %" PRIu16
+                " of the server object", tlv->id);
+            //All or nothing
+            ctx->min_period = min_period;
+            ctx->max_period = max_period;
+            return r;
+        }
+    }
+
+    update_notify_period(ctx);
+    return 0;
+}
+
+static int
+execute_server_obj(void *instance_data, void *user_data,
+    struct sol_lwm2m_client *client, uint16_t instance_id,
+    uint16_t res_id, const struct sol_str_slice args)
+{
+    if (res_id != SERVER_OBJ_REGISTRATION_UPDATE_RES_ID)
+        return -EINVAL;
+
+    return sol_lwm2m_client_send_update(client);
+}
+
+static int
+del_location_obj(void *instance_data, void *user_data,
+    struct sol_lwm2m_client *client, uint16_t instance_id)
+{
+    struct location_obj_instance_ctx *instance_ctx = instance_data;
+    struct lwm2m_client_ctx *ctx = user_data;
+
+    location_instance_free(instance_ctx);
+    ctx->location = NULL;
+
+    if (ctx->monitor && ctx->monitor->location_deleted)
+        ctx->monitor->location_deleted(ctx);
+    return 0;
+}
+
+static const struct sol_lwm2m_object location_object = {
+    SOL_SET_API_VERSION(.api_version = SOL_LWM2M_OBJECT_API_VERSION, )
+    .id = LOCATION_OBJ_ID,
+    .create = create_location_obj,
+    .read = read_location_obj,
+    .del = del_location_obj,
+    .resources_count = 6
+};
+
+static const struct sol_lwm2m_object security_object = {
+    SOL_SET_API_VERSION(.api_version = SOL_LWM2M_OBJECT_API_VERSION, )
+    .id = SECURITY_SERVER_OBJ_ID,
+    .resources_count = 12,
+    .read = read_security_server_obj
+};
+
+static const struct sol_lwm2m_object server_object = {
+    SOL_SET_API_VERSION(.api_version = SOL_LWM2M_OBJECT_API_VERSION, )
+    .id = SERVER_OBJ_ID,
+    .resources_count = 9,
+    .read = read_server_obj,
+    .write_resource = write_server_obj_res,
+    .write_tlv = write_server_obj_tlv,
+    .execute = execute_server_obj
+};
+
+int
+lwm2m_client_add_location(struct lwm2m_client_ctx *ctx,
+    const char *latitude, const char *longitude, int64_t timestamp)
+{
+    struct location_obj_instance_ctx *instance_ctx;
+    int r;
+
+    if (ctx->location)
+        return -EALREADY;
+
+    instance_ctx = location_instance_new(ctx);
+    if (!instance_ctx)
+        return -ENOMEM;
+
+    instance_ctx->timestamp = timestamp;
+    instance_ctx->latitude = strdup(latitude);
+    instance_ctx->longitude = strdup(longitude);
+    if (!instance_ctx->latitude || !instance_ctx->longitude) {
+        r = -ENOMEM;
+        goto err_free_instance;
+    }
+
+    r = sol_lwm2m_client_add_object_instance(ctx->client, &location_object,
+        instance_ctx);
+    if (r < 0)
+        goto err_free_instance;
+
+    ctx->location = instance_ctx;
+    return 0;
+
+err_free_instance:
+    location_instance_free(instance_ctx);
+    return r;
+}
+
+int
+lwm2m_client_ctx_init(struct lwm2m_client_ctx *ctx, const char *name)
+{
+    static const struct sol_lwm2m_object *objects[] =
+    { &security_object, &server_object, &location_object, NULL };
+    int r;
+
+    if (!ctx->notify_interval)
+        ctx->notify_interval = ONE_SECOND;
+
+    ctx->client = sol_lwm2m_client_new(name, NULL, NULL, objects, ctx);
+    if (!ctx->client) {
+        SOL_WRN("Could not the create the LWM2M client");
+        return -ENOMEM;
+    }
+
+    r = sol_lwm2m_client_add_object_instance(ctx->client, &server_object,
+        NULL);
+    if (r < 0) {
+        SOL_WRN("Could not add a server object instance");
+        goto err_del;
+    }
+
+    r = sol_lwm2m_client_add_object_instance(ctx->client, &security_object,
+        NULL);
+    if (r < 0) {
+        SOL_WRN("Could not add a security object instance");
+        goto err_del;
+    }
+
+    return 0;
+
+err_del:
+    sol_lwm2m_client_del(ctx->client);
+    ctx->client = NULL;
+    return r;
+}
+
+void
+lwm2m_client_ctx_fini(struct lwm2m_client_ctx *ctx)
+{
+    //Deleting the client deletes the location instance as well
+    if (ctx->client)
+        sol_lwm2m_client_del(ctx->client);
+    ctx->client = NULL;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <sol-lwm2m.h>
+
+#define LOCATION_OBJ_ID (6)
+#define LOCATION_OBJ_LATITUDE_RES_ID (0)
+#define LOCATION_OBJ_LONGITUDE_RES_ID (1)
+#define LOCATION_OBJ_TIMESTAMP_RES_ID (5)
+
+#define ONE_SECOND (1000)
+#define LIFETIME (60)
+
+#define SERVER_OBJ_ID (1)
+#define SERVER_OBJ_SHORT_RES_ID (0)
+#define SERVER_OBJ_LIFETIME_RES_ID (1)
+#define SERVER_OBJ_DEFAULT_MIN_PERIOD_RES_ID (2)
+#define SERVER_OBJ_DEFAULT_MAX_PERIOD_RES_ID (3)
+#define SERVER_OBJ_BINDING_RES_ID (7)
+#define SERVER_OBJ_REGISTRATION_UPDATE_RES_ID (8)
+
+#define SECURITY_SERVER_OBJ_ID (0)
+#define SECURITY_SERVER_SERVER_URI_RES_ID (0)
+#define SECURITY_SERVER_IS_BOOTSTRAP_RES_ID (1)
+#define SECURITY_SERVER_SECURITY_MODE_RES_ID (2)
+#define SECURITY_SERVER_PUBLIC_KEY_OR_ID_RES_ID (3)
+#define SECURITY_SERVER_SECRET_KEY_RES_ID (5)
+#define SECURITY_SERVER_SERVER_ID_RES_ID (10)
+
+#define SECURITY_MODE_PSK (0)
+#define SECURITY_MODE_NO_SEC (3)
+
+struct lwm2m_client_ctx;
+
+struct location_obj_instance_ctx {
+    struct sol_timeout *timeout;
+    struct lwm2m_client_ctx *ctx;
+    char *latitude;
+    char *longitude;
+    int64_t timestamp;
+};
+
+/*
+   Optional hooks, so the application can follow what happens to the
+   location object. Any of them may be NULL.
+ */
+struct lwm2m_client_monitor {
+    void (*location_created)(struct lwm2m_client_ctx *ctx);
+    void (*location_read)(struct lwm2m_client_ctx *ctx, uint16_t res_id);
+    void (*location_changed)(struct lwm2m_client_ctx *ctx, int notify_result);
+    void (*location_deleted)(struct lwm2m_client_ctx *ctx);
+    //The server changed the notification period, in ms
+    void (*period_changed)(struct lwm2m_client_ctx *ctx, uint32_t period);
+};
+
+/*
+   State of one LWM2M client. It is the user data of all its objects, so
+   a single process may run as many clients as it wants.
+ */
+struct lwm2m_client_ctx {
+    struct sol_lwm2m_client *client;
+    const char *server_uri;
+    //With a PSK, the server URI must be a coaps:// one
+    struct sol_str_slice psk_id;
+    struct sol_str_slice psk;
+    uint32_t notify_interval;
+    //Default Minimum/Maximum Period written by the server, in s (0 if unset)
+    uint32_t min_period;
+    uint32_t max_period;
+    struct location_obj_instance_ctx *location;
+    const struct lwm2m_client_monitor *monitor;
+    void *monitor_data;
+};
+
+/*
+   Time between two location changes: notify_interval, bounded by the
+   periods the server asked for.
+ */
+uint32_t lwm2m_client_notify_period(const struct lwm2m_client_ctx *ctx);
+
+int lwm2m_client_ctx_init(struct lwm2m_client_ctx *ctx, const char *name);
+void lwm2m_client_ctx_fini(struct lwm2m_client_ctx *ctx);
+
+/* Adds a location instance locally, without the server asking for it. */
+int lwm2m_client_add_location(struct lwm2m_client_ctx *ctx,
+    const char *latitude, const char *longitude, int64_t timestamp);
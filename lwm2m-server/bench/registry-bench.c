@@ -0,0 +1,327 @@
+/*
+   Measures the registry operations done by lwm2m-server on each
+   registration, update and notification, with 10k registered clients.
+   Name lookups are also timed with a linear scan, which is what the
+   server did before having the registry. Clients coming and going, as
+   in a churning swarm, must not grow the indexes. Walking the clients
+   of a group is compared to filtering all of them, as the server did.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "registry.h"
+
+#define CLIENTS (10000)
+#define OBJECTS_PER_CLIENT (4)
+#define ROUNDS (20)
+//Clients that register and go away, each under a name never seen before
+#define CHURN (1000000)
+//As many as the backpressure groups of the server
+#define GROUPS (16)
+
+static const uint16_t object_ids[OBJECTS_PER_CLIENT] = { 0, 1, 3, 6 };
+
+static char names[CLIENTS][24];
+static char locations[CLIENTS][16];
+static registry_handle handles[CLIENTS];
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void
+report(const char *what, uint64_t elapsed, uint64_t ops)
+{
+    printf("%-28s %10.1f ns/op %12.0f ops/s\n", what,
+        (double)elapsed / ops, ops * 1e9 / elapsed);
+}
+
+static int
+index_objects(struct registry_client *client)
+{
+    int r, i;
+
+    r = registry_client_reset_objects(client, OBJECTS_PER_CLIENT);
+    if (r < 0)
+        return r;
+
+    for (i = 0; i < OBJECTS_PER_CLIENT; i++) {
+        r = registry_client_set_object(client, object_ids[i],
+            &object_ids[i], 1);
+        if (r < 0)
+            return r;
+    }
+    return 0;
+}
+
+static int
+bench_register(struct registry *reg)
+{
+    uint64_t start = now_ns();
+    int i, r;
+
+    for (i = 0; i < CLIENTS; i++) {
+        struct registry_client *client;
+
+        r = registry_add(reg, names[i], locations[i], NULL, &handles[i]);
+        if (r < 0)
+            return r;
+        client = registry_get(reg, handles[i]);
+        r = index_objects(client);
+        if (r < 0)
+            return r;
+        if (!registry_client_get_object(client, 6))
+            return -ENOENT;
+    }
+
+    report("register", now_ns() - start, CLIENTS);
+    return 0;
+}
+
+static int
+bench_update(struct registry *reg)
+{
+    uint64_t start = now_ns();
+    int round, i, r;
+
+    for (round = 0; round < ROUNDS; round++) {
+        for (i = 0; i < CLIENTS; i++) {
+            struct registry_client *client;
+
+            client = registry_find_by_location(reg, locations[i]);
+            if (!client)
+                return -ENOENT;
+            r = index_objects(client);
+            if (r < 0)
+                return r;
+        }
+    }
+
+    report("update (by location)", now_ns() - start,
+        (uint64_t)ROUNDS * CLIENTS);
+    return 0;
+}
+
+static int
+bench_notify(struct registry *reg)
+{
+    uint64_t start = now_ns();
+    int round, i;
+
+    for (round = 0; round < ROUNDS; round++) {
+        for (i = 0; i < CLIENTS; i++) {
+            if (!registry_get(reg, handles[i]))
+                return -ENOENT;
+        }
+    }
+
+    report("notification (by handle)", now_ns() - start,
+        (uint64_t)ROUNDS * CLIENTS);
+    return 0;
+}
+
+static bool
+count_cb(void *data, struct registry_client *client)
+{
+    (*(uint32_t *)data)++;
+    return true;
+}
+
+struct group_filter {
+    uint32_t group;
+    uint32_t n;
+};
+
+static bool
+filter_cb(void *data, struct registry_client *client)
+{
+    struct group_filter *filter = data;
+
+    if (client->group == filter->group)
+        filter->n++;
+    return true;
+}
+
+static int
+bench_group(struct registry *reg)
+{
+    struct group_filter filter = { 0 };
+    uint32_t g, n = 0;
+    uint64_t start;
+    int i, r;
+
+    for (i = 0; i < CLIENTS; i++) {
+        r = registry_client_set_group(reg, handles[i], i % GROUPS);
+        if (r < 0)
+            return r;
+    }
+
+    start = now_ns();
+    for (g = 0; g < GROUPS; g++)
+        registry_foreach_in_group(reg, g, count_cb, &n);
+    report("walk a group", now_ns() - start, GROUPS);
+
+    start = now_ns();
+    for (g = 0; g < GROUPS; g++) {
+        filter.group = g;
+        registry_foreach(reg, filter_cb, &filter);
+    }
+    report("walk a group (filtering all)", now_ns() - start, GROUPS);
+
+    return n == CLIENTS && filter.n == CLIENTS ? 0 : -EINVAL;
+}
+
+static int
+bench_find_by_name(struct registry *reg)
+{
+    uint64_t start = now_ns();
+    int round, i;
+
+    for (round = 0; round < ROUNDS; round++) {
+        for (i = 0; i < CLIENTS; i++) {
+            if (!registry_find_by_name(reg, names[i]))
+                return -ENOENT;
+        }
+    }
+
+    report("find by name", now_ns() - start, (uint64_t)ROUNDS * CLIENTS);
+    return 0;
+}
+
+static int
+bench_linear_scan(void)
+{
+    uint64_t start = now_ns();
+    int i, j, found = 0;
+
+    //A single round is enough, it is quadratic
+    for (i = 0; i < CLIENTS; i++) {
+        for (j = 0; j < CLIENTS; j++) {
+            if (!strcmp(names[j], names[i])) {
+                found++;
+                break;
+            }
+        }
+    }
+
+    report("find by name (linear scan)", now_ns() - start, CLIENTS);
+    return found == CLIENTS ? 0 : -ENOENT;
+}
+
+static int
+bench_reregister(struct registry *reg)
+{
+    uint64_t start = now_ns();
+    int i, r;
+
+    for (i = 0; i < CLIENTS; i++) {
+        registry_handle old = handles[i];
+
+        r = registry_add(reg, names[i], locations[i], NULL, &handles[i]);
+        if (r < 0)
+            return r;
+        if (registry_get(reg, old))
+            return -EINVAL;
+        r = index_objects(registry_get(reg, handles[i]));
+        if (r < 0)
+            return r;
+    }
+
+    report("re-register", now_ns() - start, CLIENTS);
+    return 0;
+}
+
+static int
+bench_unregister(struct registry *reg)
+{
+    uint64_t start = now_ns();
+    int i, r;
+
+    for (i = 0; i < CLIENTS; i++) {
+        r = registry_remove(reg, handles[i]);
+        if (r < 0)
+            return r;
+    }
+
+    report("unregister", now_ns() - start, CLIENTS);
+    return registry_count(reg) ? -EINVAL : 0;
+}
+
+static int
+bench_churn(struct registry *reg)
+{
+    uint64_t start = now_ns();
+    char name[24], location[16];
+    registry_handle handle;
+    int i, r;
+
+    for (i = 0; i < CHURN; i++) {
+        snprintf(name, sizeof(name), "lwm2m-churn-%07d", i);
+        snprintf(location, sizeof(location), "c%x", i);
+        r = registry_add(reg, name, location, NULL, &handle);
+        if (r < 0)
+            return r;
+        r = registry_remove(reg, handle);
+        if (r < 0)
+            return r;
+    }
+
+    report("register + unregister", now_ns() - start, CHURN);
+    return registry_count(reg) == CLIENTS ? 0 : -EINVAL;
+}
+
+int
+main(int argc, char *argv[])
+{
+    struct registry *reg;
+    int i, r;
+
+    for (i = 0; i < CLIENTS; i++) {
+        snprintf(names[i], sizeof(names[i]), "lwm2m-client-%05d", i);
+        snprintf(locations[i], sizeof(locations[i]), "%x", i * 2654435761u);
+    }
+
+    reg = registry_new(0);
+    if (!reg) {
+        fprintf(stderr, "Could not create the registry\n");
+        return EXIT_FAILURE;
+    }
+
+    printf("%d clients, %d objects each\n", CLIENTS, OBJECTS_PER_CLIENT);
+
+    r = bench_register(reg);
+    if (!r)
+        r = bench_update(reg);
+    if (!r)
+        r = bench_notify(reg);
+    if (!r)
+        r = bench_group(reg);
+    if (!r)
+        r = bench_find_by_name(reg);
+    if (!r)
+        r = bench_linear_scan();
+    if (!r)
+        r = bench_reregister(reg);
+    if (!r)
+        r = bench_churn(reg);
+    if (!r)
+        r = bench_unregister(reg);
+
+    registry_del(reg);
+
+    if (r < 0) {
+        fprintf(stderr, "Benchmark failed: %s\n", strerror(-r));
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,351 @@
+/*
+   Measures the sharded mode: echo worker processes stand for the LWM2M
+   workers, taking their socket over with shard_worker_adopt() as the
+   server does, and clients send registrations followed by
+   notifications, each waiting for the echo before sending the next.
+   Prints the round trips per second for 1, 2, 4 and 8 shards, and
+   fails if a client is answered by more than one worker.
+
+   Then each client registers again from a new port, as after a reboot,
+   and fails unless the worker it had before, when another one, is told
+   to evict it, once.
+ */
+
+#define _GNU_SOURCE
+#include <arpa/inet.h>
+#include <errno.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shard.h"
+
+#define PORT (25683)
+#define CLIENTS_PER_THREAD (64)
+#define CLIENT_THREADS (4)
+#define DURATION (2)
+#define MOVE_CLIENTS (256)
+#define MOVE_SHARDS (4)
+#define REPLY_TIMEOUT (1000)
+
+static atomic_bool stop;
+static atomic_uint_fast64_t round_trips;
+static atomic_uint moved;
+//Bit <shard> is set once the worker <shard> answered
+static atomic_uint_fast64_t answered;
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+//Tells the parent of a registration, as the server does
+static void
+worker_registered(const uint8_t *msg, ssize_t len)
+{
+    char name[SHARD_NAME_MAX + 1];
+    const uint8_t *ep = memmem(msg, len, "ep=", 3);
+    size_t n;
+
+    //The query is the last option, the name runs to the end
+    if (len < 2 || msg[1] != 0x02 || !ep)
+        return;
+    n = msg + len - ep - 3;
+    if (n > SHARD_NAME_MAX)
+        return;
+    memcpy(name, ep + 3, n);
+    name[n] = 0;
+    shard_worker_registered(name);
+}
+
+//Answers with the shard in the first byte, until SIGTERM
+static int
+worker_run(unsigned int shard)
+{
+    struct sockaddr_in6 addr = {
+        .sin6_family = AF_INET6,
+        .sin6_port = htons(PORT),
+        .sin6_addr = IN6ADDR_ANY_INIT
+    };
+    uint8_t buf[2048];
+    char name[SHARD_NAME_MAX + 1];
+    struct pollfd fds[2];
+    int fd;
+
+    shard_worker_adopt(PORT);
+    fd = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (fd < 0 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        !shard_worker_adopted()) {
+        fprintf(stderr, "The worker %u has no socket\n", shard);
+        return EXIT_FAILURE;
+    }
+
+    fds[0].fd = fd;
+    fds[0].events = POLLIN;
+    fds[1].fd = SHARD_CONTROL_FD;
+    fds[1].events = POLLIN;
+
+    for (;;) {
+        struct sockaddr_in6 from;
+        socklen_t len = sizeof(from);
+        ssize_t n;
+
+        if (poll(fds, 2, -1) <= 0)
+            continue;
+
+        //Nothing to forget, the echo keeps no state
+        if (fds[1].revents & POLLIN)
+            while (shard_worker_next_eviction(name, sizeof(name)) > 0) ;
+
+        if (!(fds[0].revents & POLLIN))
+            continue;
+        n = recvfrom(fd, buf, sizeof(buf), MSG_DONTWAIT,
+            (struct sockaddr *)&from, &len);
+        if (n <= 0)
+            continue;
+        worker_registered(buf, n);
+        buf[0] = shard;
+        sendto(fd, buf, n, 0, (struct sockaddr *)&from, len);
+    }
+}
+
+//Returns the evictions sent, waiting up to ms for the first message
+static int
+dispatch(struct shard_workers *workers, unsigned int shards, int ms)
+{
+    struct pollfd fds[SHARD_MAX];
+    unsigned int i;
+    int r, evicted = 0;
+
+    for (i = 0; i < shards; i++) {
+        fds[i].fd = shard_workers_get_control_fd(workers, i);
+        fds[i].events = POLLIN;
+    }
+
+    if (poll(fds, shards, ms) <= 0)
+        return 0;
+
+    for (i = 0; i < shards; i++) {
+        if (!(fds[i].revents & POLLIN))
+            continue;
+        r = shard_workers_dispatch(workers, i);
+        if (r > 0)
+            evicted += r;
+    }
+    return evicted;
+}
+
+static size_t
+registration(uint8_t *msg, unsigned int id)
+{
+    size_t len = 0;
+    int n;
+
+    msg[len++] = 0x40;
+    msg[len++] = 0x02;
+    msg[len++] = 0;
+    msg[len++] = 1;
+    msg[len++] = (11 << 4) | 2;
+    msg[len++] = 'r';
+    msg[len++] = 'd';
+    n = snprintf((char *)msg + len + 1, 32, "ep=bench-%05u", id);
+    msg[len++] = (4 << 4) | n;
+    return len + n;
+}
+
+static void *
+client_run(void *data)
+{
+    struct sockaddr_in6 server = {
+        .sin6_family = AF_INET6,
+        .sin6_port = htons(PORT),
+        .sin6_addr = IN6ADDR_LOOPBACK_INIT
+    };
+    unsigned int base = (intptr_t)data, i;
+    struct pollfd fds[CLIENTS_PER_THREAD];
+    int shard[CLIENTS_PER_THREAD];
+    static const uint8_t notification[64] = { 0x50, 0x45 };
+    uint8_t buf[2048];
+
+    for (i = 0; i < CLIENTS_PER_THREAD; i++) {
+        size_t len = registration(buf, base + i);
+
+        fds[i].fd = socket(AF_INET6, SOCK_DGRAM, 0);
+        fds[i].events = POLLIN;
+        shard[i] = -1;
+        connect(fds[i].fd, (struct sockaddr *)&server, sizeof(server));
+        send(fds[i].fd, buf, len, 0);
+    }
+
+    while (!stop) {
+        if (poll(fds, CLIENTS_PER_THREAD, 100) <= 0) {
+            //Lost datagrams, get the clients going again
+            for (i = 0; i < CLIENTS_PER_THREAD; i++)
+                send(fds[i].fd, notification, sizeof(notification), 0);
+            continue;
+        }
+
+        for (i = 0; i < CLIENTS_PER_THREAD; i++) {
+            if (!(fds[i].revents & POLLIN))
+                continue;
+            if (recv(fds[i].fd, buf, sizeof(buf), MSG_DONTWAIT) <= 0)
+                continue;
+            if (shard[i] < 0)
+                shard[i] = buf[0];
+            else if (shard[i] != buf[0])
+                moved++;
+            answered |= UINT64_C(1) << buf[0];
+            round_trips++;
+            send(fds[i].fd, notification, sizeof(notification), 0);
+        }
+    }
+
+    for (i = 0; i < CLIENTS_PER_THREAD; i++)
+        close(fds[i].fd);
+    return NULL;
+}
+
+static int
+run(const char *argv0, unsigned int shards)
+{
+    char *const argv[] = { (char *)argv0, NULL };
+    pthread_t clients[CLIENT_THREADS];
+    struct shard_workers *workers;
+    uint64_t start, elapsed;
+    unsigned int i;
+
+    stop = false;
+    round_trips = 0;
+    answered = 0;
+
+    workers = shard_workers_new("/proc/self/exe", argv, PORT, shards);
+    if (!workers)
+        return -EADDRINUSE;
+
+    start = now_ns();
+    for (i = 0; i < CLIENT_THREADS; i++)
+        pthread_create(&clients[i], NULL, client_run,
+            (void *)(intptr_t)(i * CLIENTS_PER_THREAD));
+
+    while (now_ns() - start < DURATION * 1000000000ull)
+        dispatch(workers, shards, 100);
+    stop = true;
+    elapsed = now_ns() - start;
+
+    for (i = 0; i < CLIENT_THREADS; i++)
+        pthread_join(clients[i], NULL);
+    shard_workers_del(workers);
+
+    printf("%u shards %12.0f round trips/s, %d workers answered\n", shards,
+        round_trips * 1e9 / elapsed, __builtin_popcountll(answered));
+    return 0;
+}
+
+//The shard that answered the registration of id from a new socket, or -1
+static int
+register_once(unsigned int id)
+{
+    struct sockaddr_in6 server = {
+        .sin6_family = AF_INET6,
+        .sin6_port = htons(PORT),
+        .sin6_addr = IN6ADDR_LOOPBACK_INIT
+    };
+    struct pollfd pfd = { .events = POLLIN };
+    uint8_t buf[2048];
+    size_t len = registration(buf, id);
+    int shard = -1;
+
+    pfd.fd = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (pfd.fd < 0)
+        return -1;
+    if (!connect(pfd.fd, (struct sockaddr *)&server, sizeof(server)) &&
+        send(pfd.fd, buf, len, 0) == (ssize_t)len &&
+        poll(&pfd, 1, REPLY_TIMEOUT) == 1 &&
+        recv(pfd.fd, buf, sizeof(buf), 0) > 0)
+        shard = buf[0];
+    close(pfd.fd);
+    return shard;
+}
+
+static int
+check_moves(const char *argv0)
+{
+    char *const argv[] = { (char *)argv0, NULL };
+    struct shard_workers *workers;
+    unsigned int i, moves = 0, evicted = 0;
+    uint64_t start;
+    int before, after;
+
+    workers = shard_workers_new("/proc/self/exe", argv, PORT, MOVE_SHARDS);
+    if (!workers)
+        return -EADDRINUSE;
+
+    for (i = 0; i < MOVE_CLIENTS; i++) {
+        before = register_once(i);
+        evicted += dispatch(workers, MOVE_SHARDS, 0);
+        after = register_once(i);
+        evicted += dispatch(workers, MOVE_SHARDS, 0);
+        if (before < 0 || after < 0) {
+            shard_workers_del(workers);
+            return -ETIMEDOUT;
+        }
+        moves += before != after;
+    }
+
+    //The last registrations may still be on their way
+    start = now_ns();
+    while (now_ns() - start < REPLY_TIMEOUT * 1000000ull)
+        evicted += dispatch(workers, MOVE_SHARDS, 10);
+    shard_workers_del(workers);
+
+    printf("%u of %u clients moved to another worker registering again,"
+        " %u evictions\n", moves, MOVE_CLIENTS, evicted);
+    return moves == evicted ? 0 : -EPROTO;
+}
+
+int
+main(int argc, char *argv[])
+{
+    static const unsigned int shards[] = { 1, 2, 4, 8 };
+    unsigned int i, worker;
+    int r;
+
+    if (argc == 2 && sscanf(argv[1], "--worker=%u", &worker) == 1)
+        return worker_run(worker);
+
+    printf("%d clients, %ld CPUs\n", CLIENT_THREADS * CLIENTS_PER_THREAD,
+        sysconf(_SC_NPROCESSORS_ONLN));
+    for (i = 0; i < sizeof(shards) / sizeof(shards[0]); i++) {
+        r = run(argv[0], shards[i]);
+        if (r < 0) {
+            fprintf(stderr, "Benchmark failed: %s\n", strerror(-r));
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (moved) {
+        fprintf(stderr, "%u replies came from another worker\n",
+            (unsigned int)moved);
+        return EXIT_FAILURE;
+    }
+
+    r = check_moves(argv[0]);
+    if (r < 0) {
+        fprintf(stderr, "Moving clients failed: %s\n", strerror(-r));
+        return EXIT_FAILURE;
+    }
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <stdio.h>
+
+#define SOL_WRN(...) (fprintf(stderr, __VA_ARGS__), fputc('\n', stderr))
+#define SOL_DBG(...) ((void)0)
+#define SOL_INF(...) ((void)0)
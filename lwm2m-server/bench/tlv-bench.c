@@ -0,0 +1,231 @@
+/*
+   Measures the decoding of a location object notification, as received
+   by lwm2m-server when observing /6. The cursor is compared to a parser
+   that allocates the list of TLVs and copies each value out, which is
+   what sol_lwm2m_parse_tlv() followed by sol_lwm2m_tlv_get_bytes() does.
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "tlv-cursor.h"
+
+#define ROUNDS (2000000)
+
+static uint8_t notification[128];
+static size_t notification_len;
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void
+report(const char *what, uint64_t elapsed, uint64_t ops)
+{
+    printf("%-28s %10.1f ns/op %12.0f ops/s\n", what,
+        (double)elapsed / ops, ops * 1e9 / elapsed);
+}
+
+static size_t
+put_tlv(uint8_t *p, uint8_t type, uint16_t id, const void *value, size_t len)
+{
+    size_t n = 0;
+
+    p[n++] = (type << 6) | (len < 8 ? len : 0x08);
+    p[n++] = id;
+    if (len >= 8)
+        p[n++] = len;
+    memcpy(p + n, value, len);
+    return n + len;
+}
+
+static void
+build_notification(void)
+{
+    static const uint8_t timestamp[] = { 0x57, 0x3b, 0x5c, 0x80 };
+    uint8_t resources[96];
+    size_t len = 0;
+
+    len += put_tlv(resources + len, TLV_TYPE_RESOURCE_WITH_VALUE, 0,
+        "48.858093", strlen("48.858093"));
+    len += put_tlv(resources + len, TLV_TYPE_RESOURCE_WITH_VALUE, 1,
+        "2.294694", strlen("2.294694"));
+    len += put_tlv(resources + len, TLV_TYPE_RESOURCE_WITH_VALUE, 5,
+        timestamp, sizeof(timestamp));
+
+    notification_len = put_tlv(notification, TLV_TYPE_OBJECT_INSTANCE, 0,
+        resources, len);
+}
+
+static int
+check_decoders(void)
+{
+    static const uint8_t neg[] = { 0xff, 0xfe };
+    static const uint8_t one_f[] = { 0x3f, 0x80, 0x00, 0x00 };
+    static const uint8_t link[] = { 0x00, 0x06, 0x00, 0x02 };
+    static const uint8_t truncated[] = { 0xc8, 0x00, 0x10, 'a' };
+    struct tlv_item item = { .type = TLV_TYPE_RESOURCE_WITH_VALUE };
+    struct tlv_cursor cursor;
+    uint16_t obj, inst;
+    int64_t i;
+    double d;
+    bool b;
+
+    item.value = neg;
+    item.len = sizeof(neg);
+    if (tlv_get_int(&item, &i) < 0 || i != -2)
+        return -EINVAL;
+    item.value = one_f;
+    item.len = sizeof(one_f);
+    if (tlv_get_float(&item, &d) < 0 || d != 1.0)
+        return -EINVAL;
+    item.value = link;
+    item.len = sizeof(link);
+    if (tlv_get_objlink(&item, &obj, &inst) < 0 || obj != 6 || inst != 2)
+        return -EINVAL;
+    item.len = 1;
+    if (tlv_get_bool(&item, &b) < 0 || b)
+        return -EINVAL;
+
+    tlv_cursor_init(&cursor, truncated, sizeof(truncated));
+    if (tlv_cursor_next(&cursor, &item) != -EINVAL)
+        return -EINVAL;
+
+    return 0;
+}
+
+static int
+bench_cursor(void)
+{
+    uint64_t start = now_ns(), found = 0;
+    int round, r;
+
+    for (round = 0; round < ROUNDS; round++) {
+        struct tlv_cursor cursor, instance;
+        struct tlv_item item;
+
+        tlv_cursor_init(&cursor, notification, notification_len);
+        while ((r = tlv_cursor_next(&cursor, &item)) > 0) {
+            if (tlv_cursor_enter(&item, &instance) < 0)
+                continue;
+            while ((r = tlv_cursor_next(&instance, &item)) > 0) {
+                if (item.id <= 1)
+                    found += item.len;
+            }
+            if (r < 0)
+                return r;
+        }
+        if (r < 0)
+            return r;
+    }
+
+    report("cursor", now_ns() - start, ROUNDS);
+    return found ? 0 : -ENOENT;
+}
+
+struct copied_tlv {
+    uint16_t id;
+    uint8_t *data;
+    size_t len;
+};
+
+static int
+parse_copying(const uint8_t *data, size_t len, struct copied_tlv **out,
+    size_t *count)
+{
+    struct tlv_cursor cursor, instance;
+    struct copied_tlv *tlvs = NULL;
+    struct tlv_item item;
+    size_t n = 0;
+    int r;
+
+    tlv_cursor_init(&cursor, data, len);
+    while ((r = tlv_cursor_next(&cursor, &item)) > 0) {
+        if (tlv_cursor_enter(&item, &instance) < 0)
+            continue;
+        while ((r = tlv_cursor_next(&instance, &item)) > 0) {
+            struct copied_tlv *grown;
+
+            grown = realloc(tlvs, (n + 1) * sizeof(struct copied_tlv));
+            if (!grown)
+                goto err;
+            tlvs = grown;
+            tlvs[n].id = item.id;
+            tlvs[n].len = item.len;
+            tlvs[n].data = malloc(item.len);
+            if (!tlvs[n].data)
+                goto err;
+            memcpy(tlvs[n++].data, item.value, item.len);
+        }
+    }
+
+    *out = tlvs;
+    *count = n;
+    return 0;
+
+err:
+    while (n--)
+        free(tlvs[n].data);
+    free(tlvs);
+    return -ENOMEM;
+}
+
+static int
+bench_copying(void)
+{
+    uint64_t start = now_ns(), found = 0;
+    int round, r;
+
+    for (round = 0; round < ROUNDS; round++) {
+        struct copied_tlv *tlvs;
+        size_t i, n;
+
+        r = parse_copying(notification, notification_len, &tlvs, &n);
+        if (r < 0)
+            return r;
+
+        for (i = 0; i < n; i++) {
+            char buf[32];
+
+            if (tlvs[i].id <= 1 && tlvs[i].len < sizeof(buf)) {
+                memcpy(buf, tlvs[i].data, tlvs[i].len);
+                found += strnlen(buf, tlvs[i].len);
+            }
+            free(tlvs[i].data);
+        }
+        free(tlvs);
+    }
+
+    report("allocate and copy", now_ns() - start, ROUNDS);
+    return found ? 0 : -ENOENT;
+}
+
+int
+main(int argc, char *argv[])
+{
+    int r;
+
+    build_notification();
+    printf("%zu bytes location notification\n", notification_len);
+
+    r = check_decoders();
+    if (!r)
+        r = bench_cursor();
+    if (!r)
+        r = bench_copying();
+
+    if (r < 0) {
+        fprintf(stderr, "Benchmark failed: %s\n", strerror(-r));
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,195 @@
+/*
+   Measures the location store of lwm2m-server: appending notifications
+   from many clients, asking for the last 10 minutes of one client and
+   compacting the old segments. The store is created in a temporary
+   directory, removed at the end.
+ */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <ftw.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tstore.h"
+
+#define CLIENTS (1000)
+#define NOTIFICATIONS (200)
+#define QUERIES (10000)
+#define STEP (1000) //ms between two notifications of a client
+#define LAST_MINUTES (10)
+
+static struct tstore_series *series[CLIENTS];
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static void
+report(const char *what, uint64_t elapsed, uint64_t ops)
+{
+    printf("%-28s %10.1f ns/op %12.0f ops/s\n", what,
+        (double)elapsed / ops, ops * 1e9 / elapsed);
+}
+
+static int
+remove_entry(const char *path, const struct stat *st, int flag,
+    struct FTW *ftw)
+{
+    return remove(path);
+}
+
+static int
+bench_append(struct tstore *store)
+{
+    uint64_t start = now_ns();
+    int i, c, r;
+
+    for (i = 0; i < NOTIFICATIONS; i++) {
+        for (c = 0; c < CLIENTS; c++) {
+            struct tstore_record rec = {
+                .time = (int64_t)i * STEP,
+                .latitude = 48.858093 + c * 1e-6,
+                .longitude = 2.294694 + i * 1e-6
+            };
+
+            r = tstore_series_append(series[c], &rec);
+            if (r < 0)
+                return r;
+        }
+    }
+
+    report("append", now_ns() - start, (uint64_t)NOTIFICATIONS * CLIENTS);
+    return tstore_flush(store);
+}
+
+static bool
+count_cb(void *data, const struct tstore_record *record)
+{
+    (*(uint64_t *)data)++;
+    return true;
+}
+
+static int
+bench_query(void)
+{
+    int64_t to = (int64_t)(NOTIFICATIONS - 1) * STEP;
+    int64_t from = to - LAST_MINUTES * 60 * 1000;
+    uint64_t start = now_ns(), records = 0;
+    int i, r;
+
+    for (i = 0; i < QUERIES; i++) {
+        r = tstore_series_query(series[i % CLIENTS], from, to, count_cb,
+            &records);
+        if (r < 0)
+            return r;
+    }
+
+    report("query last 10 minutes", now_ns() - start, QUERIES);
+    printf("%-28s %10.1f records/query\n", "", (double)records / QUERIES);
+    return records ? 0 : -ENOENT;
+}
+
+static int
+bench_compact(struct tstore *store)
+{
+    uint64_t start = now_ns();
+    int r, steps = 0;
+
+    //Keep one record per 10s for everything older than the last minute
+    while ((r = tstore_compact_step(store,
+        (int64_t)(NOTIFICATIONS - 60) * STEP, 10 * STEP)) > 0)
+        steps++;
+    if (r < 0)
+        return r;
+
+    report("compact (per series)", now_ns() - start, steps ? steps : 1);
+    return 0;
+}
+
+int
+main(int argc, char *argv[])
+{
+    char dir[] = "/tmp/tstore-bench-XXXXXX";
+    struct tstore_config config = { .dir = dir, .segment_records = 64 };
+    struct tstore *store;
+    uint64_t records = 0;
+    int c, r = -ENOMEM;
+
+    if (!mkdtemp(dir)) {
+        perror("mkdtemp");
+        return EXIT_FAILURE;
+    }
+
+    store = tstore_new(&config);
+    if (!store)
+        goto end;
+
+    for (c = 0; c < CLIENTS; c++) {
+        char name[32];
+
+        snprintf(name, sizeof(name), "lwm2m-client-%05d", c);
+        series[c] = tstore_open_series(store, name);
+        if (!series[c])
+            goto end;
+    }
+
+    printf("%d clients, %d notifications each\n", CLIENTS, NOTIFICATIONS);
+
+    r = bench_append(store);
+    if (!r)
+        r = bench_query();
+    if (!r)
+        r = bench_compact(store);
+    if (!r)
+        r = bench_query();
+
+    //Reloading from disk must give back the compacted series
+    if (!r) {
+        tstore_del(store);
+        store = tstore_new(&config);
+        r = -EIO;
+        if (store && (series[0] = tstore_open_series(store,
+            "lwm2m-client-00000")))
+            r = tstore_series_query(series[0], INT64_MIN, INT64_MAX,
+                count_cb, &records);
+        if (r > 0) {
+            printf("%-28s %10" PRIu64 " records after reload\n", "",
+                records);
+            r = 0;
+        }
+    }
+
+    //As must closing a series, as done when its client unregisters
+    if (!r) {
+        uint64_t reopened = 0;
+
+        tstore_close_series(series[0]);
+        r = -EIO;
+        series[0] = tstore_open_series(store, "lwm2m-client-00000");
+        if (series[0])
+            r = tstore_series_query(series[0], INT64_MIN, INT64_MAX,
+                count_cb, &reopened);
+        if (r > 0)
+            r = reopened == records ? 0 : -EIO;
+    }
+
+end:
+    tstore_del(store);
+    nftw(dir, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+
+    if (r < 0) {
+        fprintf(stderr, "Benchmark failed: %s\n", strerror(-r));
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,260 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+
+#include "sol-log.h"
+#include "sol-mainloop.h"
+#include "sol-util.h"
+
+#include "backpressure.h"
+
+#define LAG_INTERVAL (50)
+#define CONTROL_INTERVAL (1000)
+//Calm control ticks before the groups are let go a step
+#define CALM_TICKS (5)
+//Share of its period a group gets back per step, 1/RELAX_DIV
+#define RELAX_DIV (4)
+#define FIRST_PERIOD (2)
+//Share of the time spent on notifications that counts as overload, %
+#define BUSY_HIGH (80)
+#define BUSY_LOW (50)
+
+struct group {
+    uint32_t min_period;
+    uint32_t notifications;
+};
+
+struct backpressure {
+    struct backpressure_config config;
+    void (*apply)(void *data, unsigned int group, uint32_t min_period);
+    const void *data;
+
+    struct sol_timeout *lag_timeout;
+    struct sol_timeout *control_timeout;
+    int64_t last_lag_tick;
+    int64_t last_control_tick;
+
+    //Over the current control tick
+    int64_t max_lag;
+    int64_t cost_us;
+    uint32_t calm_ticks;
+
+    struct group *groups;
+};
+
+static int64_t
+now_ms(void)
+{
+    struct timespec ts = sol_util_timespec_get_current();
+
+    return sol_util_msec_from_timespec(&ts);
+}
+
+static bool
+lag_cb(void *data)
+{
+    struct backpressure *bp = data;
+    int64_t now = now_ms();
+    int64_t lag = now - bp->last_lag_tick - LAG_INTERVAL;
+
+    if (lag > bp->max_lag)
+        bp->max_lag = lag;
+    bp->last_lag_tick = now;
+    return true;
+}
+
+static void
+set_period(struct backpressure *bp, unsigned int g, uint32_t period)
+{
+    struct group *group = &bp->groups[g];
+
+    if (group->min_period == period)
+        return;
+
+    SOL_DBG("Minimum period of the group %u: %" PRIu32 "s -> %" PRIu32 "s",
+        g, group->min_period, period);
+    group->min_period = period;
+    bp->apply((void *)bp->data, g, period);
+}
+
+/* Slows down the busiest group that can still be slowed down. */
+static bool
+throttle_one(struct backpressure *bp)
+{
+    struct group *busiest = NULL;
+    uint32_t i, period;
+
+    for (i = 0; i < bp->config.groups; i++) {
+        struct group *group = &bp->groups[i];
+
+        if (group->min_period >= bp->config.period_max ||
+            !group->notifications)
+            continue;
+        if (!busiest || group->notifications > busiest->notifications)
+            busiest = group;
+    }
+
+    if (!busiest)
+        return false;
+
+    period = busiest->min_period ? busiest->min_period * 2 : FIRST_PERIOD;
+    if (period > bp->config.period_max)
+        period = bp->config.period_max;
+
+    //Do not pick it again in this tick
+    busiest->notifications = 0;
+    set_period(bp, busiest - bp->groups, period);
+    return true;
+}
+
+/*
+   Lets every throttled group go a step, in proportion to its period:
+   the throttling doubles periods, so going back a fixed amount would
+   take minutes to undo it.
+ */
+static void
+relax_all(struct backpressure *bp)
+{
+    uint32_t i, period, step;
+
+    for (i = 0; i < bp->config.groups; i++) {
+        period = bp->groups[i].min_period;
+        if (!period)
+            continue;
+
+        step = period / RELAX_DIV;
+        if (step < bp->config.period_step)
+            step = bp->config.period_step;
+        period = period > step ? period - step : 0;
+        if (period && period < FIRST_PERIOD)
+            period = 0;
+        set_period(bp, i, period);
+    }
+}
+
+static bool
+control_cb(void *data)
+{
+    struct backpressure *bp = data;
+    int64_t now = now_ms(), elapsed = now - bp->last_control_tick;
+    int64_t busy = 0, n;
+    uint32_t i;
+
+    if (elapsed > 0)
+        busy = bp->cost_us / (elapsed * 10);
+
+    if (bp->max_lag > bp->config.latency_budget || busy > BUSY_HIGH) {
+        //The further over budget, the more groups are slowed down
+        n = 1 + bp->max_lag / bp->config.latency_budget;
+        SOL_DBG("Over budget, lag %" PRId64 "ms busy %" PRId64 "%%",
+            bp->max_lag, busy);
+        bp->calm_ticks = 0;
+        while (n-- > 0 && throttle_one(bp)) ;
+    } else if (bp->max_lag < bp->config.latency_budget / 4 &&
+        busy < BUSY_LOW) {
+        if (++bp->calm_ticks >= CALM_TICKS) {
+            bp->calm_ticks = 0;
+            relax_all(bp);
+        }
+    } else
+        bp->calm_ticks = 0;
+
+    for (i = 0; i < bp->config.groups; i++)
+        bp->groups[i].notifications = 0;
+    bp->max_lag = 0;
+    bp->cost_us = 0;
+    bp->last_control_tick = now;
+    return true;
+}
+
+struct backpressure *
+backpressure_new(const struct backpressure_config *config,
+    void (*apply)(void *data, unsigned int group, uint32_t min_period),
+    const void *data)
+{
+    struct backpressure *bp;
+
+    if (!apply)
+        return NULL;
+
+    bp = calloc(1, sizeof(struct backpressure));
+    if (!bp)
+        return NULL;
+
+    if (config)
+        bp->config = *config;
+    if (!bp->config.latency_budget)
+        bp->config.latency_budget = BACKPRESSURE_DEFAULT_LATENCY_BUDGET;
+    if (!bp->config.groups)
+        bp->config.groups = BACKPRESSURE_DEFAULT_GROUPS;
+    if (!bp->config.period_step)
+        bp->config.period_step = BACKPRESSURE_DEFAULT_PERIOD_STEP;
+    if (!bp->config.period_max)
+        bp->config.period_max = BACKPRESSURE_DEFAULT_PERIOD_MAX;
+
+    bp->apply = apply;
+    bp->data = data;
+
+    bp->groups = calloc(bp->config.groups, sizeof(struct group));
+    if (!bp->groups)
+        goto err_free;
+
+    bp->last_lag_tick = bp->last_control_tick = now_ms();
+    bp->lag_timeout = sol_timeout_add(LAG_INTERVAL, lag_cb, bp);
+    if (!bp->lag_timeout)
+        goto err_groups;
+    bp->control_timeout = sol_timeout_add(CONTROL_INTERVAL, control_cb, bp);
+    if (!bp->control_timeout)
+        goto err_lag;
+
+    return bp;
+
+err_lag:
+    sol_timeout_del(bp->lag_timeout);
+err_groups:
+    free(bp->groups);
+err_free:
+    free(bp);
+    return NULL;
+}
+
+void
+backpressure_del(struct backpressure *bp)
+{
+    if (!bp)
+        return;
+
+    sol_timeout_del(bp->lag_timeout);
+    sol_timeout_del(bp->control_timeout);
+    free(bp->groups);
+    free(bp);
+}
+
+unsigned int
+backpressure_group(const struct backpressure *bp, const char *name)
+{
+    uint32_t h = 2166136261u;
+
+    for (; *name; name++) {
+        h ^= (uint8_t)*name;
+        h *= 16777619u;
+    }
+    return h % bp->config.groups;
+}
+
+uint32_t
+backpressure_get_min_period(const struct backpressure *bp, unsigned int group)
+{
+    if (group >= bp->config.groups)
+        return 0;
+    return bp->groups[group].min_period;
+}
+
+void
+backpressure_ingest(struct backpressure *bp, unsigned int group,
+    int64_t cost_us)
+{
+    if (group < bp->config.groups)
+        bp->groups[group].notifications++;
+    bp->cost_us += cost_us;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+   Keeps the server within its latency budget by slowing clients down
+   under load.
+
+   The load is taken from the lag of the main loop (how late timers
+   fire, as the datagrams waiting on the socket are not visible) and
+   from the time spent processing notifications. Clients are split in
+   groups by the hash of their name. Once a second, if the server is
+   over budget, the minimum notification period of the busiest groups
+   is doubled. After a few calm seconds, every throttled group gets a
+   quarter of its period back, at least period_step, so a period of
+   minutes recovers in under two minutes. The application is
+   told to push each new period to the clients of the group.
+ */
+
+struct backpressure;
+
+struct backpressure_config {
+    uint32_t latency_budget; //ms of main loop lag
+    uint32_t groups;
+    uint32_t period_step; //s, the least removed from a period when relaxed
+    uint32_t period_max; //s
+};
+
+#define BACKPRESSURE_DEFAULT_LATENCY_BUDGET (100)
+#define BACKPRESSURE_DEFAULT_GROUPS (16)
+#define BACKPRESSURE_DEFAULT_PERIOD_STEP (1)
+#define BACKPRESSURE_DEFAULT_PERIOD_MAX (300)
+
+/* Zeroed fields of config take the defaults. */
+struct backpressure *backpressure_new(const struct backpressure_config *config,
+    void (*apply)(void *data, unsigned int group, uint32_t min_period),
+    const void *data);
+void backpressure_del(struct backpressure *bp);
+
+unsigned int backpressure_group(const struct backpressure *bp,
+    const char *name);
+/* In seconds, 0 if the group is not throttled. */
+uint32_t backpressure_get_min_period(const struct backpressure *bp,
+    unsigned int group);
+
+/* Accounts for a notification of the group that took cost_us to process. */
+void backpressure_ingest(struct backpressure *bp, unsigned int group,
+    int64_t cost_us);
@@ -1,5 +1,6 @@
 #include "sol-log.h"
 
+#include "sol-coap.h"
 #include "sol-lwm2m.h"
 #include "soletta.h"
 #include "sol-mainloop.h"
@@ -8,49 +9,388 @@
 
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include <errno.h>
+#include <time.h>
+
+#include "registry.h"
+#include "tlv-cursor.h"
+#include "workflow.h"
+#include "backpressure.h"
+#include "metrics.h"
+#ifdef SOL_PLATFORM_LINUX
+#include "tstore.h"
+#include "shard.h"
+#endif
+
+#ifdef SOL_PLATFORM_LINUX
+#define STORE_DIR "lwm2m-server.store"
+#define STORE_FLUSH_INTERVAL (1000)
+#define STORE_COMPACT_INTERVAL (10 * 1000)
+//Locations older than an hour are kept once per minute
+#define STORE_COMPACT_AGE (60 * 60 * 1000)
+#define STORE_COMPACT_RESOLUTION (60 * 1000)
+#define STORE_QUERY_WINDOW (10 * 60 * 1000)
+
+#define WORKERS_CHECK_INTERVAL (1000)
+
+#define METRICS_FILE "lwm2m-server.metrics"
+#endif
+
+/*
+   Built with DTLS=y, the clients authenticate with a pre-shared key on
+   the DTLS port. It needs Soletta built with DTLS and its LWM2M security
+   modes. Set your own key, shared with the clients, with LWM2M_PSK_ID=
+   and LWM2M_PSK= on the make command line.
+ */
+#ifdef USE_DTLS
+#ifndef LWM2M_PSK_ID
+#define LWM2M_PSK_ID "lwm2m-client"
+#endif
+#ifndef LWM2M_PSK
+#define LWM2M_PSK "0123456789abcdef"
+#endif
+
+static struct sol_lwm2m_security_psk psk;
+static struct sol_lwm2m_security_psk *known_psks[] = { &psk, NULL };
+#endif
+
+#define METRICS_DEFAULT_PORT (5693)
+#define METRICS_INTERVAL (5 * 1000)
 
 #define LOCATION_OBJ_ID (6)
 #define LONGITUDE_ID (1)
 #define LATITUDE_ID (0)
 #define TIMESTAMP_ID (5)
 
+//Default Minimum/Maximum Period of the first server object instance
+#define SERVER_OBJ_PATH "/1/0"
+#define SERVER_OBJ_MIN_PERIOD_ID (2)
+#define SERVER_OBJ_MAX_PERIOD_ID (3)
+
 enum location_object_status {
     LOCATION_OBJECT_NOT_FOUND,
     LOCATION_OBJECT_WITH_NO_INSTANCES,
     LOCATION_OBJECT_WITH_INSTANCES
 };
 
-static enum location_object_status
-get_location_object_status(const struct sol_lwm2m_client_info *cinfo)
+#define WORKFLOW_STATS_INTERVAL (10 * 1000)
+
+static struct sol_lwm2m_server *lwm2m_server;
+static struct registry *registry;
+static struct workflow *workflow;
+static struct backpressure *backpressure;
+static struct sol_timeout *workflow_stats_timeout;
+
+static struct metrics *metrics;
+//Only the main loop updates the metrics
+static struct metrics_local *metrics_local;
+static struct sol_coap_server *metrics_server;
+static struct sol_timeout *metrics_timeout;
+//The last two periodic snapshots, what the metrics resource reports
+static struct metrics_snapshot metrics_prev, metrics_last;
+
+#ifdef SOL_PLATFORM_LINUX
+static struct tstore *store;
+static struct sol_timeout *flush_timeout;
+static struct sol_timeout *compact_timeout;
+
+static struct shard_workers *workers;
+static struct sol_timeout *workers_timeout;
+static struct sol_fd *control_watches[SHARD_MAX];
+//In a worker, where the parent sends the endpoints to evict
+static struct sol_fd *eviction_watch;
+
+static FILE *metrics_file;
+#endif
+
+struct location {
+    double latitude;
+    double longitude;
+    bool has_latitude;
+    bool has_longitude;
+};
+
+#define HANDLE_TO_PTR(_h) ((void *)(uintptr_t)(_h))
+#define PTR_TO_HANDLE(_p) ((registry_handle)(uintptr_t)(_p))
+
+/*
+   Soletta hands the client objects as a vector, so they are indexed once
+   per registration or update instead of walking the vector each time
+   an object is needed.
+ */
+static int
+index_client_objects(struct registry_client *client,
+    const struct sol_lwm2m_client_info *cinfo)
 {
     uint16_t i;
     struct sol_lwm2m_client_object *object;
     const struct sol_ptr_vector *objects =
         sol_lwm2m_client_info_get_objects(cinfo);
+    int r;
+
+    r = registry_client_reset_objects(client, sol_ptr_vector_get_len(objects));
+    if (r < 0)
+        return r;
 
     SOL_PTR_VECTOR_FOREACH_IDX (objects, object, i) {
-        const struct sol_ptr_vector *instances;
         uint16_t id;
-        int r;
 
         r = sol_lwm2m_client_object_get_id(object, &id);
         if (r < 0) {
             SOL_WRN("Could not fetch the object id from %p", object);
-            return LOCATION_OBJECT_NOT_FOUND;
+            return r;
         }
 
-        if (id != LOCATION_OBJ_ID)
+        r = registry_client_set_object(client, id, object,
+            sol_ptr_vector_get_len(
+            sol_lwm2m_client_object_get_instances(object)));
+        if (r < 0)
+            return r;
+    }
+
+    return 0;
+}
+
+static enum location_object_status
+get_location_object_status(const struct registry_client *client)
+{
+    const struct registry_object *object;
+
+    object = registry_client_get_object(client, LOCATION_OBJ_ID);
+    if (!object)
+        return LOCATION_OBJECT_NOT_FOUND;
+    if (object->instances)
+        return LOCATION_OBJECT_WITH_INSTANCES;
+    return LOCATION_OBJECT_WITH_NO_INSTANCES;
+}
+
+static void
+read_location_resource(const char *name, const struct tlv_item *item,
+    struct location *location)
+{
+    const char *prop;
+    double *value;
+    bool *has_value;
+    char *endptr;
+
+    if (item->type != TLV_TYPE_RESOURCE_WITH_VALUE)
+        return;
+
+    if (item->id == LATITUDE_ID) {
+        prop = "latitude";
+        value = &location->latitude;
+        has_value = &location->has_latitude;
+    } else if (item->id == LONGITUDE_ID) {
+        prop = "longitude";
+        value = &location->longitude;
+        has_value = &location->has_longitude;
+    } else
+        return;
+
+    SOL_DBG("Client %s %s is %.*s", name, prop, (int)item->len,
+        (const char *)item->value);
+
+    errno = 0;
+    *value = sol_util_strtod_n((const char *)item->value, &endptr,
+        item->len, false);
+    *has_value = !errno && endptr == (const char *)item->value + item->len;
+}
+
+static int
+read_location_resources(const char *name, struct sol_str_slice content,
+    struct location *location)
+{
+    struct tlv_cursor cursor, instance;
+    struct tlv_item item;
+    int r;
+
+    tlv_cursor_init(&cursor, content.data, content.len);
+    while ((r = tlv_cursor_next(&cursor, &item)) > 0) {
+        if (item.type != TLV_TYPE_OBJECT_INSTANCE) {
+            read_location_resource(name, &item, location);
             continue;
+        }
 
-        instances = sol_lwm2m_client_object_get_instances(object);
+        //Observing /6 gives the resources wrapped in their instance
+        tlv_cursor_enter(&item, &instance);
+        while ((r = tlv_cursor_next(&instance, &item)) > 0)
+            read_location_resource(name, &item, location);
+        if (r < 0)
+            return r;
+    }
+
+    return r;
+}
 
-        if (sol_ptr_vector_get_len(instances))
-            return LOCATION_OBJECT_WITH_INSTANCES;
-        return LOCATION_OBJECT_WITH_NO_INSTANCES;
+#ifdef SOL_PLATFORM_LINUX
+static int64_t
+now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+store_location(const struct registry_client *client,
+    const struct location *location)
+{
+    struct tstore_record record;
+    int r;
+
+    if (!client->data || !location->has_latitude ||
+        !location->has_longitude)
+        return;
+
+    record.time = now_ms();
+    record.latitude = location->latitude;
+    record.longitude = location->longitude;
+
+    r = tstore_series_append(client->data, &record);
+    if (r < 0)
+        SOL_WRN("Could not store the location of client %s (%d)",
+            client->name, r);
+}
+
+static bool
+count_record_cb(void *data, const struct tstore_record *record)
+{
+    return true;
+}
+
+static void
+open_client_series(struct registry_client *client)
+{
+    int64_t now = now_ms();
+    int r;
+
+    if (!store)
+        return;
+
+    client->data = tstore_open_series(store, client->name);
+    if (!client->data) {
+        SOL_WRN("Could not open the location series of client %s",
+            client->name);
+        return;
     }
 
-    return LOCATION_OBJECT_NOT_FOUND;
+    r = tstore_series_query(client->data, now - STORE_QUERY_WINDOW, now,
+        count_record_cb, NULL);
+    SOL_DBG("Client %s has %d stored locations from the last %d minutes",
+        client->name, r, STORE_QUERY_WINDOW / (60 * 1000));
+}
+
+static void
+close_client_series(struct registry_client *client)
+{
+    if (!client->data)
+        return;
+
+    tstore_close_series(client->data);
+    client->data = NULL;
+}
+
+static bool
+close_series_cb(void *data, struct registry_client *client)
+{
+    close_client_series(client);
+    return true;
+}
+
+static bool
+store_flush_cb(void *data)
+{
+    int r = tstore_flush(store);
+
+    if (r < 0)
+        SOL_WRN("Could not flush the location store (%d)", r);
+    return true;
+}
+
+static bool
+store_compact_cb(void *data)
+{
+    int r;
+
+    //One series per tick, blocking while it syncs, see tstore.h
+    r = tstore_compact_step(store, now_ms() - STORE_COMPACT_AGE,
+        STORE_COMPACT_RESOLUTION);
+    if (r < 0)
+        SOL_WRN("Could not compact the location store (%d)", r);
+    return true;
+}
+
+/*
+   Each worker has a store of its own, as it has a metrics file: two of
+   them may briefly hold the same client, see shard.h, and tstore keeps
+   no lock on its series.
+ */
+static void
+setup_store(const char *dir)
+{
+    struct tstore_config config = { .dir = dir };
+
+    store = tstore_new(&config);
+    if (!store) {
+        SOL_WRN("Could not open the location store at %s,"
+            " locations will not be stored", dir);
+        return;
+    }
+
+    flush_timeout = sol_timeout_add(STORE_FLUSH_INTERVAL, store_flush_cb,
+        NULL);
+    compact_timeout = sol_timeout_add(STORE_COMPACT_INTERVAL,
+        store_compact_cb, NULL);
+    if (!flush_timeout || !compact_timeout)
+        SOL_WRN("Could not create the location store timers");
+}
+
+static void
+teardown_store(void)
+{
+    if (flush_timeout)
+        sol_timeout_del(flush_timeout);
+    if (compact_timeout)
+        sol_timeout_del(compact_timeout);
+    tstore_del(store);
+    store = NULL;
+}
+#endif
+
+static int64_t
+elapsed_us(const struct timespec *start, const struct timespec *end)
+{
+    struct timespec elapsed;
+
+    sol_util_timespec_sub(end, start, &elapsed);
+    return (int64_t)elapsed.tv_sec * 1000000 + elapsed.tv_nsec / 1000;
+}
+
+/*
+   The jitter is how much the interval between two notifications of a
+   client changed from the previous one.
+ */
+static void
+account_notification(struct registry_client *client,
+    const struct timespec *at)
+{
+    int64_t now = sol_util_msec_from_timespec(at), gap;
+
+    metrics_count(metrics_local, METRICS_COUNTER_NOTIFICATIONS, 1);
+
+    if (client->notified_at) {
+        gap = now - client->notified_at;
+        if (client->notify_gap)
+            metrics_observe(metrics_local, METRICS_HISTOGRAM_JITTER_MS,
+                gap > client->notify_gap ? gap - client->notify_gap :
+                client->notify_gap - gap);
+        client->notify_gap = gap;
+    }
+    client->notified_at = now;
 }
 
 static void
@@ -62,71 +402,75 @@ location_changed_cb(void *data,
     enum sol_lwm2m_content_type content_type,
     struct sol_str_slice content)
 {
-    struct sol_vector tlvs;
     const char *name = sol_lwm2m_client_info_get_name(cinfo);
+    struct registry_client *client;
+    struct location location = { 0 };
+    struct timespec start = sol_util_timespec_get_current(), decoded, end;
     int r;
-    uint16_t i;
-    struct sol_lwm2m_tlv *tlv;
+
+    //Notifications may still arrive after the client is gone
+    client = registry_get(registry, PTR_TO_HANDLE(data));
+    if (!client) {
+        SOL_DBG("Dropping a location notification from the stale"
+            " client %s", name);
+        return;
+    }
 
     if (response_code != SOL_COAP_RESPONSE_CODE_CHANGED &&
         response_code != SOL_COAP_RESPONSE_CODE_CONTENT) {
         SOL_WRN("Could not get the location object value from"
             " client %s", name);
+        workflow_done(workflow, client->handle, WORKFLOW_STEP_OBSERVE, false);
         return;
     }
 
+    //Only the reply to the observe request is taken, not the notifications
+    workflow_done(workflow, client->handle, WORKFLOW_STEP_OBSERVE, true);
+    account_notification(client, &start);
+
     if (content_type != SOL_LWM2M_CONTENT_TYPE_TLV) {
         SOL_WRN("The location object content from client %s is not"
             " in TLV format. Received format: %d", name, content_type);
         return;
     }
 
-    r = sol_lwm2m_parse_tlv(content, &tlvs);
+    r = read_location_resources(name, content, &location);
+    decoded = sol_util_timespec_get_current();
+    metrics_observe(metrics_local, METRICS_HISTOGRAM_DECODE_US,
+        elapsed_us(&start, &decoded));
 
     if (r < 0) {
         SOL_WRN("Could not parse the tlv from client: %s", name);
-        return;
+        metrics_count(metrics_local, METRICS_COUNTER_DECODE_ERRORS, 1);
     }
+#ifdef SOL_PLATFORM_LINUX
+    else
+        store_location(client, &location);
+#endif
 
-    SOL_VECTOR_FOREACH_IDX (&tlvs, tlv, i) {
-        const char *prop;
-        SOL_BUFFER_DECLARE_STATIC(buf, 32);
-
-        if (tlv->id == LATITUDE_ID)
-            prop = "latitude";
-        else if (tlv->id == LONGITUDE_ID)
-            prop = "longitude";
-        else
-            continue;
-
-        r = sol_lwm2m_tlv_get_bytes(tlv, &buf);
-        if (r < 0) {
-            SOL_WRN("Could not the %s value from client %s",
-                prop, name);
-            break;
-        }
-
-        SOL_DBG("Client %s %s is %.*s", name, prop, (int)buf.used,
-                (char *)buf.data);
-
-        sol_buffer_fini(&buf);
-    }
+    end = sol_util_timespec_get_current();
+    backpressure_ingest(backpressure, client->group, elapsed_us(&start, &end));
 }
 
-static void
+static int
 observe_location(struct sol_lwm2m_server *server,
-    struct sol_lwm2m_client_info *cinfo)
+    struct sol_lwm2m_client_info *cinfo, registry_handle handle)
 {
     int r;
 
+    //A retry replaces the observation that failed
+    sol_lwm2m_server_del_observer(server, cinfo, "/6",
+        location_changed_cb, HANDLE_TO_PTR(handle));
+
     r = sol_lwm2m_server_add_observer(server, cinfo, "/6",
-        location_changed_cb, NULL);
+        location_changed_cb, HANDLE_TO_PTR(handle));
 
     if (r < 0)
         SOL_WRN("Could not send an observe request to the location"
             " object");
     else
         SOL_DBG("Observe request to the location object sent");
+    return r;
 }
 
 static void
@@ -136,21 +480,27 @@ create_cb(void *data,
     enum sol_coap_response_code response_code)
 {
     const char *name = sol_lwm2m_client_info_get_name(cinfo);
+    registry_handle handle = PTR_TO_HANDLE(data);
+
+    if (!registry_get(registry, handle)) {
+        SOL_DBG("The client %s is gone, ignoring the creation reply", name);
+        return;
+    }
 
     if (response_code != SOL_COAP_RESPONSE_CODE_CREATED) {
         SOL_WRN("The client %s could not create the location object.",
             name);
+        workflow_done(workflow, handle, WORKFLOW_STEP_CREATE, false);
         return;
     }
 
-    SOL_DBG("The client %s created the location object."
-        " Observing it now.", name);
-    observe_location(server, cinfo);
+    SOL_DBG("The client %s created the location object.", name);
+    workflow_done(workflow, handle, WORKFLOW_STEP_CREATE, true);
 }
 
-static void
+static int
 create_location_obj(struct sol_lwm2m_server *server,
-    struct sol_lwm2m_client_info *cinfo)
+    struct sol_lwm2m_client_info *cinfo, registry_handle handle)
 {
     int r;
     struct sol_lwm2m_resource res[3];
@@ -167,7 +517,7 @@ create_location_obj(struct sol_lwm2m_server *server,
 
     if (r < 0) {
         SOL_WRN("Could not init the latitude resource");
-        return;
+        return r;
     }
 
     SOL_LWM2M_RESOURCE_INIT(r, &res[1], LONGITUDE_ID, 1,
@@ -176,7 +526,8 @@ create_location_obj(struct sol_lwm2m_server *server,
 
     if (r < 0) {
         SOL_WRN("Could not init the longitude resource");
-        return;
+        sol_lwm2m_resource_clear(&res[0]);
+        return r;
     }
 
     SOL_LWM2M_RESOURCE_INIT(r, &res[2], TIMESTAMP_ID, 1,
@@ -185,11 +536,13 @@ create_location_obj(struct sol_lwm2m_server *server,
 
     if (r < 0) {
         SOL_WRN("Could not init the longitude resource");
-        return;
+        sol_lwm2m_resource_clear(&res[0]);
+        sol_lwm2m_resource_clear(&res[1]);
+        return r;
     }
 
     r = sol_lwm2m_server_create_object_instance(server, cinfo, "/6", res,
-        sol_util_array_size(res), create_cb, NULL);
+        sol_util_array_size(res), create_cb, HANDLE_TO_PTR(handle));
 
     for (i = 0; i < sol_util_array_size(res); i++)
         sol_lwm2m_resource_clear(&res[i]);
@@ -199,6 +552,356 @@ create_location_obj(struct sol_lwm2m_server *server,
             " location object");
     else
         SOL_DBG("Creation request sent");
+    return r;
+}
+
+static void
+set_period_cb(void *data,
+    struct sol_lwm2m_server *server,
+    struct sol_lwm2m_client_info *cinfo, const char *path,
+    enum sol_coap_response_code response_code)
+{
+    registry_handle handle = PTR_TO_HANDLE(data);
+
+    if (response_code != SOL_COAP_RESPONSE_CODE_CHANGED)
+        SOL_DBG("The client %s could not set its notification periods",
+            sol_lwm2m_client_info_get_name(cinfo));
+
+    workflow_done(workflow, handle, WORKFLOW_STEP_SET_PERIOD,
+        response_code == SOL_COAP_RESPONSE_CODE_CHANGED);
+}
+
+/*
+   Soletta has no Write-Attributes, the client default periods in the
+   server object are written instead. The value is taken when the
+   request is sent, so queued changes of a group coalesce.
+ */
+static int
+set_notification_period(struct sol_lwm2m_server *server,
+    struct sol_lwm2m_client_info *cinfo, const char *name,
+    registry_handle handle)
+{
+    uint32_t min_period = backpressure_get_min_period(backpressure,
+        backpressure_group(backpressure, name));
+    struct sol_lwm2m_resource res[2];
+    size_t i;
+    int r;
+
+    SOL_LWM2M_RESOURCE_INIT(r, &res[0], SERVER_OBJ_MIN_PERIOD_ID, 1,
+        SOL_LWM2M_RESOURCE_DATA_TYPE_INT, (int64_t)min_period);
+    if (r < 0)
+        return r;
+
+    //Zero clears both periods, no throttling
+    SOL_LWM2M_RESOURCE_INIT(r, &res[1], SERVER_OBJ_MAX_PERIOD_ID, 1,
+        SOL_LWM2M_RESOURCE_DATA_TYPE_INT, (int64_t)min_period * 2);
+    if (r < 0) {
+        sol_lwm2m_resource_clear(&res[0]);
+        return r;
+    }
+
+    r = sol_lwm2m_server_write(server, cinfo, SERVER_OBJ_PATH, res,
+        sol_util_array_size(res), set_period_cb, HANDLE_TO_PTR(handle));
+
+    for (i = 0; i < sol_util_array_size(res); i++)
+        sol_lwm2m_resource_clear(&res[i]);
+
+    if (r < 0)
+        SOL_WRN("Could not send the notification periods to client %s", name);
+    return r;
+}
+
+static int
+workflow_send(void *data, registry_handle handle, enum workflow_step step)
+{
+    struct sol_lwm2m_server *server = data;
+    struct registry_client *client = registry_get(registry, handle);
+    struct sol_lwm2m_client_info *cinfo;
+
+    if (!client)
+        return -ENOENT;
+
+    cinfo = (struct sol_lwm2m_client_info *)client->info;
+    if (step == WORKFLOW_STEP_CREATE)
+        return create_location_obj(server, cinfo, handle);
+    if (step == WORKFLOW_STEP_SET_PERIOD)
+        return set_notification_period(server, cinfo, client->name, handle);
+    return observe_location(server, cinfo, handle);
+}
+
+static void
+workflow_ready(void *data, registry_handle handle, int64_t time_to_ready)
+{
+    struct registry_client *client = registry_get(registry, handle);
+
+    if (client)
+        SOL_DBG("The client %s is ready after %" PRId64 "ms", client->name,
+            time_to_ready);
+}
+
+static void
+workflow_failed(void *data, registry_handle handle, enum workflow_step step)
+{
+    struct registry_client *client = registry_get(registry, handle);
+
+    static const char *steps[] = {
+        [WORKFLOW_STEP_CREATE] = "creating the location object",
+        [WORKFLOW_STEP_OBSERVE] = "observing the location object",
+        [WORKFLOW_STEP_SET_PERIOD] = "setting the notification periods"
+    };
+
+    if (client)
+        SOL_WRN("Giving up on %s of client %s", steps[step], client->name);
+}
+
+static const struct workflow_ops workflow_ops = {
+    .send = workflow_send,
+    .ready = workflow_ready,
+    .failed = workflow_failed
+};
+
+static bool
+queue_period_update(void *data, struct registry_client *client)
+{
+    if (workflow_start(workflow, client->handle,
+        WORKFLOW_STEP_FLAG(WORKFLOW_STEP_SET_PERIOD)) < 0)
+        SOL_WRN("Could not queue the new periods of client %s", client->name);
+    return true;
+}
+
+static void
+apply_min_period(void *data, unsigned int group, uint32_t min_period)
+{
+    SOL_INF("Minimum notification period of the group %u is now %" PRIu32
+        "s", group, min_period);
+    registry_foreach_in_group(registry, group, queue_period_update, NULL);
+}
+
+static bool
+workflow_stats_cb(void *data)
+{
+    const struct workflow_stats *stats = workflow_get_stats(workflow);
+    static uint64_t last_ready, last_failed;
+
+    if (stats->ready == last_ready && stats->failed == last_failed)
+        return true;
+    last_ready = stats->ready;
+    last_failed = stats->failed;
+
+    SOL_INF("Clients ready %" PRIu64 ", failed %" PRIu64 ", running %"
+        PRIu32 ", queued %" PRIu32 ", retries %" PRIu64 ". Time to ready"
+        " p50 <%" PRId64 "ms p99 <%" PRId64 "ms", stats->ready, stats->failed,
+        stats->running, stats->queued, stats->retries,
+        workflow_stats_percentile(stats, 50),
+        workflow_stats_percentile(stats, 99));
+    return true;
+}
+
+static const char *const metrics_counter_names[] = {
+    [METRICS_COUNTER_REGISTRATIONS] = "registrations",
+    [METRICS_COUNTER_UPDATES] = "updates",
+    [METRICS_COUNTER_DEREGISTRATIONS] = "deregistrations",
+    [METRICS_COUNTER_TIMEOUTS] = "timeouts",
+    [METRICS_COUNTER_NOTIFICATIONS] = "notifications",
+    [METRICS_COUNTER_DECODE_ERRORS] = "decode_errors",
+    [METRICS_COUNTER_EVICTIONS] = "evictions"
+};
+
+static const char *const metrics_gauge_names[] = {
+    [METRICS_GAUGE_CLIENTS] = "clients",
+    [METRICS_GAUGE_OUTSTANDING] = "outstanding",
+    [METRICS_GAUGE_QUEUED] = "queued"
+};
+
+static const char *const metrics_histogram_names[] = {
+    [METRICS_HISTOGRAM_DECODE_US] = "decode_us",
+    [METRICS_HISTOGRAM_JITTER_MS] = "jitter_ms"
+};
+
+/*
+   One line per metric: counters with their total and rate, gauges with
+   their value and histograms with their p50 and p99, all from the last
+   metrics interval.
+ */
+static int
+format_metrics(struct sol_buffer *buf)
+{
+    unsigned int i;
+    int r;
+
+    for (i = 0; i < METRICS_COUNTER_COUNT; i++) {
+        r = sol_buffer_append_printf(buf, "%s %" PRIu64 " %.1f/s\n",
+            metrics_counter_names[i], metrics_last.counters[i],
+            metrics_snapshot_rate(&metrics_prev, &metrics_last, i));
+        if (r < 0)
+            return r;
+    }
+
+    for (i = 0; i < METRICS_GAUGE_COUNT; i++) {
+        r = sol_buffer_append_printf(buf, "%s %" PRId64 "\n",
+            metrics_gauge_names[i], metrics_last.gauges[i]);
+        if (r < 0)
+            return r;
+    }
+
+    for (i = 0; i < METRICS_HISTOGRAM_COUNT; i++) {
+        r = sol_buffer_append_printf(buf, "%s p50 <%" PRIu64 " p99 <%"
+            PRIu64 "\n", metrics_histogram_names[i],
+            metrics_snapshot_percentile(&metrics_prev, &metrics_last, i, 50),
+            metrics_snapshot_percentile(&metrics_prev, &metrics_last, i, 99));
+        if (r < 0)
+            return r;
+    }
+
+    return 0;
+}
+
+static int
+metrics_get(void *data, struct sol_coap_server *server,
+    const struct sol_coap_resource *resource, struct sol_coap_packet *req,
+    const struct sol_network_link_addr *cliaddr)
+{
+    struct sol_coap_packet *resp;
+    struct sol_buffer *buf;
+    int r;
+
+    resp = sol_coap_packet_new(req);
+    if (!resp) {
+        SOL_WRN("Could not create the metrics response");
+        return -ENOMEM;
+    }
+    sol_coap_header_set_type(resp, SOL_COAP_MESSAGE_TYPE_ACK);
+    sol_coap_header_set_code(resp, SOL_COAP_RESPONSE_CODE_CONTENT);
+
+    r = sol_coap_packet_get_payload(resp, &buf, NULL);
+    if (r < 0)
+        goto err;
+    r = format_metrics(buf);
+    if (r < 0)
+        goto err;
+
+    return sol_coap_send_packet(server, resp, cliaddr);
+
+err:
+    sol_coap_packet_unref(resp);
+    return r;
+}
+
+#ifdef SOL_PLATFORM_LINUX
+/* Snapshots are self delimiting, they are appended back to back. */
+static void
+write_metrics_snapshot(void)
+{
+    uint8_t buf[METRICS_SNAPSHOT_MAX_SIZE];
+    int len;
+
+    if (!metrics_file)
+        return;
+
+    len = metrics_snapshot_encode(&metrics_last, buf, sizeof(buf));
+    if (len < 0 || fwrite(buf, 1, len, metrics_file) != (size_t)len ||
+        fflush(metrics_file)) {
+        SOL_WRN("Could not write the metrics snapshot, stopping");
+        fclose(metrics_file);
+        metrics_file = NULL;
+    }
+}
+#endif
+
+static bool
+metrics_cb(void *data)
+{
+    struct timespec now = sol_util_timespec_get_current();
+
+    if (registry)
+        metrics_gauge_set(metrics_local, METRICS_GAUGE_CLIENTS,
+            registry_count(registry));
+    if (workflow) {
+        const struct workflow_stats *stats = workflow_get_stats(workflow);
+
+        metrics_gauge_set(metrics_local, METRICS_GAUGE_OUTSTANDING,
+            stats->in_flight);
+        metrics_gauge_set(metrics_local, METRICS_GAUGE_QUEUED, stats->queued);
+    }
+
+    metrics_prev = metrics_last;
+    metrics_snapshot(metrics, sol_util_msec_from_timespec(&now),
+        &metrics_last);
+
+#ifdef SOL_PLATFORM_LINUX
+    write_metrics_snapshot();
+#endif
+    return true;
+}
+
+/*
+   The metrics are served by their own CoAP server, as the LWM2M one
+   does not take other resources. Failing to set them up is not fatal.
+   With loopback, they are only served to this host.
+ */
+static void
+setup_metrics(uint16_t port, bool loopback)
+{
+    static struct sol_coap_resource metrics_resource = {
+        SOL_SET_API_VERSION(.api_version = SOL_COAP_RESOURCE_API_VERSION, )
+        .get = metrics_get,
+        .flags = SOL_COAP_FLAGS_WELL_KNOWN,
+        .path = {
+            SOL_STR_SLICE_LITERAL("metrics"),
+            SOL_STR_SLICE_EMPTY
+        }
+    };
+    struct sol_network_link_addr addr = {
+        .family = SOL_NETWORK_FAMILY_INET6,
+        .port = port
+    };
+    struct timespec now = sol_util_timespec_get_current();
+
+    if (loopback)
+        addr.addr.in6[15] = 1;
+
+    metrics = metrics_new();
+    if (!metrics) {
+        SOL_WRN("Could not create the metrics");
+        return;
+    }
+
+    metrics_local = metrics_local_get(metrics);
+    metrics_snapshot(metrics, sol_util_msec_from_timespec(&now),
+        &metrics_last);
+    metrics_prev = metrics_last;
+
+    metrics_timeout = sol_timeout_add(METRICS_INTERVAL, metrics_cb, NULL);
+    if (!metrics_timeout)
+        SOL_WRN("Could not create the metrics timer");
+
+    metrics_server = sol_coap_server_new(&addr, false);
+    if (!metrics_server) {
+        SOL_WRN("Could not serve the metrics on the port %" PRIu16, port);
+        return;
+    }
+
+    if (sol_coap_server_register_resource(metrics_server, &metrics_resource,
+        NULL) < 0) {
+        SOL_WRN("Could not register the metrics resource");
+        sol_coap_server_unref(metrics_server);
+        metrics_server = NULL;
+    }
+}
+
+static void
+teardown_metrics(void)
+{
+    if (metrics_timeout)
+        sol_timeout_del(metrics_timeout);
+    if (metrics_server)
+        sol_coap_server_unref(metrics_server);
+#ifdef SOL_PLATFORM_LINUX
+    if (metrics_file)
+        fclose(metrics_file);
+#endif
+    metrics_del(metrics);
+    metrics_local = NULL;
 }
 
 static void
@@ -208,68 +911,193 @@ registration_cb(void *data,
     enum sol_lwm2m_registration_event event)
 {
     const char *name;
+    struct registry_client *client;
+    registry_handle handle;
     enum location_object_status status;
+    uint32_t steps;
+    int r;
 
     name = sol_lwm2m_client_info_get_name(cinfo);
 
     if (event == SOL_LWM2M_REGISTRATION_EVENT_UPDATE) {
         SOL_DBG("Client %s updated", name);
+        metrics_count(metrics_local, METRICS_COUNTER_UPDATES, 1);
+        client = registry_find_by_name(registry, name);
+        if (client && index_client_objects(client, cinfo) < 0)
+            SOL_WRN("Could not index the objects of client %s", name);
         return;
-    } else if (event == SOL_LWM2M_REGISTRATION_EVENT_UNREGISTER) {
-        SOL_DBG("Client %s unregistered", name);
-        return;
-    } else if (event == SOL_LWM2M_REGISTRATION_EVENT_TIMEOUT) {
-        SOL_DBG("Client %s timeout", name);
+    } else if (event == SOL_LWM2M_REGISTRATION_EVENT_UNREGISTER ||
+        event == SOL_LWM2M_REGISTRATION_EVENT_TIMEOUT) {
+        SOL_DBG("Client %s %s", name,
+            event == SOL_LWM2M_REGISTRATION_EVENT_TIMEOUT ?
+            "timeout" : "unregistered");
+        metrics_count(metrics_local,
+            event == SOL_LWM2M_REGISTRATION_EVENT_TIMEOUT ?
+            METRICS_COUNTER_TIMEOUTS : METRICS_COUNTER_DEREGISTRATIONS, 1);
+        client = registry_find_by_name(registry, name);
+        if (client) {
+            workflow_cancel(workflow, client->handle);
+#ifdef SOL_PLATFORM_LINUX
+            close_client_series(client);
+            if (eviction_watch)
+                shard_worker_unregistered(name);
+#endif
+            registry_remove(registry, client->handle);
+        }
         return;
     }
 
     SOL_DBG("Client %s registered", name);
-    status = get_location_object_status(cinfo);
+    metrics_count(metrics_local, METRICS_COUNTER_REGISTRATIONS, 1);
+
+    //A registration replaces the previous one of the same client
+    client = registry_find_by_name(registry, name);
+    if (client)
+        workflow_cancel(workflow, client->handle);
+
+    r = registry_add(registry, name, sol_lwm2m_client_info_get_location(cinfo),
+        cinfo, &handle);
+    if (r < 0) {
+        SOL_WRN("Could not add the client %s to the registry (%d)", name, r);
+        return;
+    }
+
+#ifdef SOL_PLATFORM_LINUX
+    //The worker it had before, if another one, forgets it
+    if (eviction_watch && shard_worker_registered(name) < 0)
+        SOL_WRN("Could not tell the parent that client %s registered", name);
+#endif
+
+    client = registry_get(registry, handle);
+    //Where its backpressure group finds it
+    r = registry_client_set_group(registry, handle,
+        backpressure_group(backpressure, name));
+    if (r < 0)
+        SOL_WRN("Could not group the client %s, it will not be throttled",
+            name);
+
+    r = index_client_objects(client, cinfo);
+    if (r < 0) {
+        SOL_WRN("Could not index the objects of client %s", name);
+        registry_remove(registry, handle);
+        return;
+    }
+
+#ifdef SOL_PLATFORM_LINUX
+    open_client_series(client);
+#endif
+
+    status = get_location_object_status(client);
+    /*
+       The periods are written even when they are 0: the client may still
+       be throttled from before a restart of this server, or have kept
+       the periods of an earlier registration, and only a write clears
+       them, as apply_min_period() only writes when they change.
+     */
+    steps = WORKFLOW_STEP_FLAG(WORKFLOW_STEP_OBSERVE) |
+        WORKFLOW_STEP_FLAG(WORKFLOW_STEP_SET_PERIOD);
 
     if (status == LOCATION_OBJECT_NOT_FOUND) {
         SOL_WRN(
             "The client %s does not implement the location object!",
             name);
+        return;
     } else if (status == LOCATION_OBJECT_WITH_NO_INSTANCES) {
         SOL_DBG("The client %s does not have an instance of the location"
             " object. Creating one.", name);
-        create_location_obj(server, cinfo);
+        r = workflow_start(workflow, handle,
+            steps | WORKFLOW_STEP_FLAG(WORKFLOW_STEP_CREATE));
     } else {
         SOL_DBG("The client %s have an location object instance,"
             " observing", name);
-        observe_location(server, cinfo);
+        r = workflow_start(workflow, handle, steps);
     }
+
+    if (r < 0)
+        SOL_WRN("Could not queue the location object requests of client %s",
+            name);
+}
+
+static struct sol_lwm2m_server *
+lwm2m_server_new(uint16_t port)
+{
+#ifdef USE_DTLS
+    //tinydtls keeps the session of each client, until it goes away
+    psk.id = sol_blob_new(&SOL_BLOB_TYPE_NO_FREE, NULL, LWM2M_PSK_ID,
+        sizeof(LWM2M_PSK_ID) - 1);
+    psk.key = sol_blob_new(&SOL_BLOB_TYPE_NO_FREE, NULL, LWM2M_PSK,
+        sizeof(LWM2M_PSK) - 1);
+    if (!psk.id || !psk.key)
+        return NULL;
+
+    return sol_lwm2m_server_new(port, 1,
+        SOL_LWM2M_SECURITY_MODE_PRE_SHARED_KEY, known_psks);
+#else
+    return sol_lwm2m_server_new(port);
+#endif
 }
 
 static bool
-setup_server(void)
+setup_server(uint16_t port)
 {
     struct sol_lwm2m_server *server;
-    uint16_t port = SOL_LWM2M_DEFAULT_SERVER_PORT;
     int r, ret = false;
 
-    SOL_DBG("Using the default LWM2M port (%" PRIu16 ")", port);
+    SOL_DBG("Using the LWM2M port %" PRIu16, port);
 
-    server = sol_lwm2m_server_new(port);
+    registry = registry_new(0);
+    if (!registry) {
+        SOL_WRN("Could not create the client registry");
+        goto exit;
+    }
+
+    server = lwm2m_server_new(port);
     if (!server) {
         SOL_WRN("Could not create the LWM2M server");
-        goto exit;
+        goto exit_registry;
+    }
+
+    workflow = workflow_new(NULL, &workflow_ops, server);
+    if (!workflow) {
+        SOL_WRN("Could not create the registration workflow");
+        goto exit_del;
+    }
+
+    backpressure = backpressure_new(NULL, apply_min_period, NULL);
+    if (!backpressure) {
+        SOL_WRN("Could not create the backpressure controller");
+        goto exit_workflow;
     }
 
     r = sol_lwm2m_server_add_registration_monitor(server, registration_cb,
         NULL);
     if (r < 0) {
         SOL_WRN("Could not add a registration monitor");
-        goto exit_del;
+        goto exit_backpressure;
     }
 
+    workflow_stats_timeout = sol_timeout_add(WORKFLOW_STATS_INTERVAL,
+        workflow_stats_cb, NULL);
+    if (!workflow_stats_timeout)
+        SOL_WRN("Could not create the workflow stats timer");
+
+    lwm2m_server = server;
     ret = true;
 
     SOL_DBG("setup_server() ok");
     return ret;
 
+exit_backpressure:
+    backpressure_del(backpressure);
+    backpressure = NULL;
+exit_workflow:
+    workflow_del(workflow);
+    workflow = NULL;
 exit_del:
     sol_lwm2m_server_del(server);
+exit_registry:
+    registry_del(registry);
+    registry = NULL;
 exit:
     sol_shutdown();
     return ret;
@@ -306,13 +1134,289 @@ show_interfaces(void)
     }
 }
 
+#ifdef SOL_PLATFORM_LINUX
+static bool
+parse_shard_arg(const char *arg, const char *name, long *value)
+{
+    size_t len = strlen(name);
+    char *end;
+
+    if (strncmp(arg, name, len))
+        return false;
+
+    errno = 0;
+    *value = strtol(arg + len, &end, 10);
+    if (errno || *end || *value < 0 || *value >= SHARD_MAX) {
+        SOL_WRN("Invalid value for %.*s", (int)len - 1, name);
+        *value = -1;
+    }
+    return true;
+}
+
+/*
+   --shards=N runs the LWM2M processing in N worker processes, the
+   workers are started with --worker=<shard>.
+ */
+static bool
+parse_args(long *shards, long *worker)
+{
+    char **argv = sol_argv();
+    int i, argc = sol_argc();
+
+    for (i = 1; i < argc; i++) {
+        if (parse_shard_arg(argv[i], "--shards=", shards)) {
+            if (*shards < 0)
+                return false;
+        } else if (parse_shard_arg(argv[i], "--worker=", worker)) {
+            if (*worker < 0)
+                return false;
+        } else {
+            SOL_WRN("Unknown argument: %s", argv[i]);
+            return false;
+        }
+    }
+
+    return true;
+}
+
+/*
+   The client registered again with another worker, from a new address
+   or port. It is forgotten here, so only that worker serves it, even
+   though Soletta keeps its registration until its lifetime is over.
+ */
+static void
+evict_client(const char *name)
+{
+    struct registry_client *client = registry_find_by_name(registry, name);
+
+    if (!client)
+        return;
+
+    SOL_INF("Client %s registered with another worker, evicting it", name);
+    metrics_count(metrics_local, METRICS_COUNTER_EVICTIONS, 1);
+    sol_lwm2m_server_del_observer(lwm2m_server,
+        (struct sol_lwm2m_client_info *)client->info, "/6",
+        location_changed_cb, HANDLE_TO_PTR(client->handle));
+    workflow_cancel(workflow, client->handle);
+    close_client_series(client);
+    registry_remove(registry, client->handle);
+}
+
+static bool
+eviction_cb(void *data, int fd, uint32_t active_flags)
+{
+    char name[SHARD_NAME_MAX + 1];
+    int r;
+
+    while ((r = shard_worker_next_eviction(name, sizeof(name))) > 0)
+        evict_client(name);
+
+    if (r < 0) {
+        SOL_WRN("Could not read the evictions from the parent (%d)", r);
+        eviction_watch = NULL;
+        return false;
+    }
+    return true;
+}
+
+static bool
+control_cb(void *data, int fd, uint32_t active_flags)
+{
+    unsigned int shard = (uintptr_t)data;
+    int r;
+
+    r = shard_workers_dispatch(workers, shard);
+    if (r < 0) {
+        SOL_WRN("Could not read the registrations of the worker %u (%d)",
+            shard, r);
+        control_watches[shard] = NULL;
+        return false;
+    }
+    if (r > 0)
+        SOL_DBG("%d clients of the worker %u moved from another one", r,
+            shard);
+    return true;
+}
+
+static bool
+workers_check_cb(void *data)
+{
+    shard_workers_check(workers);
+    return true;
+}
+
+static void
+teardown_shards(void)
+{
+    unsigned int i;
+
+    if (workers_timeout)
+        sol_timeout_del(workers_timeout);
+    workers_timeout = NULL;
+    for (i = 0; i < SHARD_MAX; i++) {
+        if (control_watches[i])
+            sol_fd_del(control_watches[i]);
+        control_watches[i] = NULL;
+    }
+    if (eviction_watch)
+        sol_fd_del(eviction_watch);
+    eviction_watch = NULL;
+    shard_workers_del(workers);
+    workers = NULL;
+}
+
+static bool
+setup_shards(unsigned int shards)
+{
+    char **argv = sol_argv(), **worker_argv;
+    int i, argc = sol_argc(), n = 0;
+
+    //The workers get the same arguments, but --shards
+    worker_argv = calloc(argc + 1, sizeof(char *));
+    if (!worker_argv)
+        return false;
+    for (i = 0; i < argc; i++) {
+        if (strncmp(argv[i], "--shards=", strlen("--shards=")))
+            worker_argv[n++] = argv[i];
+    }
+
+    workers = shard_workers_new("/proc/self/exe", worker_argv,
+        SOL_LWM2M_DEFAULT_SERVER_PORT, shards);
+    free(worker_argv);
+    if (!workers) {
+        SOL_WRN("Could not start the %u workers", shards);
+        return false;
+    }
+
+    for (i = 0; i < (int)shards; i++) {
+        control_watches[i] = sol_fd_add(
+            shard_workers_get_control_fd(workers, i), SOL_FD_FLAGS_IN,
+            control_cb, (void *)(uintptr_t)i);
+        if (!control_watches[i]) {
+            SOL_WRN("Could not watch the control socket of the worker %d", i);
+            goto err_watches;
+        }
+    }
+
+    workers_timeout = sol_timeout_add(WORKERS_CHECK_INTERVAL,
+        workers_check_cb, NULL);
+    if (!workers_timeout) {
+        SOL_WRN("Could not create the workers timer");
+        goto err_watches;
+    }
+
+    SOL_WRN("Serving the LWM2M port from %u workers", shards);
+    return true;
+
+err_watches:
+    teardown_shards();
+    return false;
+}
+#endif
+
 static void
 startup(void)
 {
+    uint16_t port = SOL_LWM2M_DEFAULT_SERVER_PORT;
+    uint16_t metrics_port = METRICS_DEFAULT_PORT;
+    bool metrics_loopback = false;
+
+#ifdef SOL_PLATFORM_LINUX
+    char store_dir[sizeof(STORE_DIR) + 24] = STORE_DIR;
+    long shards = 0, worker = -1;
+
+    if (!parse_args(&shards, &worker))
+        goto err_exit;
+
+    if (shards > 0 && worker < 0) {
+#ifdef USE_DTLS
+        //Each worker would bind the DTLS port on its own
+        SOL_WRN("The sharded mode does not serve DTLS");
+        goto err_exit;
+#endif
+        if (!setup_shards(shards))
+            goto err_exit;
+        return;
+    }
+
+    if (worker >= 0) {
+        char path[sizeof(METRICS_FILE) + 24];
+
+        snprintf(store_dir, sizeof(store_dir), "%s.%ld", STORE_DIR, worker);
+        shard_worker_adopt(port);
+        metrics_port = METRICS_DEFAULT_PORT + 1 + worker;
+        metrics_loopback = true;
+        snprintf(path, sizeof(path), "%s.%ld", METRICS_FILE, worker);
+        metrics_file = fopen(path, "ab");
+    } else
+        metrics_file = fopen(METRICS_FILE, "ab");
+    if (!metrics_file)
+        SOL_WRN("Could not open the metrics file, snapshots will not be"
+            " written");
+#endif
+
     SOL_WRN("Showing interfaces");
     show_interfaces();
 
+#ifdef SOL_PLATFORM_LINUX
+    setup_store(store_dir);
+#endif
+
+    setup_metrics(metrics_port, metrics_loopback);
+
     SOL_WRN("Setting up LWM2M server");
-    setup_server();
+    if (!setup_server(port))
+        return;
+
+#ifdef SOL_PLATFORM_LINUX
+    if (worker >= 0 && !shard_worker_adopted()) {
+        SOL_WRN("The worker %ld did not get the socket of its shard", worker);
+        goto err_exit;
+    }
+    if (worker >= 0) {
+        eviction_watch = sol_fd_add(SHARD_CONTROL_FD, SOL_FD_FLAGS_IN,
+            eviction_cb, NULL);
+        if (!eviction_watch) {
+            SOL_WRN("The worker %ld can not hear from the parent", worker);
+            goto err_exit;
+        }
+    }
+#endif
+    return;
+
+#ifdef SOL_PLATFORM_LINUX
+err_exit:
+    sol_quit_with_code(EXIT_FAILURE);
+#endif
+}
+
+static void
+shutdown(void)
+{
+    if (workflow_stats_timeout)
+        sol_timeout_del(workflow_stats_timeout);
+    //First, as its pending requests may still call the workflow back
+    if (lwm2m_server)
+        sol_lwm2m_server_del(lwm2m_server);
+    backpressure_del(backpressure);
+    workflow_del(workflow);
+#ifdef SOL_PLATFORM_LINUX
+    if (registry)
+        registry_foreach(registry, close_series_cb, NULL);
+#endif
+    registry_del(registry);
+    teardown_metrics();
+
+#ifdef USE_DTLS
+    if (psk.id)
+        sol_blob_unref(psk.id);
+    if (psk.key)
+        sol_blob_unref(psk.key);
+#endif
+
+#ifdef SOL_PLATFORM_LINUX
+    teardown_shards();
+    teardown_store();
+#endif
 }
-SOL_MAIN_DEFAULT(startup, NULL);
+SOL_MAIN_DEFAULT(startup, shutdown);
@@ -0,0 +1,239 @@
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sol-common-buildopts.h"
+
+#include "metrics.h"
+
+#ifdef SOL_PLATFORM_LINUX
+#define LOAD(_p) __atomic_load_n(_p, __ATOMIC_RELAXED)
+#define STORE(_p, _v) __atomic_store_n(_p, _v, __ATOMIC_RELAXED)
+#define LOAD_PTR(_p) __atomic_load_n(_p, __ATOMIC_ACQUIRE)
+#define STORE_PTR(_p, _v) __atomic_store_n(_p, _v, __ATOMIC_RELEASE)
+#define CLAIM(_p) __atomic_fetch_add(_p, 1, __ATOMIC_RELAXED)
+#else
+//Single threaded, and small cores may have no atomics at all
+#define LOAD(_p) (*(_p))
+#define STORE(_p, _v) (*(_p) = (_v))
+#define LOAD_PTR(_p) (*(_p))
+#define STORE_PTR(_p, _v) (*(_p) = (_v))
+#define CLAIM(_p) ((*(_p))++)
+#endif
+
+struct metrics_local {
+    uint64_t counters[METRICS_COUNTER_COUNT];
+    int64_t gauges[METRICS_GAUGE_COUNT];
+    uint64_t histograms[METRICS_HISTOGRAM_COUNT][METRICS_HISTOGRAM_BUCKETS];
+};
+
+struct metrics {
+    //Allocated as taken, each on its own cache lines
+    struct metrics_local *locals[METRICS_MAX_LOCALS];
+    unsigned int claimed;
+};
+
+struct metrics *
+metrics_new(void)
+{
+    return calloc(1, sizeof(struct metrics));
+}
+
+void
+metrics_del(struct metrics *m)
+{
+    unsigned int i;
+
+    if (!m)
+        return;
+
+    for (i = 0; i < METRICS_MAX_LOCALS; i++)
+        free(m->locals[i]);
+    free(m);
+}
+
+struct metrics_local *
+metrics_local_get(struct metrics *m)
+{
+    struct metrics_local *local;
+    unsigned int i;
+    size_t size;
+
+    i = CLAIM(&m->claimed);
+    if (i >= METRICS_MAX_LOCALS)
+        return NULL;
+
+    //Rounded up to a whole number of cache lines, so writers never share one
+    size = (sizeof(struct metrics_local) + 63) & ~(size_t)63;
+#ifdef SOL_PLATFORM_LINUX
+    if (posix_memalign((void **)&local, 64, size))
+        return NULL;
+    memset(local, 0, size);
+#else
+    local = calloc(1, size);
+    if (!local)
+        return NULL;
+#endif
+
+    STORE_PTR(&m->locals[i], local);
+    return local;
+}
+
+void
+metrics_count(struct metrics_local *local, enum metrics_counter counter,
+    uint64_t n)
+{
+    if (!local)
+        return;
+
+    //The only writer, no read-modify-write needed
+    STORE(&local->counters[counter], LOAD(&local->counters[counter]) + n);
+}
+
+void
+metrics_gauge_set(struct metrics_local *local, enum metrics_gauge gauge,
+    int64_t value)
+{
+    if (local)
+        STORE(&local->gauges[gauge], value);
+}
+
+void
+metrics_observe(struct metrics_local *local, enum metrics_histogram histogram,
+    uint64_t value)
+{
+    uint64_t *bucket;
+    unsigned int b = 0;
+
+    if (!local)
+        return;
+
+    while (value > 0 && b < METRICS_HISTOGRAM_BUCKETS - 1) {
+        value >>= 1;
+        b++;
+    }
+
+    bucket = &local->histograms[histogram][b];
+    STORE(bucket, LOAD(bucket) + 1);
+}
+
+void
+metrics_snapshot(struct metrics *m, int64_t time,
+    struct metrics_snapshot *snap)
+{
+    unsigned int i, j, b;
+
+    memset(snap, 0, sizeof(struct metrics_snapshot));
+    snap->time = time;
+
+    for (i = 0; i < METRICS_MAX_LOCALS; i++) {
+        struct metrics_local *local = LOAD_PTR(&m->locals[i]);
+
+        if (!local)
+            continue;
+
+        for (j = 0; j < METRICS_COUNTER_COUNT; j++)
+            snap->counters[j] += LOAD(&local->counters[j]);
+        for (j = 0; j < METRICS_GAUGE_COUNT; j++)
+            snap->gauges[j] += LOAD(&local->gauges[j]);
+        for (j = 0; j < METRICS_HISTOGRAM_COUNT; j++) {
+            for (b = 0; b < METRICS_HISTOGRAM_BUCKETS; b++)
+                snap->histograms[j][b] += LOAD(&local->histograms[j][b]);
+        }
+    }
+}
+
+double
+metrics_snapshot_rate(const struct metrics_snapshot *prev,
+    const struct metrics_snapshot *cur, enum metrics_counter counter)
+{
+    int64_t elapsed = cur->time - prev->time;
+
+    if (elapsed <= 0)
+        return 0;
+    return (cur->counters[counter] - prev->counters[counter]) * 1000.0 /
+           elapsed;
+}
+
+uint64_t
+metrics_snapshot_percentile(const struct metrics_snapshot *prev,
+    const struct metrics_snapshot *cur, enum metrics_histogram histogram,
+    unsigned int pct)
+{
+    uint64_t counts[METRICS_HISTOGRAM_BUCKETS];
+    uint64_t total = 0, seen = 0, target;
+    unsigned int b;
+
+    for (b = 0; b < METRICS_HISTOGRAM_BUCKETS; b++) {
+        counts[b] = cur->histograms[histogram][b];
+        if (prev)
+            counts[b] -= prev->histograms[histogram][b];
+        total += counts[b];
+    }
+    if (!total)
+        return 0;
+
+    target = (total * pct + 99) / 100;
+    for (b = 0; b < METRICS_HISTOGRAM_BUCKETS; b++) {
+        seen += counts[b];
+        if (seen >= target)
+            break;
+    }
+
+    return b ? (uint64_t)1 << b : 0;
+}
+
+static uint8_t *
+put_varint(uint8_t *p, const uint8_t *end, uint64_t value)
+{
+    do {
+        if (p == end)
+            return NULL;
+        *p = value & 0x7f;
+        value >>= 7;
+        if (value)
+            *p |= 0x80;
+        p++;
+    } while (value);
+
+    return p;
+}
+
+static uint64_t
+zigzag(int64_t value)
+{
+    return ((uint64_t)value << 1) ^ (uint64_t)(value >> 63);
+}
+
+int
+metrics_snapshot_encode(const struct metrics_snapshot *snap,
+    uint8_t *buf, size_t len)
+{
+    uint8_t *p = buf, *end = buf + len;
+    unsigned int i, b;
+
+    if (len < 9)
+        return -ENOBUFS;
+
+    memcpy(p, METRICS_SNAPSHOT_MAGIC, 4);
+    p += 4;
+    *p++ = METRICS_SNAPSHOT_VERSION;
+    *p++ = METRICS_COUNTER_COUNT;
+    *p++ = METRICS_GAUGE_COUNT;
+    *p++ = METRICS_HISTOGRAM_COUNT;
+    *p++ = METRICS_HISTOGRAM_BUCKETS;
+
+    p = put_varint(p, end, snap->time);
+    for (i = 0; p && i < METRICS_COUNTER_COUNT; i++)
+        p = put_varint(p, end, snap->counters[i]);
+    for (i = 0; p && i < METRICS_GAUGE_COUNT; i++)
+        p = put_varint(p, end, zigzag(snap->gauges[i]));
+    for (i = 0; p && i < METRICS_HISTOGRAM_COUNT; i++) {
+        for (b = 0; p && b < METRICS_HISTOGRAM_BUCKETS; b++)
+            p = put_varint(p, end, snap->histograms[i][b]);
+    }
+
+    if (!p)
+        return -ENOBUFS;
+    return p - buf;
+}
@@ -0,0 +1,99 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+   Counters of what the server does, to spot ingest regressions and to
+   size hosts.
+
+   Each thread that updates the metrics takes its own metrics_local and
+   is the only writer of it, so updates are plain relaxed stores, without
+   locks or read-modify-write atomics. Snapshots sum all locals, they may
+   run in any thread.
+
+   Snapshots are exported as text or in a compact binary encoding (see
+   metrics_snapshot_encode()).
+ */
+
+enum metrics_counter {
+    METRICS_COUNTER_REGISTRATIONS = 0,
+    METRICS_COUNTER_UPDATES,
+    METRICS_COUNTER_DEREGISTRATIONS,
+    METRICS_COUNTER_TIMEOUTS,
+    METRICS_COUNTER_NOTIFICATIONS,
+    METRICS_COUNTER_DECODE_ERRORS,
+    METRICS_COUNTER_EVICTIONS, //clients that moved to another worker
+    METRICS_COUNTER_COUNT
+};
+
+enum metrics_gauge {
+    METRICS_GAUGE_CLIENTS = 0,
+    METRICS_GAUGE_OUTSTANDING, //requests in flight to the clients
+    METRICS_GAUGE_QUEUED, //clients waiting for their first request
+    METRICS_GAUGE_COUNT
+};
+
+enum metrics_histogram {
+    METRICS_HISTOGRAM_DECODE_US = 0, //TLV decoding time
+    METRICS_HISTOGRAM_JITTER_MS, //change of the notification interval
+    METRICS_HISTOGRAM_COUNT
+};
+
+//Bucket i counts values in [2^(i-1), 2^i)
+#define METRICS_HISTOGRAM_BUCKETS (24)
+#define METRICS_MAX_LOCALS (16)
+
+struct metrics;
+struct metrics_local;
+
+struct metrics_snapshot {
+    int64_t time; //ms
+    uint64_t counters[METRICS_COUNTER_COUNT];
+    int64_t gauges[METRICS_GAUGE_COUNT];
+    uint64_t histograms[METRICS_HISTOGRAM_COUNT][METRICS_HISTOGRAM_BUCKETS];
+};
+
+struct metrics *metrics_new(void);
+void metrics_del(struct metrics *m);
+
+/*
+   Takes the storage of the calling thread, to be kept for the life of
+   the thread. NULL once METRICS_MAX_LOCALS were taken.
+ */
+struct metrics_local *metrics_local_get(struct metrics *m);
+
+void metrics_count(struct metrics_local *local, enum metrics_counter counter,
+    uint64_t n);
+void metrics_gauge_set(struct metrics_local *local, enum metrics_gauge gauge,
+    int64_t value);
+void metrics_observe(struct metrics_local *local,
+    enum metrics_histogram histogram, uint64_t value);
+
+void metrics_snapshot(struct metrics *m, int64_t time,
+    struct metrics_snapshot *snap);
+
+/* Per second increase of the counter from prev to cur. */
+double metrics_snapshot_rate(const struct metrics_snapshot *prev,
+    const struct metrics_snapshot *cur, enum metrics_counter counter);
+/* Upper bound of pct% of the values seen between prev (may be NULL) and cur. */
+uint64_t metrics_snapshot_percentile(const struct metrics_snapshot *prev,
+    const struct metrics_snapshot *cur, enum metrics_histogram histogram,
+    unsigned int pct);
+
+#define METRICS_SNAPSHOT_MAGIC "LWMM"
+#define METRICS_SNAPSHOT_VERSION (1)
+//Upper bound of an encoded snapshot
+#define METRICS_SNAPSHOT_MAX_SIZE (9 + 10 * (1 + METRICS_COUNTER_COUNT + \
+    METRICS_GAUGE_COUNT + \
+    METRICS_HISTOGRAM_COUNT * METRICS_HISTOGRAM_BUCKETS))
+
+/*
+   Encodes a snapshot: the magic, the version, one byte with each of the
+   number of counters, gauges, histograms and buckets, then the time,
+   counters, gauges (zigzag) and histogram buckets as LEB128 varints.
+   Returns the encoded size or -ENOBUFS.
+ */
+int metrics_snapshot_encode(const struct metrics_snapshot *snap,
+    uint8_t *buf, size_t len);
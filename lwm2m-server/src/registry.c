@@ -0,0 +1,561 @@
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "registry.h"
+
+#define SLOT_BITS (20)
+#define SLOT_MASK ((1u << SLOT_BITS) - 1)
+#define GENERATION_MASK ((1u << (32 - SLOT_BITS)) - 1)
+//Slot numbers are stored plus one, so zero is never a valid handle
+#define MAX_SLOTS (SLOT_MASK - 1)
+
+#define INDEX_EMPTY (0)
+#define INDEX_TOMBSTONE (UINT32_MAX)
+#define INDEX_MIN_CAPACITY (16)
+
+struct slot {
+    struct registry_client client;
+    uint32_t generation;
+    uint32_t next_free;
+    uint32_t name_hash;
+    uint32_t location_hash;
+    //Slots of the previous and next clients of the group, plus one
+    uint32_t group_prev;
+    uint32_t group_next;
+    bool used;
+};
+
+struct index_entry {
+    uint32_t hash;
+    uint32_t slot;
+};
+
+struct index {
+    struct index_entry *entries;
+    uint32_t cap;
+    uint32_t used; //live entries and tombstones
+    uint32_t live;
+    size_t key_offset;
+};
+
+struct registry {
+    struct slot *slots;
+    uint32_t slots_cap;
+    uint32_t slots_len;
+    uint32_t free_head;
+    uint32_t count;
+    struct index by_name;
+    struct index by_location;
+    //First slot of each group, plus one
+    uint32_t *group_heads;
+    uint32_t groups;
+};
+
+static uint32_t
+hash_str(const char *str)
+{
+    uint32_t h = 2166136261u;
+
+    for (; *str; str++) {
+        h ^= (uint8_t)*str;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static const char *
+slot_key(const struct registry *reg, const struct index *idx, uint32_t slot)
+{
+    const struct registry_client *client = &reg->slots[slot - 1].client;
+
+    return *(const char *const *)((const char *)client + idx->key_offset);
+}
+
+static int
+index_init(struct index *idx, uint32_t cap, size_t key_offset)
+{
+    uint32_t n = INDEX_MIN_CAPACITY;
+
+    while (n < cap * 2)
+        n <<= 1;
+
+    idx->entries = calloc(n, sizeof(struct index_entry));
+    if (!idx->entries)
+        return -ENOMEM;
+    idx->cap = n;
+    idx->used = 0;
+    idx->live = 0;
+    idx->key_offset = key_offset;
+    return 0;
+}
+
+static int64_t
+index_find(const struct registry *reg, const struct index *idx,
+    uint32_t hash, const char *key)
+{
+    uint32_t mask = idx->cap - 1, i;
+
+    for (i = hash & mask;; i = (i + 1) & mask) {
+        const struct index_entry *e = &idx->entries[i];
+
+        if (e->slot == INDEX_EMPTY)
+            return -1;
+        if (e->slot != INDEX_TOMBSTONE && e->hash == hash &&
+            !strcmp(slot_key(reg, idx, e->slot), key))
+            return i;
+    }
+}
+
+static void
+index_put(struct index *idx, uint32_t hash, uint32_t slot)
+{
+    uint32_t mask = idx->cap - 1, i;
+
+    for (i = hash & mask;; i = (i + 1) & mask) {
+        struct index_entry *e = &idx->entries[i];
+
+        if (e->slot == INDEX_EMPTY || e->slot == INDEX_TOMBSTONE) {
+            if (e->slot == INDEX_EMPTY)
+                idx->used++;
+            idx->live++;
+            e->hash = hash;
+            e->slot = slot;
+            return;
+        }
+    }
+}
+
+static int
+index_reserve(struct index *idx)
+{
+    struct index_entry *old = idx->entries;
+    uint32_t old_cap = idx->cap, cap = INDEX_MIN_CAPACITY, i;
+
+    //Keep the load, tombstones included, under 70%
+    if ((uint64_t)(idx->used + 1) * 10 <= (uint64_t)idx->cap * 7)
+        return 0;
+
+    //Sized from the live entries only, so the table is rehashed at the
+    //same size, or a smaller one, when most used entries are tombstones
+    //left by clients that came and went
+    while (cap < (idx->live + 1) * 2)
+        cap <<= 1;
+
+    idx->entries = calloc(cap, sizeof(struct index_entry));
+    if (!idx->entries) {
+        idx->entries = old;
+        return -ENOMEM;
+    }
+    idx->cap = cap;
+    idx->used = 0;
+    idx->live = 0;
+
+    for (i = 0; i < old_cap; i++) {
+        if (old[i].slot != INDEX_EMPTY && old[i].slot != INDEX_TOMBSTONE)
+            index_put(idx, old[i].hash, old[i].slot);
+    }
+
+    free(old);
+    return 0;
+}
+
+static void
+index_remove(struct index *idx, uint32_t hash, uint32_t slot)
+{
+    uint32_t mask = idx->cap - 1, i;
+
+    for (i = hash & mask;; i = (i + 1) & mask) {
+        struct index_entry *e = &idx->entries[i];
+
+        if (e->slot == INDEX_EMPTY)
+            return;
+        if (e->slot == slot) {
+            e->slot = INDEX_TOMBSTONE;
+            idx->live--;
+            return;
+        }
+    }
+}
+
+struct registry *
+registry_new(uint32_t initial_capacity)
+{
+    struct registry *reg;
+
+    reg = calloc(1, sizeof(struct registry));
+    if (!reg)
+        return NULL;
+
+    if (index_init(&reg->by_name, initial_capacity,
+        offsetof(struct registry_client, name)) < 0)
+        goto err_free;
+    if (index_init(&reg->by_location, initial_capacity,
+        offsetof(struct registry_client, location)) < 0)
+        goto err_free_name;
+
+    if (initial_capacity) {
+        reg->slots = calloc(initial_capacity, sizeof(struct slot));
+        if (!reg->slots)
+            goto err_free_location;
+        reg->slots_cap = initial_capacity;
+    }
+
+    return reg;
+
+err_free_location:
+    free(reg->by_location.entries);
+err_free_name:
+    free(reg->by_name.entries);
+err_free:
+    free(reg);
+    return NULL;
+}
+
+static void
+client_clear(struct registry_client *client)
+{
+    free(client->name);
+    free(client->location);
+    free(client->objects);
+    memset(client, 0, sizeof(struct registry_client));
+}
+
+void
+registry_del(struct registry *reg)
+{
+    uint32_t i;
+
+    if (!reg)
+        return;
+
+    for (i = 0; i < reg->slots_len; i++) {
+        if (reg->slots[i].used)
+            client_clear(&reg->slots[i].client);
+    }
+
+    free(reg->slots);
+    free(reg->group_heads);
+    free(reg->by_name.entries);
+    free(reg->by_location.entries);
+    free(reg);
+}
+
+uint32_t
+registry_count(const struct registry *reg)
+{
+    return reg->count;
+}
+
+static int
+slot_alloc(struct registry *reg, uint32_t *slot)
+{
+    if (reg->free_head) {
+        *slot = reg->free_head;
+        reg->free_head = reg->slots[*slot - 1].next_free;
+        return 0;
+    }
+
+    if (reg->slots_len == reg->slots_cap) {
+        uint32_t cap = reg->slots_cap ? reg->slots_cap * 2 : 16;
+        struct slot *slots;
+
+        if (cap > MAX_SLOTS)
+            cap = MAX_SLOTS;
+        if (cap == reg->slots_len)
+            return -ENOSPC;
+
+        slots = realloc(reg->slots, (size_t)cap * sizeof(struct slot));
+        if (!slots)
+            return -ENOMEM;
+        memset(slots + reg->slots_cap, 0,
+            (size_t)(cap - reg->slots_cap) * sizeof(struct slot));
+        reg->slots = slots;
+        reg->slots_cap = cap;
+    }
+
+    *slot = ++reg->slots_len;
+    return 0;
+}
+
+static registry_handle
+slot_handle(const struct slot *s, uint32_t slot)
+{
+    return ((s->generation & GENERATION_MASK) << SLOT_BITS) | slot;
+}
+
+int
+registry_add(struct registry *reg, const char *name,
+    const char *location, const void *info, registry_handle *handle)
+{
+    struct registry_client *old;
+    struct slot *s;
+    uint32_t slot;
+    int r;
+
+    if (!name)
+        return -EINVAL;
+
+    old = registry_find_by_name(reg, name);
+    if (old)
+        registry_remove(reg, old->handle);
+
+    r = index_reserve(&reg->by_name);
+    if (r < 0)
+        return r;
+    r = index_reserve(&reg->by_location);
+    if (r < 0)
+        return r;
+
+    r = slot_alloc(reg, &slot);
+    if (r < 0)
+        return r;
+
+    s = &reg->slots[slot - 1];
+    s->client.name = strdup(name);
+    s->client.location = location ? strdup(location) : NULL;
+    if (!s->client.name || (location && !s->client.location)) {
+        client_clear(&s->client);
+        s->next_free = reg->free_head;
+        reg->free_head = slot;
+        return -ENOMEM;
+    }
+
+    s->used = true;
+    s->client.group = REGISTRY_GROUP_NONE;
+    s->client.info = info;
+    s->client.handle = slot_handle(s, slot);
+    s->name_hash = hash_str(name);
+    index_put(&reg->by_name, s->name_hash, slot);
+    if (location) {
+        s->location_hash = hash_str(location);
+        index_put(&reg->by_location, s->location_hash, slot);
+    }
+
+    reg->count++;
+    if (handle)
+        *handle = s->client.handle;
+    return 0;
+}
+
+static void
+group_unlink(struct registry *reg, struct slot *s)
+{
+    if (s->client.group == REGISTRY_GROUP_NONE)
+        return;
+
+    if (s->group_prev)
+        reg->slots[s->group_prev - 1].group_next = s->group_next;
+    else
+        reg->group_heads[s->client.group] = s->group_next;
+    if (s->group_next)
+        reg->slots[s->group_next - 1].group_prev = s->group_prev;
+
+    s->group_prev = s->group_next = 0;
+    s->client.group = REGISTRY_GROUP_NONE;
+}
+
+int
+registry_remove(struct registry *reg, registry_handle handle)
+{
+    struct registry_client *client = registry_get(reg, handle);
+    uint32_t slot = handle & SLOT_MASK;
+    struct slot *s;
+
+    if (!client)
+        return -ENOENT;
+
+    s = &reg->slots[slot - 1];
+    group_unlink(reg, s);
+    index_remove(&reg->by_name, s->name_hash, slot);
+    if (client->location)
+        index_remove(&reg->by_location, s->location_hash, slot);
+
+    client_clear(client);
+    s->used = false;
+    s->generation++;
+    s->next_free = reg->free_head;
+    reg->free_head = slot;
+    reg->count--;
+    return 0;
+}
+
+struct registry_client *
+registry_get(const struct registry *reg, registry_handle handle)
+{
+    uint32_t slot = handle & SLOT_MASK;
+    struct slot *s;
+
+    if (!slot || slot > reg->slots_len)
+        return NULL;
+
+    s = &reg->slots[slot - 1];
+    if (!s->used || s->client.handle != handle)
+        return NULL;
+    return &s->client;
+}
+
+static struct registry_client *
+find(const struct registry *reg, const struct index *idx, const char *key)
+{
+    int64_t pos;
+
+    if (!key)
+        return NULL;
+
+    pos = index_find(reg, idx, hash_str(key), key);
+    if (pos < 0)
+        return NULL;
+    return &reg->slots[idx->entries[pos].slot - 1].client;
+}
+
+struct registry_client *
+registry_find_by_name(const struct registry *reg, const char *name)
+{
+    return find(reg, &reg->by_name, name);
+}
+
+struct registry_client *
+registry_find_by_location(const struct registry *reg, const char *location)
+{
+    return find(reg, &reg->by_location, location);
+}
+
+void
+registry_foreach(const struct registry *reg,
+    bool (*cb)(void *data, struct registry_client *client), void *data)
+{
+    uint32_t i;
+
+    for (i = 0; i < reg->slots_len; i++) {
+        if (reg->slots[i].used && !cb(data, &reg->slots[i].client))
+            return;
+    }
+}
+
+int
+registry_client_set_group(struct registry *reg, registry_handle handle,
+    uint32_t group)
+{
+    struct registry_client *client = registry_get(reg, handle);
+    uint32_t slot = handle & SLOT_MASK;
+    struct slot *s;
+
+    if (!client)
+        return -ENOENT;
+    if (group == REGISTRY_GROUP_NONE)
+        return -EINVAL;
+
+    if (group >= reg->groups) {
+        uint32_t *heads;
+
+        heads = realloc(reg->group_heads, ((size_t)group + 1) *
+            sizeof(uint32_t));
+        if (!heads)
+            return -ENOMEM;
+        memset(heads + reg->groups, 0,
+            (size_t)(group + 1 - reg->groups) * sizeof(uint32_t));
+        reg->group_heads = heads;
+        reg->groups = group + 1;
+    }
+
+    s = &reg->slots[slot - 1];
+    group_unlink(reg, s);
+
+    s->group_next = reg->group_heads[group];
+    if (s->group_next)
+        reg->slots[s->group_next - 1].group_prev = slot;
+    reg->group_heads[group] = slot;
+    client->group = group;
+    return 0;
+}
+
+void
+registry_foreach_in_group(const struct registry *reg, uint32_t group,
+    bool (*cb)(void *data, struct registry_client *client), void *data)
+{
+    uint32_t slot;
+
+    if (group >= reg->groups)
+        return;
+
+    for (slot = reg->group_heads[group]; slot;
+        slot = reg->slots[slot - 1].group_next) {
+        if (!cb(data, &reg->slots[slot - 1].client))
+            return;
+    }
+}
+
+int
+registry_client_reset_objects(struct registry_client *client, uint16_t n)
+{
+    uint32_t cap = 4;
+
+    while (cap < (uint32_t)n * 2)
+        cap <<= 1;
+    if (cap > UINT16_MAX)
+        return -EINVAL;
+
+    if (cap != client->objects_cap) {
+        struct registry_object *objects;
+
+        objects = calloc(cap, sizeof(struct registry_object));
+        if (!objects)
+            return -ENOMEM;
+        free(client->objects);
+        client->objects = objects;
+        client->objects_cap = cap;
+    } else
+        memset(client->objects, 0, cap * sizeof(struct registry_object));
+
+    client->objects_len = 0;
+    return 0;
+}
+
+int
+registry_client_set_object(struct registry_client *client, uint16_t id,
+    const void *object, uint16_t instances)
+{
+    uint16_t mask = client->objects_cap - 1, i;
+
+    if (!object || !client->objects_cap)
+        return -EINVAL;
+
+    for (i = id & mask;; i = (i + 1) & mask) {
+        struct registry_object *o = &client->objects[i];
+
+        if (o->object && o->id != id)
+            continue;
+
+        if (!o->object) {
+            //Always keep an empty entry, so lookups end
+            if ((uint32_t)(client->objects_len + 1) * 2 > client->objects_cap)
+                return -ENOSPC;
+            client->objects_len++;
+        }
+
+        o->id = id;
+        o->object = object;
+        o->instances = instances;
+        return 0;
+    }
+}
+
+const struct registry_object *
+registry_client_get_object(const struct registry_client *client, uint16_t id)
+{
+    uint16_t mask = client->objects_cap - 1, i;
+
+    if (!client->objects_cap)
+        return NULL;
+
+    for (i = id & mask;; i = (i + 1) & mask) {
+        const struct registry_object *o = &client->objects[i];
+
+        if (!o->object)
+            return NULL;
+        if (o->id == id)
+            return o;
+    }
+}
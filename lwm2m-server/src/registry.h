@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/*
+   Registry of the clients known by the server, indexed by endpoint name
+   and by registration location. Each client also keeps an index of its
+   objects by object ID.
+
+   Clients are referred to by handles, that stay valid for as long as
+   the client is registered. Handles of removed clients are detected as
+   stale (registry_get() returns NULL), so they are safe to be given as
+   user data to asynchronous requests. Pointers returned by the registry
+   are only valid until the next call to registry_add().
+
+   Clients may also be put in numbered groups, that are walked without
+   going through the clients of other groups.
+ */
+
+typedef uint32_t registry_handle;
+
+#define REGISTRY_HANDLE_INVALID ((registry_handle)0)
+#define REGISTRY_GROUP_NONE (UINT32_MAX)
+
+struct registry;
+
+struct registry_object {
+    uint16_t id;
+    uint16_t instances;
+    const void *object;
+};
+
+struct registry_client {
+    registry_handle handle;
+    char *name;
+    char *location;
+    const void *info;
+    void *data;
+    uint32_t group; //REGISTRY_GROUP_NONE unless set
+    //Last notification and the interval before it, in ms
+    int64_t notified_at;
+    int64_t notify_gap;
+
+    struct registry_object *objects;
+    uint16_t objects_cap;
+    uint16_t objects_len;
+};
+
+struct registry *registry_new(uint32_t initial_capacity);
+void registry_del(struct registry *reg);
+
+uint32_t registry_count(const struct registry *reg);
+
+/*
+   Adds a client. If a client with the same name is already registered,
+   it is replaced and its old handle becomes stale.
+ */
+int registry_add(struct registry *reg, const char *name,
+    const char *location, const void *info, registry_handle *handle);
+int registry_remove(struct registry *reg, registry_handle handle);
+
+struct registry_client *registry_get(const struct registry *reg,
+    registry_handle handle);
+struct registry_client *registry_find_by_name(const struct registry *reg,
+    const char *name);
+struct registry_client *registry_find_by_location(const struct registry *reg,
+    const char *location);
+
+/* Calls cb for each client while it returns true, cb must not add clients. */
+void registry_foreach(const struct registry *reg,
+    bool (*cb)(void *data, struct registry_client *client), void *data);
+
+/* Moves the client to the group, group numbers should be kept small. */
+int registry_client_set_group(struct registry *reg, registry_handle handle,
+    uint32_t group);
+/* As registry_foreach(), for the clients of the group, cb must not remove
+   clients either. */
+void registry_foreach_in_group(const struct registry *reg, uint32_t group,
+    bool (*cb)(void *data, struct registry_client *client), void *data);
+
+/* Replaces the object index of the client, sized for n objects. */
+int registry_client_reset_objects(struct registry_client *client, uint16_t n);
+int registry_client_set_object(struct registry_client *client, uint16_t id,
+    const void *object, uint16_t instances);
+const struct registry_object *registry_client_get_object(
+    const struct registry_client *client, uint16_t id);
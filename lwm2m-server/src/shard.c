@@ -0,0 +1,594 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <spawn.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "shard.h"
+
+#define OWNERS_MIN_BUCKETS (64)
+
+enum control_op {
+    CONTROL_REGISTERED = 'R',
+    CONTROL_UNREGISTERED = 'U',
+    CONTROL_EVICT = 'E'
+};
+
+//Sent up to the end of the name, not NUL terminated
+struct control_msg {
+    uint8_t op;
+    //ns of CLOCK_MONOTONIC, the same in every process, when the worker
+    //got the registration
+    uint64_t at;
+    char name[SHARD_NAME_MAX + 1];
+};
+
+extern char **environ;
+
+//The worker the endpoint last registered with
+struct owner {
+    struct owner *next;
+    uint32_t hash;
+    unsigned int shard;
+    uint64_t at;
+    char name[];
+};
+
+struct shard_workers {
+    const char *path;
+    char **argv;
+    size_t argc;
+    unsigned int shards;
+    int fds[SHARD_MAX];
+    //The parent end and the worker end of the control socket of a shard
+    int controls[SHARD_MAX][2];
+    pid_t pids[SHARD_MAX];
+    char worker_args[SHARD_MAX][16];
+
+    struct owner **owners;
+    uint32_t owners_buckets;
+    uint32_t owners_len;
+};
+
+static uint16_t adopt_port;
+static bool adopted;
+
+static uint16_t
+addr_port(const struct sockaddr *addr, socklen_t len)
+{
+    if (addr->sa_family == AF_INET6 && len >= sizeof(struct sockaddr_in6))
+        return ntohs(((const struct sockaddr_in6 *)addr)->sin6_port);
+    if (addr->sa_family == AF_INET && len >= sizeof(struct sockaddr_in))
+        return ntohs(((const struct sockaddr_in *)addr)->sin_port);
+    return 0;
+}
+
+static int
+next_bind(int fd, const struct sockaddr *addr, socklen_t len)
+{
+    static int (*bind_fn)(int, const struct sockaddr *, socklen_t);
+
+    if (!bind_fn) {
+        bind_fn = (int (*)(int, const struct sockaddr *, socklen_t))
+            dlsym(RTLD_NEXT, "bind");
+        if (!bind_fn) {
+            errno = ENOSYS;
+            return -1;
+        }
+    }
+    return bind_fn(fd, addr, len);
+}
+
+/*
+   Takes the place of the bind() of the C library for the whole process,
+   Soletta included, so the socket Soletta creates for the LWM2M port
+   becomes the one of the shard.
+
+   Nothing is looked at before the port to adopt: it is only set in a
+   worker, by shard_worker_adopt(), and cleared by the bind() that takes
+   the socket over. Any other bind() goes to the C library untouched,
+   all of them in the parent, the shard sockets included, and in the
+   worker every one but that first bind() of the LWM2M port, like the one
+   of the metrics server.
+ */
+int
+bind(int fd, const struct sockaddr *addr, socklen_t len)
+{
+    if (!adopt_port || addr_port(addr, len) != adopt_port)
+        return next_bind(fd, addr, len);
+
+    if (dup3(SHARD_WORKER_FD, fd, O_CLOEXEC) < 0)
+        return -1;
+    close(SHARD_WORKER_FD);
+    adopt_port = 0;
+    adopted = true;
+    return 0;
+}
+
+void
+shard_worker_adopt(uint16_t port)
+{
+    adopt_port = port;
+}
+
+bool
+shard_worker_adopted(void)
+{
+    return adopted;
+}
+
+static uint64_t
+now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static int
+control_send(int fd, enum control_op op, uint64_t at, const char *name,
+    int flags)
+{
+    struct control_msg msg = { .op = op, .at = at };
+    size_t len = strlen(name);
+
+    if (!len || len > SHARD_NAME_MAX)
+        return -EINVAL;
+
+    memcpy(msg.name, name, len);
+    if (send(fd, &msg, offsetof(struct control_msg, name) + len, flags) < 0)
+        return -errno;
+    return 0;
+}
+
+//The name is NUL terminated in msg, messages that do not fit are skipped
+static int
+control_recv(int fd, struct control_msg *msg)
+{
+    ssize_t len;
+
+    for (;;) {
+        len = recv(fd, msg, sizeof(*msg) - 1, MSG_DONTWAIT | MSG_TRUNC);
+        if (len < 0)
+            return -errno;
+        if (len > (ssize_t)offsetof(struct control_msg, name) &&
+            len < (ssize_t)sizeof(*msg))
+            break;
+    }
+
+    ((char *)msg)[len] = 0;
+    return 0;
+}
+
+int
+shard_worker_registered(const char *name)
+{
+    return control_send(SHARD_CONTROL_FD, CONTROL_REGISTERED, now_ns(),
+        name, 0);
+}
+
+int
+shard_worker_unregistered(const char *name)
+{
+    return control_send(SHARD_CONTROL_FD, CONTROL_UNREGISTERED, now_ns(),
+        name, 0);
+}
+
+int
+shard_worker_next_eviction(char *name, size_t len)
+{
+    struct control_msg msg;
+    int r;
+
+    for (;;) {
+        r = control_recv(SHARD_CONTROL_FD, &msg);
+        if (r == -EAGAIN)
+            return 0;
+        if (r < 0)
+            return r;
+        if (msg.op != CONTROL_EVICT || strlen(msg.name) >= len)
+            continue;
+        strcpy(name, msg.name);
+        return 1;
+    }
+}
+
+//FNV-1a
+static uint32_t
+name_hash(const char *name)
+{
+    uint32_t h = 2166136261u;
+
+    for (; *name; name++)
+        h = (h ^ (uint8_t)*name) * 16777619u;
+    return h;
+}
+
+static struct owner **
+owner_find(struct shard_workers *workers, const char *name, uint32_t hash)
+{
+    struct owner **o = &workers->owners[hash & (workers->owners_buckets - 1)];
+
+    for (; *o; o = &(*o)->next) {
+        if ((*o)->hash == hash && !strcmp((*o)->name, name))
+            break;
+    }
+    return o;
+}
+
+static int
+owners_grow(struct shard_workers *workers)
+{
+    uint32_t i, buckets = workers->owners_buckets ?
+        workers->owners_buckets * 2 : OWNERS_MIN_BUCKETS;
+    struct owner **owners, *o, *next;
+
+    owners = calloc(buckets, sizeof(struct owner *));
+    if (!owners)
+        return -ENOMEM;
+
+    for (i = 0; i < workers->owners_buckets; i++) {
+        for (o = workers->owners[i]; o; o = next) {
+            next = o->next;
+            o->next = owners[o->hash & (buckets - 1)];
+            owners[o->hash & (buckets - 1)] = o;
+        }
+    }
+
+    free(workers->owners);
+    workers->owners = owners;
+    workers->owners_buckets = buckets;
+    return 0;
+}
+
+//Found or added, shard is SHARD_MAX for an added one
+static struct owner *
+owner_get(struct shard_workers *workers, const char *name)
+{
+    uint32_t hash = name_hash(name);
+    struct owner **o, *created;
+    size_t len;
+
+    if (workers->owners_len >= workers->owners_buckets &&
+        owners_grow(workers) < 0)
+        return NULL;
+
+    o = owner_find(workers, name, hash);
+    if (*o)
+        return *o;
+
+    len = strlen(name);
+    created = malloc(sizeof(struct owner) + len + 1);
+    if (!created)
+        return NULL;
+    created->next = NULL;
+    created->hash = hash;
+    created->shard = SHARD_MAX;
+    created->at = 0;
+    memcpy(created->name, name, len + 1);
+    *o = created;
+    workers->owners_len++;
+    return created;
+}
+
+static void
+owner_unset(struct shard_workers *workers, const char *name,
+    unsigned int shard)
+{
+    struct owner **o, *found;
+
+    if (!workers->owners_buckets)
+        return;
+
+    o = owner_find(workers, name, name_hash(name));
+    found = *o;
+    //Only the worker it is registered with lets it go
+    if (!found || found->shard != shard)
+        return;
+
+    *o = found->next;
+    free(found);
+    workers->owners_len--;
+}
+
+int
+shard_workers_get_control_fd(const struct shard_workers *workers,
+    unsigned int shard)
+{
+    if (shard >= workers->shards)
+        return -EINVAL;
+    return workers->controls[shard][0];
+}
+
+static int
+evict(struct shard_workers *workers, unsigned int shard, const char *name)
+{
+    //Waits in the socket of a worker being restarted, like datagrams
+    int r = control_send(workers->controls[shard][0], CONTROL_EVICT, 0, name,
+        MSG_DONTWAIT);
+
+    if (r < 0) {
+        fprintf(stderr, "Could not have %s evicted from the worker %u: %s\n",
+            name, shard, strerror(-r));
+        return 0;
+    }
+    return 1;
+}
+
+int
+shard_workers_dispatch(struct shard_workers *workers, unsigned int shard)
+{
+    struct control_msg msg;
+    struct owner *o;
+    int r, evicted = 0;
+
+    if (shard >= workers->shards)
+        return -EINVAL;
+
+    while (!(r = control_recv(workers->controls[shard][0], &msg))) {
+        if (msg.op == CONTROL_UNREGISTERED) {
+            owner_unset(workers, msg.name, shard);
+            continue;
+        }
+        if (msg.op != CONTROL_REGISTERED)
+            continue;
+
+        o = owner_get(workers, msg.name);
+        if (!o) {
+            fprintf(stderr, "Could not record the worker of %s\n", msg.name);
+            continue;
+        }
+
+        /*
+           By the time of the registrations, not the order they are read
+           in: the sockets of two workers may be read in any order. The
+           older registration is the one evicted.
+         */
+        if (o->shard == SHARD_MAX || o->shard == shard) {
+            o->shard = shard;
+        } else if (msg.at >= o->at) {
+            evicted += evict(workers, o->shard, msg.name);
+            o->shard = shard;
+        } else {
+            evicted += evict(workers, shard, msg.name);
+            continue;
+        }
+        o->at = msg.at;
+    }
+
+    return r == -EAGAIN ? evicted : r;
+}
+
+//Clear of the descriptors the worker gets, dup2() onto itself would keep
+//it close-on-exec there too
+static int
+fd_move_up(int fd)
+{
+    int moved;
+
+    if (fd > SHARD_CONTROL_FD)
+        return fd;
+
+    moved = fcntl(fd, F_DUPFD_CLOEXEC, SHARD_CONTROL_FD + 1);
+    close(fd);
+    if (moved < 0)
+        return -errno;
+    return moved;
+}
+
+static int
+shard_socket(uint16_t port)
+{
+    struct sockaddr_in6 addr = {
+        .sin6_family = AF_INET6,
+        .sin6_port = htons(port),
+        .sin6_addr = IN6ADDR_ANY_INIT
+    };
+    int fd, on = 1, off = 0;
+
+    fd = socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0)
+        return -errno;
+
+    if (setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &on, sizeof(on)) < 0 ||
+        setsockopt(fd, IPPROTO_IPV6, IPV6_V6ONLY, &off, sizeof(off)) < 0 ||
+        bind(fd, (const struct sockaddr *)&addr, sizeof(addr)) < 0)
+        goto err;
+
+    return fd_move_up(fd);
+
+err:
+    close(fd);
+    return -errno;
+}
+
+static int
+control_socket(int fds[2])
+{
+    int r;
+
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) < 0)
+        return -errno;
+
+    fds[0] = fd_move_up(fds[0]);
+    fds[1] = fd_move_up(fds[1]);
+    if (fds[0] >= 0 && fds[1] >= 0)
+        return 0;
+
+    r = fds[0] < 0 ? fds[0] : fds[1];
+    if (fds[0] >= 0)
+        close(fds[0]);
+    if (fds[1] >= 0)
+        close(fds[1]);
+    fds[0] = fds[1] = -1;
+    return r;
+}
+
+static int
+worker_spawn(struct shard_workers *workers, unsigned int shard)
+{
+    posix_spawn_file_actions_t actions;
+    int r;
+
+    r = posix_spawn_file_actions_init(&actions);
+    if (r)
+        return -r;
+
+    r = posix_spawn_file_actions_adddup2(&actions, workers->fds[shard],
+        SHARD_WORKER_FD);
+    if (r)
+        goto exit;
+    r = posix_spawn_file_actions_adddup2(&actions, workers->controls[shard][1],
+        SHARD_CONTROL_FD);
+    if (r)
+        goto exit;
+
+    workers->argv[workers->argc] = workers->worker_args[shard];
+    r = posix_spawn(&workers->pids[shard], workers->path, &actions, NULL,
+        workers->argv, environ);
+
+exit:
+    posix_spawn_file_actions_destroy(&actions);
+    if (r) {
+        workers->pids[shard] = 0;
+        return -r;
+    }
+
+    return 0;
+}
+
+struct shard_workers *
+shard_workers_new(const char *path, char *const argv[], uint16_t port,
+    unsigned int shards)
+{
+    struct shard_workers *workers;
+    size_t argc = 0;
+    unsigned int i;
+    int r;
+
+    if (!shards || shards > SHARD_MAX)
+        return NULL;
+
+    workers = calloc(1, sizeof(struct shard_workers));
+    if (!workers)
+        return NULL;
+
+    while (argv[argc])
+        argc++;
+
+    //Room for --worker=<shard> and the terminating NULL
+    workers->argv = calloc(argc + 2, sizeof(char *));
+    if (!workers->argv)
+        goto err_free;
+    memcpy(workers->argv, argv, argc * sizeof(char *));
+    workers->argc = argc;
+    workers->path = path;
+    workers->shards = shards;
+
+    for (i = 0; i < shards; i++) {
+        workers->fds[i] = -1;
+        workers->controls[i][0] = workers->controls[i][1] = -1;
+    }
+
+    //All bound before any worker runs, socket <shard> is the shard
+    for (i = 0; i < shards; i++) {
+        r = shard_socket(port);
+        if (r < 0) {
+            fprintf(stderr, "Could not bind the port %u: %s\n", port,
+                strerror(-r));
+            goto err_del;
+        }
+        workers->fds[i] = r;
+
+        r = control_socket(workers->controls[i]);
+        if (r < 0) {
+            fprintf(stderr, "Could not create the control socket of the"
+                " worker %u: %s\n", i, strerror(-r));
+            goto err_del;
+        }
+    }
+
+    for (i = 0; i < shards; i++) {
+        snprintf(workers->worker_args[i], sizeof(workers->worker_args[i]),
+            "--worker=%u", i);
+        r = worker_spawn(workers, i);
+        if (r < 0) {
+            fprintf(stderr, "Could not start the worker %u: %s\n", i,
+                strerror(-r));
+            goto err_del;
+        }
+    }
+
+    return workers;
+
+err_del:
+    shard_workers_del(workers);
+    return NULL;
+err_free:
+    free(workers);
+    return NULL;
+}
+
+void
+shard_workers_check(struct shard_workers *workers)
+{
+    unsigned int i;
+    int status;
+
+    for (i = 0; i < workers->shards; i++) {
+        if (workers->pids[i] &&
+            waitpid(workers->pids[i], &status, WNOHANG) != workers->pids[i])
+            continue;
+
+        fprintf(stderr, "The worker %u is gone, restarting it\n", i);
+        if (worker_spawn(workers, i) < 0)
+            fprintf(stderr, "Could not restart the worker %u\n", i);
+    }
+}
+
+void
+shard_workers_del(struct shard_workers *workers)
+{
+    struct owner *o, *next;
+    unsigned int i;
+
+    if (!workers)
+        return;
+
+    for (i = 0; i < workers->shards; i++) {
+        if (workers->pids[i])
+            kill(workers->pids[i], SIGTERM);
+    }
+    for (i = 0; i < workers->shards; i++) {
+        if (workers->pids[i])
+            waitpid(workers->pids[i], NULL, 0);
+        if (workers->fds[i] >= 0)
+            close(workers->fds[i]);
+        if (workers->controls[i][0] >= 0)
+            close(workers->controls[i][0]);
+        if (workers->controls[i][1] >= 0)
+            close(workers->controls[i][1]);
+    }
+
+    for (i = 0; i < workers->owners_buckets; i++) {
+        for (o = workers->owners[i]; o; o = next) {
+            next = o->next;
+            free(o);
+        }
+    }
+    free(workers->owners);
+    free(workers->argv);
+    free(workers);
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+   Sharded mode of the server, Linux only.
+
+   The LWM2M processing runs in worker processes, each one a regular
+   server with its own main loop, receiving from the clients on the
+   public port itself:
+
+   - The parent binds one SO_REUSEPORT socket per shard on the public
+     port and hands socket <shard> to the worker <shard>, as the file
+     descriptor SHARD_WORKER_FD.
+   - The kernel picks the socket of a datagram from the hash of the
+     client address and port, so the datagrams of a client go to one
+     worker, with no hop through the parent.
+   - The parent keeps every socket open, so the group never changes:
+     a restarted worker gets the clients of the worker it replaces,
+     and their datagrams wait in its socket meanwhile.
+
+   That hash is not of the endpoint name: a client registering again
+   from another port, as it does after a reboot or a NAT rebinding, may
+   land on another worker, while the previous one still has it
+   registered. So each worker tells the parent of the endpoints that
+   register and unregister with it, over a control socket, fd
+   SHARD_CONTROL_FD, and the parent, which keeps the worker of each
+   endpoint, has the previous worker evict an endpoint that registered
+   with another one. Only the registrations go through the parent, not
+   the traffic, and an endpoint is served by one worker once its
+   eviction is read. Between two workers, the registration the worker
+   got first is the one evicted, whatever order the parent reads them
+   in.
+
+   sol_lwm2m_server_new() only takes a port, so the worker calls
+   shard_worker_adopt() first: the bind() of that port, from Soletta,
+   then takes over the inherited socket instead. That needs Soletta as
+   a shared library, which the Linux build links with.
+
+   Nothing but the public port is open to the clients, each worker
+   serves its metrics on the loopback only.
+ */
+
+#define SHARD_MAX (64)
+#define SHARD_WORKER_FD (3)
+#define SHARD_CONTROL_FD (4)
+//Longer endpoint names are not followed across workers
+#define SHARD_NAME_MAX (255)
+
+struct shard_workers;
+
+/*
+   Binds the sockets of port and starts the workers, running path with
+   argv plus --worker=<shard>. Dead workers are restarted by
+   shard_workers_check().
+ */
+struct shard_workers *shard_workers_new(const char *path, char *const argv[],
+    uint16_t port, unsigned int shards);
+void shard_workers_check(struct shard_workers *workers);
+void shard_workers_del(struct shard_workers *workers);
+
+/*
+   The descriptor of the control socket of a shard, kept for the life of
+   workers, to be watched for input. shard_workers_dispatch() then takes
+   what the worker sent, sends the evictions it calls for and returns how
+   many, or a negative errno.
+ */
+int shard_workers_get_control_fd(const struct shard_workers *workers,
+    unsigned int shard);
+int shard_workers_dispatch(struct shard_workers *workers, unsigned int shard);
+
+/*
+   In the worker: the next bind() of port takes over SHARD_WORKER_FD.
+   shard_worker_adopted() tells whether it happened.
+ */
+void shard_worker_adopt(uint16_t port);
+bool shard_worker_adopted(void);
+
+/*
+   In the worker: tells the parent an endpoint registered or unregistered
+   with this worker, blocking while the parent is behind. Then, when
+   SHARD_CONTROL_FD has input, shard_worker_next_eviction() gives the
+   next endpoint this worker has to forget, as a string in name, 1 if
+   there is one, 0 if none is left, or a negative errno.
+ */
+int shard_worker_registered(const char *name);
+int shard_worker_unregistered(const char *name);
+int shard_worker_next_eviction(char *name, size_t len);
@@ -0,0 +1,155 @@
+#include <errno.h>
+#include <string.h>
+
+#include "tlv-cursor.h"
+
+#define TYPE_SHIFT (6)
+#define ID_IS_16BITS (1 << 5)
+#define LEN_TYPE_SHIFT (3)
+#define LEN_TYPE_MASK (0x3)
+#define LEN_MASK (0x7)
+
+void
+tlv_cursor_init(struct tlv_cursor *cursor, const void *data, size_t len)
+{
+    cursor->pos = data;
+    cursor->end = cursor->pos + len;
+}
+
+static uint32_t
+read_be(const uint8_t *p, size_t n)
+{
+    uint32_t v = 0;
+
+    while (n--)
+        v = (v << 8) | *p++;
+    return v;
+}
+
+int
+tlv_cursor_next(struct tlv_cursor *cursor, struct tlv_item *item)
+{
+    const uint8_t *p = cursor->pos;
+    size_t id_len, len_len, avail;
+    uint8_t header;
+
+    if (p == cursor->end)
+        return 0;
+
+    header = *p++;
+    id_len = header & ID_IS_16BITS ? 2 : 1;
+    len_len = (header >> LEN_TYPE_SHIFT) & LEN_TYPE_MASK;
+
+    if ((size_t)(cursor->end - p) < id_len + len_len)
+        return -EINVAL;
+
+    item->type = header >> TYPE_SHIFT;
+    item->id = read_be(p, id_len);
+    p += id_len;
+
+    if (len_len)
+        item->len = read_be(p, len_len);
+    else
+        item->len = header & LEN_MASK;
+    p += len_len;
+
+    avail = cursor->end - p;
+    if (item->len > avail)
+        return -EINVAL;
+
+    item->value = p;
+    cursor->pos = p + item->len;
+    return 1;
+}
+
+int
+tlv_cursor_enter(const struct tlv_item *item, struct tlv_cursor *child)
+{
+    if (item->type != TLV_TYPE_OBJECT_INSTANCE &&
+        item->type != TLV_TYPE_MULTIPLE_RESOURCES)
+        return -EINVAL;
+
+    tlv_cursor_init(child, item->value, item->len);
+    return 0;
+}
+
+static bool
+is_value(const struct tlv_item *item)
+{
+    return item->type == TLV_TYPE_RESOURCE_WITH_VALUE ||
+           item->type == TLV_TYPE_RESOURCE_INSTANCE;
+}
+
+int
+tlv_get_int(const struct tlv_item *item, int64_t *value)
+{
+    const uint8_t *p = item->value;
+    uint64_t v;
+    size_t i;
+
+    if (!is_value(item))
+        return -EINVAL;
+
+    switch (item->len) {
+    case 1:
+    case 2:
+    case 4:
+    case 8:
+        break;
+    default:
+        return -EINVAL;
+    }
+
+    //Sign extend from the most significant byte
+    v = (p[0] & 0x80) ? UINT64_MAX : 0;
+    for (i = 0; i < item->len; i++)
+        v = (v << 8) | p[i];
+
+    *value = (int64_t)v;
+    return 0;
+}
+
+int
+tlv_get_bool(const struct tlv_item *item, bool *value)
+{
+    if (!is_value(item) || item->len != 1 || item->value[0] > 1)
+        return -EINVAL;
+
+    *value = item->value[0];
+    return 0;
+}
+
+int
+tlv_get_float(const struct tlv_item *item, double *value)
+{
+    if (!is_value(item))
+        return -EINVAL;
+
+    if (item->len == 4) {
+        uint32_t bits = read_be(item->value, 4);
+        float f;
+
+        memcpy(&f, &bits, sizeof(f));
+        *value = f;
+    } else if (item->len == 8) {
+        uint64_t bits = ((uint64_t)read_be(item->value, 4) << 32) |
+            read_be(item->value + 4, 4);
+
+        memcpy(value, &bits, sizeof(*value));
+    } else
+        return -EINVAL;
+
+    return 0;
+}
+
+int
+tlv_get_objlink(const struct tlv_item *item, uint16_t *object_id,
+    uint16_t *instance_id)
+{
+    if (!is_value(item) || item->len != 4)
+        return -EINVAL;
+
+    *object_id = read_be(item->value, 2);
+    *instance_id = read_be(item->value + 2, 2);
+    return 0;
+}
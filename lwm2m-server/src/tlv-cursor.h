@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+   Forward only cursor over LWM2M TLV content. Items point straight
+   into the buffer given to tlv_cursor_init(), nothing is allocated or
+   copied, so they are only valid while that buffer is.
+ */
+
+enum tlv_type {
+    TLV_TYPE_OBJECT_INSTANCE = 0,
+    TLV_TYPE_RESOURCE_INSTANCE = 1,
+    TLV_TYPE_MULTIPLE_RESOURCES = 2,
+    TLV_TYPE_RESOURCE_WITH_VALUE = 3
+};
+
+struct tlv_cursor {
+    const uint8_t *pos;
+    const uint8_t *end;
+};
+
+struct tlv_item {
+    enum tlv_type type;
+    uint16_t id;
+    const uint8_t *value;
+    size_t len;
+};
+
+void tlv_cursor_init(struct tlv_cursor *cursor, const void *data, size_t len);
+
+/*
+   Returns 1 and fills item if there is one, 0 at the end of the content
+   and -EINVAL if the content is truncated or malformed.
+ */
+int tlv_cursor_next(struct tlv_cursor *cursor, struct tlv_item *item);
+
+/* Starts a cursor over the items of an object instance or multiple resource. */
+int tlv_cursor_enter(const struct tlv_item *item, struct tlv_cursor *child);
+
+int tlv_get_int(const struct tlv_item *item, int64_t *value);
+int tlv_get_bool(const struct tlv_item *item, bool *value);
+int tlv_get_float(const struct tlv_item *item, double *value);
+int tlv_get_objlink(const struct tlv_item *item, uint16_t *object_id,
+    uint16_t *instance_id);
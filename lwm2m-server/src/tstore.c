@@ -0,0 +1,913 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "sol-log.h"
+
+#include "tstore.h"
+
+#define SEGMENT_MAGIC (0x4d4c5453) //"STLM"
+#define SEGMENT_VERSION (1)
+#define SEGMENT_SUFFIX ".seg"
+#define SEGMENT_COMPACTED (1 << 0)
+
+#define BUCKETS_MIN (64)
+
+struct segment_header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t capacity;
+    uint32_t count;
+    uint32_t flags;
+    uint32_t reserved[3];
+};
+
+struct segment {
+    uint64_t seq;
+    uint32_t count;
+    uint32_t flags;
+    int64_t first_time;
+    int64_t last_time;
+    //Time of every index_every-th record
+    int64_t *index;
+    uint32_t index_len;
+};
+
+struct tstore_series {
+    struct tstore_series *next;
+    struct tstore *store;
+    char *name;
+    char *path;
+
+    struct segment *segments;
+    uint32_t segments_len;
+    uint32_t segments_cap;
+
+    //The last segment, while it is being written
+    struct segment_header *active;
+    size_t active_size;
+    uint64_t next_seq;
+};
+
+struct tstore {
+    struct tstore_config config;
+    char *dir;
+
+    struct tstore_series **buckets;
+    uint32_t buckets_cap;
+    struct tstore_series **series;
+    uint32_t series_len;
+    uint32_t series_cap;
+    uint32_t compact_cursor;
+};
+
+static uint32_t
+hash_str(const char *str)
+{
+    uint32_t h = 2166136261u;
+
+    for (; *str; str++) {
+        h ^= (uint8_t)*str;
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static size_t
+segment_size(uint32_t capacity)
+{
+    return sizeof(struct segment_header) +
+           (size_t)capacity * sizeof(struct tstore_record);
+}
+
+static struct tstore_record *
+segment_records(struct segment_header *hdr)
+{
+    return (struct tstore_record *)(hdr + 1);
+}
+
+static int
+segment_path(const struct tstore_series *series, uint64_t seq,
+    const char *suffix, char *path)
+{
+    int r;
+
+    r = snprintf(path, PATH_MAX, "%s/%016" PRIx64 "%s%s", series->path,
+        seq, SEGMENT_SUFFIX, suffix);
+    if (r < 0 || r >= PATH_MAX)
+        return -ENAMETOOLONG;
+    return 0;
+}
+
+static int
+make_dir(const char *path)
+{
+    if (mkdir(path, 0755) < 0 && errno != EEXIST)
+        return -errno;
+    return 0;
+}
+
+static bool
+segment_valid(const struct segment_header *hdr, size_t size)
+{
+    return size >= sizeof(struct segment_header) &&
+           hdr->magic == SEGMENT_MAGIC &&
+           hdr->version == SEGMENT_VERSION &&
+           hdr->record_size == sizeof(struct tstore_record) &&
+           hdr->count <= hdr->capacity &&
+           size >= segment_size(hdr->capacity);
+}
+
+static int
+segment_map(const struct tstore_series *series, uint64_t seq, bool writable,
+    struct segment_header **hdr, size_t *size)
+{
+    char path[PATH_MAX];
+    struct stat st;
+    void *addr;
+    int fd, r;
+
+    r = segment_path(series, seq, "", path);
+    if (r < 0)
+        return r;
+
+    fd = open(path, (writable ? O_RDWR : O_RDONLY) | O_CLOEXEC);
+    if (fd < 0)
+        return -errno;
+
+    if (fstat(fd, &st) < 0) {
+        r = -errno;
+        goto err_close;
+    }
+
+    addr = mmap(NULL, st.st_size, PROT_READ | (writable ? PROT_WRITE : 0),
+        MAP_SHARED, fd, 0);
+    if (addr == MAP_FAILED) {
+        r = -errno;
+        goto err_close;
+    }
+    close(fd);
+
+    if (!segment_valid(addr, st.st_size)) {
+        munmap(addr, st.st_size);
+        return -EBADMSG;
+    }
+
+    *hdr = addr;
+    *size = st.st_size;
+    return 0;
+
+err_close:
+    close(fd);
+    return r;
+}
+
+static int
+segment_index_init(struct segment *seg, uint32_t capacity, uint32_t every)
+{
+    seg->index = calloc(capacity / every + 1, sizeof(int64_t));
+    if (!seg->index)
+        return -ENOMEM;
+    seg->index_len = 0;
+    return 0;
+}
+
+static void
+segment_index_add(struct segment *seg, const struct tstore_record *rec,
+    uint32_t every)
+{
+    if (!seg->count)
+        seg->first_time = rec->time;
+    if (seg->count % every == 0)
+        seg->index[seg->index_len++] = rec->time;
+    seg->last_time = rec->time;
+    seg->count++;
+}
+
+static int
+segment_load(struct segment *seg, struct segment_header *hdr, uint32_t every)
+{
+    const struct tstore_record *records = segment_records(hdr);
+    uint32_t i;
+    int r;
+
+    r = segment_index_init(seg, hdr->capacity, every);
+    if (r < 0)
+        return r;
+
+    seg->count = 0;
+    seg->flags = hdr->flags;
+    for (i = 0; i < hdr->count; i++)
+        segment_index_add(seg, &records[i], every);
+    return 0;
+}
+
+static struct segment *
+series_push_segment(struct tstore_series *series, uint64_t seq)
+{
+    struct segment *seg;
+
+    if (series->segments_len == series->segments_cap) {
+        uint32_t cap = series->segments_cap ? series->segments_cap * 2 : 8;
+        struct segment *segments;
+
+        segments = realloc(series->segments, cap * sizeof(struct segment));
+        if (!segments)
+            return NULL;
+        series->segments = segments;
+        series->segments_cap = cap;
+    }
+
+    seg = &series->segments[series->segments_len++];
+    memset(seg, 0, sizeof(struct segment));
+    seg->seq = seq;
+    return seg;
+}
+
+static void
+series_drop_segments(struct tstore_series *series, uint32_t start,
+    uint32_t n, bool unlink_files)
+{
+    char path[PATH_MAX];
+    uint32_t i;
+
+    for (i = start; i < start + n; i++) {
+        if (unlink_files && !segment_path(series, series->segments[i].seq,
+            "", path))
+            unlink(path);
+        free(series->segments[i].index);
+    }
+
+    memmove(series->segments + start, series->segments + start + n,
+        (series->segments_len - start - n) * sizeof(struct segment));
+    series->segments_len -= n;
+}
+
+static void
+series_seal(struct tstore_series *series)
+{
+    if (!series->active)
+        return;
+
+    msync(series->active, series->active_size, MS_ASYNC);
+    munmap(series->active, series->active_size);
+    series->active = NULL;
+}
+
+static int
+series_roll(struct tstore_series *series)
+{
+    const struct tstore_config *config = &series->store->config;
+    size_t size = segment_size(config->segment_records);
+    struct segment_header *hdr;
+    struct segment *seg;
+    char path[PATH_MAX];
+    int fd, r;
+
+    series_seal(series);
+
+    if (series->segments_len >= config->max_segments)
+        series_drop_segments(series, 0,
+            series->segments_len - config->max_segments + 1, true);
+
+    r = segment_path(series, series->next_seq, "", path);
+    if (r < 0)
+        return r;
+
+    fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -errno;
+
+    //Allocate the blocks now, so appends do not fault on a full disk
+    r = posix_fallocate(fd, 0, size);
+    if (r) {
+        r = -r;
+        goto err_unlink;
+    }
+
+    hdr = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (hdr == MAP_FAILED) {
+        r = -errno;
+        goto err_unlink;
+    }
+    close(fd);
+
+    seg = series_push_segment(series, series->next_seq);
+    if (!seg) {
+        r = -ENOMEM;
+        goto err_unmap;
+    }
+    r = segment_index_init(seg, config->segment_records, config->index_every);
+    if (r < 0) {
+        series->segments_len--;
+        goto err_unmap;
+    }
+
+    hdr->magic = SEGMENT_MAGIC;
+    hdr->version = SEGMENT_VERSION;
+    hdr->record_size = sizeof(struct tstore_record);
+    hdr->capacity = config->segment_records;
+    hdr->count = 0;
+    hdr->flags = 0;
+
+    series->active = hdr;
+    series->active_size = size;
+    series->next_seq++;
+    return 0;
+
+err_unmap:
+    munmap(hdr, size);
+    unlink(path);
+    return r;
+err_unlink:
+    close(fd);
+    unlink(path);
+    return r;
+}
+
+static int
+cmp_seq(const void *a, const void *b)
+{
+    uint64_t sa = ((const struct segment *)a)->seq;
+    uint64_t sb = ((const struct segment *)b)->seq;
+
+    return (sa > sb) - (sa < sb);
+}
+
+static int
+series_load(struct tstore_series *series)
+{
+    const struct tstore_config *config = &series->store->config;
+    struct segment_header *hdr;
+    struct dirent *entry;
+    struct segment *seg;
+    size_t size;
+    uint32_t i;
+    DIR *dir;
+    int r = 0;
+
+    dir = opendir(series->path);
+    if (!dir)
+        return -errno;
+
+    while ((entry = readdir(dir))) {
+        char *end;
+        uint64_t seq;
+
+        errno = 0;
+        seq = strtoull(entry->d_name, &end, 16);
+        if (errno || end == entry->d_name || strcmp(end, SEGMENT_SUFFIX))
+            continue;
+
+        if (!series_push_segment(series, seq)) {
+            r = -ENOMEM;
+            break;
+        }
+    }
+    closedir(dir);
+    if (r < 0)
+        return r;
+
+    qsort(series->segments, series->segments_len, sizeof(struct segment),
+        cmp_seq);
+
+    for (i = 0; i < series->segments_len;) {
+        seg = &series->segments[i];
+
+        r = segment_map(series, seg->seq, false, &hdr, &size);
+        if (r < 0) {
+            SOL_WRN("Skipping the segment %016" PRIx64 " of %s: %s",
+                seg->seq, series->name, strerror(-r));
+            series_drop_segments(series, i, 1, false);
+            continue;
+        }
+
+        r = segment_load(seg, hdr, config->index_every);
+        munmap(hdr, size);
+        if (r < 0)
+            return r;
+        i++;
+    }
+
+    if (!series->segments_len)
+        return 0;
+
+    seg = &series->segments[series->segments_len - 1];
+    series->next_seq = seg->seq + 1;
+
+    //Keep writing to the last segment if there is room left
+    if (!(seg->flags & SEGMENT_COMPACTED) &&
+        segment_map(series, seg->seq, true, &hdr, &size) == 0) {
+        if (hdr->count < hdr->capacity) {
+            series->active = hdr;
+            series->active_size = size;
+        } else
+            munmap(hdr, size);
+    }
+
+    return 0;
+}
+
+static void
+series_free(struct tstore_series *series)
+{
+    series_seal(series);
+    if (series->segments_len)
+        series_drop_segments(series, 0, series->segments_len, false);
+    free(series->segments);
+    free(series->name);
+    free(series->path);
+    free(series);
+}
+
+static int
+store_grow(struct tstore *store)
+{
+    struct tstore_series **buckets;
+    uint32_t cap, i;
+
+    if (store->series_len == store->series_cap) {
+        struct tstore_series **series;
+
+        cap = store->series_cap ? store->series_cap * 2 : BUCKETS_MIN;
+        series = realloc(store->series, cap * sizeof(*series));
+        if (!series)
+            return -ENOMEM;
+        store->series = series;
+        store->series_cap = cap;
+    }
+
+    if (store->series_len < store->buckets_cap)
+        return 0;
+
+    cap = store->buckets_cap ? store->buckets_cap * 2 : BUCKETS_MIN;
+    buckets = calloc(cap, sizeof(*buckets));
+    if (!buckets)
+        return -ENOMEM;
+
+    for (i = 0; i < store->series_len; i++) {
+        struct tstore_series *s = store->series[i];
+        uint32_t b = hash_str(s->name) & (cap - 1);
+
+        s->next = buckets[b];
+        buckets[b] = s;
+    }
+
+    free(store->buckets);
+    store->buckets = buckets;
+    store->buckets_cap = cap;
+    return 0;
+}
+
+struct tstore *
+tstore_new(const struct tstore_config *config)
+{
+    struct tstore *store;
+
+    if (!config || !config->dir)
+        return NULL;
+
+    store = calloc(1, sizeof(struct tstore));
+    if (!store)
+        return NULL;
+
+    store->config = *config;
+    if (!store->config.segment_records)
+        store->config.segment_records = TSTORE_DEFAULT_SEGMENT_RECORDS;
+    if (!store->config.max_segments)
+        store->config.max_segments = TSTORE_DEFAULT_MAX_SEGMENTS;
+    if (!store->config.index_every)
+        store->config.index_every = TSTORE_DEFAULT_INDEX_EVERY;
+
+    store->dir = strdup(config->dir);
+    if (!store->dir)
+        goto err_free;
+    store->config.dir = store->dir;
+
+    if (make_dir(store->dir) < 0)
+        goto err_free_dir;
+
+    if (store_grow(store) < 0)
+        goto err_free_dir;
+
+    return store;
+
+err_free_dir:
+    free(store->dir);
+err_free:
+    free(store->buckets);
+    free(store->series);
+    free(store);
+    return NULL;
+}
+
+void
+tstore_del(struct tstore *store)
+{
+    uint32_t i;
+
+    if (!store)
+        return;
+
+    for (i = 0; i < store->series_len; i++)
+        series_free(store->series[i]);
+
+    free(store->series);
+    free(store->buckets);
+    free(store->dir);
+    free(store);
+}
+
+static char *
+series_dir(const struct tstore *store, const char *name)
+{
+    static const char hex[] = "0123456789ABCDEF";
+    size_t dir_len = strlen(store->dir);
+    char *path, *p;
+
+    path = malloc(dir_len + 3 * strlen(name) + 2);
+    if (!path)
+        return NULL;
+
+    memcpy(path, store->dir, dir_len);
+    path[dir_len] = '/';
+    p = path + dir_len + 1;
+
+    /*
+       Endpoint names are not trusted to be valid file names, other bytes
+       are written as %XX (% too), so two names never share a directory
+     */
+    for (; *name; name++) {
+        uint8_t c = *name;
+
+        if ((c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') ||
+            (c >= '0' && c <= '9') || c == '-' || c == '_' ||
+            (c == '.' && p != path + dir_len + 1))
+            *p++ = c;
+        else {
+            *p++ = '%';
+            *p++ = hex[c >> 4];
+            *p++ = hex[c & 0xf];
+        }
+    }
+    *p = '\0';
+
+    return path;
+}
+
+struct tstore_series *
+tstore_open_series(struct tstore *store, const char *name)
+{
+    struct tstore_series *series;
+    uint32_t h = hash_str(name), i;
+    int r;
+
+    //Its directory would be the store's
+    if (!*name)
+        return NULL;
+
+    for (series = store->buckets[h & (store->buckets_cap - 1)]; series;
+        series = series->next) {
+        if (!strcmp(series->name, name))
+            return series;
+    }
+
+    if (store_grow(store) < 0)
+        return NULL;
+
+    series = calloc(1, sizeof(struct tstore_series));
+    if (!series)
+        return NULL;
+
+    series->store = store;
+    series->name = strdup(name);
+    series->path = series_dir(store, name);
+    if (!series->name || !series->path)
+        goto err_free;
+
+    //Never two series writing the segments of one directory
+    for (i = 0; i < store->series_len; i++) {
+        if (!strcmp(store->series[i]->path, series->path))
+            goto err_free;
+    }
+
+    r = make_dir(series->path);
+    if (r < 0)
+        goto err_free;
+
+    r = series_load(series);
+    if (r < 0)
+        goto err_free;
+
+    store->series[store->series_len++] = series;
+    h &= store->buckets_cap - 1;
+    series->next = store->buckets[h];
+    store->buckets[h] = series;
+    return series;
+
+err_free:
+    series_free(series);
+    return NULL;
+}
+
+void
+tstore_close_series(struct tstore_series *series)
+{
+    struct tstore *store = series->store;
+    struct tstore_series **link;
+    uint32_t i;
+
+    link = &store->buckets[hash_str(series->name) & (store->buckets_cap - 1)];
+    for (; *link; link = &(*link)->next) {
+        if (*link == series) {
+            *link = series->next;
+            break;
+        }
+    }
+
+    //The order of the series only matters to the compaction round robin
+    for (i = 0; i < store->series_len; i++) {
+        if (store->series[i] == series) {
+            store->series[i] = store->series[--store->series_len];
+            break;
+        }
+    }
+
+    series_free(series);
+}
+
+int
+tstore_series_append(struct tstore_series *series,
+    const struct tstore_record *record)
+{
+    uint32_t every = series->store->config.index_every;
+    struct tstore_record *dst;
+    struct segment *last;
+    int r;
+
+    if (!series->active || series->active->count == series->active->capacity) {
+        r = series_roll(series);
+        if (r < 0)
+            return r;
+    }
+
+    last = &series->segments[series->segments_len - 1];
+    dst = &segment_records(series->active)[series->active->count];
+    *dst = *record;
+
+    if (series->segments_len > 1 || last->count) {
+        const struct segment *prev = last->count ? last : last - 1;
+
+        if (dst->time < prev->last_time)
+            dst->time = prev->last_time;
+    }
+
+    segment_index_add(last, dst, every);
+    //The record is in place before it is counted
+    __atomic_store_n(&series->active->count, last->count, __ATOMIC_RELEASE);
+    return 0;
+}
+
+static uint32_t
+segment_start(const struct segment *seg, int64_t from, uint32_t every)
+{
+    uint32_t lo = 0, hi = seg->index_len;
+
+    //Last index entry before from, the records before it are skipped
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if (seg->index[mid] < from)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo ? (lo - 1) * every : 0;
+}
+
+int
+tstore_series_query(struct tstore_series *series, int64_t from,
+    int64_t to, bool (*cb)(void *data, const struct tstore_record *record),
+    void *data)
+{
+    uint32_t every = series->store->config.index_every;
+    uint32_t i;
+    int visited = 0;
+
+    for (i = 0; i < series->segments_len; i++) {
+        const struct segment *seg = &series->segments[i];
+        const struct tstore_record *records;
+        struct segment_header *hdr;
+        bool active, stop = false;
+        size_t size;
+        uint32_t j;
+        int r;
+
+        if (!seg->count || seg->last_time < from)
+            continue;
+        if (seg->first_time > to)
+            break;
+
+        active = series->active && i == series->segments_len - 1;
+        if (active)
+            hdr = series->active;
+        else {
+            r = segment_map(series, seg->seq, false, &hdr, &size);
+            if (r < 0)
+                return r;
+        }
+
+        records = segment_records(hdr);
+        for (j = segment_start(seg, from, every); j < seg->count; j++) {
+            if (records[j].time < from)
+                continue;
+            if (records[j].time > to || !cb(data, &records[j])) {
+                stop = true;
+                break;
+            }
+            visited++;
+        }
+
+        if (!active)
+            munmap(hdr, size);
+        if (stop)
+            break;
+    }
+
+    return visited;
+}
+
+int
+tstore_flush(struct tstore *store)
+{
+    uint32_t i;
+    int r = 0;
+
+    for (i = 0; i < store->series_len; i++) {
+        struct tstore_series *series = store->series[i];
+
+        if (series->active &&
+            msync(series->active, series->active_size, MS_ASYNC) < 0)
+            r = -errno;
+    }
+
+    return r;
+}
+
+static int
+series_compact(struct tstore_series *series, uint32_t start, uint32_t n,
+    int64_t resolution)
+{
+    uint32_t every = series->store->config.index_every;
+    struct segment *first = &series->segments[start];
+    struct segment merged = { .seq = first->seq };
+    struct segment_header *out, *in;
+    struct tstore_record *dst;
+    char path[PATH_MAX], tmp[PATH_MAX];
+    uint32_t capacity = 0, i, j;
+    int64_t bucket = INT64_MIN;
+    size_t size;
+    int fd, r;
+
+    for (i = start; i < start + n; i++)
+        capacity += series->segments[i].count;
+
+    r = segment_path(series, first->seq, "", path);
+    if (r < 0)
+        return r;
+    r = segment_path(series, first->seq, ".tmp", tmp);
+    if (r < 0)
+        return r;
+
+    fd = open(tmp, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+        return -errno;
+    if (ftruncate(fd, segment_size(capacity)) < 0) {
+        r = -errno;
+        goto err_close;
+    }
+    out = mmap(NULL, segment_size(capacity), PROT_READ | PROT_WRITE,
+        MAP_SHARED, fd, 0);
+    if (out == MAP_FAILED) {
+        r = -errno;
+        goto err_close;
+    }
+
+    r = segment_index_init(&merged, capacity, every);
+    if (r < 0)
+        goto err_unmap;
+
+    dst = segment_records(out);
+    for (i = start; i < start + n; i++) {
+        const struct tstore_record *records;
+
+        r = segment_map(series, series->segments[i].seq, false, &in, &size);
+        if (r < 0)
+            goto err_index;
+
+        records = segment_records(in);
+        for (j = 0; j < in->count; j++) {
+            int64_t b = records[j].time / resolution;
+
+            if (b == bucket)
+                continue;
+            bucket = b;
+            dst[merged.count] = records[j];
+            segment_index_add(&merged, &records[j], every);
+        }
+        munmap(in, size);
+    }
+
+    out->magic = SEGMENT_MAGIC;
+    out->version = SEGMENT_VERSION;
+    out->record_size = sizeof(struct tstore_record);
+    out->capacity = merged.count;
+    out->count = merged.count;
+    out->flags = merged.flags = SEGMENT_COMPACTED;
+
+    //The merged segment must be on disk before the old ones go away
+    r = msync(out, segment_size(capacity), MS_SYNC);
+    munmap(out, segment_size(capacity));
+    if (r < 0 || ftruncate(fd, segment_size(merged.count)) < 0 ||
+        fsync(fd) < 0 || rename(tmp, path) < 0) {
+        r = -errno;
+        free(merged.index);
+        goto err_close;
+    }
+    close(fd);
+
+    free(first->index);
+    *first = merged;
+    series_drop_segments(series, start + 1, n - 1, true);
+    return 1;
+
+err_index:
+    free(merged.index);
+err_unmap:
+    munmap(out, segment_size(capacity));
+err_close:
+    close(fd);
+    unlink(tmp);
+    return r;
+}
+
+static int
+series_compact_step(struct tstore_series *series, int64_t before,
+    int64_t resolution)
+{
+    uint32_t sealed = series->segments_len - (series->active ? 1 : 0);
+    uint32_t start, end;
+
+    for (start = 0; start < sealed; start++) {
+        const struct segment *seg = &series->segments[start];
+
+        if (!(seg->flags & SEGMENT_COMPACTED) && seg->count &&
+            seg->last_time < before)
+            break;
+    }
+
+    for (end = start; end < sealed; end++) {
+        const struct segment *seg = &series->segments[end];
+
+        if ((seg->flags & SEGMENT_COMPACTED) || seg->last_time >= before)
+            break;
+    }
+
+    if (start == end)
+        return 0;
+
+    return series_compact(series, start, end - start, resolution);
+}
+
+int
+tstore_compact_step(struct tstore *store, int64_t before, int64_t resolution)
+{
+    uint32_t i;
+
+    if (resolution <= 0)
+        return -EINVAL;
+
+    for (i = 0; i < store->series_len; i++) {
+        struct tstore_series *series;
+        int r;
+
+        store->compact_cursor %= store->series_len;
+        series = store->series[store->compact_cursor++];
+
+        r = series_compact_step(series, before, resolution);
+        if (r != 0)
+            return r;
+    }
+
+    return 0;
+}
@@ -0,0 +1,629 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sol-log.h"
+#include "sol-mainloop.h"
+#include "sol-util.h"
+
+#include "workflow.h"
+
+#define TICK_INTERVAL (50)
+#define JOBS_MIN (64)
+
+enum step_state {
+    STEP_UNUSED = 0,
+    STEP_WAITING,
+    STEP_IN_FLIGHT,
+    STEP_DONE
+};
+
+struct step {
+    enum step_state state;
+    uint8_t attempts;
+    //Asked for again while in flight
+    bool again;
+    //When a waiting step may be sent, or an in flight one times out
+    int64_t due;
+};
+
+struct job {
+    registry_handle handle;
+    bool started;
+    int64_t started_at;
+    struct step steps[WORKFLOW_STEP_COUNT];
+};
+
+struct workflow {
+    struct workflow_config config;
+    struct workflow_ops ops;
+    const void *data;
+
+    //Open addressing by handle, no tombstones
+    struct job *jobs;
+    uint32_t jobs_cap;
+    uint32_t jobs_len;
+
+    //Clients not started yet, first come first served
+    registry_handle *queue;
+    uint32_t queue_cap;
+    uint32_t queue_head;
+    uint32_t queue_len;
+
+    //Handles of the running clients, taken before visiting them, as
+    //removals shift the jobs table and callbacks may add to it
+    registry_handle *pump;
+    uint32_t pump_cap;
+    bool pumping;
+
+    struct sol_timeout *tick;
+    struct workflow_stats stats;
+};
+
+static int64_t
+now_ms(void)
+{
+    struct timespec ts = sol_util_timespec_get_current();
+
+    return sol_util_msec_from_timespec(&ts);
+}
+
+static uint32_t
+hash_handle(registry_handle handle)
+{
+    return handle * 2654435761u;
+}
+
+static struct job *
+job_find(const struct workflow *wf, registry_handle handle)
+{
+    uint32_t mask = wf->jobs_cap - 1, i;
+
+    for (i = hash_handle(handle) & mask;; i = (i + 1) & mask) {
+        struct job *job = &wf->jobs[i];
+
+        if (job->handle == REGISTRY_HANDLE_INVALID)
+            return NULL;
+        if (job->handle == handle)
+            return job;
+    }
+}
+
+static struct job *
+job_insert(struct job *jobs, uint32_t cap, registry_handle handle)
+{
+    uint32_t mask = cap - 1, i;
+
+    for (i = hash_handle(handle) & mask;; i = (i + 1) & mask) {
+        if (jobs[i].handle == REGISTRY_HANDLE_INVALID) {
+            jobs[i].handle = handle;
+            return &jobs[i];
+        }
+    }
+}
+
+static int
+jobs_reserve(struct workflow *wf)
+{
+    struct job *jobs;
+    uint32_t cap, i;
+
+    if ((wf->jobs_len + 1) * 2 <= wf->jobs_cap)
+        return 0;
+
+    cap = wf->jobs_cap * 2;
+    jobs = calloc(cap, sizeof(struct job));
+    if (!jobs)
+        return -ENOMEM;
+
+    for (i = 0; i < wf->jobs_cap; i++) {
+        if (wf->jobs[i].handle != REGISTRY_HANDLE_INVALID)
+            *job_insert(jobs, cap, wf->jobs[i].handle) = wf->jobs[i];
+    }
+
+    free(wf->jobs);
+    wf->jobs = jobs;
+    wf->jobs_cap = cap;
+    return 0;
+}
+
+static void
+job_remove(struct workflow *wf, struct job *job)
+{
+    uint32_t mask = wf->jobs_cap - 1;
+    uint32_t i = job - wf->jobs, j = i;
+    unsigned int s;
+
+    for (s = 0; s < WORKFLOW_STEP_COUNT; s++) {
+        if (job->steps[s].state == STEP_IN_FLIGHT)
+            wf->stats.in_flight--;
+    }
+    if (job->started)
+        wf->stats.running--;
+
+    //Shift back the entries that probed past the removed one
+    for (;;) {
+        uint32_t home;
+
+        j = (j + 1) & mask;
+        if (wf->jobs[j].handle == REGISTRY_HANDLE_INVALID)
+            break;
+
+        home = hash_handle(wf->jobs[j].handle) & mask;
+        if (((j - home) & mask) < ((j - i) & mask))
+            continue;
+
+        wf->jobs[i] = wf->jobs[j];
+        i = j;
+    }
+
+    memset(&wf->jobs[i], 0, sizeof(struct job));
+    wf->jobs_len--;
+}
+
+static int
+queue_push(struct workflow *wf, registry_handle handle)
+{
+    if (wf->queue_len == wf->queue_cap) {
+        uint32_t cap = wf->queue_cap * 2, i;
+        registry_handle *queue;
+
+        queue = malloc(cap * sizeof(registry_handle));
+        if (!queue)
+            return -ENOMEM;
+        for (i = 0; i < wf->queue_len; i++)
+            queue[i] = wf->queue[(wf->queue_head + i) & (wf->queue_cap - 1)];
+
+        free(wf->queue);
+        wf->queue = queue;
+        wf->queue_cap = cap;
+        wf->queue_head = 0;
+    }
+
+    wf->queue[(wf->queue_head + wf->queue_len++) & (wf->queue_cap - 1)] =
+        handle;
+    return 0;
+}
+
+static registry_handle
+queue_pop(struct workflow *wf)
+{
+    registry_handle handle = wf->queue[wf->queue_head];
+
+    wf->queue_head = (wf->queue_head + 1) & (wf->queue_cap - 1);
+    wf->queue_len--;
+    return handle;
+}
+
+static uint32_t
+backoff(const struct workflow *wf, uint8_t attempts)
+{
+    uint64_t delay = (uint64_t)wf->config.backoff_min << (attempts - 1);
+
+    if (attempts > 31 || delay > wf->config.backoff_max)
+        delay = wf->config.backoff_max;
+
+    //Up to 25% of jitter, so the retries of a storm do not line up
+    return delay - (delay / 4) * (rand() % 101) / 100;
+}
+
+static void
+histogram_add(struct workflow_stats *stats, int64_t ms)
+{
+    unsigned int b = 0;
+
+    while (ms > 0 && b < WORKFLOW_HISTOGRAM_BUCKETS - 1) {
+        ms >>= 1;
+        b++;
+    }
+    stats->histogram[b]++;
+}
+
+static void
+job_check_done(struct workflow *wf, struct job *job)
+{
+    unsigned int s;
+
+    for (s = 0; s < WORKFLOW_STEP_COUNT; s++) {
+        if (job->steps[s].state != STEP_UNUSED &&
+            job->steps[s].state != STEP_DONE)
+            return;
+    }
+
+    job_remove(wf, job);
+}
+
+static void
+job_ready(struct workflow *wf, struct job *job, int64_t now)
+{
+    int64_t elapsed = now - job->started_at;
+
+    wf->stats.ready++;
+    histogram_add(&wf->stats, elapsed);
+
+    if (wf->ops.ready)
+        wf->ops.ready((void *)wf->data, job->handle, elapsed);
+}
+
+static void
+job_fail(struct workflow *wf, struct job *job, enum workflow_step step)
+{
+    registry_handle handle = job->handle;
+
+    wf->stats.failed++;
+    job_remove(wf, job);
+
+    if (wf->ops.failed)
+        wf->ops.failed((void *)wf->data, handle, step);
+}
+
+/* Returns false if the job is gone. */
+static bool
+step_retry(struct workflow *wf, struct job *job, enum workflow_step step,
+    int64_t now)
+{
+    struct step *st = &job->steps[step];
+
+    //Already taken out of the requests in flight by the caller, so
+    //job_fail() must not count it again
+    st->state = STEP_WAITING;
+    if (st->attempts >= wf->config.max_attempts) {
+        job_fail(wf, job, step);
+        return false;
+    }
+
+    wf->stats.retries++;
+    //The resend carries whatever asked for it again
+    st->again = false;
+    st->due = now + backoff(wf, st->attempts);
+    return true;
+}
+
+/* Returns false if the job is gone. */
+static bool
+step_send(struct workflow *wf, struct job *job, enum workflow_step step,
+    int64_t now)
+{
+    struct step *st = &job->steps[step];
+    registry_handle handle = job->handle;
+    int r;
+
+    st->attempts++;
+    st->state = STEP_IN_FLIGHT;
+    st->due = now + wf->config.step_timeout;
+    wf->stats.in_flight++;
+
+    r = wf->ops.send((void *)wf->data, handle, step);
+
+    //send() may have cancelled the client
+    job = job_find(wf, handle);
+    if (!job)
+        return false;
+
+    if (r < 0) {
+        SOL_DBG("Could not send the step %d of %" PRIu32 " (%d)", step,
+            handle, r);
+        wf->stats.in_flight--;
+        return step_retry(wf, job, step, now);
+    }
+
+    return true;
+}
+
+/* Sends the due steps of a job, in order, while there is room. */
+static bool
+job_pump(struct workflow *wf, registry_handle handle, int64_t now)
+{
+    unsigned int s;
+
+    for (s = 0; s < WORKFLOW_STEP_COUNT; s++) {
+        struct job *job = job_find(wf, handle);
+
+        if (!job)
+            return true;
+        if (job->steps[s].state != STEP_WAITING || job->steps[s].due > now)
+            continue;
+        if (wf->stats.in_flight >= wf->config.max_in_flight)
+            return false;
+        step_send(wf, job, s, now);
+    }
+
+    return true;
+}
+
+static void
+workflow_pump(struct workflow *wf)
+{
+    int64_t now = now_ms();
+    uint32_t i, n = 0;
+
+    //Started again from a callback, the outer pump sees to it
+    if (wf->pumping)
+        return;
+
+    if (wf->pump_cap < wf->jobs_len) {
+        registry_handle *pump;
+
+        pump = realloc(wf->pump, wf->jobs_cap * sizeof(registry_handle));
+        if (!pump) {
+            SOL_WRN("Could not pump the workflow, retrying on the next tick");
+            return;
+        }
+        wf->pump = pump;
+        wf->pump_cap = wf->jobs_cap;
+    }
+
+    for (i = 0; i < wf->jobs_cap; i++) {
+        if (wf->jobs[i].handle != REGISTRY_HANDLE_INVALID &&
+            wf->jobs[i].started)
+            wf->pump[n++] = wf->jobs[i].handle;
+    }
+
+    wf->pumping = true;
+
+    //Retries and timeouts of the running clients go first
+    for (i = 0; i < n; i++) {
+        registry_handle handle = wf->pump[i];
+        struct job *job = job_find(wf, handle);
+        unsigned int s;
+
+        if (!job)
+            continue;
+
+        for (s = 0; s < WORKFLOW_STEP_COUNT; s++) {
+            struct step *st = &job->steps[s];
+
+            if (st->state != STEP_IN_FLIGHT || st->due > now)
+                continue;
+            SOL_DBG("The step %d of %" PRIu32 " timed out", s, handle);
+            wf->stats.in_flight--;
+            if (!step_retry(wf, job, s, now))
+                break;
+        }
+
+        if (!job_pump(wf, handle, now))
+            goto end;
+    }
+
+    while (wf->queue_len && wf->stats.in_flight < wf->config.max_in_flight) {
+        registry_handle handle = queue_pop(wf);
+        struct job *job = job_find(wf, handle);
+
+        if (!job || job->started)
+            continue;
+
+        wf->stats.queued--;
+        wf->stats.running++;
+        job->started = true;
+        job->started_at = now;
+        job_pump(wf, handle, now);
+    }
+
+end:
+    wf->pumping = false;
+}
+
+static bool
+tick_cb(void *data)
+{
+    struct workflow *wf = data;
+
+    workflow_pump(wf);
+    if (wf->jobs_len)
+        return true;
+
+    wf->tick = NULL;
+    return false;
+}
+
+static void
+tick_start(struct workflow *wf)
+{
+    if (wf->tick)
+        return;
+
+    wf->tick = sol_timeout_add(TICK_INTERVAL, tick_cb, wf);
+    if (!wf->tick)
+        SOL_WRN("Could not start the workflow timer");
+}
+
+struct workflow *
+workflow_new(const struct workflow_config *config,
+    const struct workflow_ops *ops, const void *data)
+{
+    struct workflow *wf;
+
+    if (!ops || !ops->send)
+        return NULL;
+
+    wf = calloc(1, sizeof(struct workflow));
+    if (!wf)
+        return NULL;
+
+    if (config)
+        wf->config = *config;
+    if (!wf->config.max_in_flight)
+        wf->config.max_in_flight = WORKFLOW_DEFAULT_MAX_IN_FLIGHT;
+    if (!wf->config.max_attempts)
+        wf->config.max_attempts = WORKFLOW_DEFAULT_MAX_ATTEMPTS;
+    if (!wf->config.backoff_min)
+        wf->config.backoff_min = WORKFLOW_DEFAULT_BACKOFF_MIN;
+    if (!wf->config.backoff_max)
+        wf->config.backoff_max = WORKFLOW_DEFAULT_BACKOFF_MAX;
+    if (!wf->config.step_timeout)
+        wf->config.step_timeout = WORKFLOW_DEFAULT_STEP_TIMEOUT;
+
+    wf->ops = *ops;
+    wf->data = data;
+
+    wf->jobs = calloc(JOBS_MIN, sizeof(struct job));
+    wf->queue = malloc(JOBS_MIN * sizeof(registry_handle));
+    if (!wf->jobs || !wf->queue)
+        goto err_free;
+    wf->jobs_cap = JOBS_MIN;
+    wf->queue_cap = JOBS_MIN;
+
+    return wf;
+
+err_free:
+    free(wf->jobs);
+    free(wf->queue);
+    free(wf);
+    return NULL;
+}
+
+void
+workflow_del(struct workflow *wf)
+{
+    if (!wf)
+        return;
+
+    if (wf->tick)
+        sol_timeout_del(wf->tick);
+    free(wf->jobs);
+    free(wf->queue);
+    free(wf->pump);
+    free(wf);
+}
+
+int
+workflow_start(struct workflow *wf, registry_handle handle, uint32_t steps)
+{
+    struct job *job;
+    unsigned int s;
+    int r;
+
+    if (handle == REGISTRY_HANDLE_INVALID || !steps ||
+        steps >= WORKFLOW_STEP_FLAG(WORKFLOW_STEP_COUNT))
+        return -EINVAL;
+
+    job = job_find(wf, handle);
+    if (!job) {
+        r = jobs_reserve(wf);
+        if (r < 0)
+            return r;
+        r = queue_push(wf, handle);
+        if (r < 0)
+            return r;
+
+        job = job_insert(wf->jobs, wf->jobs_cap, handle);
+        wf->jobs_len++;
+        wf->stats.queued++;
+    }
+
+    for (s = 0; s < WORKFLOW_STEP_COUNT; s++) {
+        struct step *st = &job->steps[s];
+
+        if (!(steps & WORKFLOW_STEP_FLAG(s)))
+            continue;
+
+        if (st->state == STEP_IN_FLIGHT)
+            st->again = true;
+        else if (st->state != STEP_WAITING) {
+            st->state = STEP_WAITING;
+            st->attempts = 0;
+            st->due = 0;
+        }
+    }
+
+    workflow_pump(wf);
+    if (wf->jobs_len)
+        tick_start(wf);
+    return 0;
+}
+
+void
+workflow_cancel(struct workflow *wf, registry_handle handle)
+{
+    struct job *job = job_find(wf, handle);
+
+    if (!job)
+        return;
+
+    //Its queue entry is skipped when popped
+    if (!job->started)
+        wf->stats.queued--;
+    job_remove(wf, job);
+}
+
+void
+workflow_done(struct workflow *wf, registry_handle handle,
+    enum workflow_step step, bool success)
+{
+    int64_t now = now_ms();
+    struct job *job;
+    struct step *st;
+
+    if (step >= WORKFLOW_STEP_COUNT)
+        return;
+
+    job = job_find(wf, handle);
+    if (!job)
+        return;
+
+    st = &job->steps[step];
+    if (st->state != STEP_IN_FLIGHT)
+        return;
+    wf->stats.in_flight--;
+
+    if (success && st->again) {
+        st->again = false;
+        st->state = STEP_WAITING;
+        st->attempts = 0;
+        st->due = now;
+    } else if (success) {
+        st->state = STEP_DONE;
+
+        /*
+           An observation sent along with the creation may have reached
+           the client first, and failed for the lack of an instance.
+           Now there is one, try again right away.
+         */
+        if (step == WORKFLOW_STEP_CREATE &&
+            job->steps[WORKFLOW_STEP_OBSERVE].state == STEP_WAITING)
+            job->steps[WORKFLOW_STEP_OBSERVE].due = now;
+
+        if (step == WORKFLOW_STEP_OBSERVE)
+            job_ready(wf, job, now);
+        job_check_done(wf, job);
+    } else if (step == WORKFLOW_STEP_OBSERVE &&
+        job->steps[WORKFLOW_STEP_CREATE].state == STEP_IN_FLIGHT) {
+        //Wait for the creation, without spending an attempt
+        st->state = STEP_WAITING;
+        st->attempts--;
+        st->due = now + wf->config.step_timeout;
+    } else
+        step_retry(wf, job, step, now);
+
+    //A reply frees room for the next request
+    workflow_pump(wf);
+}
+
+const struct workflow_stats *
+workflow_get_stats(const struct workflow *wf)
+{
+    return &wf->stats;
+}
+
+int64_t
+workflow_stats_percentile(const struct workflow_stats *stats,
+    unsigned int pct)
+{
+    uint64_t total = 0, seen = 0, target;
+    unsigned int b;
+
+    for (b = 0; b < WORKFLOW_HISTOGRAM_BUCKETS; b++)
+        total += stats->histogram[b];
+    if (!total)
+        return 0;
+
+    target = (total * pct + 99) / 100;
+    for (b = 0; b < WORKFLOW_HISTOGRAM_BUCKETS; b++) {
+        seen += stats->histogram[b];
+        if (seen >= target)
+            break;
+    }
+
+    return b ? (int64_t)1 << b : 0;
+}
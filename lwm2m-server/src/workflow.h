@@ -0,0 +1,84 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "registry.h"
+
+/*
+   Runs the steps the server takes on each registered client (creating
+   and observing its location object, setting its notification periods),
+   for many clients at once.
+
+   The steps of a client are sent back to back, without waiting for the
+   previous reply, while the number of requests in flight of all clients
+   stays under a limit. Failed or unanswered steps are retried with an
+   exponential backoff. The time from workflow_start() to the observation
+   succeeding is reported as the time to ready of the client.
+ */
+
+enum workflow_step {
+    WORKFLOW_STEP_CREATE = 0,
+    WORKFLOW_STEP_OBSERVE,
+    WORKFLOW_STEP_SET_PERIOD,
+    WORKFLOW_STEP_COUNT
+};
+
+#define WORKFLOW_STEP_FLAG(_step) (1u << (_step))
+
+struct workflow;
+
+struct workflow_ops {
+    //Sends the request of a step, the reply goes to workflow_done()
+    int (*send)(void *data, registry_handle handle, enum workflow_step step);
+    void (*ready)(void *data, registry_handle handle, int64_t time_to_ready);
+    void (*failed)(void *data, registry_handle handle, enum workflow_step step);
+};
+
+struct workflow_config {
+    uint32_t max_in_flight;
+    uint32_t max_attempts;
+    uint32_t backoff_min; //ms
+    uint32_t backoff_max; //ms
+    uint32_t step_timeout; //ms without a reply before retrying
+};
+
+#define WORKFLOW_DEFAULT_MAX_IN_FLIGHT (64)
+#define WORKFLOW_DEFAULT_MAX_ATTEMPTS (5)
+#define WORKFLOW_DEFAULT_BACKOFF_MIN (500)
+#define WORKFLOW_DEFAULT_BACKOFF_MAX (30 * 1000)
+#define WORKFLOW_DEFAULT_STEP_TIMEOUT (60 * 1000)
+
+#define WORKFLOW_HISTOGRAM_BUCKETS (24)
+
+struct workflow_stats {
+    uint32_t queued;
+    uint32_t running;
+    uint32_t in_flight;
+    uint64_t ready;
+    uint64_t failed;
+    uint64_t retries;
+    //Time to ready, bucket i counts clients ready in [2^(i-1), 2^i) ms
+    uint64_t histogram[WORKFLOW_HISTOGRAM_BUCKETS];
+};
+
+/* Zeroed fields of config take the defaults. */
+struct workflow *workflow_new(const struct workflow_config *config,
+    const struct workflow_ops *ops, const void *data);
+void workflow_del(struct workflow *wf);
+
+/*
+   Queues the steps (WORKFLOW_STEP_FLAG() mask) of a client. Steps may be
+   added to a client that is already running, a step that is in flight
+   is sent again once it is done.
+ */
+int workflow_start(struct workflow *wf, registry_handle handle, uint32_t steps);
+/* Forgets a client, replies still on the way are ignored. */
+void workflow_cancel(struct workflow *wf, registry_handle handle);
+void workflow_done(struct workflow *wf, registry_handle handle,
+    enum workflow_step step, bool success);
+
+const struct workflow_stats *workflow_get_stats(const struct workflow *wf);
+/* Upper bound, in ms, of the time to ready of pct% of the clients. */
+int64_t workflow_stats_percentile(const struct workflow_stats *stats,
+    unsigned int pct);
@@ -0,0 +1,582 @@
+#include <stdio.h>
+#include <stdbool.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <string.h>
+#include <time.h>
+
+#include <soletta.h>
+#include <sol-coap.h>
+#include <sol-log.h>
+#include <sol-lwm2m.h>
+#include <sol-mainloop.h>
+#include <sol-network.h>
+#include <sol-util.h>
+
+#include "objects.h"
+#include "register-timing.h"
+
+#define DEFAULT_SERVER_URI "coap://[::1]:5683"
+#define DEFAULT_CLIENTS (100)
+#define DEFAULT_RAMP (50)
+#define DEFAULT_REPORT (5)
+#define DEFAULT_PREFIX "swarm"
+//Of lwm2m-server, a worker of its sharded mode serves it on 5694 + shard
+#define DEFAULT_METRICS_PORT (5693)
+#define METRICS_PAYLOAD_MAX (1024)
+
+#define RAMP_TICK (100)
+
+struct swarm_client {
+    //Must be the first member, the monitor gets it back from the ctx
+    struct lwm2m_client_ctx ctx;
+    int64_t started_at;
+    int64_t register_rtt_us; //-1 until registered
+    int64_t created_at;
+    int64_t observed_at;
+    bool throttled;
+    char name[32];
+};
+
+struct swarm_totals {
+    uint64_t notified;
+    uint64_t notify_failed;
+};
+
+//Counters of the server metrics resource the report shows
+enum server_counter {
+    SERVER_NOTIFICATIONS = 0,
+    SERVER_TIMEOUTS,
+    SERVER_DECODE_ERRORS,
+    SERVER_COUNTER_COUNT
+};
+
+static const char *const server_counter_names[] = {
+    [SERVER_NOTIFICATIONS] = "notifications",
+    [SERVER_TIMEOUTS] = "timeouts",
+    [SERVER_DECODE_ERRORS] = "decode_errors"
+};
+
+static struct swarm {
+    const char *server_uri;
+    const char *prefix;
+    struct sol_str_slice psk_id;
+    struct sol_str_slice psk;
+    uint32_t count;
+    uint32_t ramp;
+    uint32_t interval;
+    uint32_t report;
+    const char *metrics_host;
+    uint32_t metrics_port;
+
+    struct swarm_client *clients;
+    int64_t *latencies;
+    uint32_t started;
+    uint32_t registered;
+    uint32_t created;
+    uint32_t observed;
+    uint32_t throttled;
+    uint64_t ramp_credit; //clients per second times ms, not to overflow
+
+    struct swarm_totals totals;
+    struct swarm_totals last;
+    int64_t last_report_at;
+
+    //The server counters as the swarm started, and as last read
+    struct sol_coap_server *metrics_client;
+    struct sol_network_link_addr metrics_addr;
+    bool has_server_base;
+    uint64_t server_base[SERVER_COUNTER_COUNT];
+    uint64_t server_last[SERVER_COUNTER_COUNT];
+
+    struct sol_timeout *ramp_timeout;
+    struct sol_timeout *report_timeout;
+} swarm;
+
+static int64_t
+now_ms(void)
+{
+    struct timespec ts = sol_util_timespec_get_current();
+
+    return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void
+location_created(struct lwm2m_client_ctx *ctx)
+{
+    struct swarm_client *sc = (struct swarm_client *)ctx;
+
+    if (sc->created_at)
+        return;
+
+    sc->created_at = now_ms();
+    swarm.created++;
+}
+
+static void
+location_read(struct lwm2m_client_ctx *ctx, uint16_t res_id)
+{
+    struct swarm_client *sc = (struct swarm_client *)ctx;
+
+    //The first read after the creation comes from the observe request
+    if (sc->observed_at || !sc->created_at)
+        return;
+
+    sc->observed_at = now_ms();
+    swarm.observed++;
+}
+
+static void
+location_changed(struct lwm2m_client_ctx *ctx, int notify_result)
+{
+    if (notify_result < 0)
+        swarm.totals.notify_failed++;
+    else
+        swarm.totals.notified++;
+}
+
+static void
+period_changed(struct lwm2m_client_ctx *ctx, uint32_t period)
+{
+    struct swarm_client *sc = (struct swarm_client *)ctx;
+    bool throttled = period > swarm.interval;
+
+    if (throttled == sc->throttled)
+        return;
+
+    sc->throttled = throttled;
+    if (throttled)
+        swarm.throttled++;
+    else
+        swarm.throttled--;
+}
+
+static void
+client_registered(const char *name, size_t len, int64_t rtt_us)
+{
+    size_t prefix_len = strlen(swarm.prefix);
+    struct swarm_client *sc;
+    unsigned long idx;
+    char *end;
+
+    if (len <= prefix_len + 1 || memcmp(name, swarm.prefix, prefix_len) ||
+        name[prefix_len] != '-')
+        return;
+
+    //name is not NUL terminated, the digits end before len
+    idx = strtoul(name + prefix_len + 1, &end, 10);
+    if (end != name + len || idx >= swarm.started)
+        return;
+
+    sc = &swarm.clients[idx];
+    if (sc->register_rtt_us >= 0)
+        return;
+    sc->register_rtt_us = rtt_us;
+    swarm.registered++;
+}
+
+static const struct lwm2m_client_monitor swarm_monitor = {
+    .location_created = location_created,
+    .location_read = location_read,
+    .location_changed = location_changed,
+    .period_changed = period_changed
+};
+
+static int
+cmp_latency(const void *a, const void *b)
+{
+    int64_t la = *(const int64_t *)a, lb = *(const int64_t *)b;
+
+    return (la > lb) - (la < lb);
+}
+
+//Of the first n swarm.latencies
+static void
+print_percentiles(const char *label, uint32_t n)
+{
+    if (!n) {
+        printf(" %s -", label);
+        return;
+    }
+
+    qsort(swarm.latencies, n, sizeof(int64_t), cmp_latency);
+    printf(" %s %" PRId64 "/%" PRId64 "/%" PRId64 "/%" PRId64 "/%" PRId64,
+        label, swarm.latencies[0], swarm.latencies[n / 2],
+        swarm.latencies[(n * 95) / 100], swarm.latencies[(n * 99) / 100],
+        swarm.latencies[n - 1]);
+}
+
+static void
+print_latencies(const char *label, size_t offset)
+{
+    uint32_t i, n = 0;
+
+    for (i = 0; i < swarm.started; i++) {
+        struct swarm_client *sc = &swarm.clients[i];
+        int64_t at = *(int64_t *)((char *)sc + offset);
+
+        if (at)
+            swarm.latencies[n++] = at - sc->started_at;
+    }
+
+    print_percentiles(label, n);
+}
+
+//In us, a round trip on a quiet network is well under a ms
+static void
+print_register_latencies(void)
+{
+    uint32_t i, n = 0;
+
+    for (i = 0; i < swarm.started; i++) {
+        if (swarm.clients[i].register_rtt_us >= 0)
+            swarm.latencies[n++] = swarm.clients[i].register_rtt_us;
+    }
+
+    print_percentiles("register(us)", n);
+}
+
+static bool
+metrics_reply_cb(void *data, struct sol_coap_server *server,
+    struct sol_coap_packet *resp, const struct sol_network_link_addr *addr)
+{
+    char text[METRICS_PAYLOAD_MAX], *line, *saveptr;
+    struct sol_buffer *buf;
+    size_t offset, len;
+    unsigned int i;
+
+    //Timed out, the next report asks again
+    if (!resp || sol_coap_packet_get_payload(resp, &buf, &offset) < 0)
+        return false;
+
+    len = buf->used - offset;
+    if (len >= sizeof(text))
+        len = sizeof(text) - 1;
+    memcpy(text, sol_buffer_at(buf, offset), len);
+    text[len] = '\0';
+
+    //One "<name> <value> <rate>/s" line per counter
+    for (line = strtok_r(text, "\n", &saveptr); line;
+        line = strtok_r(NULL, "\n", &saveptr)) {
+        char name[32];
+        uint64_t value;
+
+        if (sscanf(line, "%31s %" SCNu64, name, &value) != 2)
+            continue;
+        for (i = 0; i < SERVER_COUNTER_COUNT; i++) {
+            if (!strcmp(name, server_counter_names[i]))
+                swarm.server_last[i] = value;
+        }
+    }
+
+    if (!swarm.has_server_base) {
+        memcpy(swarm.server_base, swarm.server_last,
+            sizeof(swarm.server_base));
+        swarm.has_server_base = true;
+    }
+    return false;
+}
+
+static void
+request_metrics(void)
+{
+    struct sol_coap_packet *req;
+    int r;
+
+    req = sol_coap_packet_new_request(SOL_COAP_METHOD_GET,
+        SOL_COAP_MESSAGE_TYPE_CON);
+    if (!req) {
+        SOL_WRN("Could not create the metrics request");
+        return;
+    }
+
+    r = sol_coap_add_option(req, SOL_COAP_OPTION_URI_PATH, "metrics",
+        strlen("metrics"));
+    if (r < 0) {
+        sol_coap_packet_unref(req);
+        return;
+    }
+
+    r = sol_coap_send_packet_with_reply(swarm.metrics_client, req,
+        &swarm.metrics_addr, metrics_reply_cb, NULL);
+    if (r < 0)
+        SOL_WRN("Could not ask the server for its metrics");
+}
+
+/*
+   What the server counted since the swarm started. Its snapshot is
+   taken every few seconds, so unseen, the notifications sent that the
+   server did not count, runs ahead by that much; it only means drops
+   when the swarm is the only load of the server.
+ */
+static void
+print_server_metrics(void)
+{
+    uint64_t counts[SERVER_COUNTER_COUNT];
+    unsigned int i;
+
+    if (!swarm.has_server_base) {
+        printf(" server -");
+        return;
+    }
+
+    for (i = 0; i < SERVER_COUNTER_COUNT; i++)
+        counts[i] = swarm.server_last[i] - swarm.server_base[i];
+
+    printf(" server notified %" PRIu64 " unseen %" PRId64 " timeouts %"
+        PRIu64 " decode_errors %" PRIu64, counts[SERVER_NOTIFICATIONS],
+        (int64_t)(swarm.totals.notified - counts[SERVER_NOTIFICATIONS]),
+        counts[SERVER_TIMEOUTS], counts[SERVER_DECODE_ERRORS]);
+}
+
+static bool
+report_cb(void *data)
+{
+    int64_t now = now_ms();
+    double elapsed = (now - swarm.last_report_at) / 1000.0;
+    uint64_t notified = swarm.totals.notified - swarm.last.notified;
+    uint64_t failed = swarm.totals.notify_failed - swarm.last.notify_failed;
+
+    if (elapsed <= 0)
+        return true;
+
+    printf("started %" PRIu32 "/%" PRIu32 " registered %" PRIu32
+        " created %" PRIu32 " observed %" PRIu32, swarm.started, swarm.count,
+        swarm.registered, swarm.created, swarm.observed);
+    print_register_latencies();
+    print_latencies("create(ms)", offsetof(struct swarm_client, created_at));
+    print_latencies("observe(ms)",
+        offsetof(struct swarm_client, observed_at));
+    printf(" notify/s %.1f failed/s %.1f total %" PRIu64 "/%" PRIu64
+        " throttled %" PRIu32, notified / elapsed, failed / elapsed,
+        swarm.totals.notified, swarm.totals.notify_failed, swarm.throttled);
+    if (swarm.metrics_client) {
+        print_server_metrics();
+        request_metrics();
+    }
+    printf("\n");
+    fflush(stdout);
+
+    swarm.last = swarm.totals;
+    swarm.last_report_at = now;
+    return true;
+}
+
+static int
+start_client(struct swarm_client *sc, uint32_t idx)
+{
+    int r;
+
+    snprintf(sc->name, sizeof(sc->name), "%s-%05" PRIu32, swarm.prefix, idx);
+    sc->ctx.server_uri = swarm.server_uri;
+    sc->ctx.psk_id = swarm.psk_id;
+    sc->ctx.psk = swarm.psk;
+    sc->ctx.notify_interval = swarm.interval;
+    sc->ctx.monitor = &swarm_monitor;
+    sc->register_rtt_us = -1;
+
+    r = lwm2m_client_ctx_init(&sc->ctx, sc->name);
+    if (r < 0)
+        return r;
+
+    sc->started_at = now_ms();
+    r = sol_lwm2m_client_start(sc->ctx.client);
+    if (r < 0) {
+        SOL_WRN("Could not start the client %s", sc->name);
+        lwm2m_client_ctx_fini(&sc->ctx);
+        return r;
+    }
+
+    return 0;
+}
+
+static bool
+ramp_cb(void *data)
+{
+    uint32_t n;
+
+    swarm.ramp_credit += (uint64_t)swarm.ramp * RAMP_TICK;
+    n = swarm.ramp_credit / 1000;
+    swarm.ramp_credit %= 1000;
+
+    for (; n > 0 && swarm.started < swarm.count; n--) {
+        if (start_client(&swarm.clients[swarm.started], swarm.started) < 0) {
+            SOL_WRN("Stopping the ramp up at %" PRIu32 " clients",
+                swarm.started);
+            break;
+        }
+        swarm.started++;
+    }
+
+    if (n > 0 || swarm.started == swarm.count) {
+        swarm.ramp_timeout = NULL;
+        return false;
+    }
+
+    return true;
+}
+
+static bool
+parse_uint(const char *arg, const char *name, uint32_t *value)
+{
+    size_t len = strlen(name);
+    char *end;
+    unsigned long v;
+
+    if (strncmp(arg, name, len) || arg[len] != '=')
+        return false;
+
+    errno = 0;
+    v = strtoul(arg + len + 1, &end, 10);
+    if (errno || *end || !v || v > UINT32_MAX) {
+        fprintf(stderr, "Invalid value for %s\n", name);
+        return false;
+    }
+
+    *value = v;
+    return true;
+}
+
+static bool
+parse_args(void)
+{
+    char **argv = sol_argv();
+    int i, argc = sol_argc();
+
+    swarm.server_uri = DEFAULT_SERVER_URI;
+    swarm.prefix = DEFAULT_PREFIX;
+    swarm.count = DEFAULT_CLIENTS;
+    swarm.ramp = DEFAULT_RAMP;
+    swarm.interval = ONE_SECOND;
+    swarm.report = DEFAULT_REPORT;
+    swarm.metrics_port = DEFAULT_METRICS_PORT;
+
+    for (i = 1; i < argc; i++) {
+        const char *arg = argv[i];
+
+        if (!strncmp(arg, "--server=", strlen("--server=")))
+            swarm.server_uri = arg + strlen("--server=");
+        else if (!strncmp(arg, "--prefix=", strlen("--prefix=")))
+            swarm.prefix = arg + strlen("--prefix=");
+        else if (!strncmp(arg, "--psk-id=", strlen("--psk-id=")))
+            swarm.psk_id = sol_str_slice_from_str(arg + strlen("--psk-id="));
+        else if (!strncmp(arg, "--psk=", strlen("--psk=")))
+            swarm.psk = sol_str_slice_from_str(arg + strlen("--psk="));
+        else if (!strncmp(arg, "--metrics=", strlen("--metrics=")))
+            swarm.metrics_host = arg + strlen("--metrics=");
+        else if (!parse_uint(arg, "--metrics-port", &swarm.metrics_port) &&
+            !parse_uint(arg, "--clients", &swarm.count) &&
+            !parse_uint(arg, "--ramp", &swarm.ramp) &&
+            !parse_uint(arg, "--interval", &swarm.interval) &&
+            !parse_uint(arg, "--report", &swarm.report)) {
+            fprintf(stderr, "Unknown or invalid argument: %s\n", arg);
+            return false;
+        }
+    }
+
+    //Both or none, a PSK makes the clients use DTLS
+    if (!swarm.psk_id.len != !swarm.psk.len) {
+        fprintf(stderr, "--psk-id and --psk go together\n");
+        return false;
+    }
+
+    if (swarm.metrics_port > UINT16_MAX) {
+        fprintf(stderr, "Invalid value for --metrics-port\n");
+        return false;
+    }
+
+    return true;
+}
+
+static bool
+setup_metrics(void)
+{
+    struct sol_network_link_addr any = {
+        .family = SOL_NETWORK_FAMILY_INET6
+    };
+
+    if (!swarm.metrics_host)
+        return true;
+
+    swarm.metrics_addr.family = SOL_NETWORK_FAMILY_INET6;
+    if (!sol_network_link_addr_from_str(&swarm.metrics_addr,
+        swarm.metrics_host)) {
+        fprintf(stderr, "Invalid address for --metrics: %s\n",
+            swarm.metrics_host);
+        return false;
+    }
+    swarm.metrics_addr.port = swarm.metrics_port;
+
+    swarm.metrics_client = sol_coap_server_new(&any, false);
+    if (!swarm.metrics_client) {
+        SOL_WRN("Could not create the metrics client");
+        return false;
+    }
+
+    //The counters before the clients start
+    request_metrics();
+
+    return true;
+}
+
+static void
+startup(void)
+{
+    if (!parse_args() || !setup_metrics())
+        goto err_exit;
+
+    swarm.clients = calloc(swarm.count, sizeof(struct swarm_client));
+    swarm.latencies = calloc(swarm.count, sizeof(int64_t));
+    if (!swarm.clients || !swarm.latencies) {
+        SOL_WRN("Could not alloc memory for %" PRIu32 " clients",
+            swarm.count);
+        goto err_exit;
+    }
+
+    srand(time(NULL));
+    //With a PSK the datagrams are encrypted, there is nothing to time
+    if (!swarm.psk.len)
+        register_timing_start(client_registered);
+
+    printf("Starting %" PRIu32 " clients against %s, %" PRIu32
+        " per second, notifying every %" PRIu32 "ms\n", swarm.count,
+        swarm.server_uri, swarm.ramp, swarm.interval);
+
+    swarm.ramp_timeout = sol_timeout_add(RAMP_TICK, ramp_cb, NULL);
+    swarm.report_timeout = sol_timeout_add(swarm.report * ONE_SECOND,
+        report_cb, NULL);
+    if (!swarm.ramp_timeout || !swarm.report_timeout) {
+        SOL_WRN("Could not create the swarm timers");
+        goto err_exit;
+    }
+
+    swarm.last_report_at = now_ms();
+    return;
+
+err_exit:
+    sol_quit_with_code(EXIT_FAILURE);
+}
+
+static void
+shutdown(void)
+{
+    uint32_t i;
+
+    if (swarm.ramp_timeout)
+        sol_timeout_del(swarm.ramp_timeout);
+    if (swarm.report_timeout) {
+        sol_timeout_del(swarm.report_timeout);
+        report_cb(NULL);
+    }
+
+    for (i = 0; i < swarm.started; i++)
+        lwm2m_client_ctx_fini(&swarm.clients[i].ctx);
+
+    free(swarm.clients);
+    free(swarm.latencies);
+    if (swarm.metrics_client)
+        sol_coap_server_unref(swarm.metrics_client);
+}
+SOL_MAIN_DEFAULT(startup, shutdown);
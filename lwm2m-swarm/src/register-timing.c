@@ -0,0 +1,264 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#include "register-timing.h"
+
+#define COAP_CODE_POST (2)
+#define COAP_CODE_CREATED (0x41)
+#define COAP_OPTION_URI_PATH (11)
+#define COAP_OPTION_URI_QUERY (15)
+#define COAP_PAYLOAD_MARKER (0xff)
+#define COAP_TOKEN_MAX (8)
+#define NAME_MAX_LEN (64)
+//Enough for the header, token and options of a registration
+#define SCAN_MAX (256)
+
+//The registration in flight on a socket, indexed by its descriptor
+struct pending {
+    int64_t sent_at;
+    uint8_t token[COAP_TOKEN_MAX];
+    uint8_t token_len;
+    uint8_t name_len;
+    char name[NAME_MAX_LEN];
+};
+
+static void (*registered_cb)(const char *name, size_t len, int64_t rtt_us);
+static struct pending **pendings;
+static int pendings_len;
+
+static int64_t
+now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static void *
+next(const char *symbol)
+{
+    return dlsym(RTLD_NEXT, symbol);
+}
+
+struct coap_scan {
+    uint8_t code;
+    uint8_t token_len;
+    const uint8_t *token;
+    const char *name;
+    size_t name_len;
+    bool is_registration;
+};
+
+static bool
+coap_scan(const uint8_t *msg, size_t len, struct coap_scan *scan)
+{
+    const uint8_t *p, *end = msg + len;
+    unsigned int option = 0, paths = 0;
+    bool is_rd = false;
+
+    if (len < 4 || (msg[0] >> 6) != 1 || (msg[0] & 0x0f) > COAP_TOKEN_MAX)
+        return false;
+
+    scan->code = msg[1];
+    scan->token_len = msg[0] & 0x0f;
+    scan->token = msg + 4;
+    scan->name = NULL;
+    scan->is_registration = false;
+    if (scan->code != COAP_CODE_POST)
+        return 4u + scan->token_len <= len;
+
+    p = msg + 4 + scan->token_len;
+    while (p < end && *p != COAP_PAYLOAD_MARKER) {
+        unsigned int delta = *p >> 4, olen = *p & 0x0f;
+
+        p++;
+        if (delta == 13 && p < end)
+            delta = *p++ + 13;
+        else if (delta >= 13)
+            return false;
+        if (olen == 13 && p < end)
+            olen = *p++ + 13;
+        else if (olen >= 13)
+            return false;
+        if ((size_t)(end - p) < olen)
+            return false;
+
+        option += delta;
+        if (option == COAP_OPTION_URI_PATH) {
+            paths++;
+            is_rd = olen == 2 && !memcmp(p, "rd", 2);
+        } else if (option == COAP_OPTION_URI_QUERY && olen > 3 &&
+            !memcmp(p, "ep=", 3)) {
+            scan->name = (const char *)p + 3;
+            scan->name_len = olen - 3;
+        }
+        p += olen;
+    }
+
+    //Updates go to /rd/<location>, only /rd is a registration
+    scan->is_registration = is_rd && paths == 1 && scan->name &&
+        scan->name_len <= NAME_MAX_LEN;
+    return true;
+}
+
+static struct pending *
+pending_get(int fd, bool create)
+{
+    if (fd < 0)
+        return NULL;
+
+    if (fd >= pendings_len) {
+        struct pending **grown;
+        int len = pendings_len ? pendings_len : 64;
+
+        if (!create)
+            return NULL;
+        while (len <= fd)
+            len *= 2;
+        grown = realloc(pendings, len * sizeof(struct pending *));
+        if (!grown)
+            return NULL;
+        memset(grown + pendings_len, 0,
+            (len - pendings_len) * sizeof(struct pending *));
+        pendings = grown;
+        pendings_len = len;
+    }
+
+    if (!pendings[fd] && create)
+        pendings[fd] = calloc(1, sizeof(struct pending));
+    return pendings[fd];
+}
+
+static void
+sent(int fd, const uint8_t *msg, size_t len)
+{
+    struct coap_scan scan;
+    struct pending *p;
+
+    if (!registered_cb || !coap_scan(msg, len, &scan) ||
+        !scan.is_registration)
+        return;
+
+    p = pending_get(fd, true);
+    if (!p)
+        return;
+
+    //A retransmission keeps the time of the first send
+    if (p->sent_at && p->token_len == scan.token_len &&
+        !memcmp(p->token, scan.token, scan.token_len))
+        return;
+
+    p->sent_at = now_us();
+    p->token_len = scan.token_len;
+    memcpy(p->token, scan.token, scan.token_len);
+    p->name_len = scan.name_len;
+    memcpy(p->name, scan.name, scan.name_len);
+}
+
+static void
+received(int fd, const uint8_t *msg, size_t len)
+{
+    struct pending *p = pending_get(fd, false);
+    struct coap_scan scan;
+
+    if (!p || !p->sent_at || !coap_scan(msg, len, &scan) ||
+        scan.code != COAP_CODE_CREATED || scan.token_len != p->token_len ||
+        memcmp(scan.token, p->token, p->token_len))
+        return;
+
+    registered_cb(p->name, p->name_len, now_us() - p->sent_at);
+    p->sent_at = 0;
+}
+
+static size_t
+gather(const struct msghdr *msg, size_t len, uint8_t *buf)
+{
+    size_t i, n = 0;
+
+    if (len > SCAN_MAX)
+        len = SCAN_MAX;
+    for (i = 0; i < (size_t)msg->msg_iovlen && n < len; i++) {
+        size_t part = msg->msg_iov[i].iov_len;
+
+        if (part > len - n)
+            part = len - n;
+        memcpy(buf + n, msg->msg_iov[i].iov_base, part);
+        n += part;
+    }
+    return n;
+}
+
+ssize_t
+sendto(int fd, const void *buf, size_t len, int flags,
+    const struct sockaddr *addr, socklen_t addr_len)
+{
+    static ssize_t (*next_sendto)(int, const void *, size_t, int,
+        const struct sockaddr *, socklen_t);
+    ssize_t r;
+
+    if (!next_sendto)
+        next_sendto = next("sendto");
+    r = next_sendto(fd, buf, len, flags, addr, addr_len);
+    if (r > 0)
+        sent(fd, buf, r);
+    return r;
+}
+
+ssize_t
+sendmsg(int fd, const struct msghdr *msg, int flags)
+{
+    static ssize_t (*next_sendmsg)(int, const struct msghdr *, int);
+    uint8_t buf[SCAN_MAX];
+    ssize_t r;
+
+    if (!next_sendmsg)
+        next_sendmsg = next("sendmsg");
+    r = next_sendmsg(fd, msg, flags);
+    if (r > 0 && registered_cb)
+        sent(fd, buf, gather(msg, r, buf));
+    return r;
+}
+
+ssize_t
+recvfrom(int fd, void *buf, size_t len, int flags, struct sockaddr *addr,
+    socklen_t *addr_len)
+{
+    static ssize_t (*next_recvfrom)(int, void *, size_t, int,
+        struct sockaddr *, socklen_t *);
+    ssize_t r;
+
+    if (!next_recvfrom)
+        next_recvfrom = next("recvfrom");
+    r = next_recvfrom(fd, buf, len, flags, addr, addr_len);
+    if (r > 0 && !(flags & MSG_PEEK))
+        received(fd, buf, r);
+    return r;
+}
+
+ssize_t
+recvmsg(int fd, struct msghdr *msg, int flags)
+{
+    static ssize_t (*next_recvmsg)(int, struct msghdr *, int);
+    uint8_t buf[SCAN_MAX];
+    ssize_t r;
+
+    if (!next_recvmsg)
+        next_recvmsg = next("recvmsg");
+    r = next_recvmsg(fd, msg, flags);
+    if (r > 0 && !(flags & MSG_PEEK) && pending_get(fd, false))
+        received(fd, buf, gather(msg, r, buf));
+    return r;
+}
+
+void
+register_timing_start(void (*registered)(const char *name, size_t len,
+    int64_t rtt_us))
+{
+    registered_cb = registered;
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+   Times the registration of each client on the wire, from its first
+   POST /rd?ep=<name> to the 2.01 Created of the same token: the client
+   API of Soletta does not tell when a client is registered.
+
+   The datagram calls of the C library (sendto, sendmsg, recvfrom and
+   recvmsg) are wrapped for the whole process, Soletta included, which
+   the Linux build links as a shared library. Only plain CoAP is seen:
+   with DTLS the datagrams are encrypted and nothing is timed.
+
+   The callback gets the endpoint name, not NUL terminated, and the
+   round trip in microseconds, once per registration.
+ */
+void register_timing_start(void (*registered)(const char *name, size_t len,
+    int64_t rtt_us));
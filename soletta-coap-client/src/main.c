@@ -26,6 +26,24 @@
 #include <sol-network.h>
 
 #define DEFAULT_UDP_PORT 5683
+#define DEFAULT_DTLS_PORT 5684
+
+/*
+   Built with DTLS=y, the light is reached over DTLS, with the PSK
+   Soletta is provisioned with. Multicast discovery does not work over
+   DTLS, so the light is asked directly at LIGHT_ADDR.
+ */
+#ifdef USE_DTLS
+#ifndef LIGHT_ADDR
+#define LIGHT_ADDR "fe80::5846:1502:7238:bcee"
+#endif
+#define LIGHT_PORT DEFAULT_DTLS_PORT
+#define LIGHT_SECURE true
+#else
+#define LIGHT_ADDR "ff02::fd"
+#define LIGHT_PORT DEFAULT_UDP_PORT
+#define LIGHT_SECURE false
+#endif
 
 #if SOL_PLATFORM_RIOT
 #define GPIO_BTN 0x4100441c
@@ -231,8 +249,8 @@ discover_resource(struct remote_light_context *ctx)
     sol_coap_add_option(req, SOL_COAP_OPTION_URI_PATH, "light", sizeof("light") - 1);
 
     cliaddr.family = SOL_NETWORK_FAMILY_INET6;
-    sol_network_link_addr_from_str(&cliaddr, "ff02::fd");
-    cliaddr.port = DEFAULT_UDP_PORT;
+    sol_network_link_addr_from_str(&cliaddr, LIGHT_ADDR);
+    cliaddr.port = LIGHT_PORT;
 
     sol_coap_send_packet_with_reply(ctx->server, req, &cliaddr,
         discover_reply_cb, ctx);
@@ -250,7 +268,7 @@ setup_server(void)
     ctx = calloc(1, sizeof(*ctx));
     SOL_NULL_CHECK(ctx, false);
 
-    ctx->server = sol_coap_server_new(&servaddr, false);
+    ctx->server = sol_coap_server_new(&servaddr, LIGHT_SECURE);
     SOL_NULL_CHECK_GOTO(ctx->server, server_failed);
 
     ctx->button = setup_button(ctx);
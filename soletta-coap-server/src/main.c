@@ -26,6 +26,20 @@
 #include <sol-network.h>
 
 #define DEFAULT_UDP_PORT 5683
+#define DEFAULT_DTLS_PORT 5684
+
+/*
+   Built with DTLS=y, the light is only served over DTLS, with the PSK
+   Soletta is provisioned with. Multicast discovery does not work over
+   DTLS, so the client has to be told the address of the light.
+ */
+#ifdef USE_DTLS
+#define LIGHT_PORT DEFAULT_DTLS_PORT
+#define LIGHT_SECURE true
+#else
+#define LIGHT_PORT DEFAULT_UDP_PORT
+#define LIGHT_SECURE false
+#endif
 
 #ifdef SOL_PLATFORM_RIOT
 #define GPIO_BTN 0x4100441c
@@ -258,7 +272,7 @@ setup_server(void)
     };
     struct sol_network_link_addr servaddr =
     { .family = SOL_NETWORK_FAMILY_INET6,
-      .port = DEFAULT_UDP_PORT };
+      .port = LIGHT_PORT };
 
     lc = calloc(1, sizeof(*lc));
     if (!lc) {
@@ -275,7 +289,7 @@ setup_server(void)
 
     lc->btn = setup_button(lc);
 
-    lc->server = sol_coap_server_new(&servaddr, false);
+    lc->server = sol_coap_server_new(&servaddr, LIGHT_SECURE);
     if (!lc->server) {
         SOL_WRN("lc->server failed");
         sol_gpio_close(lc->led);